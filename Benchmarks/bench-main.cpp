@@ -0,0 +1,438 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#include "pbkdf2.h"
+#include "password.h"
+#include "crypter.h"
+#include "randomsource.h"
+#include "domainsettings.h"
+#include "domainsettingslist.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+#include <QtTest/QTest>
+
+
+/*!
+ * \brief The Measurement class
+ *
+ * Times a `QBENCHMARK` block from construction to `record()` and counts
+ * the iterations QtTest runs through `tick()`. The results go into a JSON
+ * array, which `main()` writes out after all benchmarks have run. QtTest may
+ * run a benchmark several times until it accepts the measurement, so there is
+ * one result per benchmark and data tag, holding the last run.
+ */
+class Measurement
+{
+public:
+  Measurement(void)
+    : mOps(0)
+  {
+    mTimer.start();
+  }
+  inline void tick(void)
+  {
+    ++mOps;
+  }
+  void record(qint64 bytesPerOp = 0)
+  {
+    const qint64 ns = mTimer.nsecsElapsed();
+    if (mOps == 0 || ns <= 0)
+      return;
+    const qreal nsPerOp = qreal(ns) / qreal(mOps);
+    const QString &benchmark = QString::fromLatin1(QTest::currentTestFunction());
+    const QString &tag = QString::fromLatin1(QTest::currentDataTag());
+    QJsonObject result;
+    result["benchmark"] = benchmark;
+    result["tag"] = tag;
+    result["ops"] = mOps;
+    result["ns_per_op"] = nsPerOp;
+    result["ops_per_sec"] = 1e9 / nsPerOp;
+    if (bytesPerOp > 0) {
+      result["bytes_per_op"] = bytesPerOp;
+      result["bytes_per_sec"] = 1e9 * qreal(bytesPerOp) / nsPerOp;
+    }
+    const QPair<QString, QString> key(benchmark, tag);
+    if (ResultIndex.contains(key)) {
+      Results[ResultIndex.value(key)] = result;
+    }
+    else {
+      ResultIndex.insert(key, Results.size());
+      Results.append(result);
+    }
+  }
+
+  static QJsonArray Results;
+  static QMap<QPair<QString, QString>, int> ResultIndex;
+
+private:
+  QElapsedTimer mTimer;
+  qint64 mOps;
+};
+
+QJsonArray Measurement::Results;
+QMap<QPair<QString, QString>, int> Measurement::ResultIndex;
+
+
+static DomainSettingsList makeDomainSettingsList(int n)
+{
+  DomainSettingsList list;
+  const QDateTime &now = QDateTime::currentDateTime();
+  for (int i = 0; i < n; ++i) {
+    DomainSettings ds;
+    ds.domainName = QString("domain-%1.example.com").arg(i);
+    ds.url = QString("https://%1/login").arg(ds.domainName);
+    ds.userName = QString("user%1@example.com").arg(i);
+    ds.notes = QString("Notes for entry #%1").arg(i);
+    ds.salt_base64 = Crypter::randomBytes(DomainSettings::DefaultSaltLength).toBase64();
+    ds.iterations = DomainSettings::DefaultIterations;
+    ds.passwordTemplate = "xxxxxxxxxxxxxxxxaAno";
+    ds.extraCharacters = Password::ExtraChars;
+    ds.groupHierarchy = "Benchmarks";
+    ds.tags << "bench" << QString::number(i % 10);
+    ds.createdDate = now;
+    ds.modifiedDate = now;
+    list.append(ds);
+  }
+  return list;
+}
+
+
+static void addPayloadSizes(void)
+{
+  QTest::addColumn<int>("size");
+  QTest::newRow("1K") << 1024;
+  QTest::newRow("64K") << 64 * 1024;
+  QTest::newRow("1M") << 1024 * 1024;
+}
+
+
+static void addListSizes(void)
+{
+  QTest::addColumn<int>("count");
+  QTest::newRow("100") << 100;
+  QTest::newRow("10k") << 10000;
+  QTest::newRow("100k") << 100000;
+}
+
+
+class BenchSESAM : public QObject
+{
+  Q_OBJECT
+private slots:
+  void pbkdf2_data(void)
+  {
+    QTest::addColumn<int>("algorithm");
+    QTest::addColumn<int>("iterations");
+    static const int Iterations[] = { 1024, 4096, 32768 };
+    for (int i = 0; i < int(sizeof(Iterations) / sizeof(Iterations[0])); ++i) {
+      QTest::newRow(qPrintable(QString("sha256/%1").arg(Iterations[i]))) << int(QCryptographicHash::Sha256) << Iterations[i];
+      QTest::newRow(qPrintable(QString("sha384/%1").arg(Iterations[i]))) << int(QCryptographicHash::Sha384) << Iterations[i];
+      QTest::newRow(qPrintable(QString("sha512/%1").arg(Iterations[i]))) << int(QCryptographicHash::Sha512) << Iterations[i];
+    }
+  }
+
+  void pbkdf2(void)
+  {
+    QFETCH(int, algorithm);
+    QFETCH(int, iterations);
+    const SecureByteArray pwd("reallysafe");
+    const QByteArray salt("pepper");
+    Measurement m;
+    QBENCHMARK {
+      PBKDF2 pbkdf2(pwd, salt, iterations, QCryptographicHash::Algorithm(algorithm));
+      m.tick();
+    }
+    m.record();
+  }
+
+  void password_remix_data(void)
+  {
+    QTest::addColumn<int>("length");
+    QTest::newRow("8") << 8;
+    QTest::newRow("16") << 16;
+    QTest::newRow("32") << 32;
+    QTest::newRow("64") << 64;
+  }
+
+  void password_remix(void)
+  {
+    QFETCH(int, length);
+    DomainSettings ds;
+    ds.domainName = "example.com";
+    ds.userName = "alice";
+    ds.iterations = 1;
+    ds.extraCharacters = Password::ExtraChars;
+    ds.passwordTemplate = "naAo" + QString(length - 4, 'x');
+    Password pwd(ds);
+    pwd.generate(SecureByteArray("reallysafe"));
+    QVERIFY(pwd.password().size() == length);
+    Measurement m;
+    QBENCHMARK {
+      pwd.remix();
+      m.tick();
+    }
+    m.record(length);
+  }
+
+  void crypter_encode_data(void)
+  {
+    addPayloadSizes();
+  }
+
+  void crypter_encode(void)
+  {
+    QFETCH(int, size);
+    const SecureByteArray masterPassword("reallysafe");
+    const QByteArray &salt = Crypter::randomBytes(Crypter::SaltSize);
+    SecureByteArray key;
+    SecureByteArray IV;
+    Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+    const SecureByteArray &KGK = Crypter::generateKGK();
+    const QByteArray &data = Crypter::randomBytes(size);
+    Measurement m;
+    QBENCHMARK {
+      Crypter::encode(key, IV, salt, KGK, data, true);
+      m.tick();
+    }
+    m.record(size);
+  }
+
+  void crypter_decode_data(void)
+  {
+    addPayloadSizes();
+  }
+
+  void crypter_decode(void)
+  {
+    QFETCH(int, size);
+    const SecureByteArray masterPassword("reallysafe");
+    const QByteArray &salt = Crypter::randomBytes(Crypter::SaltSize);
+    SecureByteArray key;
+    SecureByteArray IV;
+    Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+    const QByteArray &data = Crypter::randomBytes(size);
+    const QByteArray &cipher = Crypter::encode(key, IV, salt, Crypter::generateKGK(), data, true);
+    SecureByteArray KGK;
+    Measurement m;
+    QBENCHMARK {
+      Crypter::decode(masterPassword, cipher, true, KGK);
+      m.tick();
+    }
+    m.record(size);
+  }
+
+  void random_bytes_data(void)
+  {
+    QTest::addColumn<int>("size");
+    QTest::newRow("IV") << Crypter::AESBlockSize;
+    QTest::newRow("salt") << Crypter::SaltSize;
+    QTest::newRow("KGK") << Crypter::KGKSize;
+    QTest::newRow("64K") << 64 * 1024;
+    QTest::newRow("1M") << 1024 * 1024;
+  }
+
+  void random_bytes(void)
+  {
+    QFETCH(int, size);
+    Measurement m;
+    QBENCHMARK {
+      Crypter::randomBytes(size);
+      m.tick();
+    }
+    m.record(size);
+  }
+
+  void crypter_encrypt_data(void)
+  {
+    addPayloadSizes();
+  }
+
+  void crypter_encrypt(void)
+  {
+    QFETCH(int, size);
+    const SecureByteArray key(Crypter::randomBytes(Crypter::AESKeySize));
+    const SecureByteArray IV(Crypter::randomBytes(Crypter::AESBlockSize));
+    const QByteArray &data = Crypter::randomBytes(size);
+    Measurement m;
+    QBENCHMARK {
+      Crypter::encrypt(key, IV, data, CryptoPP::StreamTransformationFilter::PKCS_PADDING);
+      m.tick();
+    }
+    m.record(size);
+  }
+
+  void crypter_decrypt_data(void)
+  {
+    addPayloadSizes();
+  }
+
+  void crypter_decrypt(void)
+  {
+    QFETCH(int, size);
+    const SecureByteArray key(Crypter::randomBytes(Crypter::AESKeySize));
+    const SecureByteArray IV(Crypter::randomBytes(Crypter::AESBlockSize));
+    const QByteArray &cipher = Crypter::encrypt(key, IV, Crypter::randomBytes(size), CryptoPP::StreamTransformationFilter::PKCS_PADDING);
+    Measurement m;
+    QBENCHMARK {
+      Crypter::decrypt(key, IV, cipher, CryptoPP::StreamTransformationFilter::PKCS_PADDING);
+      m.tick();
+    }
+    m.record(size);
+  }
+
+  void domainsettingslist_tojson_data(void)
+  {
+    addListSizes();
+  }
+
+  void domainsettingslist_tojson(void)
+  {
+    QFETCH(int, count);
+    const DomainSettingsList &list = makeDomainSettingsList(count);
+    const qint64 jsonSize = list.toJson().size();
+    Measurement m;
+    QBENCHMARK {
+      list.toJson();
+      m.tick();
+    }
+    m.record(jsonSize);
+  }
+
+  void domainsettingslist_fromjson_data(void)
+  {
+    addListSizes();
+  }
+
+  void domainsettingslist_fromjson(void)
+  {
+    QFETCH(int, count);
+    const QByteArray &json = makeDomainSettingsList(count).toJson();
+    Measurement m;
+    QBENCHMARK {
+      DomainSettingsList::fromJson(json);
+      m.tick();
+    }
+    m.record(json.size());
+  }
+
+  void domainsettingslist_tobinary_data(void)
+  {
+    addListSizes();
+  }
+
+  void domainsettingslist_tobinary(void)
+  {
+    QFETCH(int, count);
+    const DomainSettingsList &list = makeDomainSettingsList(count);
+    const qint64 binarySize = list.toBinary().size();
+    Measurement m;
+    QBENCHMARK {
+      list.toBinary();
+      m.tick();
+    }
+    m.record(binarySize);
+  }
+
+  void domainsettingslist_frombinary_data(void)
+  {
+    addListSizes();
+  }
+
+  void domainsettingslist_frombinary(void)
+  {
+    QFETCH(int, count);
+    const QByteArray &binary = makeDomainSettingsList(count).toBinary();
+    Measurement m;
+    QBENCHMARK {
+      DomainSettingsList::fromBinary(binary);
+      m.tick();
+    }
+    m.record(binary.size());
+  }
+
+  void domainsettingslist_merge_data(void)
+  {
+    addListSizes();
+  }
+
+  // the lookups mergeLocalAndRemoteData() does for every domain name
+  void domainsettingslist_merge(void)
+  {
+    QFETCH(int, count);
+    const DomainSettingsList &remote = makeDomainSettingsList(count);
+    DomainSettingsList local = remote;
+    const QStringList &names = remote.keys();
+    Measurement m;
+    QBENCHMARK {
+      foreach (QString name, names) {
+        const DomainSettings &remoteDomainSetting = remote.at(name);
+        if (local.at(name).modifiedDate <= remoteDomainSetting.modifiedDate) {
+          local.updateWith(remoteDomainSetting);
+        }
+      }
+      m.tick();
+    }
+    m.record();
+  }
+};
+
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QStringList args = app.arguments();
+  QString jsonFilename = "Qt-SESAM-Benchmarks.json";
+  const int idx = args.indexOf("-json");
+  if (idx > 0 && idx + 1 < args.size()) {
+    jsonFilename = args.at(idx + 1);
+    args.removeAt(idx + 1);
+    args.removeAt(idx);
+  }
+  BenchSESAM bench;
+  const int rc = QTest::qExec(&bench, args);
+  QJsonObject root;
+  root["version"] = QString(QTSESAM_VERSION);
+  root["qt"] = QString(qVersion());
+  root["random"] = QString(RandomSource::name());
+  root["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+  root["results"] = Measurement::Results;
+  QFile jsonFile(jsonFilename);
+  if (jsonFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    jsonFile.write(QJsonDocument(root).toJson());
+    jsonFile.close();
+  }
+  else {
+    qWarning("Cannot write benchmark results to %s", qPrintable(jsonFilename));
+    return rc != 0 ? rc : 1;
+  }
+  return rc;
+}
+
+
+#include "bench-main.moc"
@@ -23,7 +23,8 @@ SUBDIRS += \
     libSESAM \
     SESAM2Chrome \
     Qt-SESAM \
-    UnitTests
+    UnitTests \
+    Benchmarks
 
 OTHER_FILES += \
     extensions\chrome\background.js \
@@ -22,12 +22,15 @@
 #include "ui_mainwindow.h"
 
 #include <QDebug>
+#include <QBuffer>
 #include <QLibraryInfo>
 #include <QTranslator>
 #include <QLocale>
 #include <QObject>
 #include <QList>
 #include <QPair>
+#include <QMap>
+#include <QSet>
 #include <QClipboard>
 #include <QStringListModel>
 #include <QStandardPaths>
@@ -52,6 +55,7 @@
 #include <QtConcurrent>
 #include <QFuture>
 #include <QFutureWatcher>
+#include <QEventLoop>
 #include <QMutexLocker>
 #include <QSemaphore>
 #include <QDesktopServices>
@@ -77,7 +81,18 @@
 #include "hackhelper.h"
 #endif
 #include "pbkdf2.h"
+#include "hashbackend.h"
+#include "aesbackend.h"
+#include "randomsource.h"
+#include "securearena.h"
 #include "password.h"
+#include "derivedkeycache.h"
+#include "derivedkeyprefetcher.h"
+#include "keymanager.h"
+#include "crypterstream.h"
+#include "segmentedvault.h"
+#include "passwordbatch.h"
+#include "passwordgenerator.h"
 #include "crypter.h"
 #include "securebytearray.h"
 #include "securestring.h"
@@ -92,6 +107,7 @@
 static const int DefaultMasterPasswordInvalidationTimeMins = 5;
 static const bool CompressionEnabled = true;
 static const int NotFound = -1;
+static const int MaxRecentDomains = 3;
 
 enum TabIndexes {
   TabGeneratedPassword,
@@ -136,6 +152,7 @@ public:
     , hackPermutations(1)
     , hackingMode(false)
 #endif
+    , prefetcher(&keyCache)
     , trayIcon(QIcon(":/images/ctSESAM.ico"))
     , salt(Crypter::generateSalt())
     , deleteReply(Q_NULLPTR)
@@ -148,6 +165,8 @@ public:
     , masterPasswordChangeStep(0)
     , interactionSemaphore(1)
     , doConvertLocalToLegacy(false)
+    , domainDataRestored(false)
+    , syncInProgress(false)
     , lockFile(Q_NULLPTR)
     , forceStart(false)
   {
@@ -188,6 +207,8 @@ public:
   QSettings settings;
   DomainSettingsList domains;
   DomainSettingsList remoteDomains;
+  // what each sync peer sent during the last sync, the base of the next merge with it
+  QMap<int, DomainSettingsList> lastSyncedDomains;
   bool customCharacterSetDirty;
   bool parameterSetDirty;
   ExpandableGroupbox *expandableGroupBox;
@@ -202,6 +223,11 @@ public:
   bool hackingMode;
 #endif
   Password password;
+  DerivedKeyCache keyCache;
+  DerivedKeyPrefetcher prefetcher;
+  KeyManager keyManager;
+  SegmentedVault vault;
+  QStringList recentDomains;
   QDateTime createdDate;
   QDateTime modifiedDate;
   QSystemTrayIcon trayIcon;
@@ -228,6 +254,12 @@ public:
   QFuture<void> backupFileDeletionFuture;
   TcpClient tcpClient;
   bool doConvertLocalToLegacy;
+  // saving is refused until the stored domains have been read, lest they be overwritten
+  bool domainDataRestored;
+  // the legacy password conversion runs an event loop, which must not start another sync
+  bool syncInProgress;
+  QList<QNetworkReply*> deferredReadReplies;
+  QHash<QString, SecureString> legacyPasswords;
   QLockFile *lockFile;
   bool forceStart;
   QString lastAttachFileDir;
@@ -244,6 +276,18 @@ MainWindow::MainWindow(bool forceStart, QWidget *parent)
 
   // Logger::instance().setFileName(QString("%1/%2.log").arg(QStandardPaths::writableLocation(QStandardPaths::DataLocation)).arg(AppName));
   _LOG("MainWindow::MainWindow()");
+  _LOG(QString("Hash backends: %1").arg(HashBackend::description()));
+  if (!HashBackend::selfTest()) {
+    _LOG("ERROR: hash backend self-test failed");
+  }
+  _LOG(QString("Cipher backend: %1").arg(AESBackend::description()));
+  if (!AESBackend::selfTest()) {
+    _LOG("ERROR: cipher backend self-test failed");
+  }
+  _LOG(QString("Random source: %1").arg(RandomSource::description()));
+  if (!RandomSource::selfTest()) {
+    _LOG("ERROR: random source self-test failed");
+  }
   d->forceStart = forceStart;
   const QString lockfilePath = QDir::homePath() + "/.qt-sesam.lck";
   d->lockFile = new QLockFile(lockfilePath);
@@ -367,9 +411,11 @@ MainWindow::MainWindow(bool forceStart, QWidget *parent)
   QObject::connect(this, SIGNAL(saltKeyIVGenerated()), SLOT(onGeneratedSaltKeyIV()), Qt::ConnectionType::QueuedConnection);
   QObject::connect(d->progressDialog, SIGNAL(cancelled()), SLOT(cancelServerOperation()));
 
+  d->password.setCache(&d->keyCache);
   QObject::connect(&d->password, SIGNAL(generated()), SLOT(onPasswordGenerated()));
   QObject::connect(&d->password, SIGNAL(generationAborted()), SLOT(onPasswordGenerationAborted()));
   QObject::connect(&d->password, SIGNAL(generationStarted()), SLOT(onPasswordGenerationStarted()));
+  QObject::connect(&d->password, SIGNAL(generationProgress(int, int, qint64)), SLOT(onPasswordGenerationProgress(int, int, qint64)));
 
   QObject::connect(&d->tcpClient, SIGNAL(receivedMessage(QJsonDocument)), SLOT(onMessageFromTcpClient(QJsonDocument)));
 
@@ -720,6 +766,7 @@ void MainWindow::cancelPasswordGeneration(void)
 #if HACKING_MODE_ENABLED
   if (d->hackingMode) {
     d->hackingMode = false;
+    d->password.setCache(&d->keyCache);
     ui->renewSaltPushButton->setEnabled(true);
     ui->legacyPasswordLineEdit->setReadOnly(false);
   }
@@ -848,6 +895,27 @@ void MainWindow::onPasswordGenerationStarted(void)
 }
 
 
+void MainWindow::onPasswordGenerationProgress(int done, int total, qint64 etaMs)
+{
+  Q_D(MainWindow);
+  if (!d->password.isRunning() || total <= 0)
+    return;
+#if HACKING_MODE_ENABLED
+  if (d->hackingMode)
+    return;
+#endif
+  ui->statusBar->showMessage(tr("Generating password ... %1% (%2 s left)")
+                             .arg(100 * qint64(done) / total)
+                             .arg(1e-3 * etaMs, 0, 'f', 1), 1000);
+}
+
+
+void MainWindow::onLegacyPasswordGenerationProgress(int done, int total)
+{
+  ui->statusBar->showMessage(tr("Converting passwords to legacy passwords ... %1/%2").arg(done).arg(total), 1000);
+}
+
+
 void MainWindow::updatePassword(void)
 {
   Q_D(MainWindow);
@@ -995,8 +1063,8 @@ void MainWindow::stopPasswordGeneration(void)
 {
   Q_D(MainWindow);
   if (d->password.isRunning()) {
+    // doesn't block: the next generateAsync() waits for the aborted run, which winds down within a few hundred iterations
     d->password.abortGeneration();
-    d->password.waitForFinished();
   }
 }
 
@@ -1113,6 +1181,7 @@ void MainWindow::onPasswordGenerated(void)
       const QString &newCharTable = d->hackPos.substitute(st, usedCharacters());
       ui->usedCharactersPlainTextEdit->setPlainText(newCharTable);
       d->hackingMode = false;
+      d->password.setCache(&d->keyCache);
       ui->renewSaltPushButton->setEnabled(true);
       ui->legacyPasswordLineEdit->setReadOnly(false);
       hideActivityIcons();
@@ -1199,8 +1268,10 @@ void MainWindow::generateSaltKeyIVThread(void)
     return;
   }
   QMutexLocker(&d->keyGenerationMutex);
-  d->salt = Crypter::generateSalt();
-  Crypter::makeKeyAndIVFromPassword(d->masterPassword.toUtf8(), d->salt, d->masterKey, d->IV);
+  const KeyManager::SaltKeyIV &saltKeyIV = d->keyManager.takeSaltKeyIV(d->masterPassword.toUtf8());
+  d->salt = saltKeyIV.salt;
+  d->masterKey = saltKeyIV.key;
+  d->IV = saltKeyIV.IV;
   emit saltKeyIVGenerated();
 }
 
@@ -1252,6 +1323,7 @@ void MainWindow::onImportKGK(void)
       SecureByteArray kgk = Exporter(kgkFilename).read(d->masterPassword.toUtf8());
       if (kgk.size() == Crypter::KGKSize) {
         d->KGK = kgk;
+        clearDerivedKeyCache();
         QMessageBox::information(this,
                                  tr("KGK imported"),
                                  tr("KGK successfully imported. Your generated passwords may have changed. "
@@ -1284,18 +1356,6 @@ QString MainWindow::selectAlternativeDomainNameFor(const QString &domainName)
 }
 
 
-QString MainWindow::selectAlternativeDomainNameFor(const QString &domainName, const QStringList &domainNameList)
-{
-  QString newDomainName;
-  int idx = 0;
-  do {
-    newDomainName = QString("%1 (%2)").arg(domainName).arg(++idx);
-  }
-  while (domainNameList.contains(newDomainName));
-  return newDomainName;
-}
-
-
 void MainWindow::onImportKeePass2XmlFile(void)
 {
   Q_D(MainWindow);
@@ -1787,14 +1847,32 @@ void MainWindow::saveAllDomainDataToSettings(void)
 {
   Q_D(MainWindow);
   // qDebug() << "MainWindow::saveAllDomainDataToSettings()";
+  if (!d->domainDataRestored) {
+    _LOG("ERROR in MainWindow::saveAllDomainDataToSettings(): the stored domain data has not been restored");
+    return;
+  }
   if (!d->masterKey.isEmpty()) {
-    QByteArray cipher;
+    QByteArray b64Manifest;
+    QList<int> dirtyBuckets;
     {
       QMutexLocker locker(&d->keyGenerationMutex);
       try {
         d->keyGenerationFuture.waitForFinished();
         if (validCredentials()) {
-          cipher = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), d->domains.toJson(), CompressionEnabled);
+          // only the buckets containing changed domains get encrypted again,
+          // the manifest referring to them is protected by the master password
+          d->vault.setFormat(d->settings.value("misc/binaryDomainData", true).toBool()
+                             ? Crypter::AES256GCMSegmentedBinaryFormat
+                             : Crypter::AES256GCMSegmentedFormat);
+          dirtyBuckets = d->vault.seal(d->domains, d->kgk(), &d->keyManager);
+          const QByteArray &manifest = d->vault.manifest();
+          QBuffer buffer(&b64Manifest);
+          buffer.open(QIODevice::WriteOnly);
+          CrypterEncoder encoder(&buffer, CompressionEnabled, true, d->vault.format());
+          if (encoder.begin(d->masterKey, d->IV, d->salt, d->kgk(), manifest.size(), Q_NULLPTR, &d->keyManager)) {
+            encoder.write(manifest);
+            encoder.finish();
+          }
         }
         else {
           _LOG(QString("ERROR in MainWindow::saveAllDomainDataToSettings(): invalid credentials"));
@@ -1806,10 +1884,20 @@ void MainWindow::saveAllDomainDataToSettings(void)
         return;
       }
     }
-    if (!cipher.isEmpty()) {
-      const QString &b64DomainData = QString::fromUtf8(cipher.toBase64());
-      d->settings.setValue("sync/domains", b64DomainData);
+    if (!b64Manifest.isEmpty()) {
+      // buckets are stored under their digests, so the new ones don't overwrite those the
+      // current manifest refers to; the latter are only removed once the new manifest is stored
+      foreach (int idx, dirtyBuckets) {
+        const QByteArray &bucket = d->vault.bucket(idx);
+        if (!bucket.isEmpty()) {
+          d->settings.setValue(bucketSettingsKey(d->vault.bucketDigest(idx)), QString::fromLatin1(bucket.toBase64()));
+        }
+      }
       d->settings.sync();
+      _LOG(QString("Saved domains: %1 of %2 buckets encrypted").arg(dirtyBuckets.count()).arg(d->vault.bucketCount()));
+      d->settings.setValue("sync/domains", QString::fromLatin1(b64Manifest));
+      d->settings.sync();
+      removeUnreferencedBuckets();
       if (d->masterPasswordChangeStep == 0) {
         if (d->optionsDialog->writeBackups()) {
           writeBackupFile();
@@ -1824,36 +1912,96 @@ void MainWindow::saveAllDomainDataToSettings(void)
 }
 
 
+QString MainWindow::bucketSettingsKey(const QByteArray &digest)
+{
+  return QString("sync/buckets/%1").arg(QString::fromLatin1(digest.toHex()));
+}
+
+
+void MainWindow::removeUnreferencedBuckets(void)
+{
+  Q_D(MainWindow);
+  QSet<QString> referenced;
+  for (int idx = 0; idx < d->vault.bucketCount(); ++idx) {
+    const QByteArray &digest = d->vault.bucketDigest(idx);
+    if (!digest.isEmpty()) {
+      referenced << bucketSettingsKey(digest);
+    }
+  }
+  d->settings.beginGroup("sync/buckets");
+  const QStringList &keys = d->settings.childKeys();
+  d->settings.endGroup();
+  foreach (const QString &key, keys) {
+    if (!referenced.contains("sync/buckets/" + key)) {
+      d->settings.remove("sync/buckets/" + key);
+    }
+  }
+  d->settings.sync();
+}
+
+
 bool MainWindow::restoreDomainDataFromSettings(void)
 {
   Q_D(MainWindow);
   Q_ASSERT_X(!d->masterPassword.isEmpty(), "MainWindow::restoreDomainDataFromSettings()", "d->masterPassword must not be empty");
-  QJsonDocument json;
-  QStringList domainList;
-  const QByteArray &domains = QByteArray::fromBase64(d->settings.value("sync/domains").toByteArray());
-  if (!domains.isEmpty()) {
+  DomainSettingsList domains;
+  const QByteArray &b64Domains = d->settings.value("sync/domains").toByteArray();
+  if (!b64Domains.isEmpty()) {
     QByteArray recovered;
+    Crypter::FormatFlags format = Crypter::ObsoleteDefaultEncryptionFormat;
     try {
-      recovered = Crypter::decode(d->masterPassword.toUtf8(), domains, CompressionEnabled, d->KGK);
+      QBuffer buffer(&recovered);
+      buffer.open(QIODevice::WriteOnly);
+      CrypterDecoder decoder(&buffer, d->masterPassword.toUtf8(), CompressionEnabled, true, Q_NULLPTR, &d->keyManager);
+      if (decoder.write(b64Domains) && decoder.finish()) {
+        d->KGK = decoder.KGK();
+      }
+      else {
+        recovered.clear();
+      }
+      format = decoder.format();
     }
     catch (CryptoPP::Exception &e) {
       wrongPasswordWarning((int)e.GetErrorType(), e.what());
       return false;
     }
-    QJsonParseError parseError;
-    json = QJsonDocument::fromJson(recovered, &parseError);
-    if (parseError.error == QJsonParseError::NoError) {
-      domainList = json.object().keys();
-      ui->statusBar->showMessage(tr("Password accepted. Restored %1 domains.")
-                                 .arg(domainList.count()), 5000);
+    bool ok = false;
+    QString errorString;
+    if (format == Crypter::AES256GCMSegmentedFormat || format == Crypter::AES256GCMSegmentedBinaryFormat) {
+      // recovered data is the manifest of the buckets stored separately
+      d->vault.setFormat(format);
+      const QVector<QByteArray> &digests = SegmentedVault::bucketDigests(recovered);
+      QVector<QByteArray> buckets(digests.size());
+      for (int idx = 0; idx < buckets.size(); ++idx) {
+        if (!digests.at(idx).isEmpty()) {
+          buckets[idx] = QByteArray::fromBase64(d->settings.value(bucketSettingsKey(digests.at(idx))).toByteArray());
+        }
+      }
+      ok = d->vault.open(recovered, buckets, d->KGK, domains, &d->keyManager);
+      if (!ok) {
+        errorString = tr("The stored domain data is incomplete or has been tampered with.");
+      }
     }
     else {
+      QJsonParseError parseError;
+      domains = DomainSettingsList::fromJson(recovered, &parseError);
+      ok = parseError.error == QJsonParseError::NoError;
+      if (!ok) {
+        errorString = parseError.errorString();
+      }
+    }
+    if (!ok) {
+      // keep the stored data as it is, and don't let anything be saved on top of it
       QMessageBox::warning(this, tr("Bad data from sync server"),
                            tr("Decoding the data from the sync server failed: %1")
-                           .arg(parseError.errorString()), QMessageBox::Ok);
+                           .arg(errorString), QMessageBox::Ok);
+      return false;
     }
+    ui->statusBar->showMessage(tr("Password accepted. Restored %1 domains.")
+                               .arg(domains.count()), 5000);
   }
-  d->domains = DomainSettingsList::fromQJsonDocument(json);
+  d->domains = domains;
+  d->domainDataRestored = true;
   makeDomainComboBox();
   return true;
 }
@@ -1881,7 +2029,7 @@ void MainWindow::saveSyncDataToSettings(void)
   try {
     d->keyGenerationFuture.waitForFinished();
     if (validCredentials()) {
-      baCryptedData = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), QJsonDocument::fromVariant(syncData).toJson(QJsonDocument::Compact), CompressionEnabled);
+      baCryptedData = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), QJsonDocument::fromVariant(syncData).toJson(QJsonDocument::Compact), CompressionEnabled, Q_NULLPTR, &d->keyManager);
     }
     else {
       _LOG(QString("ERROR in MainWindow::collectedSyncData(): invalid credentials"));
@@ -1972,7 +2120,7 @@ bool MainWindow::restoreSyncSettings(void)
   if (!baCryptedData.isEmpty()) {
     QByteArray baSyncData;
     try {
-      baSyncData = Crypter::decode(d->masterPassword.toUtf8(), baCryptedData, CompressionEnabled, d->KGK);
+      baSyncData = Crypter::decode(d->masterPassword.toUtf8(), baCryptedData, CompressionEnabled, d->KGK, Q_NULLPTR, &d->keyManager);
     }
     catch (CryptoPP::Exception &e) {
       wrongPasswordWarning((int)e.GetErrorType(), e.what());
@@ -2019,6 +2167,8 @@ void MainWindow::hackLegacyPassword(void)
     blockUpdatePassword();
     d->masterPasswordInvalidationTimer.stop();
     d->hackingMode = true;
+    // every salt tried is used only once, so don't let them push out the cached keys
+    d->password.setCache(Q_NULLPTR);
     d->hackSalt.fill(0);
     d->hackPos = PositionTable(pwd);
     d->hackPermutations = d->hackPos.permutations();
@@ -2093,7 +2243,7 @@ void MainWindow::createEmptySyncFile(void)
   QByteArray domains;
   try {
     if (validCredentials()) {
-      domains = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), QByteArray("{}"), CompressionEnabled);
+      domains = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), QByteArray("{}"), CompressionEnabled, Q_NULLPTR, &d->keyManager, syncDataFormat());
     }
     else {
       _LOG(QString("ERROR in MainWindow::createEmptySyncFile(): invalid credentials"));
@@ -2146,6 +2296,10 @@ void MainWindow::beginSyncWithServer(void)
 void MainWindow::onSync(void)
 {
   Q_D(MainWindow);
+  if (d->syncInProgress) {
+    ui->statusBar->showMessage(tr("Sync in progress ..."), 3000);
+    return;
+  }
   restartInvalidationTimer();
   d->domainSettingsBeforceSync = d->domains.at(ui->domainsComboBox->currentText());
   if (d->optionsDialog->useSyncFile() && !d->optionsDialog->syncFilename().isEmpty()) {
@@ -2181,6 +2335,25 @@ void MainWindow::onSync(void)
 }
 
 
+/*!
+ * \brief MainWindow::syncDataFormat
+ *
+ * Format of the data written to the sync file or server. Qt-SESAM versions without
+ * GCM support cannot read anything newer than `Crypter::AES256EncryptedMasterkeyFormat`,
+ * so `Crypter::AES256GCMCompressionFormat` is only used if `misc/gcmSyncData` is set,
+ * i.e. if all installations sharing the sync data have been updated.
+ *
+ * \return the format to pass to `Crypter::encode()`
+ */
+Crypter::FormatFlags MainWindow::syncDataFormat(void)
+{
+  Q_D(MainWindow);
+  return d->settings.value("misc/gcmSyncData", false).toBool()
+      ? Crypter::AES256GCMCompressionFormat
+      : Crypter::AES256EncryptedMasterkeyFormat;
+}
+
+
 QByteArray MainWindow::cryptedRemoteDomains(void)
 {
   Q_D(MainWindow);
@@ -2189,7 +2362,7 @@ QByteArray MainWindow::cryptedRemoteDomains(void)
   try {
     d->keyGenerationFuture.waitForFinished();
     if (validCredentials()) {
-      cipher = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), d->remoteDomains.toJson(), CompressionEnabled);
+      cipher = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), d->remoteDomains.toJson(), CompressionEnabled, Q_NULLPTR, &d->keyManager, syncDataFormat());
     }
     else {
       _LOG(QString("ERROR in MainWindow::cryptedRemoteDomains(): invalid credentials"));
@@ -2216,18 +2389,36 @@ void MainWindow::warnAboutDifferingKGKs(void)
 void MainWindow::syncWith(SyncPeer syncPeer, const QByteArray &remoteDomainsEncoded)
 {
   Q_D(MainWindow);
-  // qDebug() << "MainWindow::syncWith(" << syncPeer << ")";
-  QJsonDocument remoteJSON;
+  if (d->syncInProgress) {
+    _LOG("ERROR in MainWindow::syncWith(): another sync is in progress");
+    return;
+  }
+  d->syncInProgress = true;
+  mergeWithPeer(syncPeer, remoteDomainsEncoded);
+  d->syncInProgress = false;
+  // server replies that arrived while merging are handled once the caller is done with this sync
+  while (!d->deferredReadReplies.isEmpty()) {
+    QMetaObject::invokeMethod(this, "onReadFinished", Qt::QueuedConnection, Q_ARG(QNetworkReply*, d->deferredReadReplies.takeFirst()));
+  }
+}
+
+
+void MainWindow::mergeWithPeer(SyncPeer syncPeer, const QByteArray &remoteDomainsEncoded)
+{
+  Q_D(MainWindow);
+  // qDebug() << "MainWindow::mergeWithPeer(" << syncPeer << ")";
+  DomainSettingsList remoteDomains;
   d->doConvertLocalToLegacy = false;
   if (!remoteDomainsEncoded.isEmpty()) {
     QByteArray baDomains;
     bool ok = true;
     try {
       SecureByteArray KGK;
-      baDomains = Crypter::decode(d->masterPassword.toUtf8(), remoteDomainsEncoded, CompressionEnabled, KGK);
+      baDomains = Crypter::decode(d->masterPassword.toUtf8(), remoteDomainsEncoded, CompressionEnabled, KGK, Q_NULLPTR, &d->keyManager);
       if (d->KGK != KGK) {
         d->doConvertLocalToLegacy = !d->domains.isEmpty();
         d->KGK = KGK;
+        clearDerivedKeyCache();
       }
     }
     catch (CryptoPP::Exception &e) {
@@ -2240,10 +2431,11 @@ void MainWindow::syncWith(SyncPeer syncPeer, const QByteArray &remoteDomainsEnco
     if (!ok) { // fall back to new password
       try {
         SecureByteArray KGK;
-        baDomains = Crypter::decode(d->changeMasterPasswordDialog->newPassword().toUtf8(), remoteDomainsEncoded, CompressionEnabled, KGK);
+        baDomains = Crypter::decode(d->changeMasterPasswordDialog->newPassword().toUtf8(), remoteDomainsEncoded, CompressionEnabled, KGK, Q_NULLPTR, &d->keyManager);
         if (d->KGK != KGK && !d->domains.isEmpty()) {
           d->doConvertLocalToLegacy = true;
           d->KGK = KGK;
+          clearDerivedKeyCache();
         }
       }
       catch (CryptoPP::Exception &e) {
@@ -2253,7 +2445,7 @@ void MainWindow::syncWith(SyncPeer syncPeer, const QByteArray &remoteDomainsEnco
     }
     if (!baDomains.isEmpty()) {
       QJsonParseError parseError;
-      remoteJSON = QJsonDocument::fromJson(baDomains, &parseError);
+      remoteDomains = DomainSettingsList::fromJson(baDomains, &parseError);
       if (parseError.error != QJsonParseError::NoError) {
         QMessageBox::warning(this, tr("Bad data from sync peer"),
                              tr("Decoding the data from the sync peer failed: %1")
@@ -2263,14 +2455,18 @@ void MainWindow::syncWith(SyncPeer syncPeer, const QByteArray &remoteDomainsEnco
   }
 
   d->domains.setDirty(false);
-  d->remoteDomains = DomainSettingsList::fromQJsonDocument(remoteJSON);
-  mergeLocalAndRemoteData();
-
-  if (d->remoteDomains.isDirty()) {
+  d->remoteDomains = remoteDomains;
+  // the base of the next merge is what the peer has sent, not what is written back to it,
+  // so that changes that don't make it to the peer are sent again next time
+  const DomainSettingsList received = d->remoteDomains;
+  const SyncMerger::ChangeSet &changes = mergeLocalAndRemoteData(d->lastSyncedDomains.value(syncPeer));
+  d->lastSyncedDomains[syncPeer] = received;
+
+  if (changes.remoteChanged()) {
     writeToRemote(syncPeer);
   }
 
-  if (d->domains.isDirty()) {
+  if (changes.localChanged()) {
     saveAllDomainDataToSettings();
     restoreDomainDataFromSettings();
     d->domains.setDirty(false);
@@ -2311,57 +2507,90 @@ void MainWindow::onTabChanged(int idx)
 }
 
 
+void MainWindow::generateLegacyPasswords(const QList<DomainSettings> &domains)
+{
+  Q_D(MainWindow);
+  d->legacyPasswords.clear();
+  if (domains.isEmpty())
+    return;
+  Q_ASSERT_X(!d->masterPassword.isEmpty(), "MainWindow::generateLegacyPasswords()", "d->masterPassword must not be empty");
+  if (d->masterPassword.isEmpty()) {
+    qWarning() << "Error in MainWindow::generateLegacyPasswords(): d->masterPassword must not be empty";
+    return;
+  }
+  PasswordBatch batch;
+  QEventLoop loop;
+  QObject::connect(&batch, SIGNAL(finished()), &loop, SLOT(quit()));
+  QObject::connect(&batch, SIGNAL(progress(int, int)), SLOT(onLegacyPasswordGenerationProgress(int, int)));
+  batch.start(domains, d->masterPassword.toUtf8());
+  if (batch.isRunning()) {
+    // keep the window painted, but neither let the user nor the lock timer interfere with the merge
+    d->countdownWidget->stop();
+    loop.exec(QEventLoop::ExcludeUserInputEvents);
+    restartInvalidationTimer();
+  }
+  batch.waitForFinished();
+  for (int i = 0; i < domains.size(); ++i) {
+    d->legacyPasswords.insert(domains.at(i).domainName, batch.result(i));
+  }
+}
+
+
 void MainWindow::convertToLegacyPassword(DomainSettings &ds)
 {
   Q_D(MainWindow);
   if (ds.legacyPassword.isEmpty()) {
-    Password pwd(ds);
+    if (d->legacyPasswords.contains(ds.domainName)) {
+      ds.legacyPassword = d->legacyPasswords.take(ds.domainName);
+      return;
+    }
     Q_ASSERT_X(!d->masterPassword.isEmpty(), "MainWindow::convertToLegacyPassword()", "d->masterPassword must not be empty");
     if (d->masterPassword.isEmpty()) {
       qWarning() << "Error in MainWindow::convertToLegacyPassword(): d->masterPassword must not be empty";
       return;
     }
-    pwd.generate(d->masterPassword.toUtf8());
-    ds.legacyPassword = pwd.password();
+    PasswordBuffer pwd;
+    PasswordGenerator::generatePassword(ds, d->masterPassword.toUtf8(), pwd);
+    ds.legacyPassword = pwd.toString();
   }
 }
 
 
-void MainWindow::mergeLocalAndRemoteData(void)
+SyncMerger::ChangeSet MainWindow::mergeLocalAndRemoteData(const DomainSettingsList &base)
 {
   Q_D(MainWindow);
-  QStringList allDomainNames = d->remoteDomains.keys() + d->domains.keys();
-  allDomainNames.removeDuplicates();
-  foreach(QString domainName, allDomainNames) {
-    const DomainSettings &remoteDomainSetting = d->remoteDomains.at(domainName);
-    DomainSettings localDomainSetting = d->domains.at(domainName);
-    if (!localDomainSetting.isEmpty() && !remoteDomainSetting.isEmpty()) {
-      if (remoteDomainSetting.modifiedDate > localDomainSetting.modifiedDate) {
-        d->domains.updateWith(remoteDomainSetting);
-      }
-      else if (remoteDomainSetting.modifiedDate < localDomainSetting.modifiedDate) {
-        if (d->doConvertLocalToLegacy && !localDomainSetting.deleted) {
-          convertToLegacyPassword(localDomainSetting);
-          localDomainSetting.domainName = selectAlternativeDomainNameFor(domainName, d->domains.keys());
-        }
-        d->remoteDomains.updateWith(localDomainSetting);
+  SyncMerger merger;
+  merger.setKeepBoth(d->doConvertLocalToLegacy);
+  SyncMerger::ChangeSet changes = merger.merge(d->domains, d->remoteDomains, base);
+  if (d->doConvertLocalToLegacy) {
+    // local domains sent to the peer keep their passwords as legacy passwords, derive them in one go
+    QList<DomainSettings> toBeConverted;
+    foreach (DomainSettings ds, changes.toRemote) {
+      if (!ds.deleted && ds.legacyPassword.isEmpty()) {
+        toBeConverted << ds;
       }
     }
-    else if (remoteDomainSetting.isEmpty()) {
-      if (!localDomainSetting.deleted) {
-        if (d->doConvertLocalToLegacy) {
-          convertToLegacyPassword(localDomainSetting);
-        }
-        d->remoteDomains.updateWith(localDomainSetting);
+    foreach (SyncMerger::Rename rename, changes.renames) {
+      if (rename.settings.legacyPassword.isEmpty()) {
+        toBeConverted << rename.settings;
       }
-      else {
-        d->domains.remove(domainName);
+    }
+    generateLegacyPasswords(toBeConverted);
+    for (int i = 0; i < changes.toRemote.count(); ++i) {
+      if (!changes.toRemote.at(i).deleted) {
+        convertToLegacyPassword(changes.toRemote[i]);
       }
     }
-    else {
-      d->domains.updateWith(remoteDomainSetting);
+    for (int i = 0; i < changes.renames.count(); ++i) {
+      convertToLegacyPassword(changes.renames[i].settings);
     }
   }
+  SyncMerger::apply(changes, d->domains, d->remoteDomains);
+  if (!changes.conflicts.isEmpty() || !changes.renames.isEmpty()) {
+    _LOG(QString("Sync: %1 conflicts, %2 domains renamed").arg(changes.conflicts.count()).arg(changes.renames.count()));
+  }
+  d->legacyPasswords.clear();
+  return changes;
 }
 
 
@@ -2434,7 +2663,7 @@ void MainWindow::onForcedPush(void)
     try {
       d->keyGenerationFuture.waitForFinished();
       if (validCredentials()) {
-        cipher = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), d->domains.toJson(), CompressionEnabled);
+        cipher = Crypter::encode(d->masterKey, d->IV, d->salt, d->kgk(), d->domains.toJson(), CompressionEnabled, Q_NULLPTR, &d->keyManager, syncDataFormat());
       }
       else {
         _LOG("ERROR in MainWindow::onForcedPush(): invalid credentials");
@@ -2482,7 +2711,14 @@ void MainWindow::onDomainSelected(QString domain)
       break;
     }
   }
+  // the intermediate state of the previous domain's key derivation is of no use any more
+  d->password.clearCheckpoint();
   d->lastCleanDomainSettings = d->domains.at(domain);
+  d->recentDomains.removeAll(domain);
+  d->recentDomains.prepend(domain);
+  while (d->recentDomains.size() > MaxRecentDomains) {
+    d->recentDomains.removeLast();
+  }
   // qDebug() << d->lastCleanDomainSettings;
   copyDomainSettingsToGUI(d->lastCleanDomainSettings);
   ui->generatedPasswordLineEdit->setEchoMode(QLineEdit::Password);
@@ -2496,6 +2732,7 @@ void MainWindow::onDomainTextChanged(const QString &domain)
   _LOG(QString("MainWindow::onDomainTextChanged(\"%1\") d->lastCleanDomainSettings.domainName = \"%2\"")
        .arg(domain)
        .arg(d->lastCleanDomainSettings.domainName));
+  prefetchDerivedKeys(domain);
   int idx = findDomainInComboBox(domain);
   if (idx == NotFound) {
     if (!d->lastCleanDomainSettings.isEmpty()) {
@@ -2511,6 +2748,44 @@ void MainWindow::onDomainTextChanged(const QString &domain)
 }
 
 
+// derive the keys of the domains matching `prefix` in the background, recently used ones first
+void MainWindow::prefetchDerivedKeys(const QString &prefix)
+{
+  Q_D(MainWindow);
+  if (d->masterPassword.isEmpty() || d->KGK.isEmpty()) {
+    d->prefetcher.cancel();
+    return;
+  }
+#if HACKING_MODE_ENABLED
+  if (d->hackingMode)
+    return;
+#endif
+  QStringList matches;
+  foreach (DomainSettings ds, d->domains) {
+    if (!ds.deleted && ds.legacyPassword.isEmpty() && ds.domainName.startsWith(prefix, Qt::CaseInsensitive)) {
+      matches << ds.domainName;
+    }
+  }
+  matches.sort(Qt::CaseInsensitive);
+  QStringList names;
+  foreach (QString name, d->recentDomains) {
+    if (matches.contains(name)) {
+      names << name;
+    }
+  }
+  foreach (QString name, matches) {
+    if (!names.contains(name)) {
+      names << name;
+    }
+  }
+  QList<DomainSettings> candidates;
+  foreach (QString name, names.mid(0, d->prefetcher.maxCandidates())) {
+    candidates << d->domains.at(name);
+  }
+  d->prefetcher.prefetch(candidates, d->KGK);
+}
+
+
 void MainWindow::onEasySelectorValuesChanged(int passwordLength, int complexityValue)
 {
   Q_D(MainWindow);
@@ -2549,49 +2824,33 @@ void MainWindow::onExportAllDomainSettingAsJSON(void)
 }
 
 
-struct DomainSettingsToTextConverter
+static SecureByteArray loginDataToText(const DomainSettings &ds, const SecureString &pwd)
 {
-  explicit DomainSettingsToTextConverter(const SecureByteArray &kgk)
-    : kgk(kgk)
-  { /* ... */ }
-  typedef SecureByteArray result_type;
-  SecureByteArray kgk;
-  SecureByteArray operator()(const DomainSettings &ds)
-  {
-    SecureByteArray data;
-    if (!ds.deleted && !ds.expired()) {
-      SecureString pwd = ds.legacyPassword;
-      if (pwd.isEmpty()) {
-        Password gpwd(ds);
-        gpwd.generate(kgk);
-        pwd = gpwd.password();
-      }
-      if (!pwd.isEmpty()) {
-        QString notes = ds.notes;
-        notes.replace("\\", "\\\\");
-        notes.replace("\n", "\\n");
-        data = SecureString("[%1]\n"
-                            "pwd = %2\n")
-            .arg(ds.domainName)
-            .arg(pwd)
-            .toUtf8();
-        if (!ds.url.isEmpty()) {
-          data.append(QString("url = %1\n").arg(ds.url).toUtf8());
-        }
-        if (!ds.userName.isEmpty()) {
-          data.append(QString("user = %1\n").arg(ds.userName).toUtf8());
-        }
-        if (!notes.isEmpty()) {
-          data.append(SecureString("notes = %1\n").arg(notes).toUtf8());
-        }
-        if (!ds.groupHierarchy.isEmpty()) {
-          data.append(QString("group = %1\n").arg(ds.groupHierarchy).toUtf8());
-        }
-      }
+  SecureByteArray data;
+  if (!pwd.isEmpty()) {
+    QString notes = ds.notes;
+    notes.replace("\\", "\\\\");
+    notes.replace("\n", "\\n");
+    data = SecureString("[%1]\n"
+                        "pwd = %2\n")
+        .arg(ds.domainName)
+        .arg(pwd)
+        .toUtf8();
+    if (!ds.url.isEmpty()) {
+      data.append(QString("url = %1\n").arg(ds.url).toUtf8());
+    }
+    if (!ds.userName.isEmpty()) {
+      data.append(QString("user = %1\n").arg(ds.userName).toUtf8());
+    }
+    if (!notes.isEmpty()) {
+      data.append(SecureString("notes = %1\n").arg(notes).toUtf8());
+    }
+    if (!ds.groupHierarchy.isEmpty()) {
+      data.append(QString("group = %1\n").arg(ds.groupHierarchy).toUtf8());
     }
-    return data;
   }
-};
+  return data;
+}
 
 
 static const QString LoginDataFileExtension = QObject::tr("Login data file (*.txt *.sesam)");
@@ -2605,34 +2864,44 @@ void MainWindow::onExportAllLoginDataAsClearText(void)
                                    QString(),
                                    LoginDataFileExtension);
   if (!filename.isEmpty()) {
+    QList<DomainSettings> toBeGenerated;
+    foreach (DomainSettings ds, d->domains) {
+      if (!ds.deleted && !ds.expired() && ds.legacyPassword.isEmpty()) {
+        toBeGenerated << ds;
+      }
+    }
+    PasswordBatch batch;
     QProgressDialog progressDialog(this);
     progressDialog.setLabelText(tr("Exporting logins\nin %1 thread%2 ...")
-                                .arg(QThread::idealThreadCount())
-                                .arg(QThread::idealThreadCount() == 1 ? "" : tr("s")));
-    progressDialog.show();
-    QFutureWatcher<SecureByteArray> futureWatcher;
-    QObject::connect(&futureWatcher, SIGNAL(finished()), &progressDialog, SLOT(reset()));
-    QObject::connect(&progressDialog, SIGNAL(canceled()), &futureWatcher, SLOT(cancel()));
-    QObject::connect(&futureWatcher, SIGNAL(progressRangeChanged(int, int)), &progressDialog, SLOT(setRange(int, int)));
-    QObject::connect(&futureWatcher, SIGNAL(progressValueChanged(int)), &progressDialog, SLOT(setValue(int)));
-    QFuture<SecureByteArray> future = QtConcurrent::mappedReduced<SecureByteArray>(
-          d->domains,
-          DomainSettingsToTextConverter(d->KGK),
-          [](SecureByteArray &all, const SecureByteArray &intermediate)
-          {
-            if (!intermediate.isEmpty()) {
-              all.append(intermediate).append("\n");
-            }
-          },
-          QtConcurrent::OrderedReduce);
-    futureWatcher.setFuture(future);
-    progressDialog.exec();
-    futureWatcher.waitForFinished();
-    if (!futureWatcher.future().isCanceled()) {
+                                .arg(batch.threadCount())
+                                .arg(batch.threadCount() == 1 ? "" : tr("s")));
+    progressDialog.setRange(0, toBeGenerated.size());
+    QObject::connect(&batch, SIGNAL(finished()), &progressDialog, SLOT(reset()));
+    QObject::connect(&progressDialog, SIGNAL(canceled()), &batch, SLOT(cancel()));
+    QObject::connect(&batch, SIGNAL(progress(int, int)), &progressDialog, SLOT(setValue(int)));
+    batch.start(toBeGenerated, d->KGK);
+    if (batch.isRunning()) {
+      progressDialog.exec();
+    }
+    batch.waitForFinished();
+    if (!batch.isCancelled()) {
+      SecureByteArray data;
+      int g = 0;
+      foreach (DomainSettings ds, d->domains) {
+        if (ds.deleted || ds.expired())
+          continue;
+        const SecureString &pwd = ds.legacyPassword.isEmpty()
+            ? batch.result(g++)
+            : SecureString(ds.legacyPassword);
+        const SecureByteArray &text = loginDataToText(ds, pwd);
+        if (!text.isEmpty()) {
+          data.append(text).append("\n");
+        }
+      }
       QFile outFile(filename);
       bool ok = outFile.open(QIODevice::Truncate | QIODevice::WriteOnly);
       if (ok) {
-        outFile.write(future.result());
+        outFile.write(data);
         outFile.close();
       }
       QMessageBox::information(this, tr("All login data exported"), tr("Successfully exported %1 logins.").arg(d->domains.count()));
@@ -2830,6 +3099,7 @@ void MainWindow::onMasterPasswordEntered(void)
       createLanguageMenu();
       ok = restoreDomainDataFromSettings();
       if (ok) {
+        d->keyManager.prime(d->masterPassword.toUtf8(), d->KGK);
         generateSaltKeyIV().waitForFinished();
         d->settings.setValue("mainwindow/masterPasswordEntered", true);
         d->settings.sync();
@@ -2923,6 +3193,21 @@ void MainWindow::wrongPasswordWarning(int errCode, QString errMsg)
 }
 
 
+/*!
+ * \brief MainWindow::clearDerivedKeyCache
+ *
+ * Empties the derived key cache. Prefetch jobs still running for the old key
+ * generation key are stopped first, lest they put stale keys into the cache.
+ */
+void MainWindow::clearDerivedKeyCache(void)
+{
+  Q_D(MainWindow);
+  d->prefetcher.cancel();
+  d->prefetcher.waitForDone();
+  d->keyCache.clear();
+}
+
+
 void MainWindow::invalidateMasterPassword(bool reenter)
 {
   Q_D(MainWindow);
@@ -2931,6 +3216,15 @@ void MainWindow::invalidateMasterPassword(bool reenter)
   d->masterPasswordDialog->invalidatePassword();
   d->KGK.invalidate();
   d->masterKey.invalidate();
+  _LOG(QString("Derived key cache: %1 hits, %2 misses").arg(d->keyCache.hits()).arg(d->keyCache.misses()));
+  clearDerivedKeyCache();
+  d->password.clearCheckpoint();
+  _LOG(QString("Key manager cache: %1 hits, %2 misses").arg(d->keyManager.hits()).arg(d->keyManager.misses()));
+  d->keyManager.clear();
+  d->vault.clear();
+  d->domainDataRestored = false;
+  d->lastSyncedDomains.clear();
+  _LOG(QString("Secure arena: %1").arg(SecureArena::description()));
   if (reenter) {
     enterMasterPassword();
   }
@@ -3007,6 +3301,10 @@ void MainWindow::onDeleteFinished(QNetworkReply *reply)
 void MainWindow::onReadFinished(QNetworkReply *reply)
 {
   Q_D(MainWindow);
+  if (d->syncInProgress) {
+    d->deferredReadReplies.append(reply);
+    return;
+  }
   ++d->counter;
   d->progressDialog->setValue(d->counter);
 
@@ -50,8 +50,10 @@
 #include "password.h"
 #include "domainsettings.h"
 #include "domainsettingslist.h"
+#include "syncmerger.h"
 #include "pbkdf2.h"
 #include "securebytearray.h"
+#include "crypter.h"
 
 namespace Ui {
 class MainWindow;
@@ -101,6 +103,8 @@ private slots:
   void onPasswordGenerated(void);
   void onPasswordGenerationAborted(void);
   void onPasswordGenerationStarted(void);
+  void onPasswordGenerationProgress(int done, int total, qint64 etaMs);
+  void onLegacyPasswordGenerationProgress(int done, int total);
   void saveCurrentDomainSettings(void);
   void onNotesChanged(void);
   void onLegacyPasswordChanged(QString);
@@ -192,16 +196,21 @@ private: // methods
   void saveDomainSettings(DomainSettings ds);
   void saveAllDomainDataToSettings(void);
   bool restoreDomainDataFromSettings(void);
+  void removeUnreferencedBuckets(void);
+  static QString bucketSettingsKey(const QByteArray &digest);
   void copyDomainSettingsToGUI(DomainSettings ds);
   void copyDomainSettingsToGUI(const QString &domain);
   void updateWindowTitle(void);
   void makeDomainComboBox(void);
   void wrongPasswordWarning(int errCode, QString errMsg);
   void restartInvalidationTimer(void);
+  void prefetchDerivedKeys(const QString &prefix);
   void generateSaltKeyIVThread(void);
   DomainSettings collectedDomainSettings(void) const;
   QByteArray cryptedRemoteDomains(void);
-  void mergeLocalAndRemoteData(void);
+  Crypter::FormatFlags syncDataFormat(void);
+  SyncMerger::ChangeSet mergeLocalAndRemoteData(const DomainSettingsList &base);
+  void mergeWithPeer(SyncPeer syncPeer, const QByteArray &remoteDomainsEncoded);
   void writeToRemote(SyncPeer syncPeer);
   void sendToSyncServer(const QByteArray &cipher);
   void writeToSyncFile(const QByteArray &cipher);
@@ -218,8 +227,9 @@ private: // methods
   void updateCheckableLabel(QLabel *, bool checked);
   QString selectAlternativeDomainNameFor(const QString &domainName);
   void warnAboutDifferingKGKs(void);
+  void clearDerivedKeyCache(void);
   void convertToLegacyPassword(DomainSettings &ds);
-  QString selectAlternativeDomainNameFor(const QString &domainName, const QStringList &domainNameList);
+  void generateLegacyPasswords(const QList<DomainSettings> &domains);
   void saveSyncDataToSettings(void);
   bool wipeFile(const QString &filename);
   void cleanupAfterMasterPasswordChanged(void);
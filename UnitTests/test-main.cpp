@@ -19,17 +19,48 @@
 
 
 #include "pbkdf2.h"
+#include "pbkdf2engine.h"
+#include "derivationcontrol.h"
+#include "hashbackend.h"
+#include "aesbackend.h"
+#include "randomsource.h"
+#include "securearena.h"
+#include "securebuffer.h"
 #include "password.h"
+#include "passwordgenerator.h"
+#include "derivedkeycache.h"
+#include "derivedkeyprefetcher.h"
+#include "passwordbatch.h"
 #include "crypter.h"
+#include "keymanager.h"
+#include "crypterstream.h"
+#include "compressionpolicy.h"
+#include "segmentedvault.h"
+#include "syncmerger.h"
 #include "exporter.h"
 #include "domainsettings.h"
+#include "domainsettingslist.h"
 
 #include <QDebug>
+#include <QBuffer>
 #include <QDir>
 #include <QMessageAuthenticationCode>
 #include <QtTest/QTest>
 
 
+static bool decodingFails(const SecureByteArray &masterPassword, const QByteArray &cipher)
+{
+  SecureByteArray KGK;
+  try {
+    Crypter::decode(masterPassword, cipher, false, KGK);
+  }
+  catch (CryptoPP::HashVerificationFilter::HashVerificationFailed &) {
+    return true;
+  }
+  return false;
+}
+
+
 class TestSESAM : public QObject
 {
   Q_OBJECT
@@ -67,6 +98,50 @@ private slots:
     QVERIFY(DomainSettings::DefaultSalt_base64 == QString("pepper").toUtf8().toBase64());
   }
 
+  void hash_backend_selftest(void)
+  {
+    QVERIFY(HashBackend::selfTest());
+  }
+
+  void aes_backend_selftest(void)
+  {
+    QVERIFY(AESBackend::selfTest());
+  }
+
+  void random_source_selftest(void)
+  {
+    QVERIFY(RandomSource::selfTest());
+    QVERIFY(Crypter::randomBytes(RandomSource::SmallRequestSize - 1) != Crypter::randomBytes(RandomSource::SmallRequestSize - 1));
+  }
+
+  void secure_arena(void)
+  {
+    const SecureArena::Statistics before = SecureArena::statistics();
+    SecureBuffer key(Crypter::AESKeySize);
+    QVERIFY(key.size() == Crypter::AESKeySize);
+    QVERIFY(key.constData()[0] == 0 && key.constData()[Crypter::AESKeySize - 1] == 0);
+    SecureBuffer iv(Crypter::randomBytes(Crypter::AESBlockSize).constData(), Crypter::AESBlockSize);
+    SecureBuffer big(2 * SecureArena::MaxChunkSize);
+    SecureArena::Statistics s = SecureArena::statistics();
+    QVERIFY(s.liveCount == before.liveCount + 3);
+    QVERIFY(s.highWater >= s.liveCount);
+    QVERIFY(s.heapAllocations == before.heapAllocations + 1);
+    QVERIFY(s.lockedBytes + s.unlockedBytes > 0);
+    const SecureByteArray ivCopy = iv.toByteArray();
+    SecureBuffer moved(std::move(iv));
+    QVERIFY(iv.isEmpty() && iv.constData() == Q_NULLPTR);
+    QVERIFY(moved.toByteArray() == ivCopy);
+    moved.wipe();
+    QVERIFY(moved.toByteArray() == SecureByteArray(Crypter::AESBlockSize, static_cast<char>(0)));
+    big.release();
+    QVERIFY(SecureArena::statistics().liveCount == before.liveCount + 2);
+    {
+      QScopedPointer<PBKDF2EngineBase> engine(PBKDF2EngineBase::create(QCryptographicHash::Sha512, "message", 7));
+      QVERIFY(SecureArena::statistics().liveCount == before.liveCount + 3);
+    }
+    QVERIFY(SecureArena::statistics().liveCount == before.liveCount + 2);
+  }
+
   void pbkdf2(void)
   {
     PBKDF2 pbkdf2(QString("message").toUtf8(), QString("pepper").toUtf8(), 3, QCryptographicHash::Sha512);
@@ -91,6 +166,12 @@ private slots:
     QVERIFY(pbkdf2.derivedKey() == QByteArray::fromHex("efc8e734ed5b5657ac220046754b7d1dbea00983f13209b1ec1d0e418e98807cba1026d3ed3fa2a09dfa43c074447bf4777e70e4999d29d2c2f84dc51502a195"));
   }
 
+  void pbkdf2_sha256_long_message(void)
+  {
+    PBKDF2 pbkdf2(QString("ThisMessageIsLongerThanSixtyFourCharactersWhichLeadsToTheSituationThatTheMessageHasToBeHashedWhenCalculatingTheHmac").toUtf8(), QString("pepper").toUtf8(), 3, QCryptographicHash::Sha256);
+    QVERIFY(pbkdf2.derivedKey() == QByteArray::fromHex("b987b31dbfb48bdc1269a60dcb2b4103525c2507270c1ac952efe420b8a158ab"));
+  }
+
   void pbkdf2_sha384(void)
   {
     PBKDF2 pbkdf2(QString("message").toUtf8(), QString("salt").toUtf8(), 3, QCryptographicHash::Sha384);
@@ -103,6 +184,42 @@ private slots:
     QVERIFY(pbkdf2.derivedKey() == QByteArray::fromHex("db78c5091444940f9642fce519097ee7adfeb338fd6970855135539020b53fad"));
   }
 
+  void pbkdf2_sha256_multiblock(void)
+  {
+    // RFC 7914, section 11
+    PBKDF2 pbkdf2(QString("passwd").toUtf8(), QString("salt").toUtf8(), 1, QCryptographicHash::Sha256, 64);
+    QVERIFY(pbkdf2.derivedKey() == QByteArray::fromHex("55ac046e56e3089fec1691c22544b605f94185216dde0465e68b9d57c20dacbc49ca9cccf179b645991664b39d77ef317c71b845b1e30bd509112041d3a19783"));
+  }
+
+  void pbkdf2_sha384_multiblock_truncated(void)
+  {
+    PBKDF2 pbkdf2(QString("message").toUtf8(), QString("salt").toUtf8(), 3, QCryptographicHash::Sha384, 100);
+    QVERIFY(pbkdf2.derivedKey() == QByteArray::fromHex("dcbeb0b99a4cf4d1c9c1e8f630f3aa8637c8906f1c3e1c78fb4f462b160df20f7435bdd6a904dd3c3ede7ff04bc53e90992430a31c82972c11e88294b55651283993f4f28b5e06dad0e00bbde4a00275d4b1fe0ef9b2bdc399f4b790a1301da8daccb639"));
+  }
+
+  void pbkdf2_resume(void)
+  {
+    const SecureByteArray &pwd = QString("message").toUtf8();
+    const QByteArray &salt = QString("salt").toUtf8();
+    PBKDF2 reference(pwd, salt, 4096, QCryptographicHash::Sha512, 128);
+    PBKDF2 pbkdf2;
+    DerivationControl control;
+    control.cancel();
+    pbkdf2.setControl(&control);
+    pbkdf2.generate(pwd, salt, 4096, QCryptographicHash::Sha512, 128);
+    QVERIFY(pbkdf2.checkpoint().iterations() < 4096);
+    pbkdf2.setControl(Q_NULLPTR);
+    pbkdf2.generate(pwd, salt, 1000, QCryptographicHash::Sha512, 128);
+    QVERIFY(pbkdf2.checkpoint().iterations() == 1000);
+    pbkdf2.generate(pwd, salt, 4096, QCryptographicHash::Sha512, 128);
+    QVERIFY(pbkdf2.checkpoint().iterations() == 4096);
+    QVERIFY(pbkdf2.derivedKey() == reference.derivedKey());
+    pbkdf2.clearCheckpoint();
+    QVERIFY(!pbkdf2.checkpoint().isValid());
+    pbkdf2.generate(pwd, QString("pepper").toUtf8(), 4096, QCryptographicHash::Sha512, 128);
+    QVERIFY(pbkdf2.derivedKey() != reference.derivedKey());
+  }
+
   void pwdgen_simple_password_1(void)
   {
     DomainSettings ds;
@@ -214,6 +331,177 @@ private slots:
     QVERIFY(pwd.password() == "7809");
   }
 
+  void pwdgen_core(void)
+  {
+    DomainSettings ds;
+    ds.domainName = "Bank";
+    ds.extraCharacters = "0123456789";
+    ds.iterations = 1;
+    ds.passwordTemplate = "oxxx";
+    ds.salt_base64 = QString("pepper").toUtf8().toBase64();
+    PasswordBuffer pwd;
+    QVERIFY(PasswordGenerator::generatePassword(ds, QString("reallysafe").toUtf8(), pwd));
+    QVERIFY(SecureByteArray(pwd.derivedKey(), PasswordBuffer::DerivedKeySize).toHex() == "55b5f5cdd9bf2845e339650b4f6e1398cf7fe9ceed087eb5f5bc059882723579fc8ec27443417cf33c9763bafac6277fbe991bf27dd0206e78f7d9dfd574167f");
+    QVERIFY(pwd.toString() == "7809");
+    pwd.clear();
+    QVERIFY(pwd.isEmpty());
+  }
+
+  void pwdgen_template_errors(void)
+  {
+    DomainSettings ds;
+    ds.domainName = "Bank";
+    ds.iterations = 1;
+    ds.salt_base64 = QString("pepper").toUtf8().toBase64();
+    ds.passwordTemplate = "oxxx";
+    Password pwd(ds);
+    pwd.generate("reallysafe");
+    QVERIFY(pwd.error() == Password::EmptyCharacterSetError);
+    QVERIFY(pwd.password().isEmpty());
+    ds.extraCharacters = "0123456789";
+    ds.passwordTemplate = "oxqx";
+    pwd.setDomainSettings(ds);
+    QVERIFY(pwd.remix().isEmpty());
+    QVERIFY(pwd.error() == Password::EmptyTemplateError);
+    ds.passwordTemplate = "oxxx";
+    pwd.setDomainSettings(ds);
+    QVERIFY(pwd.remix() == "7809");
+    QVERIFY(pwd.error() == Password::NoError);
+  }
+
+  void pwdgen_batch(void)
+  {
+    QList<DomainSettings> domains;
+    DomainSettings ds;
+    ds.domainName = "ct.de";
+    ds.extraCharacters = "abcdefghijklmnopqrstuvwxyzABCDEFGHJKLMNPQRTUVWXYZ0123456789#!\"§$%&/()[]{}=-_+*<>;:.";
+    ds.iterations = 4096;
+    ds.passwordTemplate = "oxxxxxxxxx";
+    ds.salt_base64 = QString("pepper").toUtf8().toBase64();
+    domains << ds;
+    ds = DomainSettings();
+    ds.domainName = "FooBar";
+    ds.iterations = 8192;
+    ds.passwordTemplate = "xxaxxx";
+    ds.salt_base64 = QString("blahfasel").toUtf8().toBase64();
+    domains << ds;
+    ds.passwordTemplate = "xxAxxx";
+    domains << ds;
+    ds.extraCharacters = "#!\"$%&/()[]{}=-_+*<>;:.";
+    ds.iterations = 4096;
+    ds.passwordTemplate = "xxoxAxxxxxxxxxaxx";
+    domains << ds;
+    ds = DomainSettings();
+    ds.domainName = "Bank";
+    ds.extraCharacters = "0123456789";
+    ds.iterations = 1;
+    ds.passwordTemplate = "oxxx";
+    ds.salt_base64 = QString("pepper").toUtf8().toBase64();
+    domains << ds;
+    ds.domainName = "Bank2";
+    ds.iterations = 77;
+    domains << ds;
+    const QVector<SecureString> &passwords = Password::generateBatch(domains, "test");
+    QVERIFY(passwords.size() == domains.size());
+    QVERIFY(passwords.at(0) == "YBVUH=sN/3");
+    QVERIFY(passwords.at(1) == "baeloh");
+    QVERIFY(passwords.at(2) == "BAELOH");
+    QVERIFY(passwords.at(3) == "pU)VUfgJ-Ws*wgzzE");
+    for (int i = 0; i < domains.size(); ++i) {
+      Password pwd(domains.at(i));
+      pwd.generate("test");
+      QVERIFY(passwords.at(i) == pwd.password());
+    }
+  }
+
+  void pwdgen_cached(void)
+  {
+    DerivedKeyCache cache(2);
+    DomainSettings ds;
+    ds.domainName = "ct.de";
+    ds.userName = "ola";
+    ds.extraCharacters = "0123456789";
+    ds.iterations = 4096;
+    ds.passwordTemplate = "xxaxnxAx";
+    ds.salt_base64 = QString("pepper").toUtf8().toBase64();
+    Password uncached(ds);
+    uncached.generate("test");
+    Password pwd(ds);
+    pwd.setCache(&cache);
+    pwd.generate("test");
+    QVERIFY(cache.hits() == 0 && cache.misses() == 1 && cache.count() == 1);
+    pwd.generate("test");
+    QVERIFY(cache.hits() == 1 && cache.misses() == 1);
+    QVERIFY(pwd.hexKey() == uncached.hexKey());
+    QVERIFY(pwd.password() == uncached.password());
+    pwd.generate("other KGK");
+    QVERIFY(cache.misses() == 2 && cache.count() == 2);
+    QVERIFY(pwd.hexKey() != uncached.hexKey());
+    cache.clear();
+    QVERIFY(cache.count() == 0);
+    pwd.generate("test");
+    QVERIFY(cache.misses() == 3);
+    QVERIFY(pwd.password() == uncached.password());
+  }
+
+  void derived_key_prefetcher(void)
+  {
+    const SecureByteArray &kgk = Crypter::generateKGK();
+    QList<DomainSettings> candidates;
+    for (int i = 0; i < 3; ++i) {
+      DomainSettings ds;
+      ds.domainName = QString("domain%1.example.com").arg(i);
+      ds.userName = "ola";
+      ds.iterations = 4096;
+      ds.passwordTemplate = "xxaxnxAx";
+      ds.salt_base64 = QString("pepper").toUtf8().toBase64();
+      candidates << ds;
+    }
+    DerivedKeyCache cache(8);
+    DerivedKeyPrefetcher prefetcher(&cache);
+    prefetcher.setMaxCandidates(2);
+    prefetcher.prefetch(candidates, kgk);
+    prefetcher.waitForDone();
+    QVERIFY(prefetcher.pendingCount() == 0);
+    QVERIFY(cache.count() == 2);
+    QVERIFY(!cache.contains(DerivedKeyCache::cacheKey(candidates.at(2), kgk)));
+    Password uncached(candidates.at(0));
+    uncached.generate(kgk);
+    SecureByteArray derivedKey;
+    QVERIFY(cache.lookup(DerivedKeyCache::cacheKey(candidates.at(0), kgk), derivedKey));
+    QVERIFY(SecureString(derivedKey.toHex()) == uncached.hexKey());
+    // the user typed on, so the domain matching the shorter prefix is no longer wanted
+    cache.clear();
+    DomainSettings slow = candidates.at(0);
+    slow.iterations = 1 << 24;
+    prefetcher.prefetch(QList<DomainSettings>() << slow, kgk);
+    prefetcher.prefetch(QList<DomainSettings>() << candidates.at(1), kgk);
+    prefetcher.waitForDone();
+    QVERIFY(prefetcher.pendingCount() == 0);
+    QVERIFY(!cache.contains(DerivedKeyCache::cacheKey(slow, kgk)));
+    QVERIFY(cache.contains(DerivedKeyCache::cacheKey(candidates.at(1), kgk)));
+  }
+
+  void pwdgen_password_batch(void)
+  {
+    QList<DomainSettings> domains;
+    for (int i = 0; i < 37; ++i) {
+      DomainSettings ds;
+      ds.domainName = QString("domain%1").arg(i);
+      ds.userName = "user";
+      ds.iterations = 1 + 97 * (i % 5);
+      ds.passwordTemplate = "xxxAxxnxxa";
+      ds.salt_base64 = QString("pepper").toUtf8().toBase64();
+      domains << ds;
+    }
+    PasswordBatch batch;
+    batch.setThreadCount(3);
+    const QVector<SecureString> &passwords = batch.run(domains, "test");
+    QVERIFY(passwords.size() == domains.size());
+    QVERIFY(batch.completedCount() == domains.size());
+    QVERIFY(passwords == Password::generateBatch(domains, "test"));
+  }
+
   void complexity(void)
   {
     for (int cv = 0; cv < Password::MaxComplexityValue; ++cv) {
@@ -246,6 +534,24 @@ private slots:
     QVERIFY(plain == data);
   }
 
+  void crypter_decrypt_parallel(void)
+  {
+    SecureByteArray key = Crypter::randomBytes(Crypter::AESKeySize);
+    SecureByteArray IV = Crypter::randomBytes(Crypter::AESBlockSize);
+    QByteArray data = Crypter::randomBytes(3 * AESBackend::ParallelThreshold + 5);
+    QByteArray cipher = Crypter::encrypt(key, IV, data, CryptoPP::StreamTransformationFilter::PKCS_PADDING);
+    QVERIFY(Crypter::decrypt(key, IV, cipher, CryptoPP::StreamTransformationFilter::PKCS_PADDING) == data);
+    cipher[cipher.size() - 1] = cipher.at(cipher.size() - 1) ^ 0x5a;
+    bool rejected = false;
+    try {
+      Crypter::decrypt(key, IV, cipher, CryptoPP::StreamTransformationFilter::PKCS_PADDING);
+    }
+    catch (CryptoPP::InvalidCiphertext &) {
+      rejected = true;
+    }
+    QVERIFY(rejected);
+  }
+
   void crypter_make_key(void)
   {
     SecureByteArray masterPassword = QString("7h15p455w0rd15m0r37h4n53cr37").toUtf8();
@@ -255,6 +561,18 @@ private slots:
     QVERIFY(key.toBase64() == "T8LlrPN1aqDlsIJVFA19r0RlZRpj7LuY8xbFnk3Tx8M=");
   }
 
+  void crypter_make_key_cancelled(void)
+  {
+    SecureByteArray masterPassword = QString("7h15p455w0rd15m0r37h4n53cr37").toUtf8();
+    QByteArray salt = QString("pepper").toUtf8();
+    DerivationControl control;
+    control.cancel();
+    QVERIFY(Crypter::makeKeyFromPassword(masterPassword, salt, &control).isEmpty());
+    control.reset();
+    SecureByteArray key = Crypter::makeKeyFromPassword(masterPassword, salt, &control);
+    QVERIFY(key.toBase64() == "T8LlrPN1aqDlsIJVFA19r0RlZRpj7LuY8xbFnk3Tx8M=");
+  }
+
   void crypter_make_key_iv(void)
   {
     SecureByteArray masterPassword = QString("7h15p455w0rd15m0r37h4n53cr37").toUtf8();
@@ -288,6 +606,471 @@ private slots:
     QVERIFY(KGK == KGK2);
   }
 
+  void crypter_stream(void)
+  {
+    const SecureByteArray masterPassword("reallysafe");
+    const QByteArray &salt = Crypter::generateSalt();
+    SecureByteArray key;
+    SecureByteArray IV;
+    Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+    const SecureByteArray &KGK = Crypter::generateKGK();
+    const QByteArray data = QByteArray(3 * CrypterEncoder::ChunkSize + 17, 'x') + Crypter::randomBytes(1000);
+    QByteArray b64Cipher;
+    QBuffer out(&b64Cipher);
+    out.open(QIODevice::WriteOnly);
+    CrypterEncoder encoder(&out, true, true);
+    QVERIFY(encoder.begin(key, IV, salt, KGK, data.size()));
+    for (int i = 0; i < data.size(); i += 1001) {
+      QVERIFY(encoder.write(data.mid(i, 1001)));
+    }
+    QVERIFY(encoder.finish());
+    QVERIFY(encoder.bytesWritten() == b64Cipher.size());
+    const QByteArray &cipher = QByteArray::fromBase64(b64Cipher);
+    QVERIFY(cipher.toBase64() == b64Cipher);
+    SecureByteArray KGK2;
+    QVERIFY(Crypter::decode(masterPassword, cipher, true, KGK2) == data);
+    QVERIFY(KGK == KGK2);
+    QByteArray plain;
+    QBuffer in(&b64Cipher);
+    in.open(QIODevice::ReadOnly);
+    QBuffer plainOut(&plain);
+    plainOut.open(QIODevice::WriteOnly);
+    CrypterDecoder decoder(&plainOut, masterPassword, true, true);
+    QVERIFY(decoder.write(&in));
+    QVERIFY(decoder.finish());
+    QVERIFY(plain == data);
+    QVERIFY(decoder.KGK() == KGK);
+  }
+
+  void crypter_compression_policy(void)
+  {
+    const SecureByteArray masterPassword("reallysafe");
+    const QByteArray &salt = Crypter::generateSalt();
+    SecureByteArray key;
+    SecureByteArray IV;
+    Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+    const SecureByteArray &KGK = Crypter::generateKGK();
+    const QByteArray data("[{\"cDate\":\"2016-02-03T04:05:06\",\"domain\":\"example.com\",\"iterations\":8192,"
+                          "\"passwordTemplate\":\"xxxxxxxxxxxxxxxxaAno\",\"salt\":\"cGVwcGVy\",\"username\":\"ola\"}]");
+    const CompressionPolicy::Method methods[3] = {
+      CompressionPolicy::NoCompression,
+      CompressionPolicy::ZlibCompression,
+      CompressionPolicy::DictionaryCompression
+    };
+    int cipherSize[3];
+    for (int i = 0; i < 3; ++i) {
+      QByteArray cipher;
+      QBuffer out(&cipher);
+      out.open(QIODevice::WriteOnly);
+      CrypterEncoder encoder(&out, true, false, Crypter::AES256GCMCompressionFormat);
+      encoder.setCompressionPolicy(CompressionPolicy(methods[i]));
+      QVERIFY(encoder.begin(key, IV, salt, KGK, data.size()));
+      QVERIFY(encoder.write(data));
+      QVERIFY(encoder.finish());
+      QVERIFY(cipher.at(0) == char(Crypter::AES256GCMCompressionFormat));
+      SecureByteArray KGK2;
+      QVERIFY(Crypter::decode(masterPassword, cipher, false, KGK2) == data);
+      cipherSize[i] = cipher.size();
+    }
+    QVERIFY(cipherSize[2] < cipherSize[1]);
+    QVERIFY(cipherSize[2] < cipherSize[0]);
+    const CompressionPolicy adaptive;
+    QVERIFY(adaptive.isAdaptive());
+    QVERIFY(adaptive.levelFor(64 * 1024) == 9);
+    QVERIFY(adaptive.levelFor(256 * 1024 * 1024) < 9);
+    QVERIFY(CompressionPolicy(CompressionPolicy::ZlibCompression, 4).levelFor(64 * 1024) == 4);
+  }
+
+  void crypter_gcm(void)
+  {
+    const SecureByteArray masterPassword("reallysafe");
+    const QByteArray &salt = Crypter::generateSalt();
+    SecureByteArray key;
+    SecureByteArray IV;
+    Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+    const SecureByteArray &KGK = Crypter::generateKGK();
+    const QByteArray &data = Crypter::randomBytes(4096);
+    SecureByteArray KGK2;
+    const QByteArray &cbcCipher = Crypter::encode(key, IV, salt, KGK, data, true, Q_NULLPTR, Q_NULLPTR, Crypter::AES256EncryptedMasterkeyFormat);
+    QVERIFY(cbcCipher.at(0) == char(Crypter::AES256EncryptedMasterkeyFormat));
+    QVERIFY(Crypter::decode(masterPassword, cbcCipher, true, KGK2) == data);
+    // older versions cannot read the GCM formats, so they must be asked for explicitly
+    const QByteArray &defaultCipher = Crypter::encode(key, IV, salt, KGK, data, true);
+    QVERIFY(defaultCipher.at(0) == char(Crypter::AES256EncryptedMasterkeyFormat));
+    const QByteArray &compressedCipher = Crypter::encode(key, IV, salt, KGK, data, true, Q_NULLPTR, Q_NULLPTR, Crypter::AES256GCMCompressionFormat);
+    QVERIFY(compressedCipher.at(0) == char(Crypter::AES256GCMCompressionFormat));
+    QVERIFY(Crypter::decode(masterPassword, compressedCipher, true, KGK2) == data);
+    QByteArray cipher = Crypter::encode(key, IV, salt, KGK, data, true, Q_NULLPTR, Q_NULLPTR, Crypter::AES256GCMFormat);
+    QVERIFY(cipher.at(0) == char(Crypter::AES256GCMFormat));
+    QVERIFY(Crypter::decode(masterPassword, cipher, true, KGK2) == data);
+    QVERIFY(KGK == KGK2);
+    // same key and IV, but the key generation key must be encrypted under a fresh nonce
+    const QByteArray &cipher2 = Crypter::encode(key, IV, salt, KGK, data, true, Q_NULLPTR, Q_NULLPTR, Crypter::AES256GCMFormat);
+    QVERIFY(cipher2.mid(1 + Crypter::SaltSize, Crypter::GCMNonceSize) != cipher.mid(1 + Crypter::SaltSize, Crypter::GCMNonceSize));
+    QVERIFY(Crypter::decode(masterPassword, cipher2, true, KGK2) == data);
+    bool rejected = false;
+    try {
+      Crypter::decode(SecureByteArray("wrong password"), cipher, true, KGK2);
+    }
+    catch (CryptoPP::HashVerificationFilter::HashVerificationFailed &) {
+      rejected = true;
+    }
+    QVERIFY(rejected);
+    cipher[cipher.size() - Crypter::GCMTagSize - 1] = cipher.at(cipher.size() - Crypter::GCMTagSize - 1) ^ 1;
+    rejected = false;
+    try {
+      Crypter::decode(masterPassword, cipher, true, KGK2);
+    }
+    catch (CryptoPP::HashVerificationFilter::HashVerificationFailed &) {
+      rejected = true;
+    }
+    QVERIFY(rejected);
+  }
+
+  void crypter_gcm_segments(void)
+  {
+    const SecureByteArray masterPassword("reallysafe");
+    const QByteArray &salt = Crypter::generateSalt();
+    SecureByteArray key;
+    SecureByteArray IV;
+    Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+    const SecureByteArray &KGK = Crypter::generateKGK();
+    const int headerSize = 1 + Crypter::SaltSize + Crypter::GCMNonceSize + Crypter::SaltSize + Crypter::AESBlockSize + Crypter::KGKSize + Crypter::GCMTagSize;
+    const int segmentSize = 64 * 1024;
+    const int segmentCipherSize = segmentSize + Crypter::GCMTagSize;
+    SecureByteArray KGK2;
+    const QByteArray &data = Crypter::randomBytes(3 * segmentSize + 100);
+    const QByteArray &cipher = Crypter::encode(key, IV, salt, KGK, data, false, Q_NULLPTR, Q_NULLPTR, Crypter::AES256GCMFormat);
+    QVERIFY(cipher.size() == headerSize + data.size() + 4 * Crypter::GCMTagSize);
+    QVERIFY(Crypter::decode(masterPassword, cipher, false, KGK2) == data);
+    const QByteArray &even = data.left(2 * segmentSize);
+    const QByteArray &evenCipher = Crypter::encode(key, IV, salt, KGK, even, false, Q_NULLPTR, Q_NULLPTR, Crypter::AES256GCMFormat);
+    QVERIFY(evenCipher.size() == headerSize + even.size() + 2 * Crypter::GCMTagSize);
+    QVERIFY(Crypter::decode(masterPassword, evenCipher, false, KGK2) == even);
+    // dropping the last segment, swapping two segments or flipping a bit must all be detected
+    QVERIFY(decodingFails(masterPassword, cipher.left(headerSize + 3 * segmentCipherSize)));
+    QVERIFY(decodingFails(masterPassword, evenCipher.left(headerSize + segmentCipherSize)));
+    const QByteArray &swapped = cipher.left(headerSize) + cipher.mid(headerSize + segmentCipherSize, segmentCipherSize)
+        + cipher.mid(headerSize, segmentCipherSize) + cipher.mid(headerSize + 2 * segmentCipherSize);
+    QVERIFY(decodingFails(masterPassword, swapped));
+    QByteArray tampered = cipher;
+    tampered[headerSize + 10] = tampered.at(headerSize + 10) ^ 1;
+    QVERIFY(decodingFails(masterPassword, tampered));
+  }
+
+  void crypter_key_manager(void)
+  {
+    const SecureByteArray masterPassword("reallysafe");
+    const SecureByteArray &KGK = Crypter::generateKGK();
+    KeyManager keyManager;
+    keyManager.prime(masterPassword, KGK);
+    keyManager.waitForDone();
+    QVERIFY(keyManager.availableSaltKeyIVs() == keyManager.poolSize());
+    QVERIFY(keyManager.availableBlobKeys() == keyManager.poolSize());
+    const KeyManager::SaltKeyIV &t = keyManager.takeSaltKeyIV(masterPassword);
+    SecureByteArray key;
+    SecureByteArray IV;
+    Crypter::makeKeyAndIVFromPassword(masterPassword, t.salt, key, IV);
+    QVERIFY(t.key == key);
+    QVERIFY(t.IV == IV);
+    const QByteArray data = Crypter::randomBytes(1024);
+    const QByteArray &cipher = Crypter::encode(t.key, t.IV, t.salt, KGK, data, true, Q_NULLPTR, &keyManager);
+    SecureByteArray KGK2;
+    QVERIFY(Crypter::decode(masterPassword, cipher, true, KGK2) == data);
+    QVERIFY(KGK == KGK2);
+    const quint64 misses = keyManager.misses();
+    QVERIFY(Crypter::decode(masterPassword, cipher, true, KGK2, Q_NULLPTR, &keyManager) == data);
+    QVERIFY(keyManager.misses() == misses);
+    QVERIFY(keyManager.hits() == 2);
+    keyManager.clear();
+    keyManager.waitForDone();
+    QVERIFY(keyManager.availableSaltKeyIVs() == 0);
+    QVERIFY(keyManager.availableBlobKeys() == 0);
+  }
+
+  void domain_settings_list(void)
+  {
+    DomainSettingsList domains;
+    for (int i = 0; i < 10; ++i) {
+      DomainSettings ds;
+      ds.domainName = QString("domain-%1").arg(i);
+      ds.userName = QString("user%1").arg(i);
+      domains << ds;
+    }
+    QVERIFY(domains.count() == 10);
+    QVERIFY(!domains.isDirty());
+    const DomainSettings &last = domains.at("domain-9");
+    QVERIFY(last.userName == "user9");
+    QVERIFY(domains.at("unknown").isEmpty());
+    DomainSettings changed = domains.at(3);
+    changed.userName = "changed";
+    domains.updateWith(changed);
+    QVERIFY(domains.count() == 10);
+    QVERIFY(domains.isDirty());
+    QVERIFY(domains.at("domain-3").userName == "changed");
+    domains.remove("domain-0");
+    QVERIFY(domains.count() == 9);
+    QVERIFY(!domains.contains("domain-0"));
+    QVERIFY(last.userName == "user9");
+    QVERIFY(&domains.at("domain-9") == &last);
+    for (int i = 0; i < domains.count(); ++i) {
+      QVERIFY(domains.indexOf(domains.at(i).domainName) == i);
+      QVERIFY(domains.at(i).domainName == QString("domain-%1").arg(i + 1));
+    }
+    DomainSettingsList restored = DomainSettingsList::fromJson(domains.toJson());
+    QVERIFY(restored.count() == domains.count());
+    foreach (DomainSettings ds, domains) {
+      QVERIFY(restored.at(ds.domainName).userName == ds.userName);
+    }
+    DomainSettings duplicate = domains.at("domain-5");
+    duplicate.userName = "duplicate";
+    domains.append(duplicate);
+    QVERIFY(domains.count() == 10);
+    QVERIFY(domains.indexOf("domain-5") == 4);
+    QVERIFY(domains.last().userName == "duplicate");
+    QVERIFY(DomainSettingsList::fromJson(domains.toJson()).at("domain-5").userName == "duplicate");
+    domains.remove("domain-5");
+    QVERIFY(domains.indexOf("domain-5") == 8);
+    QVERIFY(domains.at(4).domainName == "domain-6");
+    domains[0].domainName = "renamed";
+    QVERIFY(domains.indexOf("renamed") == 0);
+    QVERIFY(!domains.contains("domain-1"));
+    domains.removeAt(0);
+    QVERIFY(domains.first().domainName == "domain-2");
+    QVERIFY(domains.indexOf("domain-9") == 6);
+  }
+
+  void domain_settings_json(void)
+  {
+    DomainSettingsList domains;
+    DomainSettings generated;
+    generated.domainName = "z\u00fcrich.example";
+    generated.userName = "\"quoted\" \\ back/slash\ttab\nline\x01";
+    generated.url = "https://example.com/?q=\u20ac\U0001F511";
+    generated.notes = "notes";
+    generated.createdDate = QDateTime::fromString("2015-09-01T10:00:00", Qt::ISODate);
+    generated.modifiedDate = QDateTime::fromString("2015-09-02T11:30:00", Qt::ISODate);
+    generated.expiryDate = QDateTime::fromString("2016-01-01T00:00:00", Qt::ISODate);
+    generated.tags << "a" << "b";
+    generated.groupHierarchy = "work";
+    generated.passwordTemplate = "xxxxxxxx";
+    generated.extraCharacters = "#!";
+    generated.files["key.pem"] = QVariantMap();
+    domains << generated;
+    DomainSettings legacy;
+    legacy.domainName = "Alpha";
+    legacy.legacyPassword = "secret";
+    domains << legacy;
+    DomainSettings deleted;
+    deleted.domainName = "beta";
+    deleted.deleted = true;
+    domains << deleted;
+    const QByteArray &json = domains.toJson();
+    QVERIFY(json == domains.toJsonDocument().toJson(QJsonDocument::Compact));
+    QVERIFY(DomainSettingsList().toJson() == "{}");
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(domains.toJson(&buffer));
+    QVERIFY(buffer.data() == json);
+    buffer.seek(0);
+    QJsonParseError parseError;
+    const DomainSettingsList &restored = DomainSettingsList::fromJson(&buffer, &parseError);
+    QVERIFY(parseError.error == QJsonParseError::NoError);
+    const DomainSettingsList &expected = DomainSettingsList::fromQJsonDocument(QJsonDocument::fromJson(json));
+    QVERIFY(restored.count() == expected.count());
+    foreach (DomainSettings ds, expected) {
+      QVERIFY(restored.at(ds.domainName).toVariantMap() == ds.toVariantMap());
+    }
+    QVERIFY(DomainSettingsList::fromJson(json.left(json.size() - 1), &parseError).isEmpty());
+    QVERIFY(parseError.error != QJsonParseError::NoError);
+    QVERIFY(DomainSettingsList::fromJson(json + "x", &parseError).isEmpty());
+    QVERIFY(parseError.error == QJsonParseError::GarbageAtEnd);
+  }
+
+  void domain_settings_binary(void)
+  {
+    DomainSettingsList domains;
+    for (int i = 0; i < 50; ++i) {
+      DomainSettings ds;
+      ds.domainName = QString("d\u00f6main%1.example").arg(i);
+      ds.userName = "ola";
+      ds.groupHierarchy = "work";
+      ds.passwordTemplate = "xxxxxxxxxxxxxxxx";
+      ds.tags << "shop" << QString("tag%1").arg(i % 3);
+      ds.createdDate = QDateTime::fromString("2015-09-01T10:00:00", Qt::ISODate);
+      ds.modifiedDate = ds.createdDate.addSecs(i);
+      ds.salt_base64 = QString::fromLatin1(Crypter::generateSalt().toBase64());
+      ds.deleted = (i % 10) == 9;
+      if (i % 7 == 0) {
+        ds.legacyPassword = "legacy";
+      }
+      domains << ds;
+    }
+    DomainSettings odd;
+    odd.domainName = "odd";
+    odd.salt_base64 = "not base64!";
+    odd.expiryDate = QDateTime::fromString("2016-01-01T00:00:00", Qt::ISODate);
+    odd.files["key.pem"] = QString("data");
+    domains << odd;
+    DomainSettings precise;
+    precise.domainName = "precise";
+    precise.createdDate = QDateTime::fromMSecsSinceEpoch(Q_INT64_C(1441101600123));
+    precise.modifiedDate = precise.createdDate.addMSecs(456);
+    domains << precise;
+    const QByteArray &binary = domains.toBinary();
+    QVERIFY(binary.size() < domains.toJson().size() / 2);
+    bool ok = false;
+    const DomainSettingsList &restored = DomainSettingsList::fromBinary(binary, &ok);
+    QVERIFY(ok);
+    const DomainSettingsList &expected = DomainSettingsList::fromJson(domains.toJson());
+    QVERIFY(restored.count() == expected.count());
+    foreach (DomainSettings ds, expected) {
+      QVERIFY(restored.at(ds.domainName).toVariantMap() == ds.toVariantMap());
+    }
+    QVERIFY(restored.at("precise").modifiedDate == expected.at("precise").modifiedDate);
+    QVERIFY(DomainSettings::storedDateTime(restored.at("precise").modifiedDate) == DomainSettings::storedDateTime(precise.modifiedDate));
+    QVERIFY(restored.toBinary() == binary);
+    // the in-memory copy with milliseconds is the same revision as the one a peer got
+    QVERIFY(SyncMerger().merge(domains, expected, expected).isEmpty());
+    QVERIFY(DomainSettingsList::fromBinary(binary.left(binary.size() - 1), &ok).isEmpty());
+    QVERIFY(!ok);
+    QByteArray otherVersion = binary;
+    otherVersion[0] = char(DomainSettingsList::BinaryVersion + 1);
+    QVERIFY(DomainSettingsList::fromBinary(otherVersion, &ok).isEmpty());
+    QVERIFY(!ok);
+  }
+
+  void sync_merger(void)
+  {
+    const QDateTime &t0 = QDateTime::fromMSecsSinceEpoch(Q_INT64_C(1450000000000));
+    DomainSettingsList base;
+    for (int i = 0; i < 5; ++i) {
+      DomainSettings ds;
+      ds.domainName = QString("domain-%1").arg(i);
+      ds.modifiedDate = t0;
+      base << ds;
+    }
+    DomainSettingsList local = base;
+    DomainSettingsList remote = base;
+    DomainSettings ds = base.at("domain-0");
+    ds.modifiedDate = t0.addSecs(10);
+    remote.updateWith(ds);
+    ds = base.at("domain-1");
+    ds.modifiedDate = t0.addSecs(-10);
+    local.updateWith(ds);
+    ds = base.at("domain-2");
+    ds.modifiedDate = t0.addSecs(20);
+    local.updateWith(ds);
+    ds.modifiedDate = t0.addSecs(30);
+    remote.updateWith(ds);
+    ds = base.at("domain-3");
+    ds.deleted = true;
+    local.updateWith(ds);
+    remote.remove("domain-3");
+    ds = base.at("domain-4");
+    ds.domainName = "domain-5";
+    local.updateWith(ds);
+
+    SyncMerger merger;
+    SyncMerger::ChangeSet changes = merger.merge(local, remote, base);
+    QVERIFY(changes.toLocal.count() == 2);
+    QVERIFY(changes.removeFromLocal == QStringList() << "domain-3");
+    QVERIFY(changes.toRemote.count() == 2);
+    QVERIFY(changes.conflicts.count() == 1);
+    QVERIFY(changes.conflicts.first().local.domainName == "domain-2");
+    QVERIFY(!changes.conflicts.first().localWins);
+    QVERIFY(changes.renames.isEmpty());
+    SyncMerger::apply(changes, local, remote);
+    QVERIFY(local.count() == remote.count());
+    foreach (DomainSettings synced, local) {
+      QVERIFY(remote.at(synced.domainName).modifiedDate == synced.modifiedDate);
+    }
+    QVERIFY(local.at("domain-1").modifiedDate == t0.addSecs(-10));
+    QVERIFY(merger.merge(local, remote, remote).isEmpty());
+
+    ds = local.at("domain-4");
+    ds.modifiedDate = t0.addSecs(60);
+    local.updateWith(ds);
+    merger.setKeepBoth(true);
+    changes = merger.merge(local, remote);
+    QVERIFY(changes.renames.count() == 1);
+    QVERIFY(changes.renames.first().to == "domain-4 (1)");
+    SyncMerger::apply(changes, local, remote);
+    QVERIFY(local.at("domain-4").modifiedDate == t0);
+    QVERIFY(remote.at("domain-4 (1)").modifiedDate == t0.addSecs(60));
+
+    // a second peer that has missed the last sync must not roll the local records back
+    merger.setKeepBoth(false);
+    const DomainSettingsList synced = local;
+    DomainSettingsList stale = local;
+    ds = local.at("domain-0");
+    ds.modifiedDate = ds.modifiedDate.addSecs(-3600);
+    stale.updateWith(ds);
+    changes = merger.merge(local, stale, synced);
+    QVERIFY(changes.toLocal.isEmpty());
+    QVERIFY(changes.conflicts.isEmpty());
+    QVERIFY(changes.toRemote.count() == 1);
+    QVERIFY(changes.toRemote.first().domainName == "domain-0");
+    SyncMerger::apply(changes, local, stale);
+    QVERIFY(merger.merge(local, synced, synced).isEmpty());
+    QVERIFY(merger.merge(local, stale, stale).isEmpty());
+  }
+
+  void segmented_vault(void)
+  {
+    const SecureByteArray &KGK = Crypter::generateKGK();
+    DomainSettingsList domains;
+    for (int i = 0; i < 200; ++i) {
+      DomainSettings ds;
+      ds.domainName = QString("domain%1.example.com").arg(i);
+      ds.userName = "ola";
+      ds.notes = QString(i, QChar('x'));
+      domains.append(ds);
+    }
+    SegmentedVault vault(16);
+    QVERIFY(vault.seal(domains, KGK).count() == vault.bucketCount());
+    QVERIFY(vault.seal(domains, KGK).isEmpty());
+    DomainSettings changed = domains.at(42);
+    changed.notes = "changed";
+    domains.updateWith(changed);
+    const QList<int> &dirty = vault.seal(domains, KGK);
+    QVERIFY(dirty.count() == 1);
+    QVERIFY(dirty.first() == vault.bucketOf(changed.domainName));
+    QVector<QByteArray> buckets;
+    for (int i = 0; i < vault.bucketCount(); ++i) {
+      buckets << vault.bucket(i);
+    }
+    SegmentedVault vault2(16);
+    DomainSettingsList restored;
+    QVERIFY(vault2.open(vault.manifest(), buckets, KGK, restored));
+    QVERIFY(restored.count() == domains.count());
+    QVERIFY(restored.at(changed.domainName).notes == "changed");
+    QVERIFY(vault2.seal(restored, KGK).isEmpty());
+    const QVector<QByteArray> &digests = SegmentedVault::bucketDigests(vault.manifest());
+    QVERIFY(digests.size() == vault.bucketCount());
+    for (int i = 0; i < digests.size(); ++i) {
+      QVERIFY(digests.at(i) == vault.bucketDigest(i));
+      QVERIFY(digests.at(i).isEmpty() == buckets.at(i).isEmpty());
+    }
+    QVERIFY(SegmentedVault::bucketDigests("{}").isEmpty());
+    QVERIFY(!vault2.open(vault.manifest(), buckets, Crypter::generateKGK(), restored));
+    const int idx = dirty.first();
+    buckets[idx][buckets.at(idx).size() - 1] = buckets.at(idx).at(buckets.at(idx).size() - 1) ^ 1;
+    QVERIFY(!vault2.open(vault.manifest(), buckets, KGK, restored));
+    vault.setFormat(Crypter::AES256GCMSegmentedBinaryFormat);
+    QVERIFY(vault.seal(domains, KGK).count() == vault.bucketCount());
+    buckets.clear();
+    for (int i = 0; i < vault.bucketCount(); ++i) {
+      buckets << vault.bucket(i);
+    }
+    vault2.setFormat(Crypter::AES256GCMSegmentedBinaryFormat);
+    QVERIFY(vault2.open(vault.manifest(), buckets, KGK, restored));
+    QVERIFY(restored.count() == domains.count());
+    QVERIFY(restored.at(changed.domainName).notes == "changed");
+    vault2.setFormat(Crypter::AES256GCMSegmentedFormat);
+    QVERIFY(!vault2.open(vault.manifest(), buckets, KGK, restored));
+  }
+
   void export_import(void)
   {
     QString filename = QDir::tempPath() + "/qt-sesam-unit-test.pem";
@@ -0,0 +1,214 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "cpufeatures.h"
+
+#if defined(SESAM_X86)
+
+#include <immintrin.h>
+
+#include "cryptlib.h"
+
+
+namespace {
+
+// number of blocks kept in flight; AESENC/AESDEC have a latency of several
+// cycles but a throughput of one per cycle
+const int Lanes = 8;
+
+
+SESAM_TARGET("aes,sse2")
+inline __m128i expandStep(__m128i k, __m128i assist)
+{
+  k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+  k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+  k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+  return _mm_xor_si128(k, assist);
+}
+
+
+SESAM_TARGET("aes,sse2")
+inline void encryptBlocks(__m128i *blocks, int n, const __m128i *rk)
+{
+  for (int b = 0; b < n; ++b)
+    blocks[b] = _mm_xor_si128(blocks[b], rk[0]);
+  for (int r = 1; r < 14; ++r) {
+    for (int b = 0; b < n; ++b)
+      blocks[b] = _mm_aesenc_si128(blocks[b], rk[r]);
+  }
+  for (int b = 0; b < n; ++b)
+    blocks[b] = _mm_aesenclast_si128(blocks[b], rk[14]);
+}
+
+
+SESAM_TARGET("aes,sse2")
+inline void decryptBlocks(__m128i *blocks, int n, const __m128i *rk)
+{
+  for (int b = 0; b < n; ++b)
+    blocks[b] = _mm_xor_si128(blocks[b], rk[0]);
+  for (int r = 1; r < 14; ++r) {
+    for (int b = 0; b < n; ++b)
+      blocks[b] = _mm_aesdec_si128(blocks[b], rk[r]);
+  }
+  for (int b = 0; b < n; ++b)
+    blocks[b] = _mm_aesdeclast_si128(blocks[b], rk[14]);
+}
+
+
+// Same semantics as `CryptoPP::BlockTransformation::AdvancedProcessBlocks()`,
+// modelled after the AES-NI code path of Crypto++'s Rijndael.
+template <bool Encrypt>
+SESAM_TARGET("aes,sse2")
+size_t processBlocks(const quint8 *roundKeys, const quint8 *inBlocks, const quint8 *xorBlocks, quint8 *outBlocks, size_t length, quint32 flags)
+{
+  typedef CryptoPP::BlockTransformation BT;
+  static const size_t BlockSize = 16;
+  const __m128i *rk = reinterpret_cast<const __m128i*>(roundKeys);
+  const bool counter = (flags & BT::BT_InBlockIsCounter) != 0;
+  const bool xorInput = (flags & BT::BT_XorInput) != 0;
+  ptrdiff_t inIncrement = (flags & (BT::BT_InBlockIsCounter | BT::BT_DontIncrementInOutPointers)) ? 0 : BlockSize;
+  ptrdiff_t xorIncrement = xorBlocks ? BlockSize : 0;
+  ptrdiff_t outIncrement = (flags & BT::BT_DontIncrementInOutPointers) ? 0 : BlockSize;
+  if ((flags & BT::BT_ReverseDirection) && length >= BlockSize) {
+    const size_t last = length - length % BlockSize - BlockSize;
+    inBlocks += inIncrement ? last : 0;
+    xorBlocks += xorIncrement ? last : 0;
+    outBlocks += outIncrement ? last : 0;
+    inIncrement = -inIncrement;
+    xorIncrement = -xorIncrement;
+    outIncrement = -outIncrement;
+  }
+
+  __m128i blocks[Lanes];
+  const __m128i one = _mm_set_epi32(1 << 24, 0, 0, 0);
+  while ((flags & BT::BT_AllowParallel) && length >= Lanes * BlockSize) {
+    blocks[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inBlocks));
+    for (int b = 1; b < Lanes; ++b) {
+      if (counter) {
+        // the caller guarantees that the last counter byte does not wrap
+        blocks[b] = _mm_add_epi32(blocks[b - 1], one);
+      }
+      else {
+        inBlocks += inIncrement;
+        blocks[b] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inBlocks));
+      }
+    }
+    if (counter) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(const_cast<quint8*>(inBlocks)), _mm_add_epi32(blocks[Lanes - 1], one));
+    }
+    else {
+      inBlocks += inIncrement;
+    }
+    if (xorInput) {
+      for (int b = 0; b < Lanes; ++b) {
+        blocks[b] = _mm_xor_si128(blocks[b], _mm_loadu_si128(reinterpret_cast<const __m128i*>(xorBlocks)));
+        xorBlocks += xorIncrement;
+      }
+    }
+    if (Encrypt)
+      encryptBlocks(blocks, Lanes, rk);
+    else
+      decryptBlocks(blocks, Lanes, rk);
+    if (xorBlocks != Q_NULLPTR && !xorInput) {
+      for (int b = 0; b < Lanes; ++b) {
+        blocks[b] = _mm_xor_si128(blocks[b], _mm_loadu_si128(reinterpret_cast<const __m128i*>(xorBlocks)));
+        xorBlocks += xorIncrement;
+      }
+    }
+    for (int b = 0; b < Lanes; ++b) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(outBlocks), blocks[b]);
+      outBlocks += outIncrement;
+    }
+    length -= Lanes * BlockSize;
+  }
+
+  while (length >= BlockSize) {
+    blocks[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inBlocks));
+    if (xorInput)
+      blocks[0] = _mm_xor_si128(blocks[0], _mm_loadu_si128(reinterpret_cast<const __m128i*>(xorBlocks)));
+    if (counter)
+      const_cast<quint8*>(inBlocks)[BlockSize - 1]++;
+    if (Encrypt)
+      encryptBlocks(blocks, 1, rk);
+    else
+      decryptBlocks(blocks, 1, rk);
+    if (xorBlocks != Q_NULLPTR && !xorInput)
+      blocks[0] = _mm_xor_si128(blocks[0], _mm_loadu_si128(reinterpret_cast<const __m128i*>(xorBlocks)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(outBlocks), blocks[0]);
+    inBlocks += inIncrement;
+    xorBlocks += xorIncrement;
+    outBlocks += outIncrement;
+    length -= BlockSize;
+  }
+  return length;
+}
+
+}
+
+
+// AES-256 key schedule (15 round keys). If `decKeys` is given, it receives the
+// schedule for the equivalent inverse cipher used by AESDEC.
+SESAM_TARGET("aes,sse2")
+void aes256ExpandKeyAESNI(const quint8 *key, quint8 *encKeys, quint8 *decKeys)
+{
+  __m128i rk[15];
+  rk[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+  rk[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+#define SESAM_AES256_EVEN(i, rcon) \
+  rk[i] = expandStep(rk[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i - 1], rcon), 0xff));
+#define SESAM_AES256_ODD(i) \
+  rk[i] = expandStep(rk[i - 2], _mm_shuffle_epi32(_mm_aeskeygenassist_si128(rk[i - 1], 0x00), 0xaa));
+  SESAM_AES256_EVEN(2, 0x01) SESAM_AES256_ODD(3)
+  SESAM_AES256_EVEN(4, 0x02) SESAM_AES256_ODD(5)
+  SESAM_AES256_EVEN(6, 0x04) SESAM_AES256_ODD(7)
+  SESAM_AES256_EVEN(8, 0x08) SESAM_AES256_ODD(9)
+  SESAM_AES256_EVEN(10, 0x10) SESAM_AES256_ODD(11)
+  SESAM_AES256_EVEN(12, 0x20) SESAM_AES256_ODD(13)
+  SESAM_AES256_EVEN(14, 0x40)
+#undef SESAM_AES256_ODD
+#undef SESAM_AES256_EVEN
+  for (int i = 0; i < 15; ++i) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(encKeys) + i, rk[i]);
+  }
+  if (decKeys != Q_NULLPTR) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(decKeys), rk[14]);
+    for (int i = 1; i < 14; ++i) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(decKeys) + i, _mm_aesimc_si128(rk[14 - i]));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(decKeys) + 14, rk[0]);
+  }
+  volatile quint8 *wipe = reinterpret_cast<volatile quint8*>(rk);
+  for (size_t i = 0; i < sizeof(rk); ++i) {
+    wipe[i] = 0;
+  }
+}
+
+
+size_t aes256EncryptBlocksAESNI(const quint8 *roundKeys, const quint8 *inBlocks, const quint8 *xorBlocks, quint8 *outBlocks, size_t length, quint32 flags)
+{
+  return processBlocks<true>(roundKeys, inBlocks, xorBlocks, outBlocks, length, flags);
+}
+
+
+size_t aes256DecryptBlocksAESNI(const quint8 *roundKeys, const quint8 *inBlocks, const quint8 *xorBlocks, quint8 *outBlocks, size_t length, quint32 flags)
+{
+  return processBlocks<false>(roundKeys, inBlocks, xorBlocks, outBlocks, length, flags);
+}
+
+#endif
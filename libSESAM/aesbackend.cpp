@@ -0,0 +1,351 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+
+#include <QThread>
+#include <QVector>
+#include <QtConcurrent>
+
+#include "aesbackend.h"
+#include "cpufeatures.h"
+#include "modes.h"
+
+#if defined(SESAM_X86)
+extern void aes256ExpandKeyAESNI(const quint8 *key, quint8 *encKeys, quint8 *decKeys);
+extern size_t aes256EncryptBlocksAESNI(const quint8 *roundKeys, const quint8 *inBlocks, const quint8 *xorBlocks, quint8 *outBlocks, size_t length, quint32 flags);
+extern size_t aes256DecryptBlocksAESNI(const quint8 *roundKeys, const quint8 *inBlocks, const quint8 *xorBlocks, quint8 *outBlocks, size_t length, quint32 flags);
+#endif
+
+
+namespace {
+
+const int BlockSize = AESBackend::BLOCKSIZE;
+
+// FIPS-197, appendix C.3
+const byte FIPSKey[32] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+const byte FIPSPlain[16] = {
+  0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+const byte FIPSCipher[16] = {
+  0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89
+};
+
+
+void fillPseudoRandom(byte *buf, size_t size, quint64 seed)
+{
+  quint64 x = Q_UINT64_C(0x9e3779b97f4a7c15) ^ seed;
+  for (size_t i = 0; i < size; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    buf[i] = byte(x);
+  }
+}
+
+
+#if defined(SESAM_X86)
+// checks the AES-NI kernels against the FIPS-197 vector and against CryptoPP::AES
+bool aesniAgrees(void)
+{
+  CryptoPP::FixedSizeAlignedSecBlock<byte, 15 * 16> encKeys;
+  CryptoPP::FixedSizeAlignedSecBlock<byte, 15 * 16> decKeys;
+  byte out[16];
+  aes256ExpandKeyAESNI(FIPSKey, encKeys, decKeys);
+  aes256EncryptBlocksAESNI(encKeys, FIPSPlain, Q_NULLPTR, out, sizeof(out), 0);
+  if (memcmp(out, FIPSCipher, sizeof(out)) != 0)
+    return false;
+  aes256DecryptBlocksAESNI(decKeys, FIPSCipher, Q_NULLPTR, out, sizeof(out), 0);
+  if (memcmp(out, FIPSPlain, sizeof(out)) != 0)
+    return false;
+  static const int N = 21 * 16;
+  byte key[32];
+  byte in[N];
+  byte expected[N];
+  byte actual[N];
+  fillPseudoRandom(key, sizeof(key), 1);
+  fillPseudoRandom(in, sizeof(in), 2);
+  aes256ExpandKeyAESNI(key, encKeys, decKeys);
+  CryptoPP::AES::Encryption enc(key, sizeof(key));
+  CryptoPP::AES::Decryption dec(key, sizeof(key));
+  enc.AdvancedProcessBlocks(in, Q_NULLPTR, expected, N, 0);
+  aes256EncryptBlocksAESNI(encKeys, in, Q_NULLPTR, actual, N, CryptoPP::BlockTransformation::BT_AllowParallel);
+  if (memcmp(actual, expected, N) != 0)
+    return false;
+  dec.AdvancedProcessBlocks(in, Q_NULLPTR, expected, N, 0);
+  aes256DecryptBlocksAESNI(decKeys, in, Q_NULLPTR, actual, N, CryptoPP::BlockTransformation::BT_AllowParallel);
+  return memcmp(actual, expected, N) == 0;
+}
+#endif
+
+
+struct Backend {
+  bool accelerated;
+  const char *name;
+};
+
+
+Backend select(void)
+{
+#if defined(SESAM_X86)
+  if (CPUFeatures::hasAESNI() && CPUFeatures::hasSSE2() && aesniAgrees()) {
+    Backend backend = { true, "AES-NI" };
+    return backend;
+  }
+#endif
+  Backend backend = { false, "portable" };
+  return backend;
+}
+
+
+const Backend &backend(void)
+{
+  static const Backend backend = select();
+  return backend;
+}
+
+
+struct CBCChunk {
+  const byte *IV;
+  const byte *cipher;
+  byte *plain;
+  size_t length;
+};
+
+
+class CBCChunkDecryptor
+{
+public:
+  typedef void result_type;
+  CBCChunkDecryptor(const AESBackend::Decryption &dec)
+    : dec(dec)
+  { /* ... */ }
+  void operator()(const CBCChunk &chunk) const
+  {
+    // every cipher block is the IV of its successor, so a chunk only depends on the block before it
+    dec.ProcessAndXorBlock(chunk.cipher, chunk.IV, chunk.plain);
+    dec.AdvancedProcessBlocks(chunk.cipher + BlockSize, chunk.cipher, chunk.plain + BlockSize, chunk.length - BlockSize, CryptoPP::BlockTransformation::BT_AllowParallel);
+  }
+
+private:
+  const AESBackend::Decryption &dec;
+};
+
+}
+
+
+void AESBackend::Enc::UncheckedSetKey(const byte *key, unsigned int length, const CryptoPP::NameValuePairs &params)
+{
+#if defined(SESAM_X86)
+  accelerated = length == 32 && backend().accelerated;
+  if (accelerated) {
+    aes256ExpandKeyAESNI(key, roundKeys, Q_NULLPTR);
+    return;
+  }
+#endif
+  fallback.SetKey(key, length, params);
+}
+
+
+void AESBackend::Enc::ProcessAndXorBlock(const byte *inBlock, const byte *xorBlock, byte *outBlock) const
+{
+#if defined(SESAM_X86)
+  if (accelerated) {
+    aes256EncryptBlocksAESNI(roundKeys, inBlock, xorBlock, outBlock, BLOCKSIZE, 0);
+    return;
+  }
+#endif
+  fallback.ProcessAndXorBlock(inBlock, xorBlock, outBlock);
+}
+
+
+size_t AESBackend::Enc::AdvancedProcessBlocks(const byte *inBlocks, const byte *xorBlocks, byte *outBlocks, size_t length, CryptoPP::word32 flags) const
+{
+#if defined(SESAM_X86)
+  if (accelerated)
+    return aes256EncryptBlocksAESNI(roundKeys, inBlocks, xorBlocks, outBlocks, length, flags);
+#endif
+  return fallback.AdvancedProcessBlocks(inBlocks, xorBlocks, outBlocks, length, flags);
+}
+
+
+void AESBackend::Dec::UncheckedSetKey(const byte *key, unsigned int length, const CryptoPP::NameValuePairs &params)
+{
+#if defined(SESAM_X86)
+  accelerated = length == 32 && backend().accelerated;
+  if (accelerated) {
+    CryptoPP::FixedSizeAlignedSecBlock<byte, 15 * 16> encKeys;
+    aes256ExpandKeyAESNI(key, encKeys, roundKeys);
+    return;
+  }
+#endif
+  fallback.SetKey(key, length, params);
+}
+
+
+void AESBackend::Dec::ProcessAndXorBlock(const byte *inBlock, const byte *xorBlock, byte *outBlock) const
+{
+#if defined(SESAM_X86)
+  if (accelerated) {
+    aes256DecryptBlocksAESNI(roundKeys, inBlock, xorBlock, outBlock, BLOCKSIZE, 0);
+    return;
+  }
+#endif
+  fallback.ProcessAndXorBlock(inBlock, xorBlock, outBlock);
+}
+
+
+size_t AESBackend::Dec::AdvancedProcessBlocks(const byte *inBlocks, const byte *xorBlocks, byte *outBlocks, size_t length, CryptoPP::word32 flags) const
+{
+#if defined(SESAM_X86)
+  if (accelerated)
+    return aes256DecryptBlocksAESNI(roundKeys, inBlocks, xorBlocks, outBlocks, length, flags);
+#endif
+  return fallback.AdvancedProcessBlocks(inBlocks, xorBlocks, outBlocks, length, flags);
+}
+
+
+const int AESBackend::ParallelThreshold = 1024 * 1024;
+const int AESBackend::MinChunkSize = 256 * 1024;
+
+
+bool AESBackend::isAccelerated(void)
+{
+  return backend().accelerated;
+}
+
+
+const char *AESBackend::name(void)
+{
+  return backend().name;
+}
+
+
+QString AESBackend::description(void)
+{
+  return QString("AES: %1").arg(name());
+}
+
+
+/*!
+ * \brief AESBackend::decryptCBC
+ *
+ * AES-CBC decrypts `length` bytes from `cipher` to `plain` without touching the padding.
+ *
+ * Unlike CBC encryption, CBC decryption has no dependency between blocks other than
+ * the preceding cipher block. Inputs of at least `ParallelThreshold` bytes are therefore
+ * split into chunks of at least `MinChunkSize` bytes which are decrypted on the global
+ * thread pool.
+ *
+ * \param dec A keyed decryption object.
+ * \param IV The initialization vector (`AESBackend::BLOCKSIZE` bytes).
+ * \param cipher The cipher text; `length` must be a multiple of `AESBackend::BLOCKSIZE`.
+ * \param plain The destination buffer; must not overlap `cipher`.
+ * \param length The number of bytes to decrypt.
+ */
+void AESBackend::decryptCBC(const Decryption &dec, const byte *IV, const byte *cipher, byte *plain, size_t length)
+{
+  Q_ASSERT_X(length % BLOCKSIZE == 0, "AESBackend::decryptCBC()", "length must be a multiple of the block size");
+  if (length == 0)
+    return;
+  const size_t blocks = length / BLOCKSIZE;
+  const int threads = QThread::idealThreadCount();
+  size_t chunkBlocks = blocks;
+  if (length >= size_t(ParallelThreshold) && threads > 1) {
+    chunkBlocks = qMax(size_t(MinChunkSize / BLOCKSIZE), (blocks + threads - 1) / threads);
+  }
+  QVector<CBCChunk> chunks;
+  for (size_t first = 0; first < blocks; first += chunkBlocks) {
+    const size_t offset = first * BLOCKSIZE;
+    CBCChunk chunk = {
+      first == 0 ? IV : cipher + offset - BLOCKSIZE,
+      cipher + offset,
+      plain + offset,
+      qMin(chunkBlocks, blocks - first) * BLOCKSIZE
+    };
+    chunks.append(chunk);
+  }
+  const CBCChunkDecryptor decryptor(dec);
+  if (chunks.size() == 1) {
+    decryptor(chunks.first());
+  }
+  else {
+    QtConcurrent::blockingMap(chunks, decryptor);
+  }
+}
+
+
+/*!
+ * \brief AESBackend::selfTest
+ *
+ * Checks the selected implementation against the FIPS-197 test vector and compares
+ * CBC, CTR (on which GCM is built) and the chunked CBC decryption with `CryptoPP::AES`
+ * on a buffer large enough to be decrypted in parallel.
+ *
+ * \return `true` if all results match
+ */
+bool AESBackend::selfTest(void)
+{
+  byte block[16];
+  Encryption enc(FIPSKey, sizeof(FIPSKey));
+  enc.ProcessBlock(FIPSPlain, block);
+  if (memcmp(block, FIPSCipher, sizeof(block)) != 0)
+    return false;
+  Decryption dec(FIPSKey, sizeof(FIPSKey));
+  dec.ProcessBlock(FIPSCipher, block);
+  if (memcmp(block, FIPSPlain, sizeof(block)) != 0)
+    return false;
+
+  const size_t N = 2 * ParallelThreshold + 3 * BLOCKSIZE;
+  CryptoPP::SecByteBlock plain(N);
+  CryptoPP::SecByteBlock expected(N);
+  CryptoPP::SecByteBlock actual(N);
+  byte key[32];
+  byte IV[16];
+  fillPseudoRandom(plain, N, 3);
+  fillPseudoRandom(key, sizeof(key), 4);
+  fillPseudoRandom(IV, sizeof(IV), 5);
+  // make the CTR counter wrap around its last byte
+  IV[15] = 0xf3;
+
+  CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption cbcReference(key, sizeof(key), IV);
+  cbcReference.ProcessData(expected, plain, N);
+  CryptoPP::CBC_Mode<AESBackend>::Encryption cbcEnc(key, sizeof(key), IV);
+  cbcEnc.ProcessData(actual, plain, N);
+  if (memcmp(actual, expected, N) != 0)
+    return false;
+  CryptoPP::CBC_Mode<AESBackend>::Decryption cbcDec(key, sizeof(key), IV);
+  cbcDec.ProcessData(actual, expected, N);
+  if (memcmp(actual, plain, N) != 0)
+    return false;
+  memset(actual, 0, N);
+  dec.SetKey(key, sizeof(key));
+  decryptCBC(dec, IV, expected, actual, N);
+  if (memcmp(actual, plain, N) != 0)
+    return false;
+
+  CryptoPP::CTR_Mode<CryptoPP::AES>::Encryption ctrReference(key, sizeof(key), IV);
+  ctrReference.ProcessData(expected, plain, N);
+  CryptoPP::CTR_Mode<AESBackend>::Encryption ctr(key, sizeof(key), IV);
+  ctr.ProcessData(actual, plain, N);
+  return memcmp(actual, expected, N) == 0;
+}
@@ -0,0 +1,100 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __AESBACKEND_H_
+#define __AESBACKEND_H_
+
+#include <QtGlobal>
+#include <QString>
+
+#include "aes.h"
+#include "seckey.h"
+#include "secblock.h"
+
+
+struct AESBackend_Info : public CryptoPP::FixedBlockSize<16>, public CryptoPP::VariableKeyLength<32, 16, 32, 8>
+{
+  static const char *StaticAlgorithmName(void) { return "AES"; }
+};
+
+
+/*!
+ * \brief The AESBackend class
+ *
+ * A drop-in replacement for `CryptoPP::AES` that can be plugged into the Crypto++ modes,
+ * e.g. `CryptoPP::CBC_Mode<AESBackend>` or `CryptoPP::GCM<AESBackend>`.
+ *
+ * Crypto++ is built with its x86 assembly and intrinsics disabled (see Qt-SESAM.pri),
+ * so `CryptoPP::AES` always runs the table based implementation. If the CPU supports
+ * AES-NI and the AES-NI code agrees with `CryptoPP::AES` on a set of test vectors,
+ * 256 bit keys are processed with AES-NI instead, eight blocks at a time where the mode
+ * allows it (CBC decryption, CTR, GCM). All other cases fall back to `CryptoPP::AES`.
+ *
+ */
+class AESBackend : public AESBackend_Info, public CryptoPP::BlockCipherDocumentation
+{
+  class Base : public CryptoPP::BlockCipherImpl<AESBackend_Info>
+  {
+  public:
+    Base(void) : accelerated(false) { /* ... */ }
+    unsigned int OptimalNumberOfParallelBlocks(void) const { return accelerated ? 8 : 1; }
+
+  protected:
+    bool accelerated;
+    CryptoPP::FixedSizeAlignedSecBlock<byte, 15 * 16> roundKeys;
+  };
+
+  class Enc : public Base
+  {
+  public:
+    void UncheckedSetKey(const byte *key, unsigned int length, const CryptoPP::NameValuePairs &params);
+    void ProcessAndXorBlock(const byte *inBlock, const byte *xorBlock, byte *outBlock) const;
+    size_t AdvancedProcessBlocks(const byte *inBlocks, const byte *xorBlocks, byte *outBlocks, size_t length, CryptoPP::word32 flags) const;
+
+  private:
+    CryptoPP::AES::Encryption fallback;
+  };
+
+  class Dec : public Base
+  {
+  public:
+    void UncheckedSetKey(const byte *key, unsigned int length, const CryptoPP::NameValuePairs &params);
+    void ProcessAndXorBlock(const byte *inBlock, const byte *xorBlock, byte *outBlock) const;
+    size_t AdvancedProcessBlocks(const byte *inBlocks, const byte *xorBlocks, byte *outBlocks, size_t length, CryptoPP::word32 flags) const;
+
+  private:
+    CryptoPP::AES::Decryption fallback;
+  };
+
+public:
+  typedef CryptoPP::BlockCipherFinal<CryptoPP::ENCRYPTION, Enc> Encryption;
+  typedef CryptoPP::BlockCipherFinal<CryptoPP::DECRYPTION, Dec> Decryption;
+
+  static const int ParallelThreshold;
+  static const int MinChunkSize;
+
+  static bool isAccelerated(void);
+  static const char *name(void);
+  static QString description(void);
+  static bool selfTest(void);
+  static void decryptCBC(const Decryption &dec, const byte *IV, const byte *cipher, byte *plain, size_t length);
+};
+
+
+#endif // __AESBACKEND_H_
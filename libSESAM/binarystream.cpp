@@ -0,0 +1,283 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "binarystream.h"
+
+#include <climits>
+
+
+BinaryStreamWriter::BinaryStreamWriter(void)
+  : mRecordCount(0)
+{ /* ... */ }
+
+
+void BinaryStreamWriter::appendVarint(QByteArray &out, quint64 value)
+{
+  while (value >= 0x80) {
+    out.append(char(value | 0x80));
+    value >>= 7;
+  }
+  out.append(char(value));
+}
+
+
+void BinaryStreamWriter::writeKey(int field, WireType type)
+{
+  Q_ASSERT_X(field > 0, "BinaryStreamWriter::writeKey()", "field numbers must be positive");
+  appendVarint(mRecords, (quint64(field) << 2) | quint64(type));
+}
+
+
+void BinaryStreamWriter::writeUInt(int field, quint64 value)
+{
+  writeKey(field, Varint);
+  appendVarint(mRecords, value);
+}
+
+
+/*!
+ * Writes `value` zigzag encoded, so that small negative numbers stay short, too.
+ */
+void BinaryStreamWriter::writeInt(int field, qint64 value)
+{
+  writeKey(field, Varint);
+  appendVarint(mRecords, (quint64(value) << 1) ^ quint64(value >> 63));
+}
+
+
+void BinaryStreamWriter::writeString(int field, const QString &value)
+{
+  QHash<QString, int>::const_iterator s = mStringIndex.constFind(value);
+  int idx;
+  if (s == mStringIndex.constEnd()) {
+    idx = mStrings.size();
+    mStringIndex.insert(value, idx);
+    mStrings.append(value);
+  }
+  else {
+    idx = s.value();
+  }
+  writeKey(field, StringRef);
+  appendVarint(mRecords, quint64(idx));
+}
+
+
+void BinaryStreamWriter::writeBytes(int field, const QByteArray &value)
+{
+  writeKey(field, Bytes);
+  appendVarint(mRecords, quint64(value.size()));
+  mRecords.append(value);
+}
+
+
+void BinaryStreamWriter::endRecord(void)
+{
+  mRecords.append('\0');
+  ++mRecordCount;
+}
+
+
+QByteArray BinaryStreamWriter::result(int version) const
+{
+  QByteArray out;
+  appendVarint(out, quint64(version));
+  appendVarint(out, quint64(mStrings.size()));
+  foreach (const QString &s, mStrings) {
+    const QByteArray &utf8 = s.toUtf8();
+    appendVarint(out, quint64(utf8.size()));
+    out.append(utf8);
+  }
+  appendVarint(out, quint64(mRecordCount));
+  out.append(mRecords);
+  return out;
+}
+
+
+BinaryStreamReader::BinaryStreamReader(const QByteArray &data)
+  : mData(data)
+  , mCur(mData.constData())
+  , mEnd(mData.constData() + mData.size())
+  , mRecordCount(0)
+  , mWireType(BinaryStreamWriter::Varint)
+  , mError(false)
+{ /* ... */ }
+
+
+bool BinaryStreamReader::readVarint(quint64 &value)
+{
+  value = 0;
+  for (int shift = 0; shift < 64 && mCur < mEnd; shift += 7) {
+    const uchar b = static_cast<uchar>(*mCur++);
+    value |= quint64(b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+  mError = true;
+  mCur = mEnd;
+  value = 0;
+  return false;
+}
+
+
+/*!
+ * Reads the header and the string table.
+ *
+ * \return `false` if the data was written with another `version` or is truncated.
+ */
+bool BinaryStreamReader::begin(int version)
+{
+  quint64 v = 0;
+  quint64 n = 0;
+  // every string and every record takes at least one byte, which bounds the counts
+  if (!readVarint(v) || v != quint64(version) || !readVarint(n) || n > quint64(mEnd - mCur)) {
+    mError = true;
+    return false;
+  }
+  mStrings.reserve(int(n));
+  for (quint64 i = 0; i < n; ++i) {
+    quint64 size = 0;
+    if (!readVarint(size) || size > quint64(mEnd - mCur)) {
+      mError = true;
+      return false;
+    }
+    mStrings.append(QString::fromUtf8(mCur, int(size)));
+    mCur += size;
+  }
+  if (!readVarint(n) || n > quint64(mEnd - mCur)) {
+    mError = true;
+    return false;
+  }
+  mRecordCount = int(n);
+  return true;
+}
+
+
+int BinaryStreamReader::recordCount(void) const
+{
+  return mRecordCount;
+}
+
+
+/*!
+ * Reads the key of the next field of the current record.
+ *
+ * \return `false` at the end of the record or on error.
+ */
+bool BinaryStreamReader::nextField(int &field)
+{
+  quint64 key = 0;
+  if (mError || !readVarint(key) || key == 0)
+    return false;
+  if ((key >> 2) > quint64(INT_MAX) || (key & 3) > quint64(BinaryStreamWriter::Bytes)) {
+    mError = true;
+    return false;
+  }
+  field = int(key >> 2);
+  mWireType = static_cast<BinaryStreamWriter::WireType>(key & 3);
+  return true;
+}
+
+
+BinaryStreamWriter::WireType BinaryStreamReader::wireType(void) const
+{
+  return mWireType;
+}
+
+
+bool BinaryStreamReader::expect(BinaryStreamWriter::WireType type)
+{
+  if (mWireType != type)
+    mError = true;
+  return !mError;
+}
+
+
+quint64 BinaryStreamReader::readUInt(void)
+{
+  quint64 value = 0;
+  if (expect(BinaryStreamWriter::Varint))
+    readVarint(value);
+  return value;
+}
+
+
+qint64 BinaryStreamReader::readInt(void)
+{
+  const quint64 value = readUInt();
+  return qint64(value >> 1) ^ -qint64(value & 1);
+}
+
+
+QString BinaryStreamReader::readString(void)
+{
+  quint64 idx = 0;
+  if (!expect(BinaryStreamWriter::StringRef) || !readVarint(idx))
+    return QString();
+  if (idx >= quint64(mStrings.size())) {
+    mError = true;
+    return QString();
+  }
+  return mStrings.at(int(idx));
+}
+
+
+QByteArray BinaryStreamReader::readBytes(void)
+{
+  quint64 size = 0;
+  if (!expect(BinaryStreamWriter::Bytes) || !readVarint(size))
+    return QByteArray();
+  if (size > quint64(mEnd - mCur)) {
+    mError = true;
+    return QByteArray();
+  }
+  const QByteArray value(mCur, int(size));
+  mCur += size;
+  return value;
+}
+
+
+/*!
+ * Skips the value of a field the caller doesn't know.
+ */
+void BinaryStreamReader::skipField(void)
+{
+  switch (mWireType) {
+  case BinaryStreamWriter::Varint:
+    readUInt();
+    break;
+  case BinaryStreamWriter::StringRef:
+    readString();
+    break;
+  case BinaryStreamWriter::Bytes:
+    readBytes();
+    break;
+  }
+}
+
+
+bool BinaryStreamReader::atEnd(void) const
+{
+  return mCur == mEnd;
+}
+
+
+bool BinaryStreamReader::hasError(void) const
+{
+  return mError;
+}
@@ -0,0 +1,117 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __BINARYSTREAM_H_
+#define __BINARYSTREAM_H_
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+/*!
+ * \brief The BinaryStreamWriter class
+ *
+ * Builds the compact binary encoding of a sequence of records. A record is a list
+ * of fields, each one introduced by a varint key holding the field number and the
+ * wire type (`field << 2 | type`), and ends with a zero key. Strings go into a table
+ * shared by all records, so that every distinct string is stored only once and the
+ * fields merely refer to its index.
+ *
+ * `result()` returns the following structure:
+ *
+ * Bytes   | Description
+ * ------- | ---------------------------------------------------------------------------
+ *  varint | Version
+ *  varint | Number of strings in the table
+ *       n | The strings, each one as varint length followed by its UTF-8 representation
+ *  varint | Number of records
+ *       n | The records
+ *
+ */
+class BinaryStreamWriter
+{
+public:
+  enum WireType {
+    Varint = 0,
+    StringRef = 1,
+    Bytes = 2
+  };
+
+  BinaryStreamWriter(void);
+
+  void writeUInt(int field, quint64 value);
+  void writeInt(int field, qint64 value);
+  void writeString(int field, const QString &value);
+  void writeBytes(int field, const QByteArray &value);
+  void endRecord(void);
+  QByteArray result(int version) const;
+
+private:
+  static void appendVarint(QByteArray &out, quint64 value);
+  void writeKey(int field, WireType type);
+
+  QByteArray mRecords;
+  int mRecordCount;
+  QHash<QString, int> mStringIndex;
+  QVector<QString> mStrings;
+};
+
+
+/*!
+ * \brief The BinaryStreamReader class
+ *
+ * Reads data written by `BinaryStreamWriter`. Call `begin()` first, then
+ * `nextField()` until it returns `false` at the end of each record, reading the
+ * value of every field with the method matching its wire type or skipping it with
+ * `skipField()`. After the first error all reads return empty values.
+ *
+ */
+class BinaryStreamReader
+{
+public:
+  explicit BinaryStreamReader(const QByteArray &data);
+
+  bool begin(int version);
+  int recordCount(void) const;
+  bool nextField(int &field);
+  quint64 readUInt(void);
+  qint64 readInt(void);
+  QString readString(void);
+  QByteArray readBytes(void);
+  BinaryStreamWriter::WireType wireType(void) const;
+  void skipField(void);
+  bool atEnd(void) const;
+  bool hasError(void) const;
+
+private:
+  bool readVarint(quint64 &value);
+  bool expect(BinaryStreamWriter::WireType type);
+
+  const QByteArray mData;
+  const char *mCur;
+  const char *mEnd;
+  QVector<QString> mStrings;
+  int mRecordCount;
+  BinaryStreamWriter::WireType mWireType;
+  bool mError;
+};
+
+#endif // __BINARYSTREAM_H_
@@ -0,0 +1,199 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "compiledtemplate.h"
+#include "password.h"
+#include "uint512.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+
+
+static Q_DECL_CONSTEXPR ushort DigitTable[] = {
+  '0', '1', '2', '3', '4', '5', '6', '7', '8', '9'
+};
+
+static Q_DECL_CONSTEXPR ushort LowerTable[] = {
+  'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n', 'o', 'p', 'q',
+  'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z'
+};
+
+static Q_DECL_CONSTEXPR ushort UpperTable[] = {
+  'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q',
+  'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z'
+};
+
+
+static inline const QChar *qcharTable(const ushort *table)
+{
+  return reinterpret_cast<const QChar*>(table);
+}
+
+
+const int CompiledTemplate::InternTableSize = 64;
+
+
+CompiledTemplate::CompiledTemplate(const QString &passwordTemplate, const QString &extraCharacters)
+  : mExtraCharacters(extraCharacters)
+  , mError(Password::NoError)
+{
+  if (passwordTemplate.contains('n')) {
+    mUsedCharacters.append(Password::Digits);
+  }
+  if (passwordTemplate.contains('a')) {
+    mUsedCharacters.append(Password::LowerChars);
+  }
+  if (passwordTemplate.contains('A')) {
+    mUsedCharacters.append(Password::UpperChars);
+  }
+  if (passwordTemplate.contains('o')) {
+    mUsedCharacters.append(mExtraCharacters);
+  }
+  if (mUsedCharacters.isEmpty()) {
+    mError = Password::EmptyCharacterSetError;
+    mErrorString = "used character set must not be empty";
+    return;
+  }
+  if (passwordTemplate.isEmpty()) {
+    mError = Password::EmptyTemplateError;
+    mErrorString = "password template is empty";
+    return;
+  }
+  mEntries.reserve(passwordTemplate.size());
+  foreach (QChar c, passwordTemplate) {
+    const char m = c.toLatin1();
+    Entry e;
+    switch (m) {
+    case 'x':
+      e.alphabet = mUsedCharacters.constData();
+      e.radix = quint32(mUsedCharacters.size());
+      break;
+    case 'o':
+      e.alphabet = mExtraCharacters.constData();
+      e.radix = quint32(mExtraCharacters.size());
+      break;
+    case 'a':
+      e.alphabet = qcharTable(LowerTable);
+      e.radix = sizeof(LowerTable) / sizeof(LowerTable[0]);
+      break;
+    case 'A':
+      e.alphabet = qcharTable(UpperTable);
+      e.radix = sizeof(UpperTable) / sizeof(UpperTable[0]);
+      break;
+    case 'n':
+      e.alphabet = qcharTable(DigitTable);
+      e.radix = sizeof(DigitTable) / sizeof(DigitTable[0]);
+      break;
+    default:
+      mError = Password::EmptyTemplateError;
+      mErrorString = QString("invalid template character: %1").arg(m);
+      return;
+    }
+    if (e.radix == 0) {
+      mError = Password::EmptyCharacterSetError;
+      mErrorString = QString("character set for template character %1 must not be empty").arg(m);
+      return;
+    }
+    mEntries.append(e);
+  }
+}
+
+
+/*!
+ * \brief CompiledTemplate::compile
+ *
+ * Returns the compiled form of `passwordTemplate` from the intern table,
+ * compiling it first if it isn't there yet. The table is emptied when it
+ * has grown to `InternTableSize` entries; templates still in use stay alive
+ * through their shared pointers.
+ *
+ * This function is thread-safe.
+ *
+ * \param passwordTemplate template as in `DomainSettings::passwordTemplate`
+ * \param extraCharacters characters to pick from for template character 'o'
+ * \return the compiled template
+ */
+QSharedPointer<const CompiledTemplate> CompiledTemplate::compile(const QString &passwordTemplate, const QString &extraCharacters)
+{
+  typedef QPair<QString, QString> Key;
+  static QHash<Key, QSharedPointer<const CompiledTemplate> > internTable;
+  static QMutex mutex;
+  const Key key(passwordTemplate, extraCharacters);
+  QMutexLocker locker(&mutex);
+  QSharedPointer<const CompiledTemplate> compiled = internTable.value(key);
+  if (compiled.isNull()) {
+    if (internTable.size() >= InternTableSize) {
+      internTable.clear();
+    }
+    compiled = QSharedPointer<const CompiledTemplate>(new CompiledTemplate(passwordTemplate, extraCharacters));
+    internTable.insert(key, compiled);
+  }
+  return compiled;
+}
+
+
+const QString &CompiledTemplate::usedCharacters(void) const
+{
+  return mUsedCharacters;
+}
+
+
+/*!
+ * \brief CompiledTemplate::size
+ *
+ * \return number of characters `mix()` writes
+ */
+int CompiledTemplate::size(void) const
+{
+  return mEntries.size();
+}
+
+
+int CompiledTemplate::error(void) const
+{
+  return mError;
+}
+
+
+const QString &CompiledTemplate::errorString(void) const
+{
+  return mErrorString;
+}
+
+
+/*!
+ * \brief CompiledTemplate::mix
+ *
+ * Converts `derivedKey`, read as a big-endian number, into `size()` characters
+ * by repeated division by the radix of each template position.
+ *
+ * \param derivedKey key as derived by PBKDF2
+ * \param size length of `derivedKey` in bytes; at most 64
+ * \param out receives `size()` characters
+ */
+void CompiledTemplate::mix(const char *derivedKey, int size, QChar *out) const
+{
+  UInt512 v = UInt512::fromBigEndian(derivedKey, size);
+  const Entry *e = mEntries.constData();
+  for (int i = 0; i < mEntries.size(); ++i) {
+    out[i] = e[i].alphabet[v.divMod(e[i].radix)];
+  }
+}
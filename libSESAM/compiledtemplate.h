@@ -0,0 +1,73 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __COMPILEDTEMPLATE_H_
+#define __COMPILEDTEMPLATE_H_
+
+#include <QString>
+#include <QVector>
+#include <QSharedPointer>
+
+/*!
+ * \brief The CompiledTemplate class
+ *
+ * A password template resolved into one (alphabet, radix) entry per template character.
+ *
+ * Templates are compiled once per combination of template and extra characters
+ * and shared via a small intern table, so that `Password::setDomainSettings()` boils
+ * down to a hash lookup for all but the first domain using a template, and `mix()`
+ * runs without allocating memory.
+ *
+ * Errors are detected at compile time. `mix()` then produces as many characters
+ * as precede the offending template character, like the interpreting loop
+ * `Password::remix()` used to run.
+ *
+ */
+class CompiledTemplate
+{
+public:
+  struct Entry {
+    const QChar *alphabet;
+    quint32 radix;
+  };
+
+  static QSharedPointer<const CompiledTemplate> compile(const QString &passwordTemplate, const QString &extraCharacters);
+
+  const QString &usedCharacters(void) const;
+  int size(void) const;
+  int error(void) const;
+  const QString &errorString(void) const;
+  void mix(const char *derivedKey, int size, QChar *out) const;
+
+  static const int InternTableSize;
+
+private:
+  CompiledTemplate(const QString &passwordTemplate, const QString &extraCharacters);
+
+  QString mUsedCharacters;
+  QString mExtraCharacters;
+  QVector<Entry> mEntries;
+  int mError;
+  QString mErrorString;
+
+  Q_DISABLE_COPY(CompiledTemplate)
+};
+
+
+#endif // __COMPILEDTEMPLATE_H_
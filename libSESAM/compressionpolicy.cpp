@@ -0,0 +1,244 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "compressionpolicy.h"
+
+#include "filters.h"
+#include "zdeflate.h"
+#include "zinflate.h"
+#include "zlib.h"
+
+
+const int CompressionPolicy::AdaptiveLevel = -1;
+const int CompressionPolicy::DefaultTimeBudget = 50;
+
+
+namespace {
+
+// `Password::ExtraChars` as it appears in JSON
+#define SESAM_JSON_EXTRA_CHARS "!\\\\|\\\"$%/&?!<>()[]{}~`\xc2\xb4#'=-_+*~.,;:^\xc2\xb0"
+
+// The preset dictionary of `CompressionPolicy::DictionaryCompression`. Deflate encodes
+// short distances more compactly, so the most frequent strings come last.
+// Never change it, existing data depends on it.
+const char PresetDictionary[] =
+    "\"notes\":\"\",\"url\":\"https://www.\",\"group\":[\"\"],\"tags\":\"\",\"files\":[],"
+    "\"expiryDate\":\"T00:00:00\",\"legacyPassword\":\"\",\"deleted\":true,"
+    "\"usedCharacters\":\"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789" SESAM_JSON_EXTRA_CHARS "\","
+    "\"extras\":\"" SESAM_JSON_EXTRA_CHARS "\","
+    "\"iterations\":8192,\"mDate\":\"2016-01-01T00:00:00\","
+    "\"passwordTemplate\":\"xxxxxxxxxxxxxxxxaAno\",\"salt\":\"==\",\"username\":\"\"},"
+    "{\"cDate\":\"2016-01-01T00:00:00\",\"domain\":\"";
+
+#undef SESAM_JSON_EXTRA_CHARS
+
+
+// Throughput of Crypto++'s deflate on domain lists in bytes per millisecond,
+// about a third of what a 2015 desktop CPU achieves
+const struct {
+  int level;
+  qint64 bytesPerMs;
+} Throughput[] = {
+  { 9, 10000 },
+  { 6, 18000 },
+  { 3, 22000 },
+  { 1, 25000 }
+};
+
+
+/*!
+ * \brief The SkipFilter class
+ *
+ * Crypto++ filter dropping the first bytes passing through it: a given number
+ * of bytes or, until `setSkip(0)` gets called, all of them.
+ */
+class SkipFilter : public CryptoPP::Bufferless<CryptoPP::Filter>
+{
+public:
+  static const qint64 All = -1;
+  SkipFilter(CryptoPP::BufferedTransformation *attachment, qint64 skip)
+    : mSkip(skip)
+  {
+    Detach(attachment);
+  }
+  void setSkip(qint64 skip)
+  {
+    mSkip = skip;
+  }
+  size_t Put2(const byte *inString, size_t length, int messageEnd, bool blocking)
+  {
+    if (mSkip != 0) {
+      const size_t n = (mSkip == All) ? length : size_t(qMin(mSkip, qint64(length)));
+      if (mSkip != All) {
+        mSkip -= qint64(n);
+      }
+      inString += n;
+      length -= n;
+    }
+    return AttachedTransformation()->Put2(inString, length, messageEnd, blocking);
+  }
+
+private:
+  qint64 mSkip;
+};
+
+}
+
+
+CompressionPolicy::CompressionPolicy(Method method, int level, int timeBudget)
+  : mMethod(method)
+  , mLevel(level == AdaptiveLevel ? AdaptiveLevel : qBound(int(CryptoPP::Deflator::MIN_DEFLATE_LEVEL), level, int(CryptoPP::Deflator::MAX_DEFLATE_LEVEL)))
+  , mTimeBudget(qMax(0, timeBudget))
+{ /* ... */ }
+
+
+CompressionPolicy::Method CompressionPolicy::method(void) const
+{
+  return mMethod;
+}
+
+
+int CompressionPolicy::level(void) const
+{
+  return mLevel;
+}
+
+
+int CompressionPolicy::timeBudget(void) const
+{
+  return mTimeBudget;
+}
+
+
+bool CompressionPolicy::isAdaptive(void) const
+{
+  return mLevel == AdaptiveLevel;
+}
+
+
+/*!
+ * \brief CompressionPolicy::levelFor
+ *
+ * \param size The (expected) size of the payload in bytes; 0 if unknown.
+ * \return The fixed level or, if adaptive, the highest level expected to compress `size` bytes within `timeBudget()`. Unknown sizes get the default level 6.
+ */
+int CompressionPolicy::levelFor(qint64 size) const
+{
+  if (!isAdaptive())
+    return mLevel;
+  if (size <= 0)
+    return CryptoPP::Deflator::DEFAULT_DEFLATE_LEVEL;
+  const int n = int(sizeof(Throughput) / sizeof(Throughput[0]));
+  for (int i = 0; i < n; ++i) {
+    if (size / Throughput[i].bytesPerMs <= mTimeBudget)
+      return Throughput[i].level;
+  }
+  return Throughput[n - 1].level;
+}
+
+
+/*!
+ * \brief CompressionPolicy::createCompressor
+ *
+ * Builds the compression stage in front of `attachment`.
+ *
+ * \param attachment The filter receiving the compressed data; owned by the returned filter unless it is returned itself.
+ * \param sizeHint The expected payload size in bytes, used to pick the level if adaptive; 0 if unknown.
+ * \return The filter to write the payload to; `attachment` itself with `NoCompression`.
+ */
+CryptoPP::BufferedTransformation *CompressionPolicy::createCompressor(CryptoPP::BufferedTransformation *attachment, qint64 sizeHint) const
+{
+  const int deflateLevel = levelFor(sizeHint);
+  switch (mMethod) {
+  case ZlibCompression:
+    return new CryptoPP::ZlibCompressor(attachment, deflateLevel);
+  case DictionaryCompression:
+  {
+    // Run the dictionary through the deflater and drop its output up to the following
+    // sync point: the window then holds the dictionary, the rest of the stream starts
+    // on a byte boundary and may refer back into the dictionary.
+    SkipFilter *gate = new SkipFilter(attachment, SkipFilter::All);
+    CryptoPP::Deflator *deflator = new CryptoPP::Deflator(gate, deflateLevel);
+    const QByteArray &dict = dictionary();
+    deflator->Put(reinterpret_cast<const byte*>(dict.constData()), dict.size());
+    deflator->IsolatedFlush(true, true);
+    gate->setSkip(0);
+    return deflator;
+  }
+  case NoCompression:
+    // fall-through
+  default:
+    break;
+  }
+  return attachment;
+}
+
+
+bool CompressionPolicy::isSupported(int method)
+{
+  return method == NoCompression || method == ZlibCompression || method == DictionaryCompression;
+}
+
+
+/*!
+ * \brief CompressionPolicy::createDecompressor
+ *
+ * Builds the decompression stage in front of `attachment`.
+ *
+ * \return The filter to write the compressed data to; `attachment` itself with `NoCompression`.
+ */
+CryptoPP::BufferedTransformation *CompressionPolicy::createDecompressor(Method method, CryptoPP::BufferedTransformation *attachment)
+{
+  switch (method) {
+  case ZlibCompression:
+    return new CryptoPP::ZlibDecompressor(attachment);
+  case DictionaryCompression:
+  {
+    // Prime the window with a non-final stored block containing the dictionary
+    // and drop its decompressed copy.
+    const QByteArray &dict = dictionary();
+    const quint16 len = quint16(dict.size());
+    const quint16 nlen = quint16(~len);
+    const byte storedBlockHeader[5] = {
+      0x00, byte(len), byte(len >> 8), byte(nlen), byte(nlen >> 8)
+    };
+    CryptoPP::Inflator *inflator = new CryptoPP::Inflator(new SkipFilter(attachment, dict.size()));
+    inflator->Put(storedBlockHeader, sizeof(storedBlockHeader));
+    inflator->Put(reinterpret_cast<const byte*>(dict.constData()), dict.size());
+    return inflator;
+  }
+  case NoCompression:
+    // fall-through
+  default:
+    break;
+  }
+  return attachment;
+}
+
+
+/*!
+ * \brief CompressionPolicy::dictionary
+ *
+ * \return The preset dictionary used by `DictionaryCompression`.
+ */
+const QByteArray &CompressionPolicy::dictionary(void)
+{
+  static const QByteArray dict(PresetDictionary, int(sizeof(PresetDictionary) - 1));
+  return dict;
+}
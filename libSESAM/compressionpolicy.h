@@ -0,0 +1,78 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __COMPRESSIONPOLICY_H_
+#define __COMPRESSIONPOLICY_H_
+
+#include <QtGlobal>
+#include <QByteArray>
+
+namespace CryptoPP {
+class BufferedTransformation;
+}
+
+
+/*!
+ * \brief The CompressionPolicy class
+ *
+ * Decides how `CrypterEncoder` compresses its payload and builds the matching
+ * Crypto++ filters for the encoder and the decoder.
+ *
+ * `DictionaryCompression` deflates the payload with a preset dictionary made of the
+ * `DomainSettings` JSON keys and their most common values, which makes small and
+ * medium sized domain lists noticeably smaller. As the dictionary is part of the
+ * format, it must never change; a different dictionary needs a new `Method`.
+ *
+ * The level is either fixed (0 to 9, like `qCompress()`) or `AdaptiveLevel`: then
+ * the highest level is chosen that is expected to compress the payload within
+ * `timeBudget()` milliseconds.
+ *
+ */
+class CompressionPolicy
+{
+public:
+  enum Method {
+    NoCompression = 0x00,
+    ZlibCompression = 0x01,
+    DictionaryCompression = 0x02
+  };
+  static const int AdaptiveLevel;
+  static const int DefaultTimeBudget;
+
+  CompressionPolicy(Method method = DictionaryCompression, int level = AdaptiveLevel, int timeBudget = DefaultTimeBudget);
+
+  Method method(void) const;
+  int level(void) const;
+  int timeBudget(void) const;
+  bool isAdaptive(void) const;
+  int levelFor(qint64 size) const;
+  CryptoPP::BufferedTransformation *createCompressor(CryptoPP::BufferedTransformation *attachment, qint64 sizeHint) const;
+
+  static bool isSupported(int method);
+  static CryptoPP::BufferedTransformation *createDecompressor(Method method, CryptoPP::BufferedTransformation *attachment);
+  static const QByteArray &dictionary(void);
+
+private:
+  Method mMethod;
+  int mLevel;
+  int mTimeBudget;
+};
+
+
+#endif // __COMPRESSIONPOLICY_H_
@@ -0,0 +1,174 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "cpufeatures.h"
+
+#if defined(SESAM_X86)
+#if defined(Q_CC_MSVC)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+
+namespace {
+
+enum Feature {
+  SSE2   = 1 << 0,
+  SSSE3  = 1 << 1,
+  SSE41  = 1 << 2,
+  AVX    = 1 << 3,
+  AVX2   = 1 << 4,
+  AESNI  = 1 << 5,
+  SHA    = 1 << 6,
+  RDRAND = 1 << 7,
+  RDSEED = 1 << 8
+};
+
+
+#if defined(SESAM_X86)
+void cpuid(quint32 leaf, quint32 subleaf, quint32 *regs)
+{
+#if defined(Q_CC_MSVC)
+  int r[4];
+  __cpuidex(r, int(leaf), int(subleaf));
+  for (int i = 0; i < 4; ++i) {
+    regs[i] = quint32(r[i]);
+  }
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+
+quint64 xgetbv0(void)
+{
+#if defined(Q_CC_MSVC)
+  return _xgetbv(0);
+#else
+  quint32 eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (quint64(edx) << 32) | eax;
+#endif
+}
+#endif
+
+
+int detect(void)
+{
+  int features = 0;
+#if defined(SESAM_X86)
+  quint32 regs[4];
+  cpuid(0, 0, regs);
+  const quint32 maxLeaf = regs[0];
+  if (maxLeaf < 1)
+    return features;
+  cpuid(1, 0, regs);
+  const quint32 ecx1 = regs[2];
+  const quint32 edx1 = regs[3];
+  if (edx1 & (1u << 26))
+    features |= SSE2;
+  if (ecx1 & (1u << 9))
+    features |= SSSE3;
+  if (ecx1 & (1u << 19))
+    features |= SSE41;
+  if (ecx1 & (1u << 25))
+    features |= AESNI;
+  if (ecx1 & (1u << 30))
+    features |= RDRAND;
+  const bool osSavesYmm = (ecx1 & (1u << 27)) && (xgetbv0() & 0x6) == 0x6;
+  if (osSavesYmm && (ecx1 & (1u << 28)))
+    features |= AVX;
+  if (maxLeaf >= 7) {
+    cpuid(7, 0, regs);
+    const quint32 ebx7 = regs[1];
+    if ((features & AVX) && (ebx7 & (1u << 5)))
+      features |= AVX2;
+    if (ebx7 & (1u << 18))
+      features |= RDSEED;
+    if (ebx7 & (1u << 29))
+      features |= SHA;
+  }
+#endif
+  return features;
+}
+
+
+inline bool has(Feature feature)
+{
+  static const int features = detect();
+  return (features & feature) != 0;
+}
+
+}
+
+
+bool CPUFeatures::hasSSE2(void)
+{
+  return has(SSE2);
+}
+
+
+bool CPUFeatures::hasSSSE3(void)
+{
+  return has(SSSE3);
+}
+
+
+bool CPUFeatures::hasSSE41(void)
+{
+  return has(SSE41);
+}
+
+
+bool CPUFeatures::hasAVX(void)
+{
+  return has(AVX);
+}
+
+
+bool CPUFeatures::hasAVX2(void)
+{
+  return has(AVX2);
+}
+
+
+bool CPUFeatures::hasAESNI(void)
+{
+  return has(AESNI);
+}
+
+
+bool CPUFeatures::hasSHA(void)
+{
+  return has(SHA);
+}
+
+
+bool CPUFeatures::hasRDRAND(void)
+{
+  return has(RDRAND);
+}
+
+
+bool CPUFeatures::hasRDSEED(void)
+{
+  return has(RDSEED);
+}
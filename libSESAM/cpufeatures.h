@@ -0,0 +1,60 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __CPUFEATURES_H_
+#define __CPUFEATURES_H_
+
+#include <QtGlobal>
+
+#if defined(Q_PROCESSOR_X86)
+#define SESAM_X86 1
+#if defined(Q_CC_MSVC)
+#define SESAM_TARGET(isa)
+#else
+#define SESAM_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+
+/*!
+ * \brief The CPUFeatures class
+ *
+ * Runtime detection of instruction set extensions. The CPU is queried once,
+ * subsequent calls return the cached result.
+ *
+ * AVX and AVX2 are only reported if the operating system saves the YMM registers
+ * on context switches.
+ *
+ */
+class CPUFeatures
+{
+public:
+  static bool hasSSE2(void);
+  static bool hasSSSE3(void);
+  static bool hasSSE41(void);
+  static bool hasAVX(void);
+  static bool hasAVX2(void);
+  static bool hasAESNI(void);
+  static bool hasSHA(void);
+  static bool hasRDRAND(void);
+  static bool hasRDSEED(void);
+};
+
+
+#endif // __CPUFEATURES_H_
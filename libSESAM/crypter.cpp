@@ -18,12 +18,17 @@
 */
 
 #include <QDebug>
+#include <QBuffer>
 #include "sha.h"
 #include "ccm.h"
 #include "misc.h"
 #include "securebytearray.h"
 #include "pbkdf2.h"
 #include "crypter.h"
+#include "aesbackend.h"
+#include "keymanager.h"
+#include "crypterstream.h"
+#include "randomsource.h"
 #include "util.h"
 
 
@@ -33,60 +38,11 @@ const int Crypter::DomainIterations = 32768;
 const int Crypter::KGKIterations = 1024;
 const int Crypter::KGKSize = 64;
 const int Crypter::AESBlockSize = CryptoPP::AES::BLOCKSIZE;
+const int Crypter::GCMTagSize = 16;
+const int Crypter::GCMNonceSize = 12;
 const int Crypter::CryptDataSize = Crypter::SaltSize + Crypter::AESBlockSize + Crypter::KGKSize;
 
 
-#ifdef Q_OS_WIN
-#include <Windows.h>
-#include <Wincrypt.h>
-#include <intrin.h>
-#include <immintrin.h>
-#pragma comment(lib, "advapi32.lib")
-#pragma comment(lib, "crypt32.lib")
-bool isGenuineIntelCPU(void) {
-  int cpureg[4]; // EAX, EBX, ECX, EDX
-  __cpuid(cpureg, 0);
-  return memcmp((char*)&cpureg[1],
-      "Genu", 4) == 0
-      && memcmp((char*)&cpureg[2],
-      "ntel", 4) == 0
-      && memcmp((char*)&cpureg[3],
-      "ineI", 4) == 0;
-}
-bool isRdRandSupported(void) {
-  if (!isGenuineIntelCPU())
-    return false;
-  int cpureg[4];
-  __cpuid(cpureg, 1);
-  return (cpureg[2] & (1<<30)) != 0;
-}
-bool rdrand(unsigned __int32& r) {
-  int tries = 10;
-  do {
-    if (_rdrand32_step(&r))
-      return true;
-  } while (tries-- > 0);
-  return false;
-}
-#endif
-
-
-/*!
- * \brief gRandomDevice
- *
- * The random number generator used by `Crypter`.
- *
- * `std::random_device` is a uniformly-distributed integer random number generator
- * that produces non-deterministic random numbers.
- * `std::random_device` may be implemented in terms of an implementation-defined
- * pseudo-random number engine if a non-deterministic source (e.g. a hardware device)
- * is not available to the implementation.
- * In this case each `std::random_device` object may generate the same number sequence.
- *
- */
-std::random_device Crypter::fallbackRandomDev;
-
-
 /*!
  * \brief Crypter::encode
  *
@@ -100,14 +56,42 @@ std::random_device Crypter::fallbackRandomDev;
  * \param KGK Key generation key. A randomly generated byte sequence of `Crypter::KGKSize` length.
  * \param data The data to be encrypted.
  * \param compress If `true`, data will be compressed before encryption.
- * \return Block of binary data with the following structure:
+ * \param control Optional cancellation token and progress sink for the key derivation.
+ * \param keyManager Optional source of pre-derived keys. If given, the payload key is taken from its pool instead of being derived.
+ * \param format `AES256EncryptedMasterkeyFormat` (default), `AES256GCMFormat` or `AES256GCMCompressionFormat`; `AES256GCMSegmentedFormat` or `AES256GCMSegmentedBinaryFormat` for a `SegmentedVault` manifest.
+ * \return Block of binary data with the following structure (empty if cancelled via `control`):
  *
  * Bytes   | Description
  * ------- | ---------------------------------------------------------------------------
- *       1 | Format flag (must be 0x01)
+ *       1 | Format flag (0x01 to 0x05)
  *      32 | Salt (randomly generated)
- *     112 | Encrypted key generation key
- *       n | Encrypted data
+ *      12 | Nonce for the encrypted key generation key (0x02 to 0x05 only, randomly generated)
+ *     112 | Encrypted key generation key (0x01: AES-CBC)
+ *     128 | Encrypted key generation key and GCM tag (0x02 to 0x05: AES-GCM with the nonce, authenticating the format flag, salt and nonce)
+ *       1 | Compression method, see `CompressionPolicy::Method` (0x03 to 0x05 only)
+ *       n | Encrypted data (0x01: AES-CBC with PKCS#7 padding; 0x02 to 0x05: AES-GCM segments, see below)
+ *
+ * With 0x01 and 0x02 `compress` means zlib compression (compatible with `qCompress()`),
+ * with 0x03 to 0x05 the default `CompressionPolicy` is used. 0x04 is 0x03 with a
+ * `SegmentedVault` manifest as payload; the buckets it refers to are stored separately.
+ * 0x05 is the same, but the buckets hold the binary encoding of `DomainSettingsList`
+ * instead of JSON.
+ *
+ * Versions of Qt-SESAM without GCM support only read 0x01 and reject everything newer,
+ * which is why 0x01 stays the default. Data that may be read by such versions, e.g. a
+ * sync file or server shared between several installations, must be written in 0x01.
+ *
+ * With 0x02 to 0x05 the data is split into segments of 64 KB (the last one may be
+ * shorter, and empty data makes a single empty segment), each encrypted separately
+ * and followed by its 16 byte GCM tag.
+ * The nonce of a segment consists of the first 7 bytes of the IV in the key generation
+ * key block, the 32 bit big-endian number of the segment and a byte telling whether it
+ * is the last one. Every segment authenticates all bytes of the header.
+ *
+ * `key` and `IV` only depend on the master password and `salt`, so they are the same
+ * for every call until the salt gets renewed. That's why the GCM formats encrypt the
+ * key generation key with a fresh random nonce instead of `IV`: GCM must never see
+ * the same key and nonce twice.
  *
  */
 QByteArray Crypter::encode(const SecureByteArray &key,
@@ -115,47 +99,49 @@ QByteArray Crypter::encode(const SecureByteArray &key,
                            const QByteArray &salt,
                            const SecureByteArray &KGK,
                            const QByteArray &data,
-                           bool compress)
+                           bool compress,
+                           DerivationControl *control,
+                           KeyManager *keyManager,
+                           FormatFlags format)
 {
-  const QByteArray &salt2 = generateSalt();
-  const SecureByteArray &IV2 = generateIV();
-  const SecureByteArray &KGK2 = salt2 + IV2 + KGK;
-  const QByteArray &encryptedKGK = encrypt(key, IV, KGK2, CryptoPP::StreamTransformationFilter::NO_PADDING);
-  const SecureByteArray &blobKey = Crypter::makeKeyFromPassword(KGK, salt2);
-  const SecureByteArray &baPlain = compress ? qCompress(data, 9) : data;
-  const QByteArray &baCipher = encrypt(blobKey, IV2, baPlain, CryptoPP::StreamTransformationFilter::PKCS_PADDING);
-  const QByteArray formatFlag(int(1), static_cast<char>(AES256EncryptedMasterkeyFormat));
-  return formatFlag + salt + encryptedKGK + baCipher;
+  QByteArray cipher;
+  QBuffer buffer(&cipher);
+  buffer.open(QIODevice::WriteOnly);
+  CrypterEncoder encoder(&buffer, compress, false, format);
+  if (!encoder.begin(key, IV, salt, KGK, data.size(), control, keyManager))
+    return QByteArray();
+  encoder.write(data);
+  encoder.finish();
+  return cipher;
 }
 
 /*!
  * \brief Crypter::decode
  * \param masterPassword The user's master password.
  * \param cipher The data to be decrypted.
- * \param uncompress If `true`, data will be uncompressed after encryption.
+ * \param uncompress If `true`, data will be uncompressed after decryption. Ignored for `AES256GCMCompressionFormat`, whose header tells the compression method.
  * \param KGK Key generation key. A randomly generated byte sequence of `Crypter::AESKeySize` length.
- * \return The decrypted payload (without format flag and other header data) contained in `cipher`.
+ * \param control Optional cancellation token and progress sink for the key derivations.
+ * \param keyManager Optional key cache. If given, keys derived before in this session are not derived again.
+ * \return The decrypted payload (without format flag and other header data) contained in `cipher`; empty if cancelled via `control` or if `cipher` is in an unknown format.
+ * \throws CryptoPP::Exception if `masterPassword` is wrong or `cipher` has been tampered with. For `AES256GCMFormat` this is detected right after the header, before the payload gets decrypted.
  */
 QByteArray Crypter::decode(const SecureByteArray &masterPassword,
-                           QByteArray cipher,
+                           const QByteArray &cipher,
                            bool uncompress,
-                           SecureByteArray &KGK)
+                           SecureByteArray &KGK,
+                           DerivationControl *control,
+                           KeyManager *keyManager)
 {
   Q_ASSERT_X(!masterPassword.isEmpty(), "Crypter::decode()", "masterPassword must not be empty");
-  FormatFlags formatFlag = static_cast<FormatFlags>(cipher.at(0));
-  if (formatFlag != AES256EncryptedMasterkeyFormat)
+  QByteArray plain;
+  QBuffer buffer(&plain);
+  buffer.open(QIODevice::WriteOnly);
+  CrypterDecoder decoder(&buffer, masterPassword, uncompress, false, control, keyManager);
+  if (!decoder.write(cipher) || !decoder.finish())
     return QByteArray();
-  const QByteArray &salt = QByteArray(cipher.constData() + sizeof(char), SaltSize);
-  const SecureByteArray &encryptedKGK = SecureByteArray(cipher.constData() + sizeof(char) + SaltSize, CryptDataSize);
-  SecureByteArray key, IV;
-  Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
-  QByteArray baKGK = decrypt(key, IV, encryptedKGK, CryptoPP::StreamTransformationFilter::NO_PADDING);
-  const QByteArray salt2(baKGK.constData(), SaltSize);
-  const SecureByteArray IV2(baKGK.constData() + SaltSize, AESBlockSize);
-  KGK = SecureByteArray(baKGK.constData() + SaltSize + AESBlockSize, KGKSize);
-  const SecureByteArray &blobKey = Crypter::makeKeyFromPassword(KGK, salt2);
-  const QByteArray &plain = decrypt(blobKey, IV2, cipher.mid(+ sizeof(char) + SaltSize + CryptDataSize), CryptoPP::StreamTransformationFilter::PKCS_PADDING);
-  return uncompress ? qUncompress(plain) : plain;
+  KGK = decoder.KGK();
+  return plain;
 }
 
 
@@ -172,7 +158,7 @@ QByteArray Crypter::decode(const SecureByteArray &masterPassword,
  */
 QByteArray Crypter::encrypt(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &plain, CryptoPP::StreamTransformationFilter::BlockPaddingScheme padding)
 {
-  CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption enc;
+  CryptoPP::CBC_Mode<AESBackend>::Encryption enc;
   enc.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), reinterpret_cast<const byte*>(IV.constData()));
   const int cipherSize = (padding == CryptoPP::StreamTransformationFilter::NO_PADDING)
       ? plain.size()
@@ -197,29 +183,35 @@ QByteArray Crypter::encrypt(const SecureByteArray &key, const SecureByteArray &I
  *
  * AES-CBC decrypts a block of data.
  *
+ * Large blocks are decrypted in parallel (see `AESBackend::decryptCBC()`).
+ *
  * \param key The key to be used for decryption.
  * \param IV The initialization vector used to initialize AES.
  * \param cipher The block of data to be decrypted.
  * \param padding A flag telling what kind of padding should be used. `CryptoPP::StreamTransformationFilter::PKCS_PADDING` means that PKCS#7 padding should be used (see RFC 5652). `CryptoPP::StreamTransformationFilter::NO_PADDING` means that no padding should be used (only applicable if the length of the resulting plaintext data is a multiple of `Crypter::AESBlockSize`). Currently no other padding is supported by this function.
  * \return Decrypted block of data.
+ * \throws CryptoPP::InvalidCiphertext if the length of `cipher` is not a multiple of `Crypter::AESBlockSize` or the padding is invalid.
  */
 SecureByteArray Crypter::decrypt(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &cipher, CryptoPP::StreamTransformationFilter::BlockPaddingScheme padding)
 {
-  CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption dec;
-  dec.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), reinterpret_cast<const byte*>(IV.constData()));
+  if (cipher.size() % AESBlockSize != 0 || (padding == CryptoPP::StreamTransformationFilter::PKCS_PADDING && cipher.isEmpty()))
+    throw CryptoPP::InvalidCiphertext("StreamTransformationFilter: ciphertext length is not a multiple of block size");
+  AESBackend::Decryption dec(reinterpret_cast<const byte*>(key.constData()), key.size());
   SecureByteArray plain(cipher.size(), static_cast<char>(0));
-  CryptoPP::ArraySource s(
-        reinterpret_cast<const byte*>(cipher.constData()), cipher.size(),
-        true,
-        new CryptoPP::StreamTransformationFilter(
-          dec,
-          new CryptoPP::ArraySink(reinterpret_cast<byte*>(plain.data()), plain.size()),
-          padding
-          )
-        );
-  Q_UNUSED(s); // just to please the compiler
+  AESBackend::decryptCBC(dec,
+                         reinterpret_cast<const byte*>(IV.constData()),
+                         reinterpret_cast<const byte*>(cipher.constData()),
+                         reinterpret_cast<byte*>(plain.data()),
+                         cipher.size());
   if (padding == CryptoPP::StreamTransformationFilter::PKCS_PADDING) {
-    plain.resize(plain.size() - plain.at(plain.size() - 1));
+    const int pad = static_cast<uchar>(plain.at(plain.size() - 1));
+    bool valid = pad >= 1 && pad <= AESBlockSize;
+    for (int i = 1; valid && i <= pad; ++i) {
+      valid = static_cast<uchar>(plain.at(plain.size() - i)) == pad;
+    }
+    if (!valid)
+      throw CryptoPP::InvalidCiphertext("StreamTransformationFilter: invalid PKCS #7 block padding found");
+    plain.resize(plain.size() - pad);
   }
   return plain;
 }
@@ -229,60 +221,14 @@ SecureByteArray Crypter::decrypt(const SecureByteArray &key, const SecureByteArr
  * \brief Crypter::randomBytes
  *
  * Create a `QByteArray` filled with `size` randomly generated bytes. The sequence is uniformly distributed in the interval [0, 255].
+ * The bytes come from `RandomSource`.
  *
  * \param size So many bytes should be generated.
  * \return A `QByteArray` with `size` randomly generated bytes.
  */
 QByteArray Crypter::randomBytes(const int size)
 {
-  QByteArray buf(size, '\0');
-  bool useFallback = true;
-#ifdef Q_OS_WIN
-  if (isRdRandSupported()) {
-    useFallback = false;
-    quint32 *const d = reinterpret_cast<quint32*>(buf.data());
-    const quint32 *const dEnd = d + size / sizeof(quint32);
-    for (quint32* rn = d; rn < dEnd; ++rn) {
-      bool ok = rdrand(*rn);
-      if (!ok) {
-        useFallback = true;
-        qWarning() << "rdrand() returned NOK";
-        break;
-      }
-    }
-    int nRemaining = size % sizeof(quint32);
-    while (nRemaining-- > 0) {
-      quint32 rn;
-      bool ok = rdrand(rn);
-      if (!ok) {
-        useFallback = true;
-        qWarning() << "rdrand() returned NOK";
-        break;
-      }
-      *(buf.data() + size - nRemaining - 1) = static_cast<char>(rn);
-    }
-  }
-  if (useFallback) {
-    HCRYPTPROV hProvider = NULL;
-    if (!CryptAcquireContextW(&hProvider,
-                              NULL,
-                              NULL,
-                              PROV_RSA_FULL,
-                              CRYPT_VERIFYCONTEXT | CRYPT_SILENT)) {
-      useFallback = true;
-    }
-    else {
-      useFallback = (FALSE == CryptGenRandom(hProvider, size, reinterpret_cast<BYTE*>(buf.data())));
-      CryptReleaseContext(hProvider, 0);
-    }
-  }
-#endif
-  if (useFallback) {
-    for (int i = 0; i < size; ++i) {
-      buf[i] = static_cast<char>(fallbackRandomDev());
-    }
-  }
-  return buf;
+  return RandomSource::bytes(size);
 }
 
 
@@ -326,11 +272,16 @@ SecureByteArray Crypter::generateIV(void)
  *
  * \param masterKey The master key from which PBKDF2 should generate the key.
  * \param salt A salt used for PBKDF2.
- * \return A `SecureByteArray` containing a `AESKeySize` long SHA-256 hash generated via PBKDF2 parametrized with `masterKey`, `salt` and `KGKIterations`.
+ * \param control Optional cancellation token and progress sink.
+ * \return A `SecureByteArray` containing a `AESKeySize` long SHA-256 hash generated via PBKDF2 parametrized with `masterKey`, `salt` and `KGKIterations`; empty if cancelled via `control`.
  */
-SecureByteArray Crypter::makeKeyFromPassword(const SecureByteArray &masterKey, const QByteArray &salt)
+SecureByteArray Crypter::makeKeyFromPassword(const SecureByteArray &masterKey, const QByteArray &salt, DerivationControl *control)
 {
-  PBKDF2 pbkdf2(masterKey, salt, KGKIterations, QCryptographicHash::Sha256);
+  PBKDF2 pbkdf2;
+  pbkdf2.setControl(control);
+  pbkdf2.generate(masterKey, salt, KGKIterations, QCryptographicHash::Sha256, AESKeySize);
+  if (pbkdf2.isAborted())
+    return SecureByteArray();
   return pbkdf2.derivedKey(AESKeySize);
 }
 
@@ -345,11 +296,19 @@ SecureByteArray Crypter::makeKeyFromPassword(const SecureByteArray &masterKey, c
  * \param salt A salt used for PBKDF2.
  * \param key A reference to a `SecureByteArray` object to which the generated key should be assigned.
  * \param IV A reference to a `SecureByteArray` object to which the generated IV should be assigned.
+ * \param control Optional cancellation token and progress sink. If the derivation gets cancelled, `key` and `IV` are cleared.
  */
-void Crypter::makeKeyAndIVFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt, SecureByteArray &key, SecureByteArray &IV)
+void Crypter::makeKeyAndIVFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt, SecureByteArray &key, SecureByteArray &IV, DerivationControl *control)
 {
   Q_ASSERT_X(!masterPassword.isEmpty(), "Crypter::makeKeyAndIVFromPassword()", "masterPassword must not be empty");
-  PBKDF2 pbkdf2(masterPassword, salt, DomainIterations, QCryptographicHash::Sha384);
+  PBKDF2 pbkdf2;
+  pbkdf2.setControl(control);
+  pbkdf2.generate(masterPassword, salt, DomainIterations, QCryptographicHash::Sha384, AESKeySize + AESBlockSize);
+  if (pbkdf2.isAborted()) {
+    key.clear();
+    IV.clear();
+    return;
+  }
   const SecureByteArray &hash = pbkdf2.derivedKey();
   key = hash.mid(0, AESKeySize);
   IV = hash.mid(AESKeySize, AESBlockSize);
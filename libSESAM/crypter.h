@@ -26,10 +26,11 @@
 
 #include "securebytearray.h"
 #include "util.h"
+#include "derivationcontrol.h"
 #include "filters.h"
 #include "aes.h"
 
-#include <random>
+class KeyManager;
 
 class Crypter
 {
@@ -40,19 +41,24 @@ public:
   static const int SaltSize;
   enum FormatFlags {
     ObsoleteDefaultEncryptionFormat = 0x00,
-    AES256EncryptedMasterkeyFormat = 0x01
+    AES256EncryptedMasterkeyFormat = 0x01,
+    AES256GCMFormat = 0x02,
+    AES256GCMCompressionFormat = 0x03,
+    AES256GCMSegmentedFormat = 0x04,
+    AES256GCMSegmentedBinaryFormat = 0x05
   };
-  static SecureByteArray makeKeyFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt);
-  static void makeKeyAndIVFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt, SecureByteArray &key, SecureByteArray &IV);
-  static QByteArray encode(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &salt, const SecureByteArray &KGK, const QByteArray &data, bool compress);
-  static QByteArray decode(const SecureByteArray &masterPassword, QByteArray cipher, bool uncompress, SecureByteArray &KGK);
+  static const int GCMTagSize;
+  static const int GCMNonceSize;
+  static SecureByteArray makeKeyFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt, DerivationControl *control = Q_NULLPTR);
+  static void makeKeyAndIVFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt, SecureByteArray &key, SecureByteArray &IV, DerivationControl *control = Q_NULLPTR);
+  static QByteArray encode(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &salt, const SecureByteArray &KGK, const QByteArray &data, bool compress, DerivationControl *control = Q_NULLPTR, KeyManager *keyManager = Q_NULLPTR, FormatFlags format = AES256EncryptedMasterkeyFormat);
+  static QByteArray decode(const SecureByteArray &masterPassword, const QByteArray &cipher, bool uncompress, SecureByteArray &KGK, DerivationControl *control = Q_NULLPTR, KeyManager *keyManager = Q_NULLPTR);
   static QByteArray randomBytes(const int size);
   static SecureByteArray generateKGK(void);
   static SecureByteArray generateIV(void);
   static QByteArray generateSalt(void);
   static QByteArray encrypt(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &plain, CryptoPP::StreamTransformationFilter::BlockPaddingScheme padding);
   static SecureByteArray decrypt(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &cipher, CryptoPP::StreamTransformationFilter::BlockPaddingScheme padding);
-  static std::random_device fallbackRandomDev;
 
 private:
   static const int KGKIterations;
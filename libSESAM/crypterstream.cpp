@@ -0,0 +1,840 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "crypterstream.h"
+#include "crypter.h"
+#include "aesbackend.h"
+#include "keymanager.h"
+#include "compressionpolicy.h"
+#include "derivationcontrol.h"
+#include "util.h"
+
+#include <cstring>
+
+#include "filters.h"
+#include "modes.h"
+#include "aes.h"
+#include "gcm.h"
+#include "base64.h"
+
+
+const int CrypterEncoder::ChunkSize = 64 * 1024;
+
+// salt2, IV2 and KGK, encrypted with the master key to form the KGK block following the salt
+static const int KGKBlockSize = Crypter::SaltSize + Crypter::AESBlockSize + Crypter::KGKSize;
+
+
+static int headerSize(Crypter::FormatFlags format)
+{
+  switch (format) {
+  case Crypter::AES256EncryptedMasterkeyFormat:
+    return 1 + Crypter::SaltSize + KGKBlockSize;
+  case Crypter::AES256GCMFormat:
+    return 1 + Crypter::SaltSize + Crypter::GCMNonceSize + KGKBlockSize + Crypter::GCMTagSize;
+  case Crypter::AES256GCMCompressionFormat:
+    // fall-through
+  case Crypter::AES256GCMSegmentedFormat:
+    // fall-through
+  case Crypter::AES256GCMSegmentedBinaryFormat:
+    return 1 + Crypter::SaltSize + Crypter::GCMNonceSize + KGKBlockSize + Crypter::GCMTagSize + 1;
+  default:
+    break;
+  }
+  return -1;
+}
+
+
+static bool isGCM(Crypter::FormatFlags format)
+{
+  return format == Crypter::AES256GCMFormat || format == Crypter::AES256GCMCompressionFormat || format == Crypter::AES256GCMSegmentedFormat || format == Crypter::AES256GCMSegmentedBinaryFormat;
+}
+
+
+static bool hasMethodByte(Crypter::FormatFlags format)
+{
+  return format == Crypter::AES256GCMCompressionFormat || format == Crypter::AES256GCMSegmentedFormat || format == Crypter::AES256GCMSegmentedBinaryFormat;
+}
+
+
+/*!
+ * \brief encryptKGKBlock
+ *
+ * Encrypts the KGK block with the key derived from the master password. `IV` is the
+ * IV derived from the master password for `Crypter::AES256EncryptedMasterkeyFormat`
+ * and the random nonce stored in the header for the GCM formats, which additionally
+ * authenticate `aad` (the format flag, salt and nonce).
+ */
+static QByteArray encryptKGKBlock(Crypter::FormatFlags format, const SecureByteArray &key, const QByteArray &IV, const QByteArray &aad, const SecureByteArray &KGKBlock)
+{
+  if (!isGCM(format))
+    return Crypter::encrypt(key, IV, KGKBlock, CryptoPP::StreamTransformationFilter::NO_PADDING);
+  CryptoPP::GCM<AESBackend>::Encryption enc;
+  enc.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), reinterpret_cast<const byte*>(IV.constData()), IV.size());
+  QByteArray cipher(KGKBlock.size() + Crypter::GCMTagSize, static_cast<char>(0));
+  CryptoPP::AuthenticatedEncryptionFilter filter(enc, new CryptoPP::ArraySink(reinterpret_cast<byte*>(cipher.data()), cipher.size()), false, Crypter::GCMTagSize);
+  filter.ChannelPut(CryptoPP::AAD_CHANNEL, reinterpret_cast<const byte*>(aad.constData()), aad.size());
+  filter.ChannelPut(CryptoPP::DEFAULT_CHANNEL, reinterpret_cast<const byte*>(KGKBlock.constData()), KGKBlock.size());
+  filter.ChannelMessageEnd(CryptoPP::DEFAULT_CHANNEL);
+  return cipher;
+}
+
+
+/*!
+ * \brief decryptKGKBlock
+ *
+ * Counterpart of `encryptKGKBlock()`. For the GCM formats a wrong master password
+ * or a tampered header make it throw `CryptoPP::HashVerificationFilter::HashVerificationFailed`.
+ */
+static SecureByteArray decryptKGKBlock(Crypter::FormatFlags format, const SecureByteArray &key, const QByteArray &IV, const QByteArray &aad, const QByteArray &cipher)
+{
+  if (!isGCM(format))
+    return Crypter::decrypt(key, IV, cipher, CryptoPP::StreamTransformationFilter::NO_PADDING);
+  CryptoPP::GCM<AESBackend>::Decryption dec;
+  dec.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), reinterpret_cast<const byte*>(IV.constData()), IV.size());
+  SecureByteArray plain(cipher.size() - Crypter::GCMTagSize, static_cast<char>(0));
+  CryptoPP::AuthenticatedDecryptionFilter filter(dec, new CryptoPP::ArraySink(reinterpret_cast<byte*>(plain.data()), plain.size()), CryptoPP::AuthenticatedDecryptionFilter::THROW_EXCEPTION, Crypter::GCMTagSize);
+  filter.ChannelPut(CryptoPP::AAD_CHANNEL, reinterpret_cast<const byte*>(aad.constData()), aad.size());
+  filter.ChannelPut(CryptoPP::DEFAULT_CHANNEL, reinterpret_cast<const byte*>(cipher.constData()), cipher.size());
+  filter.ChannelMessageEnd(CryptoPP::DEFAULT_CHANNEL);
+  return plain;
+}
+// qCompress() prepends the uncompressed size as a 32 bit big-endian number
+static const int CompressedSizeHeaderSize = 4;
+
+
+/*!
+ * \brief The QIODeviceSink class
+ *
+ * Crypto++ sink writing everything it receives to a `QIODevice`.
+ */
+class QIODeviceSink : public CryptoPP::Bufferless<CryptoPP::Sink>
+{
+public:
+  QIODeviceSink(QIODevice *device)
+    : mDevice(device)
+    , mBytesWritten(0)
+    , mError(false)
+  { /* ... */ }
+  size_t Put2(const byte *inString, size_t length, int messageEnd, bool blocking)
+  {
+    Q_UNUSED(messageEnd);
+    Q_UNUSED(blocking);
+    if (length > 0 && !mError) {
+      const qint64 n = mDevice->write(reinterpret_cast<const char*>(inString), qint64(length));
+      if (n != qint64(length)) {
+        mError = true;
+      }
+      else {
+        mBytesWritten += n;
+      }
+    }
+    return 0;
+  }
+  bool hasError(void) const
+  {
+    return mError;
+  }
+  qint64 bytesWritten(void) const
+  {
+    return mBytesWritten;
+  }
+
+private:
+  QIODevice *mDevice;
+  qint64 mBytesWritten;
+  bool mError;
+};
+
+
+// the GCM formats authenticate the payload in segments of this many bytes
+static const int GCMSegmentSize = 64 * 1024;
+
+
+/*!
+ * \brief makeSegmentNonce
+ *
+ * Fills `nonce` with the GCM nonce of payload segment `counter`: the first 7 bytes
+ * of the IV stored in the KGK block, `counter` as a 32 bit big-endian number and
+ * a final byte of 1 for the last segment, 0 otherwise. Every encoding uses a key
+ * of its own, so the nonces of its segments needn't be unique beyond that.
+ */
+static void makeSegmentNonce(byte *nonce, const SecureByteArray &IV, quint32 counter, bool last)
+{
+  memcpy(nonce, IV.constData(), Crypter::GCMNonceSize - 5);
+  nonce[Crypter::GCMNonceSize - 5] = byte(counter >> 24);
+  nonce[Crypter::GCMNonceSize - 4] = byte(counter >> 16);
+  nonce[Crypter::GCMNonceSize - 3] = byte(counter >> 8);
+  nonce[Crypter::GCMNonceSize - 2] = byte(counter);
+  nonce[Crypter::GCMNonceSize - 1] = last ? 1 : 0;
+}
+
+
+/*!
+ * \brief The GCMSegmentEncryptionFilter class
+ *
+ * Encrypts the payload of the GCM formats in segments of `GCMSegmentSize` bytes,
+ * each followed by its tag. A segment is only written when the next byte arrives
+ * or the message ends, so that the last one can be flagged as such in its nonce,
+ * which makes truncating the cipher text at a segment boundary detectable.
+ */
+class GCMSegmentEncryptionFilter : public CryptoPP::Bufferless<CryptoPP::Filter>
+{
+public:
+  GCMSegmentEncryptionFilter(CryptoPP::BufferedTransformation *attachment, const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &aad)
+    : mIV(IV)
+    , mAAD(aad)
+    , mPlain(GCMSegmentSize, static_cast<char>(0))
+    , mCipher(GCMSegmentSize + Crypter::GCMTagSize, static_cast<char>(0))
+    , mFill(0)
+    , mCounter(0)
+  {
+    Detach(attachment);
+    byte nonce[Crypter::GCMNonceSize];
+    makeSegmentNonce(nonce, mIV, 0, false);
+    mGCM.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), nonce, Crypter::GCMNonceSize);
+  }
+  size_t Put2(const byte *inString, size_t length, int messageEnd, bool blocking)
+  {
+    while (length > 0) {
+      if (mFill == GCMSegmentSize) {
+        // more data follows, so the buffered segment isn't the last one
+        writeSegment(false, blocking);
+      }
+      const size_t n = qMin(length, size_t(GCMSegmentSize - mFill));
+      memcpy(mPlain.data() + mFill, inString, n);
+      mFill += int(n);
+      inString += n;
+      length -= n;
+    }
+    if (messageEnd) {
+      writeSegment(true, blocking);
+      AttachedTransformation()->Put2(Q_NULLPTR, 0, messageEnd - 1, blocking);
+    }
+    return 0;
+  }
+
+private:
+  void writeSegment(bool last, bool blocking)
+  {
+    byte nonce[Crypter::GCMNonceSize];
+    makeSegmentNonce(nonce, mIV, mCounter++, last);
+    byte *cipher = reinterpret_cast<byte*>(mCipher.data());
+    mGCM.EncryptAndAuthenticate(cipher, cipher + mFill, Crypter::GCMTagSize, nonce, Crypter::GCMNonceSize,
+                                reinterpret_cast<const byte*>(mAAD.constData()), mAAD.size(),
+                                reinterpret_cast<const byte*>(mPlain.constData()), mFill);
+    AttachedTransformation()->Put2(cipher, mFill + Crypter::GCMTagSize, 0, blocking);
+    SecureErase(mPlain.data(), mFill);
+    mFill = 0;
+  }
+
+  CryptoPP::GCM<AESBackend>::Encryption mGCM;
+  SecureByteArray mIV;
+  QByteArray mAAD;
+  SecureByteArray mPlain;
+  QByteArray mCipher;
+  int mFill;
+  quint32 mCounter;
+};
+
+
+/*!
+ * \brief The GCMSegmentDecryptionFilter class
+ *
+ * Counterpart of `GCMSegmentEncryptionFilter`. Each segment is passed on as soon as
+ * its tag has been verified, so no more than one segment is held in memory. A
+ * tampered, reordered or truncated segment makes it throw
+ * `CryptoPP::HashVerificationFilter::HashVerificationFailed`.
+ */
+class GCMSegmentDecryptionFilter : public CryptoPP::Bufferless<CryptoPP::Filter>
+{
+public:
+  GCMSegmentDecryptionFilter(CryptoPP::BufferedTransformation *attachment, const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &aad)
+    : mIV(IV)
+    , mAAD(aad)
+    , mCipher(GCMSegmentSize + Crypter::GCMTagSize, static_cast<char>(0))
+    , mPlain(GCMSegmentSize, static_cast<char>(0))
+    , mFill(0)
+    , mCounter(0)
+  {
+    Detach(attachment);
+    byte nonce[Crypter::GCMNonceSize];
+    makeSegmentNonce(nonce, mIV, 0, false);
+    mGCM.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), nonce, Crypter::GCMNonceSize);
+  }
+  size_t Put2(const byte *inString, size_t length, int messageEnd, bool blocking)
+  {
+    while (length > 0) {
+      if (mFill == mCipher.size()) {
+        // more data follows, so the buffered segment isn't the last one
+        readSegment(false, blocking);
+      }
+      const size_t n = qMin(length, size_t(mCipher.size() - mFill));
+      memcpy(mCipher.data() + mFill, inString, n);
+      mFill += int(n);
+      inString += n;
+      length -= n;
+    }
+    if (messageEnd) {
+      readSegment(true, blocking);
+      AttachedTransformation()->Put2(Q_NULLPTR, 0, messageEnd - 1, blocking);
+    }
+    return 0;
+  }
+
+private:
+  void readSegment(bool last, bool blocking)
+  {
+    if (mFill < Crypter::GCMTagSize)
+      throw CryptoPP::HashVerificationFilter::HashVerificationFailed();
+    const int size = mFill - Crypter::GCMTagSize;
+    byte nonce[Crypter::GCMNonceSize];
+    makeSegmentNonce(nonce, mIV, mCounter++, last);
+    const byte *cipher = reinterpret_cast<const byte*>(mCipher.constData());
+    byte *plain = reinterpret_cast<byte*>(mPlain.data());
+    const bool ok = mGCM.DecryptAndVerify(plain, cipher + size, Crypter::GCMTagSize, nonce, Crypter::GCMNonceSize,
+                                          reinterpret_cast<const byte*>(mAAD.constData()), mAAD.size(),
+                                          cipher, size);
+    if (!ok) {
+      SecureErase(plain, size);
+      throw CryptoPP::HashVerificationFilter::HashVerificationFailed();
+    }
+    AttachedTransformation()->Put2(plain, size, 0, blocking);
+    SecureErase(plain, size);
+    mFill = 0;
+  }
+
+  CryptoPP::GCM<AESBackend>::Decryption mGCM;
+  SecureByteArray mIV;
+  QByteArray mAAD;
+  QByteArray mCipher;
+  SecureByteArray mPlain;
+  int mFill;
+  quint32 mCounter;
+};
+
+
+class CrypterEncoderPrivate {
+public:
+  CrypterEncoderPrivate(QIODevice *out, bool compress, bool base64, Crypter::FormatFlags format)
+    : out(out)
+    , compress(compress)
+    , base64(base64)
+    , format(format)
+    , sink(Q_NULLPTR)
+    , begun(false)
+    , finished(false)
+  { /* ... */ }
+  ~CrypterEncoderPrivate()
+  { /* ... */ }
+  QIODevice *out;
+  bool compress;
+  bool base64;
+  Crypter::FormatFlags format;
+  CompressionPolicy policy;
+  CryptoPP::CBC_Mode<AESBackend>::Encryption cbc;
+  // head of the chain [deflate ->] AES -> [base64 ->] sink, owning the rest of it
+  QScopedPointer<CryptoPP::BufferedTransformation> pipeline;
+  QIODeviceSink *sink;
+  bool begun;
+  bool finished;
+};
+
+
+CrypterEncoder::CrypterEncoder(QIODevice *out, bool compress, bool base64, Crypter::FormatFlags format)
+  : d_ptr(new CrypterEncoderPrivate(out, compress, base64, format))
+{ /* ... */ }
+
+
+CrypterEncoder::~CrypterEncoder()
+{ /* ... */ }
+
+
+/*!
+ * \brief CrypterEncoder::setCompressionPolicy
+ *
+ * Sets the compression method and level used by `begin()` if the encoder compresses.
+ * The method only applies to the formats 0x03 to 0x05 (`Crypter::AES256GCMCompressionFormat`
+ * and the segmented formats), which record it in their header; the older formats
+ * always use zlib, but at the level of `policy`.
+ */
+void CrypterEncoder::setCompressionPolicy(const CompressionPolicy &policy)
+{
+  Q_D(CrypterEncoder);
+  d->policy = policy;
+}
+
+
+/*!
+ * \brief CrypterEncoder::begin
+ *
+ * Derives (or takes from `keyManager`) the key to encrypt the payload with
+ * and writes the header containing the encrypted KGK.
+ *
+ * \param key An AES key generated from the user's master password.
+ * \param IV AES initialization vector belonging to `key`.
+ * \param salt The salt `key` and `IV` were generated with.
+ * \param KGK Key generation key.
+ * \param sizeHint The number of bytes that will be written. Only used if data gets compressed: an adaptive `CompressionPolicy` picks the level from it, and with zlib compression older versions of `Crypter::decode()` preallocate this amount of memory when inflating.
+ * \param control Optional cancellation token and progress sink for the key derivation.
+ * \param keyManager Optional source of pre-derived keys.
+ * \return `false` if the key derivation has been cancelled, the format is not supported or the encoder was begun before.
+ */
+bool CrypterEncoder::begin(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &salt, const SecureByteArray &KGK, qint64 sizeHint, DerivationControl *control, KeyManager *keyManager)
+{
+  Q_D(CrypterEncoder);
+  if (d->begun || headerSize(d->format) < 0)
+    return false;
+  QByteArray salt2;
+  SecureByteArray IV2;
+  SecureByteArray blobKey;
+  if (keyManager != Q_NULLPTR) {
+    const KeyManager::SaltKeyIV &t = keyManager->takeBlobKey(KGK);
+    salt2 = t.salt;
+    IV2 = t.IV;
+    blobKey = t.key;
+  }
+  else {
+    salt2 = Crypter::generateSalt();
+    IV2 = Crypter::generateIV();
+    blobKey = Crypter::makeKeyFromPassword(KGK, salt2, control);
+  }
+  if (blobKey.isEmpty())
+    return false;
+  CompressionPolicy::Method method = CompressionPolicy::NoCompression;
+  if (d->compress) {
+    method = hasMethodByte(d->format)
+        ? d->policy.method()
+        : CompressionPolicy::ZlibCompression;
+  }
+  QByteArray header = QByteArray(1, static_cast<char>(d->format)) + salt;
+  if (isGCM(d->format)) {
+    // key and IV stay the same as long as the salt does, so GCM needs a nonce of its own
+    const QByteArray &nonce = Crypter::randomBytes(Crypter::GCMNonceSize);
+    header.append(nonce);
+    header.append(encryptKGKBlock(d->format, key, nonce, header, salt2 + IV2 + KGK));
+  }
+  else {
+    header.append(encryptKGKBlock(d->format, key, IV, header, salt2 + IV2 + KGK));
+  }
+  if (hasMethodByte(d->format)) {
+    header.append(static_cast<char>(method));
+  }
+  d->sink = new QIODeviceSink(d->out);
+  CryptoPP::BufferedTransformation *output = d->sink;
+  if (d->base64) {
+    output = new CryptoPP::Base64Encoder(output, false);
+  }
+  output->Put(reinterpret_cast<const byte*>(header.constData()), header.size());
+  CryptoPP::BufferedTransformation *aes;
+  if (isGCM(d->format)) {
+    aes = new GCMSegmentEncryptionFilter(output, blobKey, IV2, header);
+  }
+  else {
+    d->cbc.SetKeyWithIV(reinterpret_cast<const byte*>(blobKey.constData()), blobKey.size(), reinterpret_cast<const byte*>(IV2.constData()));
+    aes = new CryptoPP::StreamTransformationFilter(d->cbc, output, CryptoPP::StreamTransformationFilter::PKCS_PADDING);
+  }
+  if (method == CompressionPolicy::ZlibCompression) {
+    const quint32 size = quint32(qBound(Q_INT64_C(0), sizeHint, Q_INT64_C(0xffffffff)));
+    const byte sizeHeader[CompressedSizeHeaderSize] = {
+      byte(size >> 24), byte(size >> 16), byte(size >> 8), byte(size)
+    };
+    aes->Put(sizeHeader, CompressedSizeHeaderSize);
+  }
+  const CompressionPolicy policy(method, d->policy.level(), d->policy.timeBudget());
+  d->pipeline.reset(policy.createCompressor(aes, sizeHint));
+  d->begun = true;
+  return !d->sink->hasError();
+}
+
+
+/*!
+ * \brief CrypterEncoder::write
+ *
+ * Passes `size` bytes of `data` through the pipeline in chunks of at most `ChunkSize` bytes.
+ *
+ * \return `false` if the encoder has not been begun, has already been finished or if the output device failed.
+ */
+bool CrypterEncoder::write(const char *data, qint64 size)
+{
+  Q_D(CrypterEncoder);
+  if (!d->begun || d->finished)
+    return false;
+  while (size > 0 && !d->sink->hasError()) {
+    const qint64 n = qMin(size, qint64(ChunkSize));
+    d->pipeline->Put(reinterpret_cast<const byte*>(data), size_t(n));
+    data += n;
+    size -= n;
+  }
+  return !d->sink->hasError();
+}
+
+
+bool CrypterEncoder::write(const QByteArray &data)
+{
+  return write(data.constData(), data.size());
+}
+
+
+/*!
+ * \brief CrypterEncoder::write
+ *
+ * Reads `in` in chunks of `ChunkSize` bytes until its end and passes them through the pipeline.
+ */
+bool CrypterEncoder::write(QIODevice *in)
+{
+  QByteArray chunk(ChunkSize, static_cast<char>(0));
+  forever {
+    const qint64 n = in->read(chunk.data(), chunk.size());
+    if (n < 0)
+      return false;
+    if (n == 0)
+      break;
+    if (!write(chunk.constData(), n))
+      return false;
+  }
+  return true;
+}
+
+
+/*!
+ * \brief CrypterEncoder::finish
+ *
+ * Flushes the pipeline, i.e. writes the remaining compressed data, the padded
+ * last cipher block and the base64 padding to the output device.
+ */
+bool CrypterEncoder::finish(void)
+{
+  Q_D(CrypterEncoder);
+  if (!d->begun || d->finished)
+    return false;
+  d->pipeline->MessageEnd();
+  d->finished = true;
+  return !d->sink->hasError();
+}
+
+
+bool CrypterEncoder::hasError(void) const
+{
+  return d_ptr->sink != Q_NULLPTR && d_ptr->sink->hasError();
+}
+
+
+qint64 CrypterEncoder::bytesWritten(void) const
+{
+  return d_ptr->sink != Q_NULLPTR ? d_ptr->sink->bytesWritten() : 0;
+}
+
+
+class CrypterDecoderPrivate {
+public:
+  CrypterDecoderPrivate(QIODevice *out, const SecureByteArray &masterPassword, bool uncompress, DerivationControl *control, KeyManager *keyManager)
+    : out(out)
+    , masterPassword(masterPassword)
+    , uncompress(uncompress)
+    , control(control)
+    , keyManager(keyManager)
+    , headerSize(1)
+    , format(Crypter::ObsoleteDefaultEncryptionFormat)
+    , sink(new QIODeviceSink(out))
+    , sizeHeaderMissing(0)
+    , failed(false)
+    , finished(false)
+  { /* ... */ }
+  ~CrypterDecoderPrivate()
+  {
+    if (plainPipeline.isNull()) {
+      delete sink;
+    }
+  }
+  void init(bool base64);
+
+  // called with the (base64 decoded) cipher text
+  void consumeCipher(const byte *data, size_t length);
+  // called with the decrypted plain text
+  void consumePlain(const byte *data, size_t length);
+
+  QIODevice *out;
+  SecureByteArray masterPassword;
+  bool uncompress;
+  DerivationControl *control;
+  KeyManager *keyManager;
+  QByteArray header;
+  int headerSize;
+  Crypter::FormatFlags format;
+  SecureByteArray KGK;
+  CryptoPP::CBC_Mode<AESBackend>::Decryption cbc;
+  // [base64 ->] callback to consumeCipher()
+  QScopedPointer<CryptoPP::BufferedTransformation> input;
+  // AES -> callback to consumePlain()
+  QScopedPointer<CryptoPP::BufferedTransformation> cipherPipeline;
+  // [decompressor ->] sink, set up as soon as the compression method is known
+  QScopedPointer<CryptoPP::BufferedTransformation> plainPipeline;
+  QIODeviceSink *sink;
+  int sizeHeaderMissing;
+  bool failed;
+  bool finished;
+};
+
+
+/*!
+ * \brief The DecoderSink class
+ *
+ * Crypto++ sink handing everything it receives to a member function of `CrypterDecoderPrivate`.
+ */
+class DecoderSink : public CryptoPP::Bufferless<CryptoPP::Sink>
+{
+public:
+  typedef void (CrypterDecoderPrivate::*Consumer)(const byte *, size_t);
+  DecoderSink(CrypterDecoderPrivate *d, Consumer consumer)
+    : d(d)
+    , consumer(consumer)
+  { /* ... */ }
+  size_t Put2(const byte *inString, size_t length, int messageEnd, bool blocking)
+  {
+    Q_UNUSED(messageEnd);
+    Q_UNUSED(blocking);
+    if (length > 0) {
+      (d->*consumer)(inString, length);
+    }
+    return 0;
+  }
+
+private:
+  CrypterDecoderPrivate *d;
+  Consumer consumer;
+};
+
+
+void CrypterDecoderPrivate::init(bool base64)
+{
+  CryptoPP::BufferedTransformation *cipherSink = new DecoderSink(this, &CrypterDecoderPrivate::consumeCipher);
+  input.reset(base64 ? new CryptoPP::Base64Decoder(cipherSink) : cipherSink);
+}
+
+
+void CrypterDecoderPrivate::consumeCipher(const byte *data, size_t length)
+{
+  if (failed)
+    return;
+  if (cipherPipeline.isNull()) {
+    const int n = qMin(int(length), headerSize - header.size());
+    header.append(reinterpret_cast<const char*>(data), n);
+    data += n;
+    length -= size_t(n);
+    if (headerSize == 1) {
+      format = static_cast<Crypter::FormatFlags>(header.at(0));
+      headerSize = ::headerSize(format);
+      if (headerSize < 0) {
+        failed = true;
+        return;
+      }
+      consumeCipher(data, length);
+      return;
+    }
+    if (header.size() < headerSize)
+      return;
+    CompressionPolicy::Method method = uncompress ? CompressionPolicy::ZlibCompression : CompressionPolicy::NoCompression;
+    if (hasMethodByte(format)) {
+      const int m = static_cast<uchar>(header.at(headerSize - 1));
+      if (!CompressionPolicy::isSupported(m)) {
+        failed = true;
+        return;
+      }
+      method = static_cast<CompressionPolicy::Method>(m);
+    }
+    const QByteArray &salt = header.mid(1, Crypter::SaltSize);
+    SecureByteArray key;
+    SecureByteArray IV;
+    if (keyManager != Q_NULLPTR) {
+      keyManager->makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+    }
+    else {
+      Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV, control);
+    }
+    if (key.isEmpty()) {
+      failed = true;
+      return;
+    }
+    SecureByteArray KGK2;
+    if (isGCM(format)) {
+      const QByteArray &aad = header.left(1 + Crypter::SaltSize + Crypter::GCMNonceSize);
+      const QByteArray &nonce = aad.mid(1 + Crypter::SaltSize);
+      KGK2 = decryptKGKBlock(format, key, nonce, aad, header.mid(aad.size(), KGKBlockSize + Crypter::GCMTagSize));
+    }
+    else {
+      KGK2 = decryptKGKBlock(format, key, IV, header.left(1 + Crypter::SaltSize), header.mid(1 + Crypter::SaltSize, KGKBlockSize));
+    }
+    const QByteArray salt2(KGK2.constData(), Crypter::SaltSize);
+    const SecureByteArray IV2(KGK2.constData() + Crypter::SaltSize, Crypter::AESBlockSize);
+    KGK = SecureByteArray(KGK2.constData() + Crypter::SaltSize + Crypter::AESBlockSize, Crypter::KGKSize);
+    const SecureByteArray &blobKey = (keyManager != Q_NULLPTR)
+        ? keyManager->makeKeyFromPassword(KGK, salt2)
+        : Crypter::makeKeyFromPassword(KGK, salt2, control);
+    if (blobKey.isEmpty()) {
+      failed = true;
+      return;
+    }
+    sizeHeaderMissing = (method == CompressionPolicy::ZlibCompression) ? CompressedSizeHeaderSize : 0;
+    plainPipeline.reset(CompressionPolicy::createDecompressor(method, sink));
+    if (isGCM(format)) {
+      cipherPipeline.reset(new GCMSegmentDecryptionFilter(new DecoderSink(this, &CrypterDecoderPrivate::consumePlain), blobKey, IV2, header));
+    }
+    else {
+      cbc.SetKeyWithIV(reinterpret_cast<const byte*>(blobKey.constData()), blobKey.size(), reinterpret_cast<const byte*>(IV2.constData()));
+      cipherPipeline.reset(new CryptoPP::StreamTransformationFilter(cbc, new DecoderSink(this, &CrypterDecoderPrivate::consumePlain), CryptoPP::StreamTransformationFilter::PKCS_PADDING));
+    }
+  }
+  if (length > 0) {
+    cipherPipeline->Put(data, length);
+  }
+}
+
+
+void CrypterDecoderPrivate::consumePlain(const byte *data, size_t length)
+{
+  if (sizeHeaderMissing > 0) {
+    const int n = qMin(int(length), sizeHeaderMissing);
+    sizeHeaderMissing -= n;
+    data += n;
+    length -= size_t(n);
+  }
+  if (length > 0) {
+    plainPipeline->Put(data, length);
+  }
+}
+
+
+CrypterDecoder::CrypterDecoder(QIODevice *out, const SecureByteArray &masterPassword, bool uncompress, bool base64, DerivationControl *control, KeyManager *keyManager)
+  : d_ptr(new CrypterDecoderPrivate(out, masterPassword, uncompress, control, keyManager))
+{
+  d_ptr->init(base64);
+}
+
+
+CrypterDecoder::~CrypterDecoder()
+{ /* ... */ }
+
+
+/*!
+ * \brief CrypterDecoder::write
+ *
+ * Passes `size` bytes of `data` through the pipeline in chunks of at most `CrypterEncoder::ChunkSize` bytes.
+ *
+ * \return `false` if the data is not in a known format, the key derivation has been cancelled, the output device failed or the decoder has already been finished.
+ */
+bool CrypterDecoder::write(const char *data, qint64 size)
+{
+  Q_D(CrypterDecoder);
+  if (d->finished)
+    return false;
+  while (size > 0 && !hasError()) {
+    const qint64 n = qMin(size, qint64(CrypterEncoder::ChunkSize));
+    d->input->Put(reinterpret_cast<const byte*>(data), size_t(n));
+    data += n;
+    size -= n;
+  }
+  return !hasError();
+}
+
+
+bool CrypterDecoder::write(const QByteArray &data)
+{
+  return write(data.constData(), data.size());
+}
+
+
+/*!
+ * \brief CrypterDecoder::write
+ *
+ * Reads `in` in chunks of `CrypterEncoder::ChunkSize` bytes until its end and passes them through the pipeline.
+ */
+bool CrypterDecoder::write(QIODevice *in)
+{
+  QByteArray chunk(CrypterEncoder::ChunkSize, static_cast<char>(0));
+  forever {
+    const qint64 n = in->read(chunk.data(), chunk.size());
+    if (n < 0)
+      return false;
+    if (n == 0)
+      break;
+    if (!write(chunk.constData(), n))
+      return false;
+  }
+  return true;
+}
+
+
+/*!
+ * \brief CrypterDecoder::finish
+ *
+ * Flushes the pipeline, i.e. checks the padding of the last cipher block
+ * and the checksum of the compressed data.
+ *
+ * \return `false` if the input was incomplete or any of the errors described at `write()` occurred.
+ */
+bool CrypterDecoder::finish(void)
+{
+  Q_D(CrypterDecoder);
+  if (d->finished)
+    return false;
+  d->finished = true;
+  d->input->MessageEnd();
+  if (hasError() || d->cipherPipeline.isNull())
+    return false;
+  // throws if the last GCM segment is missing or doesn't match its tag
+  d->cipherPipeline->MessageEnd();
+  if (d->sizeHeaderMissing > 0)
+    return false;
+  d->plainPipeline->MessageEnd();
+  return !hasError();
+}
+
+
+bool CrypterDecoder::hasError(void) const
+{
+  return d_ptr->failed || d_ptr->sink->hasError();
+}
+
+
+/*!
+ * \brief CrypterDecoder::format
+ *
+ * \return the format flag contained in the header; `Crypter::ObsoleteDefaultEncryptionFormat` as long as nothing has been written.
+ */
+Crypter::FormatFlags CrypterDecoder::format(void) const
+{
+  return d_ptr->format;
+}
+
+
+/*!
+ * \brief CrypterDecoder::KGK
+ *
+ * \return the key generation key contained in the header; empty until the header has been decoded.
+ */
+const SecureByteArray &CrypterDecoder::KGK(void) const
+{
+  return d_ptr->KGK;
+}
+
+
+qint64 CrypterDecoder::bytesWritten(void) const
+{
+  return d_ptr->sink->bytesWritten();
+}
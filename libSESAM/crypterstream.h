@@ -0,0 +1,130 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __CRYPTERSTREAM_H_
+#define __CRYPTERSTREAM_H_
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QIODevice>
+#include <QScopedPointer>
+
+#include "securebytearray.h"
+#include "crypter.h"
+
+class DerivationControl;
+class KeyManager;
+class CompressionPolicy;
+class CrypterEncoderPrivate;
+class CrypterDecoderPrivate;
+
+/*!
+ * \brief The CrypterEncoder class
+ *
+ * Incremental counterpart of `Crypter::encode()`: the data written to the encoder
+ * is compressed, AES encrypted and optionally base64 encoded on the fly, and the
+ * result goes straight to a `QIODevice`. The encoder buffers no more than a few
+ * chunks of `ChunkSize` bytes, however much data passes through it.
+ *
+ * The output has the same format as the one of `Crypter::encode()`; if it is base64
+ * encoded, it is identical to `QByteArray::toBase64()` applied to that format.
+ * The default is `Crypter::AES256EncryptedMasterkeyFormat`, which every version can read.
+ * Versions released before the GCM formats reject 0x02 and up, so these must only be
+ * chosen explicitly for data whose readers are all known to understand them.
+ * How the data gets compressed is set with `setCompressionPolicy()`.
+ *
+ * Call `begin()` once, then `write()` as often as needed, then `finish()`.
+ * Errors reported by Crypto++ are thrown as `CryptoPP::Exception`.
+ *
+ */
+class CrypterEncoder
+{
+public:
+  static const int ChunkSize;
+
+  CrypterEncoder(QIODevice *out, bool compress, bool base64 = false, Crypter::FormatFlags format = Crypter::AES256EncryptedMasterkeyFormat);
+  ~CrypterEncoder();
+
+  void setCompressionPolicy(const CompressionPolicy &policy);
+  bool begin(const SecureByteArray &key, const SecureByteArray &IV, const QByteArray &salt, const SecureByteArray &KGK, qint64 sizeHint = 0, DerivationControl *control = Q_NULLPTR, KeyManager *keyManager = Q_NULLPTR);
+  bool write(const char *data, qint64 size);
+  bool write(const QByteArray &data);
+  bool write(QIODevice *in);
+  bool finish(void);
+  bool hasError(void) const;
+  qint64 bytesWritten(void) const;
+
+private:
+  QScopedPointer<CrypterEncoderPrivate> d_ptr;
+  Q_DECLARE_PRIVATE(CrypterEncoder)
+  Q_DISABLE_COPY(CrypterEncoder)
+};
+
+
+/*!
+ * \brief The CrypterDecoder class
+ *
+ * Incremental counterpart of `Crypter::decode()`: the data written to the decoder is
+ * base64 decoded if requested, decrypted and inflated on the fly, and the plain text
+ * goes straight to a `QIODevice`. The master key gets derived as soon as the header
+ * has arrived, so decryption overlaps with reading the rest of the input.
+ *
+ * Call `write()` as often as needed, then `finish()`. `write()` and `finish()` return
+ * `false` if the data is not in a known format or if the key derivation has been
+ * cancelled via `DerivationControl`. A wrong master password or corrupted data make
+ * Crypto++ throw a `CryptoPP::Exception`.
+ *
+ * With the GCM formats a wrong master password is detected as soon as the
+ * header has been decoded. The payload is authenticated in segments of 64 KB: each
+ * segment reaches the output device only after its tag has been verified, so nothing
+ * unauthenticated gets written and the decoder holds no more than one segment,
+ * however large the payload. A truncated payload is only detected by `finish()`, so
+ * the output must be discarded unless `finish()` succeeds. With
+ * `Crypter::AES256EncryptedMasterkeyFormat` some garbage may already have been written
+ * to the output device when the exception is thrown.
+ *
+ * `uncompress` only applies to the older formats: `Crypter::AES256GCMCompressionFormat`
+ * and the segmented formats record the compression method in their header.
+ * `Crypter::AES256GCMSegmentedFormat` and `Crypter::AES256GCMSegmentedBinaryFormat` carry
+ * a `SegmentedVault` manifest instead of the domain data, so check `format()` after decoding.
+ *
+ */
+class CrypterDecoder
+{
+public:
+  CrypterDecoder(QIODevice *out, const SecureByteArray &masterPassword, bool uncompress, bool base64 = false, DerivationControl *control = Q_NULLPTR, KeyManager *keyManager = Q_NULLPTR);
+  ~CrypterDecoder();
+
+  bool write(const char *data, qint64 size);
+  bool write(const QByteArray &data);
+  bool write(QIODevice *in);
+  bool finish(void);
+  bool hasError(void) const;
+  Crypter::FormatFlags format(void) const;
+  const SecureByteArray &KGK(void) const;
+  qint64 bytesWritten(void) const;
+
+private:
+  QScopedPointer<CrypterDecoderPrivate> d_ptr;
+  Q_DECLARE_PRIVATE(CrypterDecoder)
+  Q_DISABLE_COPY(CrypterDecoder)
+};
+
+
+#endif // __CRYPTERSTREAM_H_
@@ -0,0 +1,96 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "derivationcontrol.h"
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+
+class DerivationControlPrivate {
+public:
+  DerivationControlPrivate(void)
+    : cancelled(0)
+    , total(0)
+    , initial(0)
+    , lastReport(0)
+  { /* ... */ }
+  ~DerivationControlPrivate()
+  { /* ... */ }
+  QAtomicInt cancelled;
+  // only touched by the deriving thread
+  QElapsedTimer timer;
+  int total;
+  int initial;
+  qint64 lastReport;
+};
+
+
+const int DerivationControl::CheckInterval = 256;
+const int DerivationControl::ProgressInterval = 100;
+
+
+DerivationControl::DerivationControl(QObject *parent)
+  : QObject(parent)
+  , d_ptr(new DerivationControlPrivate)
+{ /* ... */ }
+
+
+DerivationControl::~DerivationControl()
+{ /* ... */ }
+
+
+void DerivationControl::cancel(void)
+{
+  d_ptr->cancelled.storeRelease(1);
+}
+
+
+void DerivationControl::reset(void)
+{
+  d_ptr->cancelled.storeRelease(0);
+}
+
+
+bool DerivationControl::isCancelled(void) const
+{
+  return d_ptr->cancelled.loadAcquire() != 0;
+}
+
+
+void DerivationControl::begin(int total, int done)
+{
+  Q_D(DerivationControl);
+  d->total = total;
+  d->initial = done;
+  d->lastReport = 0;
+  d->timer.start();
+}
+
+
+void DerivationControl::report(int done)
+{
+  Q_D(DerivationControl);
+  const qint64 elapsed = d->timer.elapsed();
+  if (elapsed - d->lastReport < ProgressInterval || done <= d->initial)
+    return;
+  d->lastReport = elapsed;
+  const qint64 etaMs = elapsed * (d->total - done) / (done - d->initial);
+  emit progress(done, d->total, etaMs);
+}
@@ -0,0 +1,70 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __DERIVATIONCONTROL_H_
+#define __DERIVATIONCONTROL_H_
+
+#include <QObject>
+#include <QScopedPointer>
+
+class DerivationControlPrivate;
+
+/*!
+ * \brief The DerivationControl class
+ *
+ * Cancellation token and progress sink for long running key derivations.
+ *
+ * `cancel()` may be called from any thread; it only sets an atomic flag which the
+ * deriving thread polls every `CheckInterval` iterations, so cancelling never blocks.
+ *
+ * The deriving thread calls `begin()` once and `report()` after every chunk of
+ * iterations. `progress()` is emitted at most every `ProgressInterval` milliseconds,
+ * derivations finishing faster than that don't emit it at all.
+ * A derivation resumed from a checkpoint passes the iterations already done to
+ * `begin()`, so that the estimated time left only reflects the current run.
+ *
+ */
+class DerivationControl : public QObject
+{
+  Q_OBJECT
+public:
+  explicit DerivationControl(QObject *parent = Q_NULLPTR);
+  ~DerivationControl();
+
+  static const int CheckInterval;
+  static const int ProgressInterval;
+
+  void cancel(void);
+  void reset(void);
+  bool isCancelled(void) const;
+
+  void begin(int total, int done = 0);
+  void report(int done);
+
+signals:
+  void progress(int done, int total, qint64 etaMs);
+
+private:
+  QScopedPointer<DerivationControlPrivate> d_ptr;
+  Q_DECLARE_PRIVATE(DerivationControl)
+  Q_DISABLE_COPY(DerivationControl)
+};
+
+
+#endif // __DERIVATIONCONTROL_H_
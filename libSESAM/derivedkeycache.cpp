@@ -0,0 +1,210 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+
+#include "derivedkeycache.h"
+#include "securearena.h"
+#include "securebuffer.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QScopedArrayPointer>
+#include <QVector>
+
+
+class DerivedKeyCachePrivate {
+public:
+  DerivedKeyCachePrivate(int capacity)
+    : capacity(capacity)
+    , keys(new SecureBuffer[capacity])
+    , hits(0)
+    , misses(0)
+  {
+    for (int i = capacity - 1; i >= 0; --i) {
+      keys[i] = SecureBuffer(DerivedKeyCache::KeySize);
+      freeSlots.append(i);
+    }
+  }
+  char *slot(int i)
+  {
+    return keys[i].data();
+  }
+  int capacity;
+  QScopedArrayPointer<SecureBuffer> keys;
+  quint64 hits;
+  quint64 misses;
+  QHash<QByteArray, int> index;
+  // most recently used entry first
+  QList<QByteArray> lru;
+  QVector<int> freeSlots;
+  mutable QMutex mutex;
+};
+
+
+const int DerivedKeyCache::DefaultCapacity = 64;
+const int DerivedKeyCache::KeySize = 64;
+
+
+DerivedKeyCache::DerivedKeyCache(int capacity)
+  : d_ptr(new DerivedKeyCachePrivate(qMax(1, capacity)))
+{ /* ... */ }
+
+
+DerivedKeyCache::~DerivedKeyCache()
+{ /* ... */ }
+
+
+/*!
+ * \brief DerivedKeyCache::cacheKey
+ *
+ * Computes the address of a derived key. Each field is length-prefixed so that
+ * shifting characters between domain and user name yields a different address.
+ * The KGK only enters as its SHA-256 fingerprint.
+ *
+ * \param ds settings of the domain
+ * \param kgk key generation key the domain key is derived from
+ * \return 32 byte digest
+ */
+QByteArray DerivedKeyCache::cacheKey(const DomainSettings &ds, const SecureByteArray &kgk)
+{
+  QByteArray fields;
+  QDataStream out(&fields, QIODevice::WriteOnly);
+  out << ds.domainName.toUtf8()
+      << ds.userName.toUtf8()
+      << ds.salt_base64.toUtf8()
+      << qint32(ds.iterations)
+      << QCryptographicHash::hash(kgk, QCryptographicHash::Sha256);
+  return QCryptographicHash::hash(fields, QCryptographicHash::Sha256);
+}
+
+
+bool DerivedKeyCache::lookup(const QByteArray &cacheKey, SecureByteArray &derivedKey)
+{
+  Q_D(DerivedKeyCache);
+  QMutexLocker locker(&d->mutex);
+  QHash<QByteArray, int>::const_iterator i = d->index.constFind(cacheKey);
+  if (i == d->index.constEnd()) {
+    ++d->misses;
+    return false;
+  }
+  ++d->hits;
+  d->lru.removeOne(cacheKey);
+  d->lru.prepend(cacheKey);
+  derivedKey = SecureByteArray(d->slot(i.value()), KeySize);
+  return true;
+}
+
+
+/*!
+ * \brief DerivedKeyCache::contains
+ *
+ * Unlike `lookup()` this neither touches the LRU order nor the hit/miss counters.
+ */
+bool DerivedKeyCache::contains(const QByteArray &cacheKey) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->index.contains(cacheKey);
+}
+
+
+void DerivedKeyCache::insert(const QByteArray &cacheKey, const SecureByteArray &derivedKey)
+{
+  Q_D(DerivedKeyCache);
+  Q_ASSERT_X(derivedKey.size() == KeySize, "DerivedKeyCache::insert()", "derived key must be 64 bytes long");
+  if (derivedKey.size() != KeySize)
+    return;
+  QMutexLocker locker(&d->mutex);
+  int slot;
+  if (d->index.contains(cacheKey)) {
+    slot = d->index.value(cacheKey);
+    d->lru.removeOne(cacheKey);
+  }
+  else {
+    if (d->freeSlots.isEmpty()) {
+      const QByteArray &evicted = d->lru.takeLast();
+      const int evictedSlot = d->index.take(evicted);
+      d->keys[evictedSlot].wipe();
+      d->freeSlots.append(evictedSlot);
+    }
+    slot = d->freeSlots.takeLast();
+    d->index.insert(cacheKey, slot);
+  }
+  memcpy(d->slot(slot), derivedKey.constData(), KeySize);
+  d->lru.prepend(cacheKey);
+}
+
+
+void DerivedKeyCache::clear(void)
+{
+  Q_D(DerivedKeyCache);
+  QMutexLocker locker(&d->mutex);
+  for (int i = 0; i < d->capacity; ++i) {
+    d->keys[i].wipe();
+  }
+  d->index.clear();
+  d->lru.clear();
+  d->freeSlots.clear();
+  for (int i = d->capacity - 1; i >= 0; --i) {
+    d->freeSlots.append(i);
+  }
+}
+
+
+int DerivedKeyCache::capacity(void) const
+{
+  return d_ptr->capacity;
+}
+
+
+int DerivedKeyCache::count(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->index.count();
+}
+
+
+quint64 DerivedKeyCache::hits(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->hits;
+}
+
+
+quint64 DerivedKeyCache::misses(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->misses;
+}
+
+
+/*!
+ * \brief DerivedKeyCache::isMemoryLocked
+ *
+ * The slots are served by the `SecureArena`, so this reflects the arena as a whole:
+ * it is `false` as soon as any of its slabs could not be locked into RAM.
+ */
+bool DerivedKeyCache::isMemoryLocked(void) const
+{
+  return SecureArena::statistics().unlockedBytes == 0;
+}
@@ -0,0 +1,74 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __DERIVEDKEYCACHE_H_
+#define __DERIVEDKEYCACHE_H_
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QScopedPointer>
+
+#include "securebytearray.h"
+#include "domainsettings.h"
+
+class DerivedKeyCachePrivate;
+
+/*!
+ * \brief The DerivedKeyCache class
+ *
+ * Bounded LRU cache of PBKDF2-derived domain keys.
+ *
+ * Entries are addressed by `cacheKey()`, a SHA-256 digest of the domain parameters
+ * that enter the key derivation and of a fingerprint of the KGK. The derived keys
+ * themselves live in one `SecureBuffer` per slot, allocated from the `SecureArena`
+ * up front; slots are zeroed when an entry is evicted and when the cache is cleared.
+ *
+ * All functions are thread-safe.
+ *
+ */
+class DerivedKeyCache
+{
+public:
+  static const int DefaultCapacity;
+  static const int KeySize;
+
+  explicit DerivedKeyCache(int capacity = DefaultCapacity);
+  ~DerivedKeyCache();
+
+  static QByteArray cacheKey(const DomainSettings &ds, const SecureByteArray &kgk);
+
+  bool lookup(const QByteArray &cacheKey, SecureByteArray &derivedKey);
+  bool contains(const QByteArray &cacheKey) const;
+  void insert(const QByteArray &cacheKey, const SecureByteArray &derivedKey);
+  void clear(void);
+
+  int capacity(void) const;
+  int count(void) const;
+  quint64 hits(void) const;
+  quint64 misses(void) const;
+  bool isMemoryLocked(void) const;
+
+private:
+  QScopedPointer<DerivedKeyCachePrivate> d_ptr;
+  Q_DECLARE_PRIVATE(DerivedKeyCache)
+  Q_DISABLE_COPY(DerivedKeyCache)
+};
+
+
+#endif // __DERIVEDKEYCACHE_H_
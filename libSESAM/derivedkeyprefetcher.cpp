@@ -0,0 +1,195 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "derivedkeyprefetcher.h"
+#include "derivedkeycache.h"
+#include "derivationcontrol.h"
+#include "passwordgenerator.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QSet>
+#include <QSharedPointer>
+#include <QThread>
+#include <QThreadPool>
+
+
+class DerivedKeyPrefetcherPrivate {
+public:
+  DerivedKeyPrefetcherPrivate(DerivedKeyCache *cache)
+    : cache(cache)
+    , maxCandidates(DerivedKeyPrefetcher::DefaultMaxCandidates)
+  {
+    pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+  }
+  ~DerivedKeyPrefetcherPrivate()
+  { /* ... */ }
+  DerivedKeyCache *cache;
+  int maxCandidates;
+  QThreadPool pool;
+  mutable QMutex mutex;
+  // running derivations by cache key
+  QHash<QByteArray, QSharedPointer<DerivationControl> > jobs;
+};
+
+
+class PrefetchJob : public QRunnable
+{
+public:
+  PrefetchJob(DerivedKeyPrefetcherPrivate *d, const DomainSettings &ds, const SecureByteArray &kgk, const QByteArray &cacheKey, QSharedPointer<DerivationControl> control)
+    : d(d)
+    , ds(ds)
+    , kgk(kgk)
+    , cacheKey(cacheKey)
+    , control(control)
+  { /* ... */ }
+  void run(void)
+  {
+    QThread::currentThread()->setPriority(QThread::IdlePriority);
+    if (!control->isCancelled()) {
+      PasswordBuffer buffer;
+      if (PasswordGenerator::deriveKey(ds, kgk, buffer, control.data())) {
+        d->cache->insert(cacheKey, SecureByteArray(buffer.derivedKey(), PasswordBuffer::DerivedKeySize));
+      }
+    }
+    QMutexLocker locker(&d->mutex);
+    if (d->jobs.value(cacheKey) == control) {
+      d->jobs.remove(cacheKey);
+    }
+  }
+
+private:
+  DerivedKeyPrefetcherPrivate *d;
+  DomainSettings ds;
+  SecureByteArray kgk;
+  QByteArray cacheKey;
+  QSharedPointer<DerivationControl> control;
+};
+
+
+const int DerivedKeyPrefetcher::DefaultMaxCandidates = 3;
+
+
+DerivedKeyPrefetcher::DerivedKeyPrefetcher(DerivedKeyCache *cache, QObject *parent)
+  : QObject(parent)
+  , d_ptr(new DerivedKeyPrefetcherPrivate(cache))
+{ /* ... */ }
+
+
+DerivedKeyPrefetcher::~DerivedKeyPrefetcher()
+{
+  cancel();
+  waitForDone();
+}
+
+
+/*!
+ * \brief DerivedKeyPrefetcher::prefetch
+ *
+ * Starts deriving the keys of the first `maxCandidates()` domains in `candidates`
+ * unless they are cached or already being derived. Running derivations of all
+ * other domains are cancelled.
+ *
+ * \param candidates domains in descending order of likelihood
+ * \param kgk key generation key
+ */
+void DerivedKeyPrefetcher::prefetch(const QList<DomainSettings> &candidates, const SecureByteArray &kgk)
+{
+  Q_D(DerivedKeyPrefetcher);
+  QList<QPair<QByteArray, DomainSettings> > wanted;
+  QSet<QByteArray> wantedKeys;
+  foreach (DomainSettings ds, candidates) {
+    if (wanted.size() >= d->maxCandidates)
+      break;
+    const QByteArray &cacheKey = DerivedKeyCache::cacheKey(ds, kgk);
+    if (!wantedKeys.contains(cacheKey)) {
+      wanted << qMakePair(cacheKey, ds);
+      wantedKeys << cacheKey;
+    }
+  }
+  QMutexLocker locker(&d->mutex);
+  foreach (QByteArray cacheKey, d->jobs.keys()) {
+    if (!wantedKeys.contains(cacheKey)) {
+      d->jobs.value(cacheKey)->cancel();
+    }
+  }
+  for (int i = 0; i < wanted.size(); ++i) {
+    const QByteArray &cacheKey = wanted.at(i).first;
+    if (d->jobs.contains(cacheKey) && !d->jobs.value(cacheKey)->isCancelled())
+      continue;
+    if (d->cache->contains(cacheKey))
+      continue;
+    QSharedPointer<DerivationControl> control(new DerivationControl);
+    d->jobs.insert(cacheKey, control);
+    // jobs started first are dequeued first
+    d->pool.start(new PrefetchJob(d, wanted.at(i).second, kgk, cacheKey, control), wanted.size() - i);
+  }
+}
+
+
+/*!
+ * \brief DerivedKeyPrefetcher::cancel
+ *
+ * Cancels all derivations without waiting for them to stop.
+ */
+void DerivedKeyPrefetcher::cancel(void)
+{
+  Q_D(DerivedKeyPrefetcher);
+  QMutexLocker locker(&d->mutex);
+  foreach (QSharedPointer<DerivationControl> control, d->jobs) {
+    control->cancel();
+  }
+}
+
+
+/*!
+ * \brief DerivedKeyPrefetcher::waitForDone
+ *
+ * Blocks until no derivation is running. As cancelled derivations stop
+ * within `DerivationControl::CheckInterval` iterations, waiting after
+ * `cancel()` takes no noticeable time.
+ */
+void DerivedKeyPrefetcher::waitForDone(void)
+{
+  d_ptr->pool.waitForDone();
+}
+
+
+int DerivedKeyPrefetcher::pendingCount(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->jobs.count();
+}
+
+
+void DerivedKeyPrefetcher::setMaxCandidates(int n)
+{
+  Q_D(DerivedKeyPrefetcher);
+  QMutexLocker locker(&d->mutex);
+  d->maxCandidates = qMax(0, n);
+}
+
+
+int DerivedKeyPrefetcher::maxCandidates(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->maxCandidates;
+}
@@ -0,0 +1,67 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __DERIVEDKEYPREFETCHER_H_
+#define __DERIVEDKEYPREFETCHER_H_
+
+#include <QObject>
+#include <QList>
+#include <QScopedPointer>
+
+#include "securebytearray.h"
+#include "domainsettings.h"
+
+class DerivedKeyCache;
+class DerivedKeyPrefetcherPrivate;
+
+/*!
+ * \brief The DerivedKeyPrefetcher class
+ *
+ * Speculatively derives the keys of domains the user is likely to pick next
+ * and stores them in a `DerivedKeyCache`, where `Password::generate()` finds them.
+ *
+ * The derivations run at idle thread priority in a pool of its own that leaves
+ * one core to the foreground generation. Each call to `prefetch()` replaces the
+ * set of candidates: derivations of domains no longer among them are cancelled.
+ *
+ */
+class DerivedKeyPrefetcher : public QObject
+{
+  Q_OBJECT
+public:
+  explicit DerivedKeyPrefetcher(DerivedKeyCache *cache, QObject *parent = Q_NULLPTR);
+  ~DerivedKeyPrefetcher();
+
+  static const int DefaultMaxCandidates;
+
+  void prefetch(const QList<DomainSettings> &candidates, const SecureByteArray &kgk);
+  void cancel(void);
+  void waitForDone(void);
+  int pendingCount(void) const;
+  void setMaxCandidates(int);
+  int maxCandidates(void) const;
+
+private:
+  QScopedPointer<DerivedKeyPrefetcherPrivate> d_ptr;
+  Q_DECLARE_PRIVATE(DerivedKeyPrefetcher)
+  Q_DISABLE_COPY(DerivedKeyPrefetcher)
+};
+
+
+#endif // __DERIVEDKEYPREFETCHER_H_
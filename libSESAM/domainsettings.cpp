@@ -18,6 +18,8 @@
 */
 
 #include "domainsettings.h"
+#include "jsonstream.h"
+#include "binarystream.h"
 
 #include <QDebug>
 #include <QByteArray>
@@ -50,6 +52,32 @@ const QString DomainSettings::TAGS = "tags";
 const QString DomainSettings::FILES = "files";
 
 
+namespace {
+
+// field numbers of the binary encoding; never reuse or renumber them
+enum BinaryField {
+  DomainNameField = 1,
+  UrlField,
+  UserNameField,
+  LegacyPasswordField,
+  NotesField,
+  SaltField,
+  IterationsField,
+  CDateField,
+  MDateField,
+  DeletedField,
+  ExtraCharactersField,
+  UsedCharactersField,
+  PasswordTemplateField,
+  GroupField,
+  ExpiryDateField,
+  TagField,
+  FilesField
+};
+
+}
+
+
 DomainSettings::DomainSettings(void)
   : salt_base64(DefaultSalt_base64)
   , iterations(DefaultIterations)
@@ -180,6 +208,341 @@ DomainSettings DomainSettings::fromVariantMap(const QVariantMap &map)
 }
 
 
+/*!
+ * Writes the same JSON object as `QJsonDocument::fromVariant(toVariantMap())` in
+ * compact form. The keys appear in the order in which `QJsonObject` sorts them.
+ */
+void DomainSettings::writeJson(JsonStreamWriter &out) const
+{
+  const bool generated = !deleted && legacyPassword.isEmpty();
+  out.beginObject();
+  out.writeKey(CDATE);
+  out.writeDateTime(createdDate);
+  if (deleted) {
+    out.writeKey(DELETED);
+    out.writeBool(true);
+  }
+  out.writeKey(DOMAIN_NAME);
+  out.writeString(domainName);
+  if (!deleted && !expiryDate.isNull()) {
+    out.writeKey(EXPIRY_DATE);
+    out.writeDateTime(expiryDate);
+  }
+  if (generated && !extraCharacters.isEmpty()) {
+    out.writeKey(EXTRA_CHARACTERS);
+    out.writeString(extraCharacters);
+  }
+  if (!deleted && !files.isEmpty()) {
+    out.writeKey(FILES);
+    out.writeVariantMap(files);
+  }
+  if (!deleted && !groupHierarchy.isEmpty()) {
+    out.writeKey(GROUP);
+    out.writeString(groupHierarchy);
+  }
+  if (generated) {
+    out.writeKey(ITERATIONS);
+    out.writeInt(iterations);
+  }
+  if (!deleted && !legacyPassword.isEmpty()) {
+    out.writeKey(LEGACY_PASSWORD);
+    out.writeString(legacyPassword);
+  }
+  if (modifiedDate.isValid()) {
+    out.writeKey(MDATE);
+    out.writeDateTime(modifiedDate);
+  }
+  if (!deleted && !notes.isEmpty()) {
+    out.writeKey(NOTES);
+    out.writeString(notes);
+  }
+  if (generated && !passwordTemplate.isEmpty()) {
+    out.writeKey(PASSWORD_TEMPLATE);
+    out.writeString(passwordTemplate);
+  }
+  if (generated) {
+    out.writeKey(SALT);
+    out.writeString(salt_base64);
+  }
+  if (!deleted && !tags.isEmpty()) {
+    out.writeKey(TAGS);
+    out.writeString(tags.join(QChar('\t')));
+  }
+  if (!deleted && !url.isEmpty()) {
+    out.writeKey(URL);
+    out.writeString(url);
+  }
+#ifndef OMIT_V2_CODE
+  if (generated && !usedCharacters.isEmpty()) {
+    out.writeKey(USED_CHARACTERS);
+    out.writeString(usedCharacters);
+  }
+#endif
+  if (!deleted && !userName.isEmpty()) {
+    out.writeKey(USER_NAME);
+    out.writeString(userName);
+  }
+  out.endObject();
+}
+
+
+static QString readJsonString(JsonStreamReader &in)
+{
+  return in.peek() == JsonStreamReader::String
+      ? in.readString()
+      : in.readVariant().toString();
+}
+
+
+/*!
+ * Reads a JSON object into a `DomainSettings` with the same result as
+ * `fromVariantMap()` applied to the object's `QVariantMap`. Unknown keys are
+ * skipped; a value that is not an object yields an empty record.
+ */
+DomainSettings DomainSettings::readJson(JsonStreamReader &in)
+{
+  DomainSettings ds;
+  ds.salt_base64.clear();
+  ds.iterations = 0;
+  if (!in.beginObject()) {
+    in.skipValue();
+    return ds;
+  }
+  QString key;
+  while (in.nextMember(key)) {
+    if (key == DOMAIN_NAME) {
+      ds.domainName = readJsonString(in);
+    }
+    else if (key == CDATE) {
+      ds.createdDate = QDateTime::fromString(readJsonString(in), Qt::ISODate);
+    }
+    else if (key == MDATE) {
+      ds.modifiedDate = QDateTime::fromString(readJsonString(in), Qt::ISODate);
+    }
+    else if (key == SALT) {
+      ds.salt_base64 = in.peek() == JsonStreamReader::String
+          ? in.readString()
+          : QString(in.readVariant().toByteArray());
+    }
+    else if (key == ITERATIONS) {
+      ds.iterations = in.peek() == JsonStreamReader::Number
+          ? int(qRound64(in.readNumber()))
+          : in.readVariant().toInt();
+    }
+    else if (key == DELETED) {
+      ds.deleted = in.peek() == JsonStreamReader::Bool
+          ? in.readBool()
+          : in.readVariant().toBool();
+    }
+    else if (key == USER_NAME) {
+      ds.userName = readJsonString(in);
+    }
+    else if (key == URL) {
+      ds.url = readJsonString(in);
+    }
+    else if (key == LEGACY_PASSWORD) {
+      ds.legacyPassword = readJsonString(in);
+    }
+    else if (key == NOTES) {
+      ds.notes = readJsonString(in);
+    }
+    else if (key == EXTRA_CHARACTERS) {
+      ds.extraCharacters = readJsonString(in);
+    }
+#ifndef OMIT_V2_CODE
+    else if (key == USED_CHARACTERS) {
+      ds.usedCharacters = readJsonString(in);
+    }
+#endif
+    else if (key == PASSWORD_TEMPLATE) {
+      ds.passwordTemplate = in.peek() == JsonStreamReader::String
+          ? in.readString()
+          : QString(in.readVariant().toByteArray());
+    }
+    else if (key == GROUP) {
+      ds.groupHierarchy = readJsonString(in);
+    }
+    else if (key == EXPIRY_DATE) {
+      ds.expiryDate = in.readVariant().toDateTime();
+    }
+    else if (key == TAGS) {
+      ds.tags = readJsonString(in).split(QChar('\t'), QString::SkipEmptyParts);
+    }
+    else if (key == FILES) {
+      ds.files = in.readVariant().toMap();
+    }
+    else {
+      in.skipValue();
+    }
+  }
+  return ds;
+}
+
+
+/*!
+ * \return `dateTime` as it reads back after a round trip through JSON. Before Qt 5.8
+ * `Qt::ISODate` drops the milliseconds, so they must not count there either.
+ */
+QDateTime DomainSettings::storedDateTime(const QDateTime &dateTime)
+{
+#if QT_VERSION < QT_VERSION_CHECK(5, 8, 0)
+  if (dateTime.isValid() && dateTime.time().msec() != 0)
+    return dateTime.addMSecs(-dateTime.time().msec());
+#endif
+  return dateTime;
+}
+
+
+/*!
+ * Writes the fields that `toVariantMap()` would contain in the binary encoding.
+ * Dates are stored as milliseconds since the epoch, with the precision of the JSON
+ * encoding (see `storedDateTime()`), so that both encodings yield the same dates.
+ * The salt is stored as raw bytes if it is valid base64, each tag as a field of its
+ * own and the attached files as JSON.
+ */
+void DomainSettings::writeBinary(BinaryStreamWriter &out) const
+{
+  const bool generated = !deleted && legacyPassword.isEmpty();
+  out.writeString(DomainNameField, domainName);
+  if (deleted) {
+    out.writeUInt(DeletedField, 1);
+  }
+  if (createdDate.isValid()) {
+    out.writeInt(CDateField, storedDateTime(createdDate).toMSecsSinceEpoch());
+  }
+  if (modifiedDate.isValid()) {
+    out.writeInt(MDateField, storedDateTime(modifiedDate).toMSecsSinceEpoch());
+  }
+  if (!deleted) {
+    if (!userName.isEmpty()) {
+      out.writeString(UserNameField, userName);
+    }
+    if (!url.isEmpty()) {
+      out.writeString(UrlField, url);
+    }
+    if (!notes.isEmpty()) {
+      out.writeString(NotesField, notes);
+    }
+    if (!groupHierarchy.isEmpty()) {
+      out.writeString(GroupField, groupHierarchy);
+    }
+    if (expiryDate.isValid()) {
+      out.writeInt(ExpiryDateField, storedDateTime(expiryDate).toMSecsSinceEpoch());
+    }
+    foreach (const QString &tag, tags) {
+      if (!tag.isEmpty()) {
+        out.writeString(TagField, tag);
+      }
+    }
+    if (!files.isEmpty()) {
+      out.writeBytes(FilesField, QJsonDocument::fromVariant(files).toJson(QJsonDocument::Compact));
+    }
+    if (!legacyPassword.isEmpty()) {
+      out.writeString(LegacyPasswordField, legacyPassword);
+    }
+  }
+  if (generated) {
+    const QByteArray &salt = QByteArray::fromBase64(salt_base64.toLatin1());
+    if (QString::fromLatin1(salt.toBase64()) == salt_base64) {
+      out.writeBytes(SaltField, salt);
+    }
+    else {
+      out.writeString(SaltField, salt_base64);
+    }
+    out.writeInt(IterationsField, iterations);
+    if (!extraCharacters.isEmpty()) {
+      out.writeString(ExtraCharactersField, extraCharacters);
+    }
+#ifndef OMIT_V2_CODE
+    if (!usedCharacters.isEmpty()) {
+      out.writeString(UsedCharactersField, usedCharacters);
+    }
+#endif
+    if (!passwordTemplate.isEmpty()) {
+      out.writeString(PasswordTemplateField, passwordTemplate);
+    }
+  }
+  out.endRecord();
+}
+
+
+/*!
+ * Reads a record written by `writeBinary()`. Missing fields get the same values as
+ * with `fromVariantMap()`, so both encodings yield the same `DomainSettings`.
+ * Unknown fields are skipped.
+ */
+DomainSettings DomainSettings::readBinary(BinaryStreamReader &in)
+{
+  DomainSettings ds;
+  ds.salt_base64.clear();
+  ds.iterations = 0;
+  int field = 0;
+  while (in.nextField(field)) {
+    switch (field) {
+    case DomainNameField:
+      ds.domainName = in.readString();
+      break;
+    case UrlField:
+      ds.url = in.readString();
+      break;
+    case UserNameField:
+      ds.userName = in.readString();
+      break;
+    case LegacyPasswordField:
+      ds.legacyPassword = in.readString();
+      break;
+    case NotesField:
+      ds.notes = in.readString();
+      break;
+    case SaltField:
+      ds.salt_base64 = in.wireType() == BinaryStreamWriter::Bytes
+          ? QString::fromLatin1(in.readBytes().toBase64())
+          : in.readString();
+      break;
+    case IterationsField:
+      ds.iterations = int(in.readInt());
+      break;
+    case CDateField:
+      ds.createdDate = QDateTime::fromMSecsSinceEpoch(in.readInt());
+      break;
+    case MDateField:
+      ds.modifiedDate = QDateTime::fromMSecsSinceEpoch(in.readInt());
+      break;
+    case DeletedField:
+      ds.deleted = in.readUInt() != 0;
+      break;
+    case ExtraCharactersField:
+      ds.extraCharacters = in.readString();
+      break;
+#ifndef OMIT_V2_CODE
+    case UsedCharactersField:
+      ds.usedCharacters = in.readString();
+      break;
+#endif
+    case PasswordTemplateField:
+      ds.passwordTemplate = in.readString();
+      break;
+    case GroupField:
+      ds.groupHierarchy = in.readString();
+      break;
+    case ExpiryDateField:
+      ds.expiryDate = QDateTime::fromMSecsSinceEpoch(in.readInt());
+      break;
+    case TagField:
+      ds.tags.append(in.readString());
+      break;
+    case FilesField:
+      ds.files = QJsonDocument::fromJson(in.readBytes()).toVariant().toMap();
+      break;
+    default:
+      in.skipField();
+      break;
+    }
+  }
+  return ds;
+}
+
+
 #ifndef OMIT_V2_CODE
 bool DomainSettings::isV2Template(const QString &templ)
 {
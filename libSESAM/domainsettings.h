@@ -32,6 +32,11 @@
 
 #include "securestring.h"
 
+class JsonStreamWriter;
+class JsonStreamReader;
+class BinaryStreamWriter;
+class BinaryStreamReader;
+
 // PLEASE ASK MAINTAINER BEFORE UNCOMMENTING THE FOLLOWING LINE!
 // #define OMIT_V2_CODE
 
@@ -42,10 +47,15 @@ public:
 
   bool expired(void) const;
   QVariantMap toVariantMap(void) const;
+  void writeJson(JsonStreamWriter &) const;
+  void writeBinary(BinaryStreamWriter &) const;
   bool isEmpty(void) const;
   void clear(void);
 
   static DomainSettings fromVariantMap(const QVariantMap &);
+  static DomainSettings readJson(JsonStreamReader &);
+  static DomainSettings readBinary(BinaryStreamReader &);
+  static QDateTime storedDateTime(const QDateTime &);
 #ifndef OMIT_V2_CODE
   static bool isV2Template(const QString &);
 #endif
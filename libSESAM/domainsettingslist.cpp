@@ -18,65 +18,576 @@
 */
 
 #include "domainsettingslist.h"
+#include "jsonstream.h"
+#include "binarystream.h"
 
 #include <QtDebug>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <algorithm>
+
+
+const int DomainSettingsList::BinaryVersion = 1;
+
+static const int JsonFlushSize = 64 * 1024;
 
 
 DomainSettingsList::DomainSettingsList(void)
-  : mDirty(false)
+  : mIndexValid(1)
+  , mDirty(false)
 {
   // ...
 }
 
 
-DomainSettings DomainSettingsList::at(const QString &domainName) const
+DomainSettingsList::DomainSettingsList(const DomainSettingsList &other)
+  : mRecords(other.mRecords)
+  , mIndexValid(0)
+  , mDirty(other.mDirty)
 {
-  for (DomainSettingsList::const_iterator ds = constBegin(); ds != constEnd(); ++ds)
-    if (ds->domainName == domainName)
-      return *ds;
-  return DomainSettings();
+  // another thread may be rebuilding the index of `other`, so only a complete one is taken over
+  if (other.mIndexValid.loadAcquire()) {
+    mIndex = other.mIndex;
+    mIndexValid.storeRelease(1);
+  }
 }
 
 
-DomainSettings DomainSettingsList::at(int idx) const
+DomainSettingsList::DomainSettingsList(const QList<DomainSettings> &records)
+  : mRecords(records)
+  , mIndexValid(0)
+  , mDirty(false)
 {
-  return QList<DomainSettings>::at(idx);
+  // ...
 }
 
 
-void DomainSettingsList::remove(const QString &domainName)
+DomainSettingsList &DomainSettingsList::operator=(const DomainSettingsList &other)
 {
-  int toDeleteIdx = -1;
-  for (int i = 0; i < count(); ++i) {
-    if (at(i).domainName == domainName) {
-      toDeleteIdx = i;
-      break;
+  if (this != &other) {
+    mRecords = other.mRecords;
+    mDirty = other.mDirty;
+    if (other.mIndexValid.loadAcquire()) {
+      mIndex = other.mIndex;
+      mIndexValid.storeRelease(1);
+    }
+    else {
+      invalidateIndex();
     }
   }
-  if (toDeleteIdx > -1)
-    removeAt(toDeleteIdx);
-  setDirty();
+  return *this;
 }
 
 
-void DomainSettingsList::updateWith(const DomainSettings &src)
+void DomainSettingsList::invalidateIndex(void)
 {
-  bool found = false;
-  for (auto d = begin(); d != end() && !found; ++d) {
-    if (d->domainName == src.domainName) {
-      *d = src;
-      found = true;
+  mIndexValid.storeRelease(0);
+  mIndex.clear();
+}
+
+
+/*!
+ * Rebuilds the name index if a mutable accessor may have outdated it.
+ * Const functions may run in several threads at once, so the rebuild is serialized.
+ */
+void DomainSettingsList::ensureIndex(void) const
+{
+  if (mIndexValid.loadAcquire())
+    return;
+  static QMutex mutex;
+  QMutexLocker locker(&mutex);
+  if (mIndexValid.loadAcquire())
+    return;
+  mIndex.clear();
+  mIndex.reserve(mRecords.size());
+  for (int i = 0; i < mRecords.size(); ++i) {
+    const QString &name = mRecords.at(i).domainName;
+    if (!mIndex.contains(name)) {
+      mIndex.insert(name, i);
     }
   }
-  if (!found)
+  mIndexValid.storeRelease(1);
+}
+
+
+/*!
+ * Fixes the index after the record `removedName` at position `idx` has been removed:
+ * the records behind it moved up by one, and the first of them named `removedName`,
+ * if any, is now the first record of that name.
+ */
+void DomainSettingsList::reindexFrom(int idx, const QString &removedName)
+{
+  if (!mIndexValid.loadAcquire())
+    return;
+  if (mIndex.value(removedName, -1) == idx) {
+    mIndex.remove(removedName);
+  }
+  for (int i = idx; i < mRecords.size(); ++i) {
+    const QString &name = mRecords.at(i).domainName;
+    QHash<QString, int>::iterator entry = mIndex.find(name);
+    if (entry == mIndex.end()) {
+      mIndex.insert(name, i);
+    }
+    else if (entry.value() > i) {
+      entry.value() = i;
+    }
+  }
+}
+
+
+int DomainSettingsList::count(void) const
+{
+  return mRecords.count();
+}
+
+
+int DomainSettingsList::size(void) const
+{
+  return mRecords.size();
+}
+
+
+int DomainSettingsList::length(void) const
+{
+  return mRecords.length();
+}
+
+
+bool DomainSettingsList::isEmpty(void) const
+{
+  return mRecords.isEmpty();
+}
+
+
+bool DomainSettingsList::empty(void) const
+{
+  return mRecords.isEmpty();
+}
+
+
+/*!
+ * \brief DomainSettingsList::at
+ *
+ * \param domainName name of the domain to look up
+ * \return the settings of `domainName`, or empty settings if the list doesn't contain that domain
+ */
+const DomainSettings &DomainSettingsList::at(const QString &domainName) const
+{
+  static const DomainSettings Empty;
+  const int idx = indexOf(domainName);
+  return (idx < 0) ? Empty : mRecords.at(idx);
+}
+
+
+const DomainSettings &DomainSettingsList::at(int idx) const
+{
+  return mRecords.at(idx);
+}
+
+
+DomainSettings DomainSettingsList::value(int idx) const
+{
+  return mRecords.value(idx);
+}
+
+
+DomainSettings &DomainSettingsList::operator[](int idx)
+{
+  invalidateIndex();
+  return mRecords[idx];
+}
+
+
+const DomainSettings &DomainSettingsList::operator[](int idx) const
+{
+  return mRecords.at(idx);
+}
+
+
+DomainSettings &DomainSettingsList::first(void)
+{
+  invalidateIndex();
+  return mRecords.first();
+}
+
+
+const DomainSettings &DomainSettingsList::first(void) const
+{
+  return mRecords.first();
+}
+
+
+DomainSettings &DomainSettingsList::last(void)
+{
+  invalidateIndex();
+  return mRecords.last();
+}
+
+
+const DomainSettings &DomainSettingsList::last(void) const
+{
+  return mRecords.last();
+}
+
+
+/*!
+ * \brief DomainSettingsList::indexOf
+ *
+ * \return the position of the first record named `domainName`, or -1 if there is none
+ */
+int DomainSettingsList::indexOf(const QString &domainName) const
+{
+  ensureIndex();
+  return mIndex.value(domainName, -1);
+}
+
+
+bool DomainSettingsList::contains(const QString &domainName) const
+{
+  ensureIndex();
+  return mIndex.contains(domainName);
+}
+
+
+DomainSettingsList::iterator DomainSettingsList::begin(void)
+{
+  invalidateIndex();
+  return mRecords.begin();
+}
+
+
+DomainSettingsList::iterator DomainSettingsList::end(void)
+{
+  invalidateIndex();
+  return mRecords.end();
+}
+
+
+DomainSettingsList::const_iterator DomainSettingsList::begin(void) const
+{
+  return mRecords.constBegin();
+}
+
+
+DomainSettingsList::const_iterator DomainSettingsList::end(void) const
+{
+  return mRecords.constEnd();
+}
+
+
+DomainSettingsList::const_iterator DomainSettingsList::cbegin(void) const
+{
+  return mRecords.constBegin();
+}
+
+
+DomainSettingsList::const_iterator DomainSettingsList::cend(void) const
+{
+  return mRecords.constEnd();
+}
+
+
+DomainSettingsList::const_iterator DomainSettingsList::constBegin(void) const
+{
+  return mRecords.constBegin();
+}
+
+
+DomainSettingsList::const_iterator DomainSettingsList::constEnd(void) const
+{
+  return mRecords.constEnd();
+}
+
+
+/*!
+ * \brief DomainSettingsList::append
+ *
+ * Adds `ds` to the end of the list, also if there already is a record of the same name.
+ * Unlike `updateWith()` this doesn't mark the list as dirty.
+ *
+ * \param ds the settings to add
+ */
+void DomainSettingsList::append(const DomainSettings &ds)
+{
+  if (mIndexValid.loadAcquire() && !mIndex.contains(ds.domainName)) {
+    mIndex.insert(ds.domainName, mRecords.size());
+  }
+  mRecords.append(ds);
+}
+
+
+void DomainSettingsList::append(const DomainSettingsList &other)
+{
+  if (isEmpty()) {
+    const bool dirty = mDirty;
+    *this = other;
+    mDirty = dirty;
+    return;
+  }
+  mRecords.reserve(mRecords.size() + other.size());
+  for (const_iterator ds = other.constBegin(); ds != other.constEnd(); ++ds) {
+    append(*ds);
+  }
+}
+
+
+void DomainSettingsList::prepend(const DomainSettings &ds)
+{
+  invalidateIndex();
+  mRecords.prepend(ds);
+}
+
+
+void DomainSettingsList::insert(int idx, const DomainSettings &ds)
+{
+  if (idx >= mRecords.size()) {
+    append(ds);
+  }
+  else {
+    invalidateIndex();
+    mRecords.insert(idx, ds);
+  }
+}
+
+
+void DomainSettingsList::push_back(const DomainSettings &ds)
+{
+  append(ds);
+}
+
+
+DomainSettingsList &DomainSettingsList::operator<<(const DomainSettings &ds)
+{
+  append(ds);
+  return *this;
+}
+
+
+DomainSettingsList &DomainSettingsList::operator<<(const DomainSettingsList &other)
+{
+  append(other);
+  return *this;
+}
+
+
+DomainSettingsList &DomainSettingsList::operator+=(const DomainSettings &ds)
+{
+  append(ds);
+  return *this;
+}
+
+
+DomainSettingsList &DomainSettingsList::operator+=(const DomainSettingsList &other)
+{
+  append(other);
+  return *this;
+}
+
+
+void DomainSettingsList::replace(int idx, const DomainSettings &ds)
+{
+  if (ds.domainName != mRecords.at(idx).domainName) {
+    invalidateIndex();
+  }
+  mRecords.replace(idx, ds);
+}
+
+
+void DomainSettingsList::removeAt(int idx)
+{
+  // the name must be copied, as the record it belongs to is about to be destroyed
+  const QString removedName = mRecords.at(idx).domainName;
+  mRecords.removeAt(idx);
+  reindexFrom(idx, removedName);
+}
+
+
+void DomainSettingsList::removeFirst(void)
+{
+  removeAt(0);
+}
+
+
+void DomainSettingsList::removeLast(void)
+{
+  removeAt(mRecords.size() - 1);
+}
+
+
+DomainSettings DomainSettingsList::takeAt(int idx)
+{
+  const DomainSettings ds = mRecords.at(idx);
+  removeAt(idx);
+  return ds;
+}
+
+
+DomainSettings DomainSettingsList::takeFirst(void)
+{
+  return takeAt(0);
+}
+
+
+DomainSettings DomainSettingsList::takeLast(void)
+{
+  return takeAt(mRecords.size() - 1);
+}
+
+
+DomainSettingsList::iterator DomainSettingsList::erase(iterator pos)
+{
+  const int idx = int(pos - mRecords.begin());
+  removeAt(idx);
+  return mRecords.begin() + idx;
+}
+
+
+void DomainSettingsList::move(int from, int to)
+{
+  invalidateIndex();
+  mRecords.move(from, to);
+}
+
+
+void DomainSettingsList::swap(int i, int j)
+{
+  invalidateIndex();
+  mRecords.swap(i, j);
+}
+
+
+void DomainSettingsList::reserve(int size)
+{
+  mRecords.reserve(size);
+}
+
+
+DomainSettingsList DomainSettingsList::mid(int pos, int length) const
+{
+  return DomainSettingsList(mRecords.mid(pos, length));
+}
+
+
+void DomainSettingsList::clear(void)
+{
+  mRecords.clear();
+  mIndex.clear();
+  mIndexValid.storeRelease(1);
+}
+
+
+/*!
+ * \brief DomainSettingsList::remove
+ *
+ * Removes the first record named `domainName`. The records behind it keep their order.
+ */
+void DomainSettingsList::remove(const QString &domainName)
+{
+  const int idx = indexOf(domainName);
+  if (idx > -1) {
+    removeAt(idx);
+  }
+  setDirty();
+}
+
+
+/*!
+ * \brief DomainSettingsList::updateWith
+ *
+ * Replaces the first record named like `src` with `src`, or appends `src` if there is none.
+ */
+void DomainSettingsList::updateWith(const DomainSettings &src)
+{
+  const int idx = indexOf(src.domainName);
+  if (idx < 0) {
     append(src);
+  }
+  else {
+    mRecords[idx] = src;
+  }
   setDirty();
 }
 
 
+/*!
+ * \brief DomainSettingsList::operator const QList<DomainSettings> &
+ *
+ * Gives read access to the records, e.g. for passing them to `PasswordBatch`.
+ */
+DomainSettingsList::operator const QList<DomainSettings> &(void) const
+{
+  return mRecords;
+}
+
+
+const QList<DomainSettings> &DomainSettingsList::toList(void) const
+{
+  return mRecords;
+}
+
+
 QByteArray DomainSettingsList::toJson(void) const
 {
-  return toJsonDocument().toJson(QJsonDocument::Compact);
+  QByteArray json;
+  json.reserve(256 * mRecords.size() + 2);
+  writeJson(json, Q_NULLPTR);
+  return json;
+}
+
+
+/*!
+ * Streams the JSON text to `out` in pieces of about `JsonFlushSize` bytes.
+ * Returns `false` if writing to `out` failed.
+ */
+bool DomainSettingsList::toJson(QIODevice *out) const
+{
+  QByteArray buffer;
+  buffer.reserve(JsonFlushSize + 4096);
+  return writeJson(buffer, out);
+}
+
+
+static bool nameLessThan(const DomainSettings *a, const DomainSettings *b)
+{
+  return a->domainName < b->domainName;
+}
+
+
+QVector<const DomainSettings *> DomainSettingsList::sortedByName(void) const
+{
+  QVector<const DomainSettings *> sorted;
+  sorted.reserve(mRecords.size());
+  for (DomainSettingsList::const_iterator d = constBegin(); d != constEnd(); ++d) {
+    sorted.append(&*d);
+  }
+  std::stable_sort(sorted.begin(), sorted.end(), nameLessThan);
+  return sorted;
+}
+
+
+bool DomainSettingsList::writeJson(QByteArray &buffer, QIODevice *out) const
+{
+  // QJsonObject keeps its keys sorted, so the records must appear in that order, too
+  const QVector<const DomainSettings *> &sorted = sortedByName();
+  JsonStreamWriter writer(&buffer);
+  writer.beginObject();
+  for (int i = 0; i < sorted.size(); ++i) {
+    const DomainSettings *ds = sorted.at(i);
+    // like in a QVariantMap, the last of several records of the same name wins
+    if (i + 1 < sorted.size() && sorted.at(i + 1)->domainName == ds->domainName)
+      continue;
+    writer.writeKey(ds->domainName);
+    ds->writeJson(writer);
+    if (out != Q_NULLPTR && buffer.size() >= JsonFlushSize) {
+      if (out->write(buffer) != buffer.size()) {
+        return false;
+      }
+      buffer.resize(0);
+    }
+  }
+  writer.endObject();
+  return out == Q_NULLPTR || out->write(buffer) == buffer.size();
 }
 
 
@@ -93,6 +604,7 @@ QJsonDocument DomainSettingsList::toJsonDocument(void) const
 QStringList DomainSettingsList::keys(void) const
 {
   QStringList names;
+  names.reserve(mRecords.size());
   for (DomainSettingsList::const_iterator d = constBegin(); d != constEnd(); ++d) {
     names << d->domainName;
   }
@@ -100,6 +612,67 @@ QStringList DomainSettingsList::keys(void) const
 }
 
 
+typedef QPair<QString, DomainSettings> NamedRecord;
+
+
+static bool keyLessThan(const NamedRecord &a, const NamedRecord &b)
+{
+  return a.first < b.first;
+}
+
+
+/*!
+ * Parses JSON text as written by `toJson()`. The result is the same as the one of
+ * `fromQJsonDocument(QJsonDocument::fromJson(json))`. If the text is not a valid JSON
+ * object, `error` receives the reason and an empty list is returned.
+ */
+DomainSettingsList DomainSettingsList::fromJson(const QByteArray &json, QJsonParseError *error)
+{
+  DomainSettingsList dl;
+  JsonStreamReader reader(json.constData(), json.size());
+  QVector<NamedRecord> records;
+  bool ordered = true;
+  if (reader.beginObject()) {
+    QString key;
+    while (reader.nextMember(key)) {
+      ordered = ordered && (records.isEmpty() || records.last().first < key);
+      records.append(NamedRecord(key, DomainSettings::readJson(reader)));
+    }
+  }
+  else if (reader.peek() == JsonStreamReader::Array) {
+    reader.skipValue();
+  }
+  else {
+    reader.setError(QJsonParseError::IllegalValue);
+  }
+  const bool ok = reader.finish();
+  if (error != Q_NULLPTR) {
+    *error = reader.error();
+  }
+  if (!ok) {
+    return dl;
+  }
+  if (!ordered) {
+    // same order as in a QVariantMap, and the last of several equal keys wins
+    std::stable_sort(records.begin(), records.end(), keyLessThan);
+  }
+  for (int i = 0; i < records.size(); ++i) {
+    const NamedRecord &record = records.at(i);
+    const bool superseded = i + 1 < records.size() && records.at(i + 1).first == record.first;
+    if (!superseded && record.first.size() > 0) {
+      dl << record.second;
+    }
+  }
+  return dl;
+}
+
+
+DomainSettingsList DomainSettingsList::fromJson(QIODevice *in, QJsonParseError *error)
+{
+  return fromJson(in->readAll(), error);
+}
+
+
 DomainSettingsList DomainSettingsList::fromQJsonDocument(const QJsonDocument &json)
 {
   DomainSettingsList dl;
@@ -114,6 +687,46 @@ DomainSettingsList DomainSettingsList::fromQJsonDocument(const QJsonDocument &js
 }
 
 
+/*!
+ * Encodes the records in the binary format, sorted by domain name like `toJson()`,
+ * so that equal lists yield equal bytes.
+ */
+QByteArray DomainSettingsList::toBinary(void) const
+{
+  BinaryStreamWriter writer;
+  foreach (const DomainSettings *ds, sortedByName()) {
+    ds->writeBinary(writer);
+  }
+  return writer.result(BinaryVersion);
+}
+
+
+/*!
+ * Decodes data written by `toBinary()`. Records without a domain name are dropped,
+ * as in `fromJson()`.
+ *
+ * \param ok Set to `false` if `data` is truncated, corrupt or of another `BinaryVersion`.
+ */
+DomainSettingsList DomainSettingsList::fromBinary(const QByteArray &data, bool *ok)
+{
+  DomainSettingsList dl;
+  BinaryStreamReader reader(data);
+  bool valid = reader.begin(BinaryVersion);
+  for (int i = 0; valid && i < reader.recordCount(); ++i) {
+    const DomainSettings &ds = DomainSettings::readBinary(reader);
+    valid = !reader.hasError();
+    if (valid && !ds.domainName.isEmpty()) {
+      dl << ds;
+    }
+  }
+  valid = valid && reader.atEnd();
+  if (ok != Q_NULLPTR) {
+    *ok = valid;
+  }
+  return valid ? dl : DomainSettingsList();
+}
+
+
 bool DomainSettingsList::isDirty(void) const
 {
   return mDirty;
@@ -21,28 +21,133 @@
 #ifndef __DOMAINSETTINGSLIST_H_
 #define __DOMAINSETTINGSLIST_H_
 
+#include <QAtomicInt>
 #include <QByteArray>
+#include <QHash>
+#include <QIODevice>
+#include <QList>
 #include <QStringList>
+#include <QVector>
 #include <QJsonDocument>
+#include <QJsonParseError>
 
 #include "domainsettings.h"
 
-class DomainSettingsList : public QList<DomainSettings> {
+/*!
+ * \brief The DomainSettingsList class
+ *
+ * Domain settings addressed by position or by domain name.
+ *
+ * The records are stored in a `QList`, which holds every `DomainSettings` in a node
+ * of its own, so references returned by `at()` remain valid while other records are
+ * added or removed. A `QHash` maps each domain name to the position of its first
+ * record, which makes `at()`, `contains()` and `updateWith()` constant-time operations.
+ *
+ * The list offers the `QList` interface it used to inherit. Like a `QList` it may hold
+ * several records of the same name; `append()` adds records as they are, whereas
+ * `updateWith()` replaces the first record of the name. Functions handing out mutable
+ * references or iterators can't tell whether a name gets changed through them, so they
+ * mark the index as outdated and the next lookup rebuilds it. Lookups are thread-safe
+ * as long as no thread modifies the list.
+ *
+ * `toJson()` and `fromJson()` write and parse the JSON text directly, without going
+ * through `QJsonDocument` and `QVariantMap`. Their output is byte-compatible with
+ * `toJsonDocument().toJson(QJsonDocument::Compact)`, so older versions read it as before.
+ *
+ * `toBinary()` and `fromBinary()` use a compact encoding instead, see `BinaryStreamWriter`:
+ * no escaping, dates as milliseconds since the epoch and a table of the distinct strings.
+ * Only this version of the library reads it; `BinaryVersion` changes with its layout.
+ *
+ */
+class DomainSettingsList {
 public:
+  static const int BinaryVersion;
+
+  typedef QList<DomainSettings>::iterator iterator;
+  typedef QList<DomainSettings>::const_iterator const_iterator;
+  typedef DomainSettings value_type;
+  typedef DomainSettings &reference;
+  typedef const DomainSettings &const_reference;
+  typedef int size_type;
+  typedef qptrdiff difference_type;
+
   DomainSettingsList(void);
-  DomainSettings at(int idx) const;
-  DomainSettings at(const QString &domainName) const;
+  DomainSettingsList(const DomainSettingsList &);
+  explicit DomainSettingsList(const QList<DomainSettings> &);
+  DomainSettingsList &operator=(const DomainSettingsList &);
+  int count(void) const;
+  int size(void) const;
+  int length(void) const;
+  bool isEmpty(void) const;
+  bool empty(void) const;
+  const DomainSettings &at(int idx) const;
+  const DomainSettings &at(const QString &domainName) const;
+  DomainSettings value(int idx) const;
+  DomainSettings &operator[](int idx);
+  const DomainSettings &operator[](int idx) const;
+  DomainSettings &first(void);
+  const DomainSettings &first(void) const;
+  DomainSettings &last(void);
+  const DomainSettings &last(void) const;
+  int indexOf(const QString &domainName) const;
+  bool contains(const QString &domainName) const;
+  iterator begin(void);
+  iterator end(void);
+  const_iterator begin(void) const;
+  const_iterator end(void) const;
+  const_iterator cbegin(void) const;
+  const_iterator cend(void) const;
+  const_iterator constBegin(void) const;
+  const_iterator constEnd(void) const;
+  void append(const DomainSettings &);
+  void append(const DomainSettingsList &);
+  void prepend(const DomainSettings &);
+  void insert(int idx, const DomainSettings &);
+  void push_back(const DomainSettings &);
+  DomainSettingsList &operator<<(const DomainSettings &);
+  DomainSettingsList &operator<<(const DomainSettingsList &);
+  DomainSettingsList &operator+=(const DomainSettings &);
+  DomainSettingsList &operator+=(const DomainSettingsList &);
+  void replace(int idx, const DomainSettings &);
+  void removeAt(int idx);
+  void removeFirst(void);
+  void removeLast(void);
+  DomainSettings takeAt(int idx);
+  DomainSettings takeFirst(void);
+  DomainSettings takeLast(void);
+  iterator erase(iterator pos);
+  void move(int from, int to);
+  void swap(int i, int j);
+  void reserve(int size);
+  DomainSettingsList mid(int pos, int length = -1) const;
+  void clear(void);
   void remove(const QString &domainName);
   void updateWith(const DomainSettings &);
+  operator const QList<DomainSettings> &(void) const;
+  const QList<DomainSettings> &toList(void) const;
   QByteArray toJson(void) const;
+  bool toJson(QIODevice *out) const;
   QJsonDocument toJsonDocument(void) const;
   QStringList keys(void) const;
+  static DomainSettingsList fromJson(const QByteArray &json, QJsonParseError *error = Q_NULLPTR);
+  static DomainSettingsList fromJson(QIODevice *in, QJsonParseError *error = Q_NULLPTR);
   static DomainSettingsList fromQJsonDocument(const QJsonDocument &);
+  QByteArray toBinary(void) const;
+  static DomainSettingsList fromBinary(const QByteArray &data, bool *ok = Q_NULLPTR);
 
   bool isDirty(void) const;
   void setDirty(bool dirty = true);
 
 private:
+  void invalidateIndex(void);
+  void ensureIndex(void) const;
+  void reindexFrom(int idx, const QString &removedName);
+  bool writeJson(QByteArray &buffer, QIODevice *out) const;
+  QVector<const DomainSettings *> sortedByName(void) const;
+
+  QList<DomainSettings> mRecords;
+  mutable QHash<QString, int> mIndex;
+  mutable QAtomicInt mIndexValid;
   bool mDirty;
 };
 
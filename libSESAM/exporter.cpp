@@ -77,20 +77,7 @@ bool Exporter::write(const SecureByteArray &data, const SecureString &pwd)
   SecureByteArray iv;
   SecureByteArray key;
   Crypter::makeKeyAndIVFromPassword(pwd.toUtf8(), salt, key, iv);
-  CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption enc;
-  enc.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), reinterpret_cast<const byte*>(iv.constData()));
-  const int cipherSize = data.size();
-  QByteArray cipher(cipherSize, static_cast<char>(0));
-  CryptoPP::ArraySource s(
-        reinterpret_cast<const byte*>(data.constData()), data.size(),
-        true,
-        new CryptoPP::StreamTransformationFilter(
-          enc,
-          new CryptoPP::ArraySink(reinterpret_cast<byte*>(cipher.data()), cipher.size()),
-          CryptoPP::StreamTransformationFilter::NO_PADDING
-          )
-        );
-  Q_UNUSED(s); // just to please the compiler
+  const QByteArray &cipher = Crypter::encrypt(key, iv, data, CryptoPP::StreamTransformationFilter::NO_PADDING);
   QFile file(d->filename);
   bool opened = file.open(QIODevice::WriteOnly);
   if (!opened)
@@ -156,19 +143,7 @@ SecureByteArray Exporter::read(const SecureString &pwd)
     QByteArray salt = imported.mid(0, Crypter::SaltSize);
     QByteArray cipher = imported.mid(Crypter::SaltSize);
     Crypter::makeKeyAndIVFromPassword(pwd.toUtf8(), salt, key, iv);
-    CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption dec;
-    dec.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.size(), reinterpret_cast<const byte*>(iv.constData()));
-    plain = SecureByteArray(cipher.size(), static_cast<char>(0));
-    CryptoPP::ArraySource s(
-          reinterpret_cast<const byte*>(cipher.constData()), cipher.size(),
-          true,
-          new CryptoPP::StreamTransformationFilter(
-            dec,
-            new CryptoPP::ArraySink(reinterpret_cast<byte*>(plain.data()), plain.size()),
-            CryptoPP::StreamTransformationFilter::NO_PADDING
-            )
-          );
-    Q_UNUSED(s); // just to please the compiler
+    plain = Crypter::decrypt(key, iv, cipher, CryptoPP::StreamTransformationFilter::NO_PADDING);
   }
   return plain;
 }
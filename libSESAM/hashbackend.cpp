@@ -0,0 +1,205 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+
+#include "hashbackend.h"
+#include "cpufeatures.h"
+#include "pbkdf2engine.h"
+#include "sha512multibuffer.h"
+
+#if defined(SESAM_X86)
+extern void sha256TransformSHANI(quint32 *state, const quint32 *block);
+extern void sha512TransformAVX2(quint64 *state, const quint64 *block);
+#endif
+
+
+namespace {
+
+// runs both transforms over a chain of pseudo-random blocks and compares the states
+template <typename Word, typename Transform>
+bool agree(Transform candidate, Transform reference)
+{
+  Word block[16];
+  Word s1[8];
+  Word s2[8];
+  quint64 x = Q_UINT64_C(0x9e3779b97f4a7c15);
+  for (int w = 0; w < 8; ++w) {
+    s1[w] = s2[w] = Word(x * (w + 1));
+  }
+  for (int round = 0; round < 8; ++round) {
+    for (int w = 0; w < 16; ++w) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      block[w] = Word(x);
+    }
+    candidate(s1, block);
+    reference(s2, block);
+    if (memcmp(s1, s2, sizeof(s1)) != 0)
+      return false;
+  }
+  return true;
+}
+
+
+struct Sha256Backend {
+  HashBackend::Sha256Transform transform;
+  const char *name;
+};
+
+
+struct Sha512Backend {
+  HashBackend::Sha512Transform transform;
+  const char *name;
+};
+
+
+Sha256Backend selectSha256(void)
+{
+#if defined(SESAM_X86)
+  if (CPUFeatures::hasSHA() && CPUFeatures::hasSSE41() && agree<quint32>(sha256TransformSHANI, Sha256::transformPortable)) {
+    Sha256Backend backend = { sha256TransformSHANI, "SHA-NI" };
+    return backend;
+  }
+#endif
+  Sha256Backend backend = { Sha256::transformPortable, "portable" };
+  return backend;
+}
+
+
+Sha512Backend selectSha512(void)
+{
+#if defined(SESAM_X86)
+  if (CPUFeatures::hasAVX2() && agree<quint64>(sha512TransformAVX2, Sha512::transformPortable)) {
+    Sha512Backend backend = { sha512TransformAVX2, "AVX2 message schedule" };
+    return backend;
+  }
+#endif
+  Sha512Backend backend = { Sha512::transformPortable, "portable" };
+  return backend;
+}
+
+
+const Sha256Backend &sha256Backend(void)
+{
+  static const Sha256Backend backend = selectSha256();
+  return backend;
+}
+
+
+const Sha512Backend &sha512Backend(void)
+{
+  static const Sha512Backend backend = selectSha512();
+  return backend;
+}
+
+
+template <class Hash>
+bool pbkdf2Matches(const char *pwd, const char *salt, int iterations, const char *expectedHex)
+{
+  PBKDF2Engine<Hash> engine(pwd, int(strlen(pwd)));
+  engine.start(salt, int(strlen(salt)), 1);
+  engine.iterate(iterations - 1);
+  QByteArray result(Hash::DigestSize, static_cast<char>(0));
+  engine.result(result.data());
+  return result == QByteArray::fromHex(expectedHex);
+}
+
+}
+
+
+HashBackend::Sha256Transform HashBackend::sha256Transform(void)
+{
+  return sha256Backend().transform;
+}
+
+
+HashBackend::Sha512Transform HashBackend::sha512Transform(void)
+{
+  return sha512Backend().transform;
+}
+
+
+const char *HashBackend::sha256Name(void)
+{
+  return sha256Backend().name;
+}
+
+
+const char *HashBackend::sha512Name(void)
+{
+  return sha512Backend().name;
+}
+
+
+QString HashBackend::description(void)
+{
+  return QString("SHA-256: %1, SHA-512: %2, SHA-512 multi-buffer: %3")
+      .arg(sha256Name())
+      .arg(sha512Name())
+      .arg(Sha512MultiBuffer::backendName());
+}
+
+
+/*!
+ * \brief HashBackend::selfTest
+ *
+ * Runs the PBKDF2 test vectors of the unit tests through the selected backends,
+ * including the multi-buffer SHA-512 kernel.
+ *
+ * \return `true` if all results match
+ */
+bool HashBackend::selfTest(void)
+{
+  bool ok = pbkdf2Matches<Sha512>("message", "pepper", 3, "2646f9ccb58d21406815bafc62245771bf80aaa080a633ff1bdd660eb44f369a89da48fb041c5551a118de20cfb8b96b92e7a9945425ba889e9ad645614522eb")
+      && pbkdf2Matches<Sha384>("message", "salt", 3, "dcbeb0b99a4cf4d1c9c1e8f630f3aa8637c8906f1c3e1c78fb4f462b160df20f7435bdd6a904dd3c3ede7ff04bc53e90")
+      && pbkdf2Matches<Sha256>("message", "salt", 3, "db78c5091444940f9642fce519097ee7adfeb338fd6970855135539020b53fad");
+  if (!ok)
+    return false;
+  typedef PBKDF2Engine<Sha512> Engine;
+  const int L = Sha512MultiBuffer::lanes();
+  quint64 inner[Sha512::StateWords * Sha512MultiBuffer::MaxLanes];
+  quint64 outer[Sha512::StateWords * Sha512MultiBuffer::MaxLanes];
+  quint64 u[Sha512::DigestWords * Sha512MultiBuffer::MaxLanes];
+  quint64 t[Sha512::DigestWords * Sha512MultiBuffer::MaxLanes];
+  Engine engine("message", 7);
+  engine.start("pepper", 6, 1);
+  Engine::State state;
+  engine.saveState(state);
+  for (int l = 0; l < L; ++l) {
+    for (int w = 0; w < Sha512::StateWords; ++w) {
+      inner[w * L + l] = state.inner[w];
+      outer[w * L + l] = state.outer[w];
+    }
+    for (int w = 0; w < Sha512::DigestWords; ++w) {
+      u[w * L + l] = state.u[w];
+      t[w * L + l] = state.t[w];
+    }
+  }
+  Sha512MultiBuffer::iterate(inner, outer, u, t, 2);
+  engine.iterate(2);
+  engine.saveState(state);
+  for (int l = 0; l < L; ++l) {
+    for (int w = 0; w < Sha512::DigestWords; ++w) {
+      ok = ok && t[w * L + l] == state.t[w];
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,53 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __HASHBACKEND_H_
+#define __HASHBACKEND_H_
+
+#include <QtGlobal>
+#include <QString>
+
+
+/*!
+ * \brief The HashBackend class
+ *
+ * Selects the SHA-2 block transforms used by `Sha256::transform()` and `Sha512::transform()`.
+ *
+ * On first use the CPU is probed (see `CPUFeatures`): SHA-256 uses the SHA extensions
+ * (SHA-NI) if present, SHA-512 computes its message schedule with AVX2. An accelerated
+ * transform is only selected if it agrees with the portable one on a set of test blocks,
+ * otherwise the portable transform is used.
+ *
+ */
+class HashBackend
+{
+public:
+  typedef void (*Sha256Transform)(quint32 *state, const quint32 *block);
+  typedef void (*Sha512Transform)(quint64 *state, const quint64 *block);
+
+  static Sha256Transform sha256Transform(void);
+  static Sha512Transform sha512Transform(void);
+  static const char *sha256Name(void);
+  static const char *sha512Name(void);
+  static QString description(void);
+  static bool selfTest(void);
+};
+
+
+#endif // __HASHBACKEND_H_
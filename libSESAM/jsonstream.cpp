@@ -0,0 +1,532 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "jsonstream.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVariantList>
+#include <QVariantMap>
+
+
+static const int MaxNestingDepth = 1024;
+
+
+JsonStreamWriter::JsonStreamWriter(QByteArray *out)
+  : mOut(out)
+  , mNeedsComma(false)
+{ /* ... */ }
+
+
+void JsonStreamWriter::separate(void)
+{
+  if (mNeedsComma) {
+    mOut->append(',');
+  }
+}
+
+
+void JsonStreamWriter::beginObject(void)
+{
+  separate();
+  mOut->append('{');
+  mNeedsComma = false;
+}
+
+
+void JsonStreamWriter::endObject(void)
+{
+  mOut->append('}');
+  mNeedsComma = true;
+}
+
+
+void JsonStreamWriter::writeKey(const QString &key)
+{
+  separate();
+  mOut->append('"');
+  appendEscaped(key);
+  mOut->append("\":", 2);
+  mNeedsComma = false;
+}
+
+
+void JsonStreamWriter::writeString(const QString &value)
+{
+  separate();
+  mOut->append('"');
+  appendEscaped(value);
+  mOut->append('"');
+  mNeedsComma = true;
+}
+
+
+void JsonStreamWriter::writeBool(bool value)
+{
+  separate();
+  if (value) {
+    mOut->append("true", 4);
+  }
+  else {
+    mOut->append("false", 5);
+  }
+  mNeedsComma = true;
+}
+
+
+void JsonStreamWriter::writeInt(int value)
+{
+  separate();
+  mOut->append(QByteArray::number(value));
+  mNeedsComma = true;
+}
+
+
+void JsonStreamWriter::writeDateTime(const QDateTime &value)
+{
+  // QJsonValue::fromVariant() stores dates as QVariant::toString() does, which depends
+  // on the Qt version; an invalid date gives an empty string and thus null.
+  const QString &str = QVariant(value).toString();
+  if (str.isEmpty()) {
+    writeNull();
+  }
+  else {
+    writeString(str);
+  }
+}
+
+
+void JsonStreamWriter::writeNull(void)
+{
+  separate();
+  mOut->append("null", 4);
+  mNeedsComma = true;
+}
+
+
+void JsonStreamWriter::writeVariantMap(const QVariantMap &value)
+{
+  separate();
+  mOut->append(QJsonDocument(QJsonObject::fromVariantMap(value)).toJson(QJsonDocument::Compact));
+  mNeedsComma = true;
+}
+
+
+void JsonStreamWriter::appendEscaped(const QString &value)
+{
+  static const char Hex[] = "0123456789abcdef";
+  const ushort *src = value.utf16();
+  const ushort *const end = src + value.size();
+  while (src < end) {
+    const ushort c = *src;
+    if (c >= 0x80) {
+      const ushort *run = src;
+      while (src < end && *src >= 0x80) {
+        ++src;
+      }
+      mOut->append(QString::fromRawData(reinterpret_cast<const QChar *>(run), int(src - run)).toUtf8());
+      continue;
+    }
+    switch (c) {
+    case '"':
+      mOut->append("\\\"", 2);
+      break;
+    case '\\':
+      mOut->append("\\\\", 2);
+      break;
+    case '\b':
+      mOut->append("\\b", 2);
+      break;
+    case '\f':
+      mOut->append("\\f", 2);
+      break;
+    case '\n':
+      mOut->append("\\n", 2);
+      break;
+    case '\r':
+      mOut->append("\\r", 2);
+      break;
+    case '\t':
+      mOut->append("\\t", 2);
+      break;
+    default:
+      if (c < 0x20) {
+        const char escaped[6] = { '\\', 'u', '0', '0', Hex[c >> 4], Hex[c & 0xf] };
+        mOut->append(escaped, 6);
+      }
+      else {
+        mOut->append(char(c));
+      }
+      break;
+    }
+    ++src;
+  }
+}
+
+
+JsonStreamReader::JsonStreamReader(const char *data, int size)
+  : mBegin(data)
+  , mCur(data)
+  , mEnd(data + size)
+  , mError(QJsonParseError::NoError)
+  , mErrorOffset(0)
+  , mHasMember(false)
+{ /* ... */ }
+
+
+void JsonStreamReader::setError(QJsonParseError::ParseError err)
+{
+  if (mError == QJsonParseError::NoError) {
+    mError = err;
+    mErrorOffset = int(mCur - mBegin);
+  }
+  mCur = mEnd;
+}
+
+
+bool JsonStreamReader::hasError(void) const
+{
+  return mError != QJsonParseError::NoError;
+}
+
+
+QJsonParseError JsonStreamReader::error(void) const
+{
+  QJsonParseError err;
+  err.error = mError;
+  err.offset = mErrorOffset;
+  return err;
+}
+
+
+void JsonStreamReader::skipWhitespace(void)
+{
+  while (mCur < mEnd && (*mCur == ' ' || *mCur == '\t' || *mCur == '\n' || *mCur == '\r')) {
+    ++mCur;
+  }
+}
+
+
+bool JsonStreamReader::expect(char c, QJsonParseError::ParseError err)
+{
+  skipWhitespace();
+  if (mCur < mEnd && *mCur == c) {
+    ++mCur;
+    return true;
+  }
+  setError(err);
+  return false;
+}
+
+
+bool JsonStreamReader::readLiteral(const char *literal)
+{
+  const char *p = mCur;
+  while (*literal != 0) {
+    if (p == mEnd || *p != *literal) {
+      setError(QJsonParseError::IllegalValue);
+      return false;
+    }
+    ++p;
+    ++literal;
+  }
+  mCur = p;
+  return true;
+}
+
+
+JsonStreamReader::Type JsonStreamReader::peek(void)
+{
+  skipWhitespace();
+  if (mCur == mEnd) {
+    return Invalid;
+  }
+  switch (*mCur) {
+  case 'n':
+    return Null;
+  case 't':
+    // fall-through
+  case 'f':
+    return Bool;
+  case '"':
+    return String;
+  case '[':
+    return Array;
+  case '{':
+    return Object;
+  default:
+    if (*mCur == '-' || (*mCur >= '0' && *mCur <= '9')) {
+      return Number;
+    }
+    return Invalid;
+  }
+}
+
+
+bool JsonStreamReader::beginObject(void)
+{
+  if (peek() != Object) {
+    return false;
+  }
+  ++mCur;
+  mHasMember = false;
+  return true;
+}
+
+
+bool JsonStreamReader::nextMember(QString &key)
+{
+  skipWhitespace();
+  if (mCur == mEnd) {
+    setError(QJsonParseError::UnterminatedObject);
+    return false;
+  }
+  if (*mCur == '}') {
+    ++mCur;
+    // the object just closed was the value of a member of the enclosing object
+    mHasMember = true;
+    return false;
+  }
+  if (mHasMember && !expect(',', QJsonParseError::MissingValueSeparator)) {
+    return false;
+  }
+  if (peek() != String) {
+    setError(QJsonParseError::IllegalValue);
+    return false;
+  }
+  key = readString();
+  if (!expect(':', QJsonParseError::MissingNameSeparator)) {
+    return false;
+  }
+  mHasMember = true;
+  return true;
+}
+
+
+QString JsonStreamReader::readString(void)
+{
+  if (peek() != String) {
+    setError(QJsonParseError::IllegalValue);
+    return QString();
+  }
+  ++mCur;
+  const char *run = mCur;
+  while (mCur < mEnd && *mCur != '"' && *mCur != '\\') {
+    ++mCur;
+  }
+  if (mCur < mEnd && *mCur == '"') {
+    QString str = QString::fromUtf8(run, int(mCur - run));
+    ++mCur;
+    return str;
+  }
+  QString str;
+  while (mCur < mEnd) {
+    if (*mCur == '"') {
+      str.append(QString::fromUtf8(run, int(mCur - run)));
+      ++mCur;
+      return str;
+    }
+    if (*mCur != '\\') {
+      ++mCur;
+      continue;
+    }
+    str.append(QString::fromUtf8(run, int(mCur - run)));
+    if (++mCur == mEnd) {
+      break;
+    }
+    switch (*mCur++) {
+    case '"':
+      str.append(QChar('"'));
+      break;
+    case '\\':
+      str.append(QChar('\\'));
+      break;
+    case '/':
+      str.append(QChar('/'));
+      break;
+    case 'b':
+      str.append(QChar('\b'));
+      break;
+    case 'f':
+      str.append(QChar('\f'));
+      break;
+    case 'n':
+      str.append(QChar('\n'));
+      break;
+    case 'r':
+      str.append(QChar('\r'));
+      break;
+    case 't':
+      str.append(QChar('\t'));
+      break;
+    case 'u':
+    {
+      if (mEnd - mCur < 4) {
+        setError(QJsonParseError::IllegalEscapeSequence);
+        return QString();
+      }
+      ushort u = 0;
+      for (int i = 0; i < 4; ++i) {
+        const char h = *mCur++;
+        u <<= 4;
+        if (h >= '0' && h <= '9') {
+          u |= ushort(h - '0');
+        }
+        else if (h >= 'a' && h <= 'f') {
+          u |= ushort(h - 'a' + 10);
+        }
+        else if (h >= 'A' && h <= 'F') {
+          u |= ushort(h - 'A' + 10);
+        }
+        else {
+          setError(QJsonParseError::IllegalEscapeSequence);
+          return QString();
+        }
+      }
+      str.append(QChar(u));
+      break;
+    }
+    default:
+      --mCur;
+      setError(QJsonParseError::IllegalEscapeSequence);
+      return QString();
+    }
+    run = mCur;
+  }
+  setError(QJsonParseError::UnterminatedString);
+  return QString();
+}
+
+
+bool JsonStreamReader::readBool(void)
+{
+  if (peek() == Bool) {
+    if (*mCur == 't') {
+      return readLiteral("true");
+    }
+    readLiteral("false");
+  }
+  else {
+    setError(QJsonParseError::IllegalValue);
+  }
+  return false;
+}
+
+
+double JsonStreamReader::readNumber(void)
+{
+  if (peek() != Number) {
+    setError(QJsonParseError::IllegalValue);
+    return 0;
+  }
+  const char *start = mCur;
+  if (*mCur == '-') {
+    ++mCur;
+  }
+  while (mCur < mEnd && ((*mCur >= '0' && *mCur <= '9') || *mCur == '.' || *mCur == 'e' || *mCur == 'E' || *mCur == '+' || *mCur == '-')) {
+    ++mCur;
+  }
+  bool ok = false;
+  // QByteArray::toDouble() ignores the locale, unlike strtod()
+  const double value = QByteArray::fromRawData(start, int(mCur - start)).toDouble(&ok);
+  if (!ok) {
+    mCur = start;
+    setError(QJsonParseError::IllegalNumber);
+    return 0;
+  }
+  return value;
+}
+
+
+QVariant JsonStreamReader::readVariant(void)
+{
+  return readVariant(0);
+}
+
+
+QVariant JsonStreamReader::readVariant(int depth)
+{
+  if (depth > MaxNestingDepth) {
+    setError(QJsonParseError::DeepNesting);
+    return QVariant();
+  }
+  switch (peek()) {
+  case Null:
+    readLiteral("null");
+    return QVariant();
+  case Bool:
+    return QVariant(readBool());
+  case Number:
+    return QVariant(readNumber());
+  case String:
+    return QVariant(readString());
+  case Array:
+  {
+    QVariantList list;
+    ++mCur;
+    skipWhitespace();
+    if (mCur < mEnd && *mCur == ']') {
+      ++mCur;
+      return list;
+    }
+    while (!hasError()) {
+      list.append(readVariant(depth + 1));
+      skipWhitespace();
+      if (mCur < mEnd && *mCur == ']') {
+        ++mCur;
+        return list;
+      }
+      if (!expect(',', mCur < mEnd ? QJsonParseError::MissingValueSeparator : QJsonParseError::UnterminatedArray)) {
+        break;
+      }
+    }
+    return QVariant();
+  }
+  case Object:
+  {
+    QVariantMap map;
+    beginObject();
+    QString key;
+    while (nextMember(key)) {
+      const QVariant &value = readVariant(depth + 1);
+      map.insert(key, value);
+    }
+    return hasError() ? QVariant() : QVariant(map);
+  }
+  default:
+    setError(QJsonParseError::IllegalValue);
+    return QVariant();
+  }
+}
+
+
+void JsonStreamReader::skipValue(void)
+{
+  readVariant();
+}
+
+
+bool JsonStreamReader::finish(void)
+{
+  skipWhitespace();
+  if (mCur != mEnd) {
+    setError(QJsonParseError::GarbageAtEnd);
+  }
+  return !hasError();
+}
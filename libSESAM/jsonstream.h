@@ -0,0 +1,117 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __JSONSTREAM_H_
+#define __JSONSTREAM_H_
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QJsonParseError>
+#include <QString>
+#include <QVariant>
+
+/*!
+ * \brief The JsonStreamWriter class
+ *
+ * Appends JSON text to a `QByteArray` without building a `QJsonDocument` first.
+ * The output is byte for byte what `QJsonDocument::toJson(QJsonDocument::Compact)`
+ * produces for the same values, provided the caller writes the keys of an object
+ * in the order in which `QJsonObject` sorts them.
+ *
+ */
+class JsonStreamWriter
+{
+public:
+  explicit JsonStreamWriter(QByteArray *out);
+
+  void beginObject(void);
+  void endObject(void);
+  void writeKey(const QString &key);
+  void writeString(const QString &value);
+  void writeBool(bool value);
+  void writeInt(int value);
+  void writeDateTime(const QDateTime &value);
+  void writeNull(void);
+  void writeVariantMap(const QVariantMap &value);
+
+private:
+  void separate(void);
+  void appendEscaped(const QString &value);
+
+  QByteArray *mOut;
+  bool mNeedsComma;
+};
+
+
+/*!
+ * \brief The JsonStreamReader class
+ *
+ * Pull parser that reads JSON text straight from a buffer. Strings, numbers and
+ * booleans are handed out as they are met; only values the caller asks for with
+ * `readVariant()` become `QVariant` trees, with the same types that
+ * `QJsonValue::toVariant()` would produce.
+ *
+ * After the first syntax error all reads return empty values and `error()` tells
+ * what went wrong and where. `finish()` reports anything but whitespace after the
+ * last value as `QJsonParseError::GarbageAtEnd`.
+ *
+ */
+class JsonStreamReader
+{
+public:
+  enum Type {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object,
+    Invalid
+  };
+
+  JsonStreamReader(const char *data, int size);
+
+  Type peek(void);
+  bool beginObject(void);
+  bool nextMember(QString &key);
+  QString readString(void);
+  bool readBool(void);
+  double readNumber(void);
+  QVariant readVariant(void);
+  void skipValue(void);
+  bool finish(void);
+  void setError(QJsonParseError::ParseError err);
+  bool hasError(void) const;
+  QJsonParseError error(void) const;
+
+private:
+  void skipWhitespace(void);
+  bool expect(char c, QJsonParseError::ParseError err);
+  bool readLiteral(const char *literal);
+  QVariant readVariant(int depth);
+
+  const char *mBegin;
+  const char *mCur;
+  const char *mEnd;
+  QJsonParseError::ParseError mError;
+  int mErrorOffset;
+  bool mHasMember;
+};
+
+#endif // __JSONSTREAM_H_
@@ -0,0 +1,386 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "keymanager.h"
+#include "crypter.h"
+
+#include <QCryptographicHash>
+#include <QHash>
+#include <QList>
+#include <QMessageAuthenticationCode>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+
+const int KeyManager::DefaultPoolSize = 2;
+const int KeyManager::MaxCachedKeys = 32;
+
+
+class KeyManagerPrivate {
+public:
+  KeyManagerPrivate(int poolSize)
+    : poolSize(qMax(1, poolSize))
+    , saltKeyIVGeneration(0)
+    , blobKeyGeneration(0)
+    , refilling(false)
+    , hits(0)
+    , misses(0)
+  {
+    pool.setMaxThreadCount(1);
+  }
+  ~KeyManagerPrivate()
+  { /* ... */ }
+
+  enum KeyType {
+    MasterKeyType = 'M',
+    BlobKeyType = 'B'
+  };
+
+  static QByteArray fingerprintOf(KeyType type, const SecureByteArray &secret, const QByteArray &salt)
+  {
+    QMessageAuthenticationCode hmac(QCryptographicHash::Sha256, secret);
+    hmac.addData(QByteArray(1, char(type)) + salt);
+    return hmac.result();
+  }
+
+  // must be called with mutex locked
+  bool lookup(const QByteArray &fingerprint, SecureByteArray &key)
+  {
+    if (!keys.contains(fingerprint)) {
+      ++misses;
+      return false;
+    }
+    ++hits;
+    key = keys.value(fingerprint);
+    return true;
+  }
+
+  // must be called with mutex locked
+  void insert(const QByteArray &fingerprint, const SecureByteArray &key)
+  {
+    if (keys.size() >= KeyManager::MaxCachedKeys && !keys.contains(fingerprint)) {
+      keys.clear();
+    }
+    keys.insert(fingerprint, key);
+  }
+
+  // must be called with mutex locked
+  void setMasterPassword(const SecureByteArray &pwd)
+  {
+    if (pwd != masterPassword) {
+      masterPassword = pwd;
+      saltKeyIVs.clear();
+      ++saltKeyIVGeneration;
+    }
+  }
+
+  // must be called with mutex locked
+  void setKGK(const SecureByteArray &kgk)
+  {
+    if (kgk != KGK) {
+      KGK = kgk;
+      blobKeys.clear();
+      ++blobKeyGeneration;
+    }
+  }
+
+  // must be called with mutex locked
+  void startRefill(void);
+
+  int poolSize;
+  mutable QMutex mutex;
+  QThreadPool pool;
+  SecureByteArray masterPassword;
+  SecureByteArray KGK;
+  QList<KeyManager::SaltKeyIV> saltKeyIVs;
+  QList<KeyManager::SaltKeyIV> blobKeys;
+  quint64 saltKeyIVGeneration;
+  quint64 blobKeyGeneration;
+  bool refilling;
+  QHash<QByteArray, SecureByteArray> keys;
+  quint64 hits;
+  quint64 misses;
+};
+
+
+class KeyPoolRefillJob : public QRunnable
+{
+public:
+  KeyPoolRefillJob(KeyManagerPrivate *d)
+    : d(d)
+  { /* ... */ }
+  void run(void)
+  {
+    QThread::currentThread()->setPriority(QThread::LowPriority);
+    forever {
+      SecureByteArray secret;
+      quint64 generation;
+      bool saltKeyIVNeeded = false;
+      {
+        QMutexLocker locker(&d->mutex);
+        if (!d->masterPassword.isEmpty() && d->saltKeyIVs.size() < d->poolSize) {
+          saltKeyIVNeeded = true;
+          secret = d->masterPassword;
+          generation = d->saltKeyIVGeneration;
+        }
+        else if (!d->KGK.isEmpty() && d->blobKeys.size() < d->poolSize) {
+          secret = d->KGK;
+          generation = d->blobKeyGeneration;
+        }
+        else {
+          d->refilling = false;
+          return;
+        }
+      }
+      KeyManager::SaltKeyIV t;
+      t.salt = Crypter::generateSalt();
+      if (saltKeyIVNeeded) {
+        Crypter::makeKeyAndIVFromPassword(secret, t.salt, t.key, t.IV);
+      }
+      else {
+        t.IV = Crypter::generateIV();
+        t.key = Crypter::makeKeyFromPassword(secret, t.salt);
+      }
+      QMutexLocker locker(&d->mutex);
+      if (saltKeyIVNeeded && generation == d->saltKeyIVGeneration) {
+        d->saltKeyIVs.append(t);
+      }
+      else if (!saltKeyIVNeeded && generation == d->blobKeyGeneration) {
+        d->blobKeys.append(t);
+      }
+    }
+  }
+
+private:
+  KeyManagerPrivate *d;
+};
+
+
+void KeyManagerPrivate::startRefill(void)
+{
+  if (refilling)
+    return;
+  const bool saltKeyIVsNeeded = !masterPassword.isEmpty() && saltKeyIVs.size() < poolSize;
+  const bool blobKeysNeeded = !KGK.isEmpty() && blobKeys.size() < poolSize;
+  if (saltKeyIVsNeeded || blobKeysNeeded) {
+    refilling = true;
+    pool.start(new KeyPoolRefillJob(this));
+  }
+}
+
+
+KeyManager::KeyManager(int poolSize)
+  : d_ptr(new KeyManagerPrivate(poolSize))
+{ /* ... */ }
+
+
+KeyManager::~KeyManager()
+{
+  clear();
+  waitForDone();
+}
+
+
+/*!
+ * \brief KeyManager::prime
+ *
+ * Starts filling the pools for `masterPassword` and `KGK` in the background.
+ * Call this as soon as both are known, e.g. after the user has logged in.
+ *
+ * \param masterPassword the user's master password
+ * \param KGK key generation key
+ */
+void KeyManager::prime(const SecureByteArray &masterPassword, const SecureByteArray &KGK)
+{
+  Q_D(KeyManager);
+  QMutexLocker locker(&d->mutex);
+  d->setMasterPassword(masterPassword);
+  d->setKGK(KGK);
+  d->startRefill();
+}
+
+
+/*!
+ * \brief KeyManager::takeSaltKeyIV
+ *
+ * Removes a fresh salt together with the AES key and IV derived from it and
+ * `masterPassword` from the pool. Only if the pool is empty, e.g. because the
+ * master password has just changed, the key gets derived synchronously.
+ * The returned key is cached, so a subsequent `Crypter::decode()` of data
+ * encoded with it needs no key derivation.
+ *
+ * \param masterPassword the user's master password
+ * \return salt, key and IV as `Crypter::makeKeyAndIVFromPassword()` would produce them
+ */
+KeyManager::SaltKeyIV KeyManager::takeSaltKeyIV(const SecureByteArray &masterPassword)
+{
+  Q_D(KeyManager);
+  QMutexLocker locker(&d->mutex);
+  d->setMasterPassword(masterPassword);
+  SaltKeyIV t;
+  if (!d->saltKeyIVs.isEmpty()) {
+    t = d->saltKeyIVs.takeFirst();
+  }
+  else {
+    locker.unlock();
+    t.salt = Crypter::generateSalt();
+    Crypter::makeKeyAndIVFromPassword(masterPassword, t.salt, t.key, t.IV);
+    locker.relock();
+  }
+  d->insert(KeyManagerPrivate::fingerprintOf(KeyManagerPrivate::MasterKeyType, masterPassword, t.salt), t.key + t.IV);
+  d->startRefill();
+  return t;
+}
+
+
+/*!
+ * \brief KeyManager::takeBlobKey
+ *
+ * Like `takeSaltKeyIV()`, but for the key that encrypts the payload of a vault,
+ * i.e. derived from `KGK` via `Crypter::makeKeyFromPassword()` with a fresh salt
+ * and accompanied by a fresh IV.
+ *
+ * \param KGK key generation key
+ * \return salt, key and IV
+ */
+KeyManager::SaltKeyIV KeyManager::takeBlobKey(const SecureByteArray &KGK)
+{
+  Q_D(KeyManager);
+  QMutexLocker locker(&d->mutex);
+  d->setKGK(KGK);
+  SaltKeyIV t;
+  if (!d->blobKeys.isEmpty()) {
+    t = d->blobKeys.takeFirst();
+  }
+  else {
+    locker.unlock();
+    t.salt = Crypter::generateSalt();
+    t.IV = Crypter::generateIV();
+    t.key = Crypter::makeKeyFromPassword(KGK, t.salt);
+    locker.relock();
+  }
+  d->insert(KeyManagerPrivate::fingerprintOf(KeyManagerPrivate::BlobKeyType, KGK, t.salt), t.key);
+  d->startRefill();
+  return t;
+}
+
+
+/*!
+ * \brief KeyManager::makeKeyAndIVFromPassword
+ *
+ * Cached variant of `Crypter::makeKeyAndIVFromPassword()`.
+ */
+void KeyManager::makeKeyAndIVFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt, SecureByteArray &key, SecureByteArray &IV)
+{
+  Q_D(KeyManager);
+  const QByteArray &fingerprint = KeyManagerPrivate::fingerprintOf(KeyManagerPrivate::MasterKeyType, masterPassword, salt);
+  SecureByteArray keyAndIV;
+  {
+    QMutexLocker locker(&d->mutex);
+    if (d->lookup(fingerprint, keyAndIV)) {
+      key = keyAndIV.left(Crypter::AESKeySize);
+      IV = keyAndIV.mid(Crypter::AESKeySize);
+      return;
+    }
+  }
+  Crypter::makeKeyAndIVFromPassword(masterPassword, salt, key, IV);
+  QMutexLocker locker(&d->mutex);
+  d->insert(fingerprint, key + IV);
+}
+
+
+/*!
+ * \brief KeyManager::makeKeyFromPassword
+ *
+ * Cached variant of `Crypter::makeKeyFromPassword()`.
+ */
+SecureByteArray KeyManager::makeKeyFromPassword(const SecureByteArray &KGK, const QByteArray &salt)
+{
+  Q_D(KeyManager);
+  const QByteArray &fingerprint = KeyManagerPrivate::fingerprintOf(KeyManagerPrivate::BlobKeyType, KGK, salt);
+  SecureByteArray key;
+  {
+    QMutexLocker locker(&d->mutex);
+    if (d->lookup(fingerprint, key))
+      return key;
+  }
+  key = Crypter::makeKeyFromPassword(KGK, salt);
+  QMutexLocker locker(&d->mutex);
+  d->insert(fingerprint, key);
+  return key;
+}
+
+
+/*!
+ * \brief KeyManager::clear
+ *
+ * Forgets the secrets, empties the pools and the cache. A running refill
+ * stops after the derivation at hand.
+ */
+void KeyManager::clear(void)
+{
+  Q_D(KeyManager);
+  QMutexLocker locker(&d->mutex);
+  d->setMasterPassword(SecureByteArray());
+  d->setKGK(SecureByteArray());
+  d->keys.clear();
+}
+
+
+void KeyManager::waitForDone(void)
+{
+  d_ptr->pool.waitForDone();
+}
+
+
+int KeyManager::poolSize(void) const
+{
+  return d_ptr->poolSize;
+}
+
+
+int KeyManager::availableSaltKeyIVs(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->saltKeyIVs.size();
+}
+
+
+int KeyManager::availableBlobKeys(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->blobKeys.size();
+}
+
+
+quint64 KeyManager::hits(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->hits;
+}
+
+
+quint64 KeyManager::misses(void) const
+{
+  QMutexLocker locker(&d_ptr->mutex);
+  return d_ptr->misses;
+}
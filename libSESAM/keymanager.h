@@ -0,0 +1,86 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __KEYMANAGER_H_
+#define __KEYMANAGER_H_
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QScopedPointer>
+
+#include "securebytearray.h"
+
+class KeyManagerPrivate;
+
+/*!
+ * \brief The KeyManager class
+ *
+ * Takes the PBKDF2 runs of `Crypter` off the interactive path.
+ *
+ * A background thread keeps two small pools filled: (salt, key, IV) tuples
+ * derived from the master password, which protect the KGK in a vault, and
+ * (salt, IV, key) tuples derived from the KGK, which protect the payload.
+ * Saving takes a tuple from each pool instead of deriving fresh ones.
+ *
+ * Every key used or derived in the session is also cached by the secret
+ * and salt it was derived from, so decoding a vault written or read before
+ * (e.g. a sync peer) needs no key derivation at all. Pass the `KeyManager`
+ * to `Crypter::encode()` and `Crypter::decode()` to make use of it.
+ *
+ * All functions are thread-safe.
+ *
+ */
+class KeyManager
+{
+public:
+  static const int DefaultPoolSize;
+  static const int MaxCachedKeys;
+
+  struct SaltKeyIV {
+    QByteArray salt;
+    SecureByteArray key;
+    SecureByteArray IV;
+    bool isEmpty(void) const { return key.isEmpty(); }
+  };
+
+  explicit KeyManager(int poolSize = DefaultPoolSize);
+  ~KeyManager();
+
+  void prime(const SecureByteArray &masterPassword, const SecureByteArray &KGK);
+  SaltKeyIV takeSaltKeyIV(const SecureByteArray &masterPassword);
+  void makeKeyAndIVFromPassword(const SecureByteArray &masterPassword, const QByteArray &salt, SecureByteArray &key, SecureByteArray &IV);
+  SecureByteArray makeKeyFromPassword(const SecureByteArray &KGK, const QByteArray &salt);
+  SaltKeyIV takeBlobKey(const SecureByteArray &KGK);
+  void clear(void);
+  void waitForDone(void);
+
+  int poolSize(void) const;
+  int availableSaltKeyIVs(void) const;
+  int availableBlobKeys(void) const;
+  quint64 hits(void) const;
+  quint64 misses(void) const;
+
+private:
+  QScopedPointer<KeyManagerPrivate> d_ptr;
+  Q_DECLARE_PRIVATE(KeyManager)
+  Q_DISABLE_COPY(KeyManager)
+};
+
+
+#endif // __KEYMANAGER_H_
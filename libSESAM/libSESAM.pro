@@ -36,7 +36,6 @@ win32-msvc* {
     DEFINES -= UNICODE
 }
 
-include(3rdparty/bigint/bigint.pri)
 include(3rdparty/cryptopp/cryptopp.pri)
 
 SOURCES += \
@@ -44,8 +43,35 @@ SOURCES += \
     crypter.cpp \
     domainsettings.cpp \
     domainsettingslist.cpp \
+    jsonstream.cpp \
+    binarystream.cpp \
     password.cpp \
+    passwordgenerator.cpp \
+    compiledtemplate.cpp \
+    passwordbatch.cpp \
     pbkdf2.cpp \
+    pbkdf2engine.cpp \
+    sha2.cpp \
+    sha256_shani.cpp \
+    sha512_avx2.cpp \
+    hashbackend.cpp \
+    aesbackend.cpp \
+    aes_aesni.cpp \
+    sha512multibuffer.cpp \
+    sha512multibuffer_sse2.cpp \
+    sha512multibuffer_avx2.cpp \
+    cpufeatures.cpp \
+    randomsource.cpp \
+    derivationcontrol.cpp \
+    derivedkeycache.cpp \
+    derivedkeyprefetcher.cpp \
+    keymanager.cpp \
+    compressionpolicy.cpp \
+    crypterstream.cpp \
+    segmentedvault.cpp \
+    syncmerger.cpp \
+    securearena.cpp \
+    securebuffer.cpp \
     securebytearray.cpp \
     securestring.cpp \
     exporter.cpp
@@ -55,8 +81,32 @@ HEADERS +=\
     crypter.h \
     domainsettings.h \
     domainsettingslist.h \
+    jsonstream.h \
+    binarystream.h \
     password.h \
+    passwordgenerator.h \
+    compiledtemplate.h \
+    passwordbatch.h \
     pbkdf2.h \
+    pbkdf2engine.h \
+    sha2.h \
+    uint512.h \
+    hashbackend.h \
+    aesbackend.h \
+    sha512multibuffer.h \
+    sha512multibuffer_p.h \
+    cpufeatures.h \
+    randomsource.h \
+    derivationcontrol.h \
+    derivedkeycache.h \
+    derivedkeyprefetcher.h \
+    keymanager.h \
+    compressionpolicy.h \
+    crypterstream.h \
+    segmentedvault.h \
+    syncmerger.h \
+    securearena.h \
+    securebuffer.h \
     securebytearray.h \
     securestring.h \
     exporter.h
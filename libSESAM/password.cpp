@@ -27,9 +27,13 @@
 #include "securestring.h"
 #include "password.h"
 #include "pbkdf2.h"
+#include "passwordgenerator.h"
+#include "derivationcontrol.h"
+#include "derivedkeycache.h"
 #include "util.h"
+#include "compiledtemplate.h"
 
-#include "3rdparty/bigint/bigInt.h"
+#include <QElapsedTimer>
 
 Password::Complexity::Complexity(void)
   : digits(false)
@@ -118,15 +122,26 @@ class PasswordPrivate {
 public:
   PasswordPrivate(void)
     : error(Password::NoError)
+    , elapsed(0)
+    , cache(Q_NULLPTR)
+    , fromCache(false)
   { /* ... */ }
   ~PasswordPrivate()
   { /* ... */ }
   DomainSettings ds;
-  PBKDF2 pbkdf2;
+  DerivationControl control;
+  PBKDF2::Checkpoint checkpoint;
+  PasswordBuffer buffer;
+  QSharedPointer<const CompiledTemplate> compiledTemplate;
+  SecureByteArray derivedKey;
+  SecureString hexKey;
   SecureString password;
   int error;
   QString errorString;
+  qreal elapsed;
   QFuture<void> future;
+  DerivedKeyCache *cache;
+  bool fromCache;
 };
 
 
@@ -141,26 +156,19 @@ const int Password::DefaultComplexityValue = 5;
 const int Password::NoComplexityValue = 0;
 
 
-const Password::TemplateCharacterMap Password::TemplateCharacters = {
-  std::pair<char, QString>('n', Password::Digits),
-  std::pair<char, QString>('a', Password::LowerChars),
-  std::pair<char, QString>('A', Password::UpperChars)
-};
-
-
 Password::Password(const DomainSettings &ds, QObject *parent)
   : QObject(parent)
   , d_ptr(new PasswordPrivate)
 {
-  QObject::connect(&d_ptr->pbkdf2, SIGNAL(generationStarted()), SIGNAL(generationStarted()));
-  QObject::connect(&d_ptr->pbkdf2, SIGNAL(generationAborted()), SIGNAL(generationAborted()));
+  QObject::connect(&d_ptr->control, SIGNAL(progress(int, int, qint64)), SIGNAL(generationProgress(int, int, qint64)));
   setDomainSettings(ds);
 }
 
 
 Password::~Password()
 {
-  // ...
+  abortGeneration();
+  waitForFinished();
 }
 
 
@@ -168,92 +176,120 @@ void Password::setDomainSettings(const DomainSettings &ds)
 {
   Q_D(Password);
   d->ds = ds;
-  d->ds.usedCharacters.clear();
-  if (d->ds.passwordTemplate.contains('n')) {
-    d->ds.usedCharacters.append(Password::Digits);
-  }
-  if (d->ds.passwordTemplate.contains('a')) {
-    d->ds.usedCharacters.append(Password::LowerChars);
-  }
-  if (d->ds.passwordTemplate.contains('A')) {
-    d->ds.usedCharacters.append(Password::UpperChars);
-  }
-  if (d->ds.passwordTemplate.contains('o')) {
-    d->ds.usedCharacters.append(d_ptr->ds.extraCharacters);
-  }
+  d->compiledTemplate = CompiledTemplate::compile(ds.passwordTemplate, ds.extraCharacters);
+  d->ds.usedCharacters = d->compiledTemplate->usedCharacters();
 }
 
 
 SecureString Password::remix(void)
 {
   Q_D(Password);
-  d->password.clear();
-  if (d->ds.usedCharacters.isEmpty()) {
-    d->error = EmptyCharacterSetError;
-    d->errorString = "used character set must not be empty";
-    return SecureString();
-  }
-  if (d->ds.passwordTemplate.isEmpty()) {
-    d->error = EmptyTemplateError;
-    d->errorString = "password template is empty";
-    return SecureString();
-  }
-  d->error = NoError;
-  d->errorString.clear();
-  BigInt::Rossi v(d->pbkdf2.hexKey().toStdString(), BigInt::HEX_DIGIT);
-  foreach (QChar c, d->ds.passwordTemplate) {
-    QString charSet;
-    const char m = c.toLatin1();
-    switch (m) {
-    case 'x':
-      charSet = d->ds.usedCharacters;
-      break;
-    case 'o':
-      charSet = d->ds.extraCharacters;
-      break;
-    case 'a': // fall-through
-    case 'A': // fall-through
-    case 'n':
-      charSet = TemplateCharacters[m];
-      break;
-    default:
-      d->error = EmptyTemplateError;
-      d->errorString = QString("invalid template character: %1").arg(m);
-      return SecureString();
-    }
-    if (charSet.isEmpty()) {
-      d->error = EmptyCharacterSetError;
-      d->errorString = QString("character set for template character %1 must not be empty").arg(m);
-      return SecureString();
-    }
-    const BigInt::Rossi Modulus(QString("%1").arg(charSet.size()).toStdString(), BigInt::DEC_DIGIT);
-    const BigInt::Rossi &mod = v % Modulus;
-    d->password.append(charSet.at(int(mod.toUlong())));
-    v = v / Modulus;
+  const CompiledTemplate &tpl = *d->compiledTemplate;
+  d->password.resize(tpl.size());
+  if (tpl.size() > 0) {
+    tpl.mix(d->derivedKey.constData(), d->derivedKey.size(), d->password.data());
   }
-  return d->password;
+  d->error = tpl.error();
+  d->errorString = tpl.errorString();
+  return (d->error == NoError)
+      ? d->password
+      : SecureString();
 }
 
 
 void Password::generate(const SecureByteArray &key)
 {
   Q_D(Password);
-  const SecureByteArray &pwd =
-      d->ds.domainName.toUtf8() +
-      d->ds.userName.toUtf8() +
-      key;
-  d->pbkdf2.generate(pwd,
-                     QByteArray::fromBase64(d->ds.salt_base64.toUtf8()),
-                     d->ds.iterations,
-                     QCryptographicHash::Sha512);
+  QByteArray cacheKey;
+  d->fromCache = false;
+  if (d->cache != Q_NULLPTR) {
+    cacheKey = DerivedKeyCache::cacheKey(d->ds, key);
+    SecureByteArray derivedKey;
+    d->fromCache = d->cache->lookup(cacheKey, derivedKey);
+    if (d->fromCache) {
+      d->derivedKey = derivedKey;
+      d->hexKey = derivedKey.toHex();
+      remix();
+      emit generated();
+      return;
+    }
+  }
+  d->control.reset();
+  QElapsedTimer elapsedTimer;
+  elapsedTimer.start();
+  emit generationStarted();
+  const bool completed = PasswordGenerator::deriveKey(d->ds, key, d->buffer, &d->control, &d->checkpoint);
+  d->elapsed = 1e-9 * elapsedTimer.nsecsElapsed();
+  if (!completed) {
+    emit generationAborted();
+  }
+  d->derivedKey = SecureByteArray(d->buffer.derivedKey(), PasswordBuffer::DerivedKeySize);
+  d->hexKey = d->derivedKey.toHex();
+  if (d->cache != Q_NULLPTR && completed) {
+    d->cache->insert(cacheKey, d->derivedKey);
+  }
   remix();
   emit generated();
 }
 
 
+/*!
+ * \brief Password::generateBatch
+ *
+ * Generates the passwords for all given domain settings at once. The key derivations
+ * run side by side in the SIMD lanes of `PBKDF2::generateBatch()`.
+ *
+ * The call blocks the calling thread and uses no other threads.
+ *
+ * \param domainSettings list of domains to generate the passwords for
+ * \param key key generation key
+ * \return the generated passwords in the order of `domainSettings`;
+ *         an empty string for domains whose template or character set is invalid
+ */
+QVector<SecureString> Password::generateBatch(const QList<DomainSettings> &domainSettings, const SecureByteArray &key)
+{
+  QVector<SecureByteArray> pwds;
+  QVector<QByteArray> salts;
+  QVector<int> iterations;
+  pwds.reserve(domainSettings.size());
+  salts.reserve(domainSettings.size());
+  iterations.reserve(domainSettings.size());
+  foreach (DomainSettings ds, domainSettings) {
+    pwds << ds.domainName.toUtf8() + ds.userName.toUtf8() + key;
+    salts << QByteArray::fromBase64(ds.salt_base64.toUtf8());
+    iterations << ds.iterations;
+  }
+  const QVector<SecureByteArray> &derivedKeys = PBKDF2::generateBatch(pwds, salts, iterations);
+  QVector<SecureString> passwords;
+  passwords.reserve(domainSettings.size());
+  Password pwd;
+  for (int i = 0; i < domainSettings.size(); ++i) {
+    pwd.setDomainSettings(domainSettings.at(i));
+    pwd.d_ptr->derivedKey = derivedKeys.at(i);
+    pwd.d_ptr->hexKey = derivedKeys.at(i).toHex();
+    passwords << pwd.remix();
+  }
+  return passwords;
+}
+
+
+/*!
+ * \brief Password::generateAsync
+ *
+ * Starts the generation in a worker thread. A generation still running is aborted
+ * first; as the worker checks for cancellation every `DerivationControl::CheckInterval`
+ * iterations, waiting for it to wind down takes a fraction of a millisecond.
+ *
+ * \param key key generation key
+ * \param domainSettings settings of the domain to generate the password for
+ */
 void Password::generateAsync(const SecureByteArray &key, const DomainSettings &domainSettings)
 {
   Q_D(Password);
+  if (d->future.isRunning()) {
+    d->control.cancel();
+    d->future.waitForFinished();
+  }
   setDomainSettings(domainSettings);
   d->future = QtConcurrent::run(this, &Password::generate, key);
 }
@@ -267,19 +303,35 @@ bool Password::isRunning(void) const
 
 bool Password::isAborted(void) const
 {
-  return d_ptr->pbkdf2.isAborted();
+  return !d_ptr->fromCache && d_ptr->control.isCancelled();
 }
 
 
 qreal Password::elapsedSeconds(void) const
 {
-  return d_ptr->pbkdf2.elapsedSeconds();
+  return d_ptr->fromCache ? 0.0 : d_ptr->elapsed;
 }
 
 
 void Password::abortGeneration(void)
 {
-  d_ptr->pbkdf2.abortGeneration();
+  d_ptr->control.cancel();
+}
+
+
+/*!
+ * \brief Password::clearCheckpoint
+ *
+ * Aborts a running generation and wipes the intermediate state of the last
+ * key derivation, which `generate()` would otherwise resume from. As the state
+ * is as good as the derived key, call this when the key is no longer needed.
+ */
+void Password::clearCheckpoint(void)
+{
+  Q_D(Password);
+  d->control.cancel();
+  d->future.waitForFinished();
+  d->checkpoint = PBKDF2::Checkpoint();
 }
 
 
@@ -289,9 +341,29 @@ const SecureString &Password::password(void) const
 }
 
 
+/*!
+ * \brief Password::setCache
+ *
+ * Lets `generate()` look up derived keys in `cache` before running the
+ * key derivation, and store freshly derived keys there.
+ *
+ * \param cache cache to use; `Q_NULLPTR` disables caching
+ */
+void Password::setCache(DerivedKeyCache *cache)
+{
+  d_ptr->cache = cache;
+}
+
+
+DerivedKeyCache *Password::cache(void) const
+{
+  return d_ptr->cache;
+}
+
+
 const SecureString &Password::hexKey(void) const
 {
-  return d_ptr->pbkdf2.hexKey();
+  return d_ptr->hexKey;
 }
 
 
@@ -27,6 +27,7 @@
 #include <QByteArray>
 #include <QBitArray>
 #include <QVector>
+#include <QList>
 #include <QMap>
 
 #include "securebytearray.h"
@@ -34,6 +35,7 @@
 #include "domainsettings.h"
 
 class PasswordPrivate;
+class DerivedKeyCache;
 
 
 class Password : public QObject
@@ -90,26 +92,29 @@ public:
   int error(void) const;
   QString errorString(void) const;
   void setDomainSettings(const DomainSettings &);
+  void setCache(DerivedKeyCache *cache);
+  DerivedKeyCache *cache(void) const;
 
   void generate(const SecureByteArray &key);
   void generateAsync(const SecureByteArray &key, const DomainSettings &domainSettings = DomainSettings());
+  static QVector<SecureString> generateBatch(const QList<DomainSettings> &domainSettings, const SecureByteArray &key);
 
   bool isRunning(void) const;
   bool isAborted(void) const;
   qreal elapsedSeconds(void) const;
   void abortGeneration(void);
+  void clearCheckpoint(void);
 
 signals:
   void generated(void);
   void generationStarted(void);
   void generationAborted(void);
+  void generationProgress(int done, int total, qint64 etaMs);
 
 private:
   QScopedPointer<PasswordPrivate> d_ptr;
   Q_DECLARE_PRIVATE(Password)
   Q_DISABLE_COPY(Password)
-
-  static const TemplateCharacterMap TemplateCharacters;
 };
 
 
@@ -0,0 +1,300 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "passwordbatch.h"
+#include "password.h"
+#include "pbkdf2.h"
+
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+
+class PasswordBatchPrivate {
+public:
+  // chunks [next, end) not yet taken by the owning worker or a thief
+  struct Share {
+    Share(void)
+      : next(0)
+      , end(0)
+    { /* ... */ }
+    QMutex mutex;
+    int next;
+    int end;
+  };
+
+  PasswordBatchPrivate(void)
+    : chunkSize(2 * PBKDF2::batchLanes())
+    , resultData(Q_NULLPTR)
+    , running(0)
+    , cancelled(0)
+    , completed(0)
+  {
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+  }
+  ~PasswordBatchPrivate()
+  { /* ... */ }
+  bool take(int worker, int &chunk);
+  bool steal(int thief, int &chunk);
+
+  const int chunkSize;
+  QList<DomainSettings> domains;
+  SecureByteArray kgk;
+  QVector<SecureString> results;
+  // distinct workers write distinct elements through this pointer, obtained once in `start()`
+  SecureString *resultData;
+  QVector<Share*> shares;
+  QThreadPool pool;
+  QAtomicInt running;
+  QAtomicInt cancelled;
+  QAtomicInt completed;
+};
+
+
+bool PasswordBatchPrivate::take(int worker, int &chunk)
+{
+  Share *share = shares.at(worker);
+  QMutexLocker locker(&share->mutex);
+  if (share->next < share->end) {
+    chunk = share->next++;
+    return true;
+  }
+  return false;
+}
+
+
+bool PasswordBatchPrivate::steal(int thief, int &chunk)
+{
+  int victim = -1;
+  int most = 0;
+  for (int i = 0; i < shares.size(); ++i) {
+    if (i == thief)
+      continue;
+    QMutexLocker locker(&shares.at(i)->mutex);
+    const int left = shares.at(i)->end - shares.at(i)->next;
+    if (left > most) {
+      most = left;
+      victim = i;
+    }
+  }
+  if (victim < 0)
+    return false;
+  int first;
+  int last;
+  {
+    Share *share = shares.at(victim);
+    QMutexLocker locker(&share->mutex);
+    const int left = share->end - share->next;
+    if (left <= 0)
+      return steal(thief, chunk);
+    last = share->end;
+    share->end -= (left + 1) / 2;
+    first = share->end;
+  }
+  Share *own = shares.at(thief);
+  QMutexLocker locker(&own->mutex);
+  chunk = first;
+  own->next = first + 1;
+  own->end = last;
+  return true;
+}
+
+
+class PasswordBatchWorker : public QRunnable
+{
+public:
+  PasswordBatchWorker(PasswordBatch *q, PasswordBatchPrivate *d, int worker)
+    : q(q)
+    , d(d)
+    , worker(worker)
+  { /* ... */ }
+  void run(void)
+  {
+    int chunk;
+    while (d->cancelled.load() == 0 && (d->take(worker, chunk) || d->steal(worker, chunk))) {
+      const int first = chunk * d->chunkSize;
+      const QList<DomainSettings> &batch = d->domains.mid(first, d->chunkSize);
+      const QVector<SecureString> &passwords = Password::generateBatch(batch, d->kgk);
+      for (int i = 0; i < passwords.size(); ++i) {
+        d->resultData[first + i] = passwords.at(i);
+      }
+      const int done = d->completed.fetchAndAddOrdered(passwords.size()) + passwords.size();
+      emit q->chunkReady(first, passwords.size());
+      emit q->progress(done, d->domains.size());
+    }
+    if (d->running.fetchAndAddOrdered(-1) == 1) {
+      emit q->finished();
+    }
+  }
+
+private:
+  PasswordBatch *q;
+  PasswordBatchPrivate *d;
+  int worker;
+};
+
+
+PasswordBatch::PasswordBatch(QObject *parent)
+  : QObject(parent)
+  , d_ptr(new PasswordBatchPrivate)
+{ /* ... */ }
+
+
+PasswordBatch::~PasswordBatch()
+{
+  cancel();
+  waitForFinished();
+  qDeleteAll(d_ptr->shares);
+}
+
+
+/*!
+ * \brief PasswordBatch::start
+ *
+ * Starts generating the passwords of `domains` in the background. A generation
+ * still in progress is cancelled first.
+ *
+ * \param domains domains to generate the passwords for; legacy passwords aren't looked at
+ * \param kgk key generation key
+ */
+void PasswordBatch::start(const QList<DomainSettings> &domains, const SecureByteArray &kgk)
+{
+  Q_D(PasswordBatch);
+  cancel();
+  waitForFinished();
+  qDeleteAll(d->shares);
+  d->shares.clear();
+  d->domains = domains;
+  d->kgk = kgk;
+  d->results = QVector<SecureString>(domains.size());
+  d->resultData = d->results.data();
+  d->cancelled.store(0);
+  d->completed.store(0);
+  const int nChunks = (domains.size() + d->chunkSize - 1) / d->chunkSize;
+  const int nWorkers = qMax(1, qMin(d->pool.maxThreadCount(), nChunks));
+  if (nChunks == 0) {
+    emit finished();
+    return;
+  }
+  for (int w = 0; w < nWorkers; ++w) {
+    PasswordBatchPrivate::Share *share = new PasswordBatchPrivate::Share;
+    share->next = w * nChunks / nWorkers;
+    share->end = (w + 1) * nChunks / nWorkers;
+    d->shares << share;
+  }
+  d->running.store(nWorkers);
+  for (int w = 0; w < nWorkers; ++w) {
+    d->pool.start(new PasswordBatchWorker(this, d, w));
+  }
+}
+
+
+/*!
+ * \brief PasswordBatch::run
+ *
+ * Generates the passwords of `domains` and waits for the result.
+ *
+ * \param domains domains to generate the passwords for
+ * \param kgk key generation key
+ * \return the passwords in the order of `domains`
+ */
+QVector<SecureString> PasswordBatch::run(const QList<DomainSettings> &domains, const SecureByteArray &kgk)
+{
+  start(domains, kgk);
+  waitForFinished();
+  return results();
+}
+
+
+void PasswordBatch::cancel(void)
+{
+  d_ptr->cancelled.store(1);
+}
+
+
+void PasswordBatch::waitForFinished(void)
+{
+  d_ptr->pool.waitForDone();
+}
+
+
+bool PasswordBatch::isRunning(void) const
+{
+  return d_ptr->running.load() > 0;
+}
+
+
+bool PasswordBatch::isCancelled(void) const
+{
+  return d_ptr->cancelled.load() != 0;
+}
+
+
+int PasswordBatch::count(void) const
+{
+  return d_ptr->domains.size();
+}
+
+
+int PasswordBatch::completedCount(void) const
+{
+  return d_ptr->completed.load();
+}
+
+
+/*!
+ * \brief PasswordBatch::result
+ *
+ * May be called for the range announced by `chunkReady()` while the generation is still running.
+ *
+ * \param index index into the list of domains passed to `start()`
+ * \return the password of domain `index`, or an empty string if it isn't generated (yet)
+ */
+SecureString PasswordBatch::result(int index) const
+{
+  return d_ptr->results.at(index);
+}
+
+
+QVector<SecureString> PasswordBatch::results(void) const
+{
+  return d_ptr->results;
+}
+
+
+/*!
+ * \brief PasswordBatch::setThreadCount
+ *
+ * Takes effect with the next call to `start()`.
+ *
+ * \param n maximum number of worker threads; defaults to `QThread::idealThreadCount()`
+ */
+void PasswordBatch::setThreadCount(int n)
+{
+  d_ptr->pool.setMaxThreadCount(qMax(1, n));
+}
+
+
+int PasswordBatch::threadCount(void) const
+{
+  return d_ptr->pool.maxThreadCount();
+}
@@ -0,0 +1,83 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __PASSWORDBATCH_H_
+#define __PASSWORDBATCH_H_
+
+#include <QObject>
+#include <QList>
+#include <QVector>
+#include <QScopedPointer>
+
+#include "securebytearray.h"
+#include "securestring.h"
+#include "domainsettings.h"
+
+class PasswordBatchPrivate;
+
+/*!
+ * \brief The PasswordBatch class
+ *
+ * Generates the passwords of many domains at once.
+ *
+ * The domains are cut into chunks which fill the SIMD lanes of
+ * `Password::generateBatch()`. Every worker thread starts out with an equal
+ * share of the chunks and takes them from the front; a worker that runs out
+ * steals the back half of the largest remaining share, so that domains with
+ * high iteration counts don't leave cores idle.
+ *
+ * `chunkReady()` announces results as they come in, `cancel()` stops the
+ * generation after the chunks currently being processed.
+ *
+ */
+class PasswordBatch : public QObject
+{
+  Q_OBJECT
+public:
+  explicit PasswordBatch(QObject *parent = Q_NULLPTR);
+  ~PasswordBatch();
+
+  void start(const QList<DomainSettings> &domains, const SecureByteArray &kgk);
+  QVector<SecureString> run(const QList<DomainSettings> &domains, const SecureByteArray &kgk);
+  void waitForFinished(void);
+  bool isRunning(void) const;
+  bool isCancelled(void) const;
+  int count(void) const;
+  int completedCount(void) const;
+  SecureString result(int index) const;
+  QVector<SecureString> results(void) const;
+  void setThreadCount(int n);
+  int threadCount(void) const;
+
+public slots:
+  void cancel(void);
+
+signals:
+  void chunkReady(int first, int count);
+  void progress(int done, int total);
+  void finished(void);
+
+private:
+  QScopedPointer<PasswordBatchPrivate> d_ptr;
+  Q_DECLARE_PRIVATE(PasswordBatch)
+  Q_DISABLE_COPY(PasswordBatch)
+};
+
+
+#endif // __PASSWORDBATCH_H_
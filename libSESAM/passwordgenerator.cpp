@@ -0,0 +1,311 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+
+#include "passwordgenerator.h"
+#include "pbkdf2engine.h"
+#include "compiledtemplate.h"
+#include "derivationcontrol.h"
+#include "password.h"
+#include "util.h"
+
+
+PasswordBuffer::PasswordBuffer(void)
+  : mSize(0)
+  , mError(Password::NoError)
+{
+  memset(mDerivedKey, 0, sizeof(mDerivedKey));
+}
+
+
+PasswordBuffer::~PasswordBuffer()
+{
+  SecureErase(mDerivedKey, sizeof(mDerivedKey));
+}
+
+
+const QChar *PasswordBuffer::constData(void) const
+{
+  return reinterpret_cast<const QChar*>(mChars.constData());
+}
+
+
+int PasswordBuffer::size(void) const
+{
+  return mSize;
+}
+
+
+bool PasswordBuffer::isEmpty(void) const
+{
+  return mSize == 0;
+}
+
+
+/*!
+ * \brief PasswordBuffer::error
+ *
+ * \return one of `Password::PasswordError`
+ */
+int PasswordBuffer::error(void) const
+{
+  return mError;
+}
+
+
+SecureString PasswordBuffer::toString(void) const
+{
+  return SecureString(constData(), mSize);
+}
+
+
+/*!
+ * \brief PasswordBuffer::derivedKey
+ *
+ * \return the `DerivedKeySize` bytes of the key derived last
+ */
+const char *PasswordBuffer::derivedKey(void) const
+{
+  return mDerivedKey;
+}
+
+
+void PasswordBuffer::clear(void)
+{
+  mChars.wipe();
+  SecureErase(mDerivedKey, sizeof(mDerivedKey));
+  mSize = 0;
+  mError = Password::NoError;
+}
+
+
+QChar *PasswordBuffer::resize(int size)
+{
+  if (size * int(sizeof(QChar)) > mChars.size()) {
+    mChars = SecureBuffer(size * int(sizeof(QChar)));
+  }
+  mSize = size;
+  return reinterpret_cast<QChar*>(mChars.data());
+}
+
+
+char *PasswordBuffer::scratch(int size)
+{
+  if (size > mScratch.size()) {
+    mScratch = SecureBuffer(size);
+  }
+  return mScratch.data();
+}
+
+
+// maximum number of bytes `appendUtf8()` writes for `str`
+static inline int maxUtf8Size(const QString &str)
+{
+  return 3 * str.size();
+}
+
+
+// writes `str` as UTF-8 to `out`; returns the number of bytes written, or -1 on unpaired surrogates
+static int appendUtf8(const QString &str, char *out)
+{
+  uchar *dst = reinterpret_cast<uchar*>(out);
+  const ushort *src = reinterpret_cast<const ushort*>(str.constData());
+  const int n = str.size();
+  for (int i = 0; i < n; ++i) {
+    uint u = src[i];
+    if (u < 0x80) {
+      *dst++ = uchar(u);
+    }
+    else if (u < 0x800) {
+      *dst++ = uchar(0xc0 | (u >> 6));
+      *dst++ = uchar(0x80 | (u & 0x3f));
+    }
+    else if (QChar::isHighSurrogate(u) && i + 1 < n && QChar::isLowSurrogate(src[i + 1])) {
+      u = QChar::surrogateToUcs4(ushort(u), src[++i]);
+      *dst++ = uchar(0xf0 | (u >> 18));
+      *dst++ = uchar(0x80 | ((u >> 12) & 0x3f));
+      *dst++ = uchar(0x80 | ((u >> 6) & 0x3f));
+      *dst++ = uchar(0x80 | (u & 0x3f));
+    }
+    else if (QChar::isSurrogate(u)) {
+      return -1;
+    }
+    else {
+      *dst++ = uchar(0xe0 | (u >> 12));
+      *dst++ = uchar(0x80 | ((u >> 6) & 0x3f));
+      *dst++ = uchar(0x80 | (u & 0x3f));
+    }
+  }
+  return int(dst - reinterpret_cast<uchar*>(out));
+}
+
+
+static int appendUtf8OrFallback(const QString &str, char *out)
+{
+  int n = appendUtf8(str, out);
+  if (n < 0) {
+    // let Qt decide how to encode broken surrogate pairs
+    const QByteArray &utf8 = str.toUtf8();
+    memcpy(out, utf8.constData(), utf8.size());
+    n = utf8.size();
+  }
+  return n;
+}
+
+
+// decodes like `QByteArray::fromBase64()`: characters outside the alphabet are skipped
+static int decodeBase64(const QString &str, char *out)
+{
+  uint buf = 0;
+  int nbits = 0;
+  int size = 0;
+  const ushort *src = reinterpret_cast<const ushort*>(str.constData());
+  for (int i = 0; i < str.size(); ++i) {
+    const ushort ch = src[i];
+    int d;
+    if (ch >= 'A' && ch <= 'Z')
+      d = ch - 'A';
+    else if (ch >= 'a' && ch <= 'z')
+      d = ch - 'a' + 26;
+    else if (ch >= '0' && ch <= '9')
+      d = ch - '0' + 52;
+    else if (ch == '+')
+      d = 62;
+    else if (ch == '/')
+      d = 63;
+    else
+      continue;
+    buf = (buf << 6) | uint(d);
+    nbits += 6;
+    if (nbits >= 8) {
+      nbits -= 8;
+      out[size++] = char(buf >> nbits);
+      buf &= (1U << nbits) - 1;
+    }
+  }
+  return size;
+}
+
+
+/*!
+ * \brief PasswordGenerator::deriveKey
+ *
+ * Derives the key of domain `ds` like `Password::generate()` does and stores it in `out`.
+ *
+ * \param ds settings of the domain
+ * \param kgk key generation key
+ * \param out receives the derived key, see `PasswordBuffer::derivedKey()`
+ * \param control optional cancellation token and progress sink
+ * \param checkpoint optional checkpoint; the derivation continues from it
+ *        if it was taken with the same parameters and at most `ds.iterations`
+ *        iterations, and it is updated with the state reached
+ * \return false if the derivation was cancelled via `control`
+ */
+bool PasswordGenerator::deriveKey(const DomainSettings &ds, const SecureByteArray &kgk, PasswordBuffer &out, DerivationControl *control, PBKDF2::Checkpoint *checkpoint)
+{
+  typedef PBKDF2Engine<Sha512> Engine;
+  const int pwdCapacity = maxUtf8Size(ds.domainName) + maxUtf8Size(ds.userName) + kgk.size();
+  const int saltCapacity = ds.salt_base64.size();
+  char *pwd = out.scratch(pwdCapacity + saltCapacity);
+  int pwdSize = appendUtf8OrFallback(ds.domainName, pwd);
+  pwdSize += appendUtf8OrFallback(ds.userName, pwd + pwdSize);
+  memcpy(pwd + pwdSize, kgk.constData(), kgk.size());
+  pwdSize += kgk.size();
+  char *salt = pwd + pwdCapacity;
+  const int saltSize = decodeBase64(ds.salt_base64, salt);
+
+  Engine engine(pwd, pwdSize);
+  QByteArray fingerprint;
+  bool resumed = false;
+  if (checkpoint != Q_NULLPTR) {
+    fingerprint = PBKDF2::Checkpoint::fingerprintOf(SecureByteArray(pwd, pwdSize), QByteArray(salt, saltSize), QCryptographicHash::Sha512);
+    if (checkpoint->isValid()
+        && checkpoint->algorithm == QCryptographicHash::Sha512
+        && checkpoint->fingerprint == fingerprint
+        && checkpoint->blockIterations.first() > 0
+        && checkpoint->blockIterations.first() <= ds.iterations
+        && checkpoint->blockStates.first().size() == engine.progressSize()) {
+      engine.restoreProgress(checkpoint->blockStates.first().constData(), checkpoint->blockIterations.first());
+      resumed = true;
+    }
+  }
+  if (!resumed) {
+    engine.start(salt, saltSize, 1);
+  }
+
+  bool completed = true;
+  if (control != Q_NULLPTR) {
+    control->begin(ds.iterations, engine.iterations());
+  }
+  while (engine.iterations() < ds.iterations) {
+    if (control != Q_NULLPTR) {
+      if (control->isCancelled()) {
+        completed = false;
+        break;
+      }
+      engine.iterate(qMin(DerivationControl::CheckInterval, ds.iterations - engine.iterations()));
+      control->report(engine.iterations());
+    }
+    else {
+      engine.iterate(ds.iterations - engine.iterations());
+    }
+  }
+  engine.result(out.mDerivedKey);
+
+  if (checkpoint != Q_NULLPTR) {
+    SecureByteArray progress(engine.progressSize(), static_cast<char>(0));
+    engine.saveProgress(progress.data());
+    checkpoint->algorithm = QCryptographicHash::Sha512;
+    checkpoint->fingerprint = fingerprint;
+    checkpoint->blockStates = QVector<SecureByteArray>() << progress;
+    checkpoint->blockIterations = QVector<int>() << engine.iterations();
+  }
+  SecureErase(pwd, pwdCapacity + saltCapacity);
+  return completed;
+}
+
+
+/*!
+ * \brief PasswordGenerator::generatePassword
+ *
+ * Derives the key of domain `ds` and turns it into the password, which is
+ * written to `out`. This is what `Password::generate()` does, minus caching,
+ * signals and worker threads.
+ *
+ * \param ds settings of the domain
+ * \param kgk key generation key
+ * \param out receives the password
+ * \param control optional cancellation token and progress sink
+ * \return true if the password was generated; false if the derivation was
+ *         cancelled or the template is invalid (see `PasswordBuffer::error()`)
+ */
+bool PasswordGenerator::generatePassword(const DomainSettings &ds, const SecureByteArray &kgk, PasswordBuffer &out, DerivationControl *control)
+{
+  out.mSize = 0;
+  if (!deriveKey(ds, kgk, out, control))
+    return false;
+  const QSharedPointer<const CompiledTemplate> &tpl = CompiledTemplate::compile(ds.passwordTemplate, ds.extraCharacters);
+  out.mError = tpl->error();
+  if (out.mError != Password::NoError)
+    return false;
+  QChar *chars = out.resize(tpl->size());
+  tpl->mix(out.mDerivedKey, PasswordBuffer::DerivedKeySize, chars);
+  return true;
+}
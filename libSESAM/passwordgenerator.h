@@ -0,0 +1,94 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __PASSWORDGENERATOR_H_
+#define __PASSWORDGENERATOR_H_
+
+#include <QtGlobal>
+#include <QChar>
+
+#include "securebytearray.h"
+#include "securestring.h"
+#include "securebuffer.h"
+#include "domainsettings.h"
+#include "pbkdf2.h"
+
+class DerivationControl;
+
+/*!
+ * \brief The PasswordBuffer class
+ *
+ * Caller-owned output and work space of `PasswordGenerator`.
+ *
+ * The buffers grow on demand and are kept for later calls, so a buffer
+ * reused across generations doesn't allocate once it has reached its working size.
+ * All memory is overwritten with 0 before it is released. The generated password and
+ * the scratch space holding the UTF-8 encoded password come from the `SecureArena`.
+ *
+ */
+class PasswordBuffer
+{
+public:
+  enum { DerivedKeySize = 64 };
+
+  PasswordBuffer(void);
+  ~PasswordBuffer();
+
+  const QChar *constData(void) const;
+  int size(void) const;
+  bool isEmpty(void) const;
+  int error(void) const;
+  SecureString toString(void) const;
+  const char *derivedKey(void) const;
+  void clear(void);
+
+private:
+  friend class PasswordGenerator;
+  QChar *resize(int size);
+  char *scratch(int size);
+
+  SecureBuffer mChars;
+  int mSize;
+  SecureBuffer mScratch;
+  char mDerivedKey[DerivedKeySize];
+  int mError;
+
+  Q_DISABLE_COPY(PasswordBuffer)
+};
+
+
+/*!
+ * \brief The PasswordGenerator class
+ *
+ * Stateless, reentrant core of the password generation.
+ *
+ * Neither function creates a QObject or emits a signal, and both only work on
+ * the given `PasswordBuffer`, so any number of threads may generate passwords
+ * side by side, each with a buffer of its own.
+ *
+ */
+class PasswordGenerator
+{
+public:
+  static bool deriveKey(const DomainSettings &ds, const SecureByteArray &kgk, PasswordBuffer &out, DerivationControl *control = Q_NULLPTR, PBKDF2::Checkpoint *checkpoint = Q_NULLPTR);
+  static bool generatePassword(const DomainSettings &ds, const SecureByteArray &kgk, PasswordBuffer &out, DerivationControl *control = Q_NULLPTR);
+};
+
+
+#endif // __PASSWORDGENERATOR_H_
@@ -18,12 +18,16 @@
 */
 
 #include <cstring>
+#include <climits>
 
 #include "pbkdf2.h"
+#include "pbkdf2engine.h"
+#include "sha512multibuffer.h"
 #include "util.h"
 
 #include <QElapsedTimer>
 #include <QMessageAuthenticationCode>
+#include <QMutex>
 #include <QMutexLocker>
 #include <QtConcurrent>
 #include <QtDebug>
@@ -34,7 +38,7 @@ class PBKDF2Private {
 public:
   PBKDF2Private(void)
     : elapsed(0)
-    , abort(false)
+    , control(&ownControl)
   { /* ... */ }
   ~PBKDF2Private()
   { /* ... */ }
@@ -42,9 +46,11 @@ public:
   SecureByteArray derivedKey;
   SecureString hexKey;
   qreal elapsed;
-  bool abort;
-  QMutex abortMutex;
+  DerivationControl ownControl;
+  DerivationControl *control;
   QFuture<void> future;
+  PBKDF2::Checkpoint checkpoint;
+  mutable QMutex checkpointMutex;
 };
 
 
@@ -52,7 +58,9 @@ public:
 PBKDF2::PBKDF2(QObject *parent)
   : QObject(parent)
   , d_ptr(new PBKDF2Private)
-{ /* ... */ }
+{
+  QObject::connect(&d_ptr->ownControl, SIGNAL(progress(int, int, qint64)), SIGNAL(generationProgress(int, int, qint64)));
+}
 
 
 PBKDF2::PBKDF2(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, QObject *parent)
@@ -62,6 +70,13 @@ PBKDF2::PBKDF2(const SecureByteArray &pwd, const QByteArray &salt, int iteration
 }
 
 
+PBKDF2::PBKDF2(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, int keyLength, QObject *parent)
+  : PBKDF2(parent)
+{
+  generate(pwd, salt, iterations, algorithm, keyLength);
+}
+
+
 PBKDF2::~PBKDF2()
 { /* ... */ }
 
@@ -74,58 +89,179 @@ auto xorbuf = [](QByteArray &dst, const QByteArray &src) {
 };
 
 
-void PBKDF2::generate(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm)
+// computes output block `index` of PBKDF2, continuing from `progress` if `done` > 0;
+// on return `progress` and `done` hold the state reached. Returns false if cancelled via `control`
+static bool deriveBlock(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, quint32 index, DerivationControl *control, bool reportProgress, SecureByteArray &progress, int &done, SecureByteArray &block)
+{
+  bool completed = true;
+  QScopedPointer<PBKDF2EngineBase> engine(PBKDF2EngineBase::create(algorithm, pwd.constData(), pwd.size()));
+  if (!engine.isNull()) {
+    if (done > 0 && done <= iterations && progress.size() == engine->progressSize()) {
+      engine->restoreProgress(progress.constData(), done);
+    }
+    else {
+      engine->start(salt.constData(), salt.size(), index);
+    }
+    while (engine->iterations() < iterations) {
+      if (control->isCancelled()) {
+        completed = false;
+        break;
+      }
+      engine->iterate(qMin(DerivationControl::CheckInterval, iterations - engine->iterations()));
+      if (reportProgress) {
+        control->report(engine->iterations());
+      }
+    }
+    progress = SecureByteArray(engine->progressSize(), static_cast<char>(0));
+    engine->saveProgress(progress.data());
+    done = engine->iterations();
+    block = SecureByteArray(engine->digestSize(), static_cast<char>(0));
+    engine->result(block.data());
+  }
+  else {
+    // no specialized engine available, fall back to Qt's generic HMAC
+    QMessageAuthenticationCode hmac(algorithm);
+    hmac.setKey(pwd);
+    const int hashLength = QCryptographicHash::hash(QByteArray(), algorithm).size();
+    QByteArray buffer;
+    int j = 1;
+    if (done > 0 && done <= iterations && progress.size() == 2 * hashLength) {
+      buffer = progress.left(hashLength);
+      block = progress.mid(hashLength);
+      j = done;
+    }
+    else {
+      uchar INT_32_BE[4];
+      qToBigEndian<quint32>(index, INT_32_BE);
+      hmac.addData(salt + QByteArray(reinterpret_cast<const char*>(INT_32_BE), 4));
+      buffer = hmac.result();
+      block = buffer;
+    }
+
+    for ( ; j < iterations; ++j) {
+      if (j % DerivationControl::CheckInterval == 0) {
+        if (control->isCancelled()) {
+          completed = false;
+          break;
+        }
+        if (reportProgress) {
+          control->report(j);
+        }
+      }
+      hmac.reset();
+      hmac.addData(buffer);
+      buffer = hmac.result();
+      xorbuf(block, buffer);
+    }
+    progress = buffer;
+    progress.append(block);
+    done = j;
+  }
+  return completed;
+}
+
+
+/*!
+ * \brief PBKDF2::generate
+ *
+ * Derives `keyLength` bytes from `pwd` and `salt`.
+ *
+ * If more than one hash length is requested, every further output block is derived
+ * by its own task in the global thread pool while the calling thread computes the
+ * first block, so the elapsed time is about that of a single block on multi-core machines.
+ *
+ * Blocks covered by the current checkpoint (see `checkpoint()`) with no more than
+ * `iterations` iterations are continued instead of being derived from scratch.
+ *
+ * \param pwd password
+ * \param salt salt
+ * \param iterations iteration count
+ * \param algorithm hash function used with HMAC
+ * \param keyLength number of bytes to derive; if < 1 the hash length of `algorithm` is used
+ */
+void PBKDF2::generate(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, int keyLength)
 {
   Q_D(PBKDF2);
 
-  d->abortMutex.lock();
-  d->abort = false;
-  d->abortMutex.unlock();
+  DerivationControl *control = d->control;
+  if (control == &d->ownControl) {
+    // an external control is reset by its owner only, so that a cancellation preceding the call isn't lost
+    control->reset();
+  }
 
   QElapsedTimer elapsedTimer;
   elapsedTimer.start();
 
+  const int hashLength = QCryptographicHash::hash(QByteArray(), algorithm).size();
+  const int nBlocks = (keyLength > hashLength)
+      ? (keyLength + hashLength - 1) / hashLength
+      : 1;
+  Checkpoint cp = checkpoint();
+  const QByteArray &fingerprint = Checkpoint::fingerprintOf(pwd, salt, algorithm);
+  QVector<SecureByteArray> progress(nBlocks);
+  QVector<int> done(nBlocks, 0);
+  if (cp.isValid() && cp.algorithm == algorithm && cp.fingerprint == fingerprint) {
+    for (int i = 0; i < nBlocks && i < cp.blockStates.size(); ++i) {
+      if (cp.blockIterations.at(i) <= iterations) {
+        progress[i] = cp.blockStates.at(i);
+        done[i] = cp.blockIterations.at(i);
+      }
+    }
+  }
+  control->begin(iterations, done.first());
+
   emit generationStarted();
 
-  static const char INT_32_BE1[4] = { 0, 0, 0, 1 };
-  QMessageAuthenticationCode hmac(algorithm);
-  hmac.setKey(pwd);
-  hmac.addData(salt + QByteArray(INT_32_BE1, 4));
+  QVector<SecureByteArray> blocks(nBlocks);
+  QList<QFuture<bool> > futures;
+  for (int i = 1; i < nBlocks; ++i) {
+    SecureByteArray *block = &blocks[i];
+    SecureByteArray *blockProgress = &progress[i];
+    int *blockDone = &done[i];
+    futures << QtConcurrent::run([=]() {
+      return deriveBlock(pwd, salt, iterations, algorithm, quint32(i + 1), control, false, *blockProgress, *blockDone, *block);
+    });
+  }
+  bool completed = deriveBlock(pwd, salt, iterations, algorithm, 1, control, true, progress[0], done[0], blocks[0]);
+  foreach (QFuture<bool> future, futures) {
+    completed &= future.result();
+  }
 
-  QByteArray buffer = hmac.result();
-  d->derivedKey = buffer;
+  cp.algorithm = algorithm;
+  cp.fingerprint = fingerprint;
+  cp.blockStates = progress;
+  cp.blockIterations = done;
+  setCheckpoint(cp);
 
-  for (int j = 1; j < iterations; ++j) {
-    QMutexLocker locker(&d->abortMutex);
-    if (d->abort) {
-      emit generationAborted();
-      break;
-    }
-    hmac.reset();
-    hmac.addData(buffer);
-    buffer = hmac.result();
-    xorbuf(d->derivedKey, buffer);
+  if (!completed) {
+    emit generationAborted();
   }
 
+  SecureByteArray key;
+  key.reserve(nBlocks * hashLength);
+  foreach (SecureByteArray block, blocks) {
+    key.append(block);
+  }
+  d->derivedKey = (keyLength > 0)
+      ? SecureByteArray(key.constData(), keyLength)
+      : key;
+
   d->hexKey = d->derivedKey.toHex();
   d->elapsed = 1e-9 * elapsedTimer.nsecsElapsed();
 }
 
 
-void PBKDF2::generateAsync(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm)
+void PBKDF2::generateAsync(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, int keyLength)
 {
   Q_D(PBKDF2);
-  d->abort = false;
-  d->future = QtConcurrent::run(this, &PBKDF2::generate, pwd, salt, iterations, algorithm);
+  d->control->reset();
+  d->future = QtConcurrent::run(this, &PBKDF2::generate, pwd, salt, iterations, algorithm, keyLength);
 }
 
 
 void PBKDF2::abortGeneration(void)
 {
-  Q_D(PBKDF2);
-  d->abortMutex.lock();
-  d->abort = true;
-  d->abortMutex.unlock();
+  d_ptr->control->cancel();
 }
 
 
@@ -137,7 +273,7 @@ const SecureString &PBKDF2::hexKey(void) const
 
 SecureByteArray PBKDF2::derivedKey(int size) const
 {
-  Q_ASSERT_X(size <= d_ptr->derivedKey.size(), "Password::derivedKey()", "size must be <= key size");
+  Q_ASSERT_X(size <= d_ptr->derivedKey.size(), "PBKDF2::derivedKey()", "size must be <= generated key length");
   if (size < 0)
     return d_ptr->derivedKey;
   else
@@ -159,5 +295,207 @@ bool PBKDF2::isRunning(void) const
 
 bool PBKDF2::isAborted(void) const
 {
-  return d_ptr->abort;
+  return d_ptr->control->isCancelled();
+}
+
+
+/*!
+ * \brief PBKDF2::setControl
+ *
+ * Makes the generation use an external cancellation token and progress sink.
+ * Progress reported to an external control is not forwarded as `generationProgress()`.
+ *
+ * \param control the control to use, or `Q_NULLPTR` to return to the built-in one
+ */
+void PBKDF2::setControl(DerivationControl *control)
+{
+  Q_D(PBKDF2);
+  d->control = (control != Q_NULLPTR) ? control : &d->ownControl;
+}
+
+
+DerivationControl *PBKDF2::control(void) const
+{
+  return d_ptr->control;
+}
+
+
+PBKDF2::Checkpoint::Checkpoint(void)
+  : algorithm(QCryptographicHash::Sha512)
+{ /* ... */ }
+
+
+bool PBKDF2::Checkpoint::isValid(void) const
+{
+  return !fingerprint.isEmpty() && !blockStates.isEmpty() && blockStates.size() == blockIterations.size();
+}
+
+
+/*!
+ * \brief PBKDF2::Checkpoint::iterations
+ *
+ * \return number of iterations completed for all blocks
+ */
+int PBKDF2::Checkpoint::iterations(void) const
+{
+  int n = 0;
+  for (int i = 0; i < blockIterations.size(); ++i) {
+    n = (i == 0) ? blockIterations.at(i) : qMin(n, blockIterations.at(i));
+  }
+  return n;
+}
+
+
+/*!
+ * \brief PBKDF2::Checkpoint::fingerprintOf
+ *
+ * The fingerprint is an HMAC-SHA256 keyed with the password, so that it doesn't
+ * reveal anything about the password itself.
+ *
+ * \param pwd password
+ * \param salt salt
+ * \param algorithm hash function used with HMAC
+ * \return 32 byte fingerprint
+ */
+QByteArray PBKDF2::Checkpoint::fingerprintOf(const SecureByteArray &pwd, const QByteArray &salt, QCryptographicHash::Algorithm algorithm)
+{
+  QMessageAuthenticationCode hmac(QCryptographicHash::Sha256, pwd);
+  hmac.addData(QByteArray::number(int(algorithm)) + ':' + salt);
+  return hmac.result();
+}
+
+
+/*!
+ * \brief PBKDF2::checkpoint
+ *
+ * \return the state left behind by the latest call to `generate()`
+ */
+PBKDF2::Checkpoint PBKDF2::checkpoint(void) const
+{
+  QMutexLocker locker(&d_ptr->checkpointMutex);
+  return d_ptr->checkpoint;
+}
+
+
+/*!
+ * \brief PBKDF2::setCheckpoint
+ *
+ * Lets the next call to `generate()` continue from `checkpoint`, provided that it
+ * matches password, salt and algorithm of that call.
+ *
+ * \param checkpoint a checkpoint previously obtained from `checkpoint()`
+ */
+void PBKDF2::setCheckpoint(const Checkpoint &checkpoint)
+{
+  QMutexLocker locker(&d_ptr->checkpointMutex);
+  d_ptr->checkpoint = checkpoint;
+}
+
+
+void PBKDF2::clearCheckpoint(void)
+{
+  setCheckpoint(Checkpoint());
+}
+
+
+/*!
+ * \brief PBKDF2::generateBatch
+ *
+ * Derives one PBKDF2-HMAC-SHA512 key per password/salt/iterations triple.
+ *
+ * The derivations are distributed over the SIMD lanes of `Sha512MultiBuffer`.
+ * Whenever a lane has finished its job it is refilled with the next pending one,
+ * so jobs with differing iteration counts keep all lanes busy.
+ *
+ * The call is synchronous and single-threaded; callers wanting to use several
+ * cores split their jobs into chunks and run one batch per thread.
+ *
+ * \param pwds passwords
+ * \param salts salts, one per password
+ * \param iterations iteration counts, one per password
+ * \return the 64 byte keys in the order of `pwds`
+ */
+QVector<SecureByteArray> PBKDF2::generateBatch(const QVector<SecureByteArray> &pwds, const QVector<QByteArray> &salts, const QVector<int> &iterations)
+{
+  Q_ASSERT_X(pwds.size() == salts.size() && pwds.size() == iterations.size(), "PBKDF2::generateBatch()", "number of passwords, salts and iteration counts must be equal");
+  typedef PBKDF2Engine<Sha512> Engine;
+  const int nJobs = pwds.size();
+  QVector<SecureByteArray> keys(nJobs);
+  const int L = Sha512MultiBuffer::lanes();
+  quint64 inner[Sha512::StateWords * Sha512MultiBuffer::MaxLanes];
+  quint64 outer[Sha512::StateWords * Sha512MultiBuffer::MaxLanes];
+  quint64 u[Sha512::DigestWords * Sha512MultiBuffer::MaxLanes];
+  quint64 t[Sha512::DigestWords * Sha512MultiBuffer::MaxLanes];
+  memset(inner, 0, sizeof(inner));
+  memset(outer, 0, sizeof(outer));
+  memset(u, 0, sizeof(u));
+  memset(t, 0, sizeof(t));
+  int job[Sha512MultiBuffer::MaxLanes];
+  int remaining[Sha512MultiBuffer::MaxLanes];
+  for (int l = 0; l < L; ++l) {
+    job[l] = -1;
+    remaining[l] = 0;
+  }
+  Engine::State state;
+  auto collect = [&](int l) {
+    SecureByteArray key(Sha512::DigestSize, static_cast<char>(0));
+    for (int w = 0; w < Sha512::DigestWords; ++w) {
+      qToBigEndian<quint64>(t[w * L + l], reinterpret_cast<uchar*>(key.data()) + w * sizeof(quint64));
+    }
+    keys[job[l]] = key;
+    job[l] = -1;
+  };
+  int next = 0;
+  forever {
+    int active = 0;
+    int rounds = INT_MAX;
+    for (int l = 0; l < L; ++l) {
+      while (job[l] < 0 && next < nJobs) {
+        const int j = next++;
+        Engine engine(pwds.at(j).constData(), pwds.at(j).size());
+        engine.start(salts.at(j).constData(), salts.at(j).size(), 1);
+        engine.saveState(state);
+        for (int w = 0; w < Sha512::StateWords; ++w) {
+          inner[w * L + l] = state.inner[w];
+          outer[w * L + l] = state.outer[w];
+        }
+        for (int w = 0; w < Sha512::DigestWords; ++w) {
+          u[w * L + l] = state.u[w];
+          t[w * L + l] = state.t[w];
+        }
+        job[l] = j;
+        remaining[l] = iterations.at(j) - 1;
+        if (remaining[l] <= 0) {
+          collect(l);
+        }
+      }
+      if (job[l] >= 0) {
+        ++active;
+        rounds = qMin(rounds, remaining[l]);
+      }
+    }
+    if (active == 0)
+      break;
+    Sha512MultiBuffer::iterate(inner, outer, u, t, rounds);
+    for (int l = 0; l < L; ++l) {
+      if (job[l] >= 0) {
+        remaining[l] -= rounds;
+        if (remaining[l] == 0) {
+          collect(l);
+        }
+      }
+    }
+  }
+  SecureErase(&state, sizeof(state));
+  SecureErase(inner, sizeof(inner));
+  SecureErase(outer, sizeof(outer));
+  SecureErase(u, sizeof(u));
+  SecureErase(t, sizeof(t));
+  return keys;
+}
+
+
+int PBKDF2::batchLanes(void)
+{
+  return Sha512MultiBuffer::lanes();
 }
@@ -24,9 +24,11 @@
 #include <QString>
 #include <QScopedPointer>
 #include <QCryptographicHash>
+#include <QVector>
 
 #include "securebytearray.h"
 #include "securestring.h"
+#include "derivationcontrol.h"
 
 class PBKDF2Private;
 
@@ -35,6 +37,11 @@ class PBKDF2Private;
  *
  * `PBKDF2` implements the Password-Based Key Derivation Function 2.
  *
+ * Every call to `generate()` leaves a `Checkpoint` behind, also if it was aborted.
+ * A following call with the same password, salt and algorithm but at least as many
+ * iterations continues from there, so raising the iteration count only costs the
+ * additional iterations.
+ *
  */
 class PBKDF2 : public QObject
 {
@@ -42,21 +49,52 @@ class PBKDF2 : public QObject
 public:
   explicit PBKDF2(QObject *parent = Q_NULLPTR);
   PBKDF2(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, QObject *parent = Q_NULLPTR);
+  PBKDF2(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, int keyLength, QObject *parent = Q_NULLPTR);
   ~PBKDF2();
 
+  /*!
+   * \brief The Checkpoint class
+   *
+   * Intermediate state of a derivation: the last U and the accumulated T of every
+   * output block together with the number of iterations they represent.
+   * `fingerprint` binds the checkpoint to the password, salt and hash algorithm.
+   *
+   */
+  class Checkpoint {
+  public:
+    Checkpoint(void);
+    bool isValid(void) const;
+    int iterations(void) const;
+    QCryptographicHash::Algorithm algorithm;
+    QByteArray fingerprint;
+    QVector<SecureByteArray> blockStates;
+    QVector<int> blockIterations;
+
+    static QByteArray fingerprintOf(const SecureByteArray &pwd, const QByteArray &salt, QCryptographicHash::Algorithm algorithm);
+  };
+
   void abortGeneration(void);
-  void generate(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm);
-  void generateAsync(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm);
+  void generate(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, int keyLength = -1);
+  void generateAsync(const SecureByteArray &pwd, const QByteArray &salt, int iterations, QCryptographicHash::Algorithm algorithm, int keyLength = -1);
 
   const SecureString &hexKey(void) const;
   SecureByteArray derivedKey(int size = -1) const;
   qreal elapsedSeconds(void) const;
   bool isRunning(void) const;
   bool isAborted(void) const;
+  void setControl(DerivationControl *control);
+  DerivationControl *control(void) const;
+  Checkpoint checkpoint(void) const;
+  void setCheckpoint(const Checkpoint &checkpoint);
+  void clearCheckpoint(void);
+
+  static QVector<SecureByteArray> generateBatch(const QVector<SecureByteArray> &pwds, const QVector<QByteArray> &salts, const QVector<int> &iterations);
+  static int batchLanes(void);
 
 signals:
   void generationStarted(void);
   void generationAborted(void);
+  void generationProgress(int done, int total, qint64 etaMs);
 
 private:
   QScopedPointer<PBKDF2Private> d_ptr;
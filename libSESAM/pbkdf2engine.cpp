@@ -0,0 +1,48 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "pbkdf2engine.h"
+
+
+/*!
+ * \brief PBKDF2EngineBase::create
+ *
+ * Creates a PBKDF2 engine for the given hash algorithm.
+ *
+ * \param algorithm The hash algorithm to be used in HMAC.
+ * \param pwd The password.
+ * \param pwdSize The length of the password in bytes.
+ * \return A newly allocated engine or `Q_NULLPTR` if there's no specialized engine for `algorithm`.
+ */
+PBKDF2EngineBase *PBKDF2EngineBase::create(QCryptographicHash::Algorithm algorithm, const char *pwd, int pwdSize)
+{
+  switch (algorithm) {
+  case QCryptographicHash::Sha224:
+    return new PBKDF2Engine<Sha224>(pwd, pwdSize);
+  case QCryptographicHash::Sha256:
+    return new PBKDF2Engine<Sha256>(pwd, pwdSize);
+  case QCryptographicHash::Sha384:
+    return new PBKDF2Engine<Sha384>(pwd, pwdSize);
+  case QCryptographicHash::Sha512:
+    return new PBKDF2Engine<Sha512>(pwd, pwdSize);
+  default:
+    break;
+  }
+  return Q_NULLPTR;
+}
@@ -0,0 +1,299 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __PBKDF2ENGINE_H_
+#define __PBKDF2ENGINE_H_
+
+#include <cstring>
+
+#include <QtGlobal>
+#include <QtEndian>
+#include <QByteArray>
+#include <QCryptographicHash>
+
+#include "sha2.h"
+#include "securearena.h"
+#include "securebuffer.h"
+#include "util.h"
+
+
+/*!
+ * \brief The PBKDF2EngineBase class
+ *
+ * Hash-agnostic interface of the PBKDF2-HMAC iteration engine.
+ *
+ * An engine is bound to a password. `start()` computes U_1 for the given salt and
+ * block index, each call to `iterate()` advances the derivation by further rounds.
+ * `result()` yields the accumulated T = U_1 ^ U_2 ^ ... ^ U_c.
+ *
+ * `saveProgress()` and `restoreProgress()` capture and reinstate the last U and T,
+ * so that a derivation with c iterations can be continued to c + k iterations
+ * by calling `iterate(k)`.
+ *
+ * Engines created on the heap live in the `SecureArena`, as they hold the HMAC pad
+ * states derived from the password.
+ *
+ */
+class PBKDF2EngineBase
+{
+public:
+  virtual ~PBKDF2EngineBase() { /* ... */ }
+  virtual int digestSize(void) const = 0;
+  virtual void start(const char *salt, int saltSize, quint32 blockIndex) = 0;
+  virtual void iterate(int n) = 0;
+  virtual int iterations(void) const = 0;
+  virtual void result(char *out) const = 0;
+  virtual int progressSize(void) const = 0;
+  virtual void saveProgress(char *out) const = 0;
+  virtual void restoreProgress(const char *in, int iterations) = 0;
+
+  static PBKDF2EngineBase *create(QCryptographicHash::Algorithm algorithm, const char *pwd, int pwdSize);
+
+  static void *operator new(size_t size)
+  {
+    return SecureArena::allocate(size);
+  }
+
+  static void operator delete(void *p, size_t size)
+  {
+    SecureArena::release(p, size);
+  }
+};
+
+
+/*!
+ * \brief The PBKDF2Engine class
+ *
+ * PBKDF2-HMAC specialized on one of the SHA-2 block transforms declared in sha2.h.
+ *
+ * The inner and outer HMAC pad states are computed once per password. As the message
+ * hashed in every iteration has the fixed length of one block plus one digest,
+ * inner and outer hash share a single preformatted padding block, so that an iteration
+ * costs exactly two block transforms and works on fixed-size buffers only.
+ *
+ */
+template <class Hash>
+class PBKDF2Engine : public PBKDF2EngineBase
+{
+public:
+  typedef typename Hash::Word Word;
+
+  /*!
+   * \brief The State struct
+   *
+   * Snapshot of a running derivation: HMAC pad states, the last U_i and the accumulated T.
+   *
+   */
+  struct State {
+    Word inner[Hash::StateWords];
+    Word outer[Hash::StateWords];
+    Word u[Hash::DigestWords];
+    Word t[Hash::DigestWords];
+    int iterations;
+  };
+
+  PBKDF2Engine(const char *pwd, int pwdSize)
+    : mIterations(0)
+  {
+    uchar key[Hash::BlockSize];
+    memset(key, 0, Hash::BlockSize);
+    if (pwdSize > Hash::BlockSize) {
+      hash(pwd, pwdSize, reinterpret_cast<char*>(key));
+    }
+    else if (pwdSize > 0) {
+      memcpy(key, pwd, pwdSize);
+    }
+    uchar pad[Hash::BlockSize];
+    Word block[Hash::BlockWords];
+    for (int i = 0; i < Hash::BlockSize; ++i) {
+      pad[i] = key[i] ^ 0x36;
+    }
+    load(block, pad);
+    Hash::init(mInner);
+    Hash::transform(mInner, block);
+    for (int i = 0; i < Hash::BlockSize; ++i) {
+      pad[i] = key[i] ^ 0x5c;
+    }
+    load(block, pad);
+    Hash::init(mOuter);
+    Hash::transform(mOuter, block);
+    SecureErase(key, sizeof(key));
+    SecureErase(pad, sizeof(pad));
+    SecureErase(block, sizeof(block));
+
+    memset(mBlock, 0, sizeof(mBlock));
+    mBlock[Hash::DigestWords] = Word(0x80) << (8 * sizeof(Word) - 8);
+    mBlock[Hash::BlockWords - 1] = Word(8 * (Hash::BlockSize + Hash::DigestSize));
+    memset(mT, 0, sizeof(mT));
+  }
+
+  ~PBKDF2Engine()
+  {
+    SecureErase(mInner, sizeof(mInner));
+    SecureErase(mOuter, sizeof(mOuter));
+    SecureErase(mBlock, sizeof(mBlock));
+    SecureErase(mT, sizeof(mT));
+  }
+
+  int digestSize(void) const
+  {
+    return Hash::DigestSize;
+  }
+
+  void start(const char *salt, int saltSize, quint32 blockIndex)
+  {
+    SecureBuffer msg(saltSize + int(sizeof(quint32)));
+    memcpy(msg.data(), salt, saltSize);
+    qToBigEndian<quint32>(blockIndex, reinterpret_cast<uchar*>(msg.data() + saltSize));
+    Word state[Hash::StateWords];
+    memcpy(state, mInner, sizeof(state));
+    finish(state, reinterpret_cast<const uchar*>(msg.constData()), msg.size(), Hash::BlockSize);
+    memcpy(mBlock, state, Hash::DigestWords * sizeof(Word));
+    memcpy(state, mOuter, sizeof(state));
+    Hash::transform(state, mBlock);
+    memcpy(mBlock, state, Hash::DigestWords * sizeof(Word));
+    memcpy(mT, state, Hash::DigestWords * sizeof(Word));
+    SecureErase(state, sizeof(state));
+    mIterations = 1;
+  }
+
+  void iterate(int n)
+  {
+    Word state[Hash::StateWords];
+    for (int j = 0; j < n; ++j) {
+      memcpy(state, mInner, sizeof(state));
+      Hash::transform(state, mBlock);
+      memcpy(mBlock, state, Hash::DigestWords * sizeof(Word));
+      memcpy(state, mOuter, sizeof(state));
+      Hash::transform(state, mBlock);
+      for (int w = 0; w < Hash::DigestWords; ++w) {
+        mBlock[w] = state[w];
+        mT[w] ^= state[w];
+      }
+    }
+    SecureErase(state, sizeof(state));
+    mIterations += n;
+  }
+
+  int iterations(void) const
+  {
+    return mIterations;
+  }
+
+  void result(char *out) const
+  {
+    for (int w = 0; w < Hash::DigestWords; ++w) {
+      qToBigEndian<Word>(mT[w], reinterpret_cast<uchar*>(out) + w * sizeof(Word));
+    }
+  }
+
+  int progressSize(void) const
+  {
+    return 2 * Hash::DigestWords * sizeof(Word);
+  }
+
+  void saveProgress(char *out) const
+  {
+    memcpy(out, mBlock, Hash::DigestWords * sizeof(Word));
+    memcpy(out + Hash::DigestWords * sizeof(Word), mT, Hash::DigestWords * sizeof(Word));
+  }
+
+  void restoreProgress(const char *in, int iterations)
+  {
+    memcpy(mBlock, in, Hash::DigestWords * sizeof(Word));
+    memcpy(mT, in + Hash::DigestWords * sizeof(Word), Hash::DigestWords * sizeof(Word));
+    mIterations = iterations;
+  }
+
+  void saveState(State &state) const
+  {
+    memcpy(state.inner, mInner, sizeof(state.inner));
+    memcpy(state.outer, mOuter, sizeof(state.outer));
+    memcpy(state.u, mBlock, sizeof(state.u));
+    memcpy(state.t, mT, sizeof(state.t));
+    state.iterations = mIterations;
+  }
+
+  void restoreState(const State &state)
+  {
+    memcpy(mInner, state.inner, sizeof(mInner));
+    memcpy(mOuter, state.outer, sizeof(mOuter));
+    memcpy(mBlock, state.u, sizeof(state.u));
+    memcpy(mT, state.t, sizeof(mT));
+    mIterations = state.iterations;
+  }
+
+  static void hash(const char *data, int size, char *digest)
+  {
+    Word state[Hash::StateWords];
+    Hash::init(state);
+    finish(state, reinterpret_cast<const uchar*>(data), size, 0);
+    for (int w = 0; w < Hash::DigestWords; ++w) {
+      qToBigEndian<Word>(state[w], reinterpret_cast<uchar*>(digest) + w * sizeof(Word));
+    }
+    SecureErase(state, sizeof(state));
+  }
+
+private:
+  static void load(Word *block, const uchar *data)
+  {
+    for (int w = 0; w < Hash::BlockWords; ++w) {
+      block[w] = qFromBigEndian<Word>(data + w * sizeof(Word));
+    }
+  }
+
+  // hashes `data` into `state`, which has already absorbed `prefixSize` bytes, and appends the final padding
+  static void finish(Word *state, const uchar *data, int size, quint64 prefixSize)
+  {
+    Word block[Hash::BlockWords];
+    int i = 0;
+    for ( ; size - i >= Hash::BlockSize; i += Hash::BlockSize) {
+      load(block, data + i);
+      Hash::transform(state, block);
+    }
+    uchar tail[2 * Hash::BlockSize];
+    memset(tail, 0, sizeof(tail));
+    const int rest = size - i;
+    if (rest > 0) {
+      memcpy(tail, data + i, rest);
+    }
+    tail[rest] = 0x80;
+    const int tailSize = (rest + 1 + Hash::LengthSize <= Hash::BlockSize)
+        ? Hash::BlockSize
+        : 2 * Hash::BlockSize;
+    qToBigEndian<quint64>(8 * (prefixSize + quint64(size)), tail + tailSize - sizeof(quint64));
+    for (int off = 0; off < tailSize; off += Hash::BlockSize) {
+      load(block, tail + off);
+      Hash::transform(state, block);
+    }
+    SecureErase(tail, sizeof(tail));
+    SecureErase(block, sizeof(block));
+  }
+
+  Word mInner[Hash::StateWords];
+  Word mOuter[Hash::StateWords];
+  Word mBlock[Hash::BlockWords];
+  Word mT[Hash::DigestWords];
+  int mIterations;
+
+  Q_DISABLE_COPY(PBKDF2Engine)
+};
+
+
+#endif // __PBKDF2ENGINE_H_
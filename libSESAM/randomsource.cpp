@@ -0,0 +1,415 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QThreadStorage>
+
+#include "randomsource.h"
+#include "securebytearray.h"
+#include "cpufeatures.h"
+#include "osrng.h"
+#include "randpool.h"
+
+#if defined(Q_OS_LINUX)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(Q_OS_WIN)
+#pragma comment(lib, "advapi32.lib")
+#endif
+
+#if defined(SESAM_X86) && defined(Q_PROCESSOR_X86_64)
+#define SESAM_RDRAND 1
+#include <immintrin.h>
+#endif
+
+
+const int RandomSource::BufferSize = 4096;
+const int RandomSource::SmallRequestSize = 256;
+const qint64 RandomSource::ReseedInterval = 1024 * 1024;
+
+
+namespace {
+
+const int HardwareRetries = 10;
+const int SeedSize = 32;
+
+
+#if defined(SESAM_RDRAND)
+SESAM_TARGET("rdrnd")
+bool rdrand64(quint64 *r)
+{
+  unsigned long long v;
+  for (int i = 0; i < HardwareRetries; ++i) {
+    if (_rdrand64_step(&v)) {
+      *r = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+SESAM_TARGET("rdseed")
+bool rdseed64(quint64 *r)
+{
+  unsigned long long v;
+  for (int i = 0; i < HardwareRetries; ++i) {
+    if (_rdseed64_step(&v)) {
+      *r = v;
+      return true;
+    }
+    // RDSEED fails if the entropy source cannot keep up, so give it some time
+    _mm_pause();
+  }
+  return false;
+}
+#endif
+
+
+// All fill functions return the number of bytes actually produced.
+
+int fillHardware(char *buf, int size)
+{
+#if defined(SESAM_RDRAND)
+  int n = 0;
+  quint64 r = 0;
+  while (n < size && rdrand64(&r)) {
+    const int k = qMin(size - n, int(sizeof(r)));
+    memcpy(buf + n, &r, size_t(k));
+    n += k;
+  }
+  r = 0;
+  return n;
+#else
+  Q_UNUSED(buf);
+  Q_UNUSED(size);
+  return 0;
+#endif
+}
+
+
+bool hardwareIsSane(void)
+{
+#if defined(SESAM_RDRAND)
+  if (!CPUFeatures::hasRDRAND())
+    return false;
+  quint64 samples[4];
+  for (int i = 0; i < 4; ++i) {
+    if (!rdrand64(&samples[i]))
+      return false;
+  }
+  // some CPUs keep returning all ones while signalling success
+  for (int i = 1; i < 4; ++i) {
+    if (samples[i] != samples[0])
+      return true;
+  }
+#endif
+  return false;
+}
+
+
+int fillSystem(char *buf, int size)
+{
+#if defined(Q_OS_LINUX) && defined(SYS_getrandom)
+  int n = 0;
+  while (n < size) {
+    const long k = syscall(SYS_getrandom, buf + n, size_t(size - n), 0);
+    if (k < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    n += int(k);
+  }
+  return n;
+#else
+  Q_UNUSED(buf);
+  Q_UNUSED(size);
+  return 0;
+#endif
+}
+
+
+class ThreadState
+{
+public:
+  ThreadState(void)
+    : buffer(RandomSource::BufferSize, static_cast<char>(0))
+    , bufferPos(RandomSource::BufferSize)
+    , sinceReseed(0)
+    , seeded(false)
+  { /* ... */ }
+  // random bytes not yet handed out; handed out bytes are zeroed
+  SecureByteArray buffer;
+  int bufferPos;
+  CryptoPP::RandomPool pool;
+  qint64 sinceReseed;
+  bool seeded;
+};
+
+
+QThreadStorage<ThreadState*> threadStates;
+
+
+ThreadState *threadState(void)
+{
+  if (!threadStates.hasLocalData()) {
+    threadStates.setLocalData(new ThreadState);
+  }
+  return threadStates.localData();
+}
+
+
+int fillSystemBuffered(char *buf, int size)
+{
+  if (size >= RandomSource::SmallRequestSize)
+    return fillSystem(buf, size);
+  ThreadState *state = threadState();
+  int n = 0;
+  while (n < size) {
+    if (state->bufferPos == RandomSource::BufferSize) {
+      if (fillSystem(state->buffer.data(), RandomSource::BufferSize) != RandomSource::BufferSize)
+        break;
+      state->bufferPos = 0;
+    }
+    const int k = qMin(size - n, RandomSource::BufferSize - state->bufferPos);
+    char *const src = state->buffer.data() + state->bufferPos;
+    memcpy(buf + n, src, size_t(k));
+    memset(src, 0, size_t(k));
+    state->bufferPos += k;
+    n += k;
+  }
+  return n;
+}
+
+
+void reseed(ThreadState *state)
+{
+  CryptoPP::SecByteBlock seed(2 * SeedSize);
+  size_t n = SeedSize;
+  CryptoPP::OS_GenerateRandomBlock(false, seed.data(), SeedSize);
+#if defined(SESAM_RDRAND)
+  if (CPUFeatures::hasRDSEED()) {
+    quint64 r;
+    while (n < seed.size() && rdseed64(&r)) {
+      memcpy(seed.data() + n, &r, sizeof(r));
+      n += sizeof(r);
+    }
+    r = 0;
+  }
+#endif
+  state->pool.IncorporateEntropy(seed.data(), n);
+  state->sinceReseed = 0;
+  state->seeded = true;
+}
+
+
+int fillPool(char *buf, int size)
+{
+  ThreadState *state = threadState();
+  int n = 0;
+  while (n < size) {
+    if (!state->seeded || state->sinceReseed >= RandomSource::ReseedInterval) {
+      reseed(state);
+    }
+    const int k = int(qMin(qint64(size - n), RandomSource::ReseedInterval - state->sinceReseed));
+    state->pool.GenerateBlock(reinterpret_cast<byte*>(buf + n), size_t(k));
+    state->sinceReseed += k;
+    n += k;
+  }
+  return n;
+}
+
+
+int fillWith(RandomSource::Backend backend, char *buf, int size)
+{
+  switch (backend) {
+  case RandomSource::HardwareBackend:
+    return fillHardware(buf, size);
+  case RandomSource::SystemBackend:
+    return fillSystemBuffered(buf, size);
+  case RandomSource::PoolBackend:
+    // fall-through
+  default:
+    break;
+  }
+  return fillPool(buf, size);
+}
+
+
+// the faster of two runs, -1 if the backend fails
+qint64 nsecsFor(RandomSource::Backend backend)
+{
+  QByteArray buf(RandomSource::BufferSize, static_cast<char>(0));
+  qint64 best = -1;
+  for (int i = 0; i < 2; ++i) {
+    QElapsedTimer timer;
+    timer.start();
+    if (fillWith(backend, buf.data(), buf.size()) != buf.size())
+      return -1;
+    const qint64 ns = timer.nsecsElapsed();
+    if (best < 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+
+RandomSource::Backend select(void)
+{
+  const qint64 systemNs = nsecsFor(RandomSource::SystemBackend);
+  // RDRAND is not necessarily faster than getrandom(2), e.g. in virtual machines
+  if (hardwareIsSane() && (systemNs < 0 || nsecsFor(RandomSource::HardwareBackend) < systemNs))
+    return RandomSource::HardwareBackend;
+  return systemNs < 0 ? RandomSource::PoolBackend : RandomSource::SystemBackend;
+}
+
+
+// crude sanity check: about half of the bits must be set
+bool looksRandom(const QByteArray &a, const QByteArray &b)
+{
+  if (a == b)
+    return false;
+  int ones = 0;
+  for (int i = 0; i < a.size(); ++i) {
+    for (uchar c = static_cast<uchar>(a.at(i)); c != 0; c &= c - 1) {
+      ++ones;
+    }
+  }
+  const int bits = 8 * a.size();
+  return ones > bits * 40 / 100 && ones < bits * 60 / 100;
+}
+
+}
+
+
+/*!
+ * \brief RandomSource::fill
+ *
+ * Fills `buf` with `size` random bytes from the selected backend.
+ *
+ * \throws CryptoPP::OS_RNG_Err if the operating system's generator fails, which is the last resort.
+ */
+void RandomSource::fill(char *buf, int size)
+{
+  int n = 0;
+  switch (backend()) {
+  case HardwareBackend:
+    n = fillHardware(buf, size);
+    if (n == size)
+      break;
+    // fall-through
+  case SystemBackend:
+    n += fillSystemBuffered(buf + n, size - n);
+    if (n == size)
+      break;
+    // fall-through
+  case PoolBackend:
+    // fall-through
+  default:
+    fillPool(buf + n, size - n);
+    break;
+  }
+}
+
+
+/*!
+ * \brief RandomSource::bytes
+ *
+ * \return A `QByteArray` with `size` random bytes.
+ */
+QByteArray RandomSource::bytes(int size)
+{
+  if (size <= 0)
+    return QByteArray();
+  QByteArray buf(size, static_cast<char>(0));
+  fill(buf.data(), size);
+  return buf;
+}
+
+
+RandomSource::Backend RandomSource::backend(void)
+{
+  static const Backend backend = select();
+  return backend;
+}
+
+
+const char *RandomSource::name(void)
+{
+  switch (backend()) {
+  case HardwareBackend:
+    return "RDRAND";
+  case SystemBackend:
+    return "getrandom";
+  case PoolBackend:
+    // fall-through
+  default:
+    break;
+  }
+  return "RandomPool";
+}
+
+
+QString RandomSource::description(void)
+{
+  return QString("Random: %1").arg(name());
+}
+
+
+/*!
+ * \brief RandomSource::selfTest
+ *
+ * Draws two blocks from every available backend, one small enough to go through
+ * the per-thread buffer and one larger than the buffer, and checks that they differ
+ * and have about as many bits set as cleared.
+ *
+ * \return `true` if all checks pass
+ */
+bool RandomSource::selfTest(void)
+{
+  QList<Backend> backends;
+  backends << PoolBackend;
+  char probe;
+  if (fillSystem(&probe, 1) == 1) {
+    backends << SystemBackend;
+  }
+  if (backend() == HardwareBackend) {
+    backends << HardwareBackend;
+  }
+  const int sizes[2] = { SmallRequestSize - 1, BufferSize + 1 };
+  foreach (Backend b, backends) {
+    for (int i = 0; i < 2; ++i) {
+      QByteArray x(sizes[i], static_cast<char>(0));
+      QByteArray y(sizes[i], static_cast<char>(0));
+      if (fillWith(b, x.data(), x.size()) != x.size() || fillWith(b, y.data(), y.size()) != y.size())
+        return false;
+      if (!looksRandom(x, y))
+        return false;
+    }
+  }
+  return bytes(0).isEmpty() && bytes(1).size() == 1 && bytes(BufferSize + SmallRequestSize).size() == BufferSize + SmallRequestSize;
+}
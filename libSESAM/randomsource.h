@@ -0,0 +1,72 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __RANDOMSOURCE_H_
+#define __RANDOMSOURCE_H_
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QString>
+
+
+/*!
+ * \brief The RandomSource class
+ *
+ * Cryptographically secure random numbers for salts, IVs, KGKs and the like,
+ * produced in bulk instead of byte by byte.
+ *
+ * The backend is selected once:
+ *
+ * - `HardwareBackend`: on x86-64 CPUs with RDRAND, 64 bits per instruction.
+ *   It is only used if a few samples drawn at startup look sane, as some CPUs
+ *   are known to return a constant while signalling success, and if it turns out
+ *   faster than getrandom(2).
+ * - `SystemBackend`: on Linux the getrandom(2) system call. Requests smaller than
+ *   `SmallRequestSize` are served from a per-thread buffer of `BufferSize` bytes,
+ *   so generating a salt or IV rarely costs a system call.
+ * - `PoolBackend`: elsewhere a per-thread `CryptoPP::RandomPool` seeded from the
+ *   operating system's generator (and RDSEED, if available) and reseeded after
+ *   every `ReseedInterval` bytes.
+ *
+ * If the selected backend fails, the request is completed by the next one.
+ * All functions are thread-safe.
+ *
+ */
+class RandomSource
+{
+public:
+  enum Backend {
+    HardwareBackend,
+    SystemBackend,
+    PoolBackend
+  };
+  static const int BufferSize;
+  static const int SmallRequestSize;
+  static const qint64 ReseedInterval;
+
+  static void fill(char *buf, int size);
+  static QByteArray bytes(int size);
+  static Backend backend(void);
+  static const char *name(void);
+  static QString description(void);
+  static bool selfTest(void);
+};
+
+
+#endif // __RANDOMSOURCE_H_
@@ -0,0 +1,237 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+#include <new>
+
+#include <QMutex>
+#include <QMutexLocker>
+
+#include "securearena.h"
+#include "util.h"
+
+#if defined(Q_OS_WIN)
+#include <Windows.h>
+#elif defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+const int SecureArena::MinChunkSize = 16;
+const int SecureArena::MaxChunkSize = 512;
+
+
+namespace {
+
+// chunk sizes 16, 32, ..., 512
+const int SizeClasses = 6;
+
+
+class Arena
+{
+public:
+  Arena(void)
+    : slabSize(4096)
+  {
+#if defined(Q_OS_UNIX)
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if (pageSize > slabSize) {
+      slabSize = size_t(pageSize);
+    }
+#endif
+    for (int c = 0; c < SizeClasses; ++c) {
+      freeList[c] = Q_NULLPTR;
+    }
+  }
+
+  static int sizeClass(size_t size)
+  {
+    int c = 0;
+    for (size_t chunkSize = size_t(SecureArena::MinChunkSize); chunkSize < size; chunkSize <<= 1) {
+      ++c;
+    }
+    return (c < SizeClasses) ? c : -1;
+  }
+
+  static size_t chunkSize(int c)
+  {
+    return size_t(SecureArena::MinChunkSize) << c;
+  }
+
+  // carves a new slab into chunks of class `c`; called with `mutex` locked
+  void grow(int c)
+  {
+    char *slab = Q_NULLPTR;
+    bool locked = false;
+#if defined(Q_OS_WIN)
+    slab = reinterpret_cast<char*>(VirtualAlloc(NULL, slabSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+    locked = slab != Q_NULLPTR && VirtualLock(slab, slabSize) != 0;
+#elif defined(Q_OS_UNIX)
+    void *p = mmap(Q_NULLPTR, slabSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+      slab = reinterpret_cast<char*>(p);
+      locked = mlock(slab, slabSize) == 0;
+#if defined(MADV_DONTDUMP)
+      madvise(slab, slabSize, MADV_DONTDUMP);
+#endif
+    }
+#endif
+    if (slab == Q_NULLPTR) {
+      // unlike fresh pages from the OS, heap memory isn't zeroed
+      slab = reinterpret_cast<char*>(::operator new(slabSize));
+      memset(slab, 0, slabSize);
+    }
+    if (locked) {
+      stats.lockedBytes += qint64(slabSize);
+    }
+    else {
+      stats.unlockedBytes += qint64(slabSize);
+    }
+    const size_t size = chunkSize(c);
+    for (size_t off = slabSize; off >= size; off -= size) {
+      push(c, slab + off - size);
+    }
+  }
+
+  void push(int c, char *chunk)
+  {
+    *reinterpret_cast<char**>(chunk) = freeList[c];
+    freeList[c] = chunk;
+  }
+
+  char *pop(int c)
+  {
+    char *chunk = freeList[c];
+    freeList[c] = *reinterpret_cast<char**>(chunk);
+    *reinterpret_cast<char**>(chunk) = Q_NULLPTR;
+    return chunk;
+  }
+
+  QMutex mutex;
+  size_t slabSize;
+  char *freeList[SizeClasses];
+  SecureArena::Statistics stats;
+};
+
+
+// never destroyed, as secrets owned by static objects may be released after the end of main()
+Arena &arena(void)
+{
+  static Arena *instance = new Arena;
+  return *instance;
+}
+
+}
+
+
+SecureArena::Statistics::Statistics(void)
+  : liveCount(0)
+  , highWater(0)
+  , liveBytes(0)
+  , lockedBytes(0)
+  , unlockedBytes(0)
+  , heapAllocations(0)
+{ /* ... */ }
+
+
+/*!
+ * \brief SecureArena::allocate
+ *
+ * \param size number of bytes needed
+ * \return memory for at least `size` bytes, filled with 0
+ */
+void *SecureArena::allocate(size_t size)
+{
+  Arena &a = arena();
+  const int c = Arena::sizeClass(size);
+  char *p = Q_NULLPTR;
+  if (c < 0) {
+    p = reinterpret_cast<char*>(::operator new(size));
+    memset(p, 0, size);
+  }
+  QMutexLocker locker(&a.mutex);
+  if (c < 0) {
+    ++a.stats.heapAllocations;
+    a.stats.liveBytes += qint64(size);
+  }
+  else {
+    if (a.freeList[c] == Q_NULLPTR) {
+      a.grow(c);
+    }
+    p = a.pop(c);
+    a.stats.liveBytes += qint64(Arena::chunkSize(c));
+  }
+  ++a.stats.liveCount;
+  a.stats.highWater = qMax(a.stats.highWater, a.stats.liveCount);
+  return p;
+}
+
+
+/*!
+ * \brief SecureArena::release
+ *
+ * Wipes and releases memory obtained from `allocate()`.
+ *
+ * \param p the memory to release; may be `Q_NULLPTR`
+ * \param size the `size` that was passed to `allocate()`
+ */
+void SecureArena::release(void *p, size_t size)
+{
+  if (p == Q_NULLPTR)
+    return;
+  Arena &a = arena();
+  const int c = Arena::sizeClass(size);
+  if (c < 0) {
+    SecureZero(p, size);
+    ::operator delete(p);
+  }
+  else {
+    SecureZero(p, Arena::chunkSize(c));
+  }
+  QMutexLocker locker(&a.mutex);
+  if (c < 0) {
+    a.stats.liveBytes -= qint64(size);
+  }
+  else {
+    a.push(c, reinterpret_cast<char*>(p));
+    a.stats.liveBytes -= qint64(Arena::chunkSize(c));
+  }
+  --a.stats.liveCount;
+}
+
+
+SecureArena::Statistics SecureArena::statistics(void)
+{
+  Arena &a = arena();
+  QMutexLocker locker(&a.mutex);
+  return a.stats;
+}
+
+
+QString SecureArena::description(void)
+{
+  const Statistics &s = statistics();
+  return QString("%1 live secrets (high water %2), %3 bytes locked, %4 bytes unlocked, %5 heap allocations")
+      .arg(s.liveCount)
+      .arg(s.highWater)
+      .arg(s.lockedBytes)
+      .arg(s.unlockedBytes)
+      .arg(s.heapAllocations);
+}
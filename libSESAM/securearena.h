@@ -0,0 +1,80 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SECUREARENA_H_
+#define __SECUREARENA_H_
+
+#include <cstddef>
+
+#include <QtGlobal>
+#include <QString>
+
+
+/*!
+ * \brief The SecureArena class
+ *
+ * Process-wide store for short-lived secrets of fixed size: keys, IVs, derived keys,
+ * HMAC states and the like.
+ *
+ * Requests of up to `MaxChunkSize` bytes are rounded up to a power of two (at least
+ * `MinChunkSize`) and served from slabs of one memory page each. Slab pages are locked
+ * into RAM (`mlock()` or `VirtualLock()`) so they never reach the swap file, and on
+ * Linux they are excluded from core dumps (`MADV_DONTDUMP`). If the operating system
+ * refuses to lock more memory, further slabs are used unlocked; `statistics()` tells
+ * how many bytes that concerns. Larger requests are served from the general heap.
+ *
+ * Every chunk is wiped with `SecureZero()` when it is released and kept for reuse.
+ * Slabs are never returned to the operating system, so once the arena has grown to
+ * the working set of a hot path, that path no longer touches the heap.
+ *
+ * All functions are thread-safe.
+ *
+ */
+class SecureArena
+{
+public:
+  static const int MinChunkSize;
+  static const int MaxChunkSize;
+
+  /*!
+   * \brief The Statistics struct
+   *
+   * `liveCount` is the number of secrets currently allocated and `highWater` the
+   * largest value `liveCount` has ever had, i.e. an upper bound on how many copies
+   * of secrets have existed at the same time.
+   *
+   */
+  struct Statistics {
+    Statistics(void);
+    int liveCount;
+    int highWater;
+    qint64 liveBytes;
+    qint64 lockedBytes;
+    qint64 unlockedBytes;
+    qint64 heapAllocations;
+  };
+
+  static void *allocate(size_t size);
+  static void release(void *p, size_t size);
+  static Statistics statistics(void);
+  static QString description(void);
+};
+
+
+#endif // __SECUREARENA_H_
@@ -0,0 +1,138 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+
+#include "securebuffer.h"
+#include "securearena.h"
+#include "util.h"
+
+
+SecureBuffer::SecureBuffer(void)
+  : mData(Q_NULLPTR)
+  , mSize(0)
+{ /* ... */ }
+
+
+SecureBuffer::SecureBuffer(int size)
+  : mData(Q_NULLPTR)
+  , mSize(qMax(0, size))
+{
+  if (mSize > 0) {
+    mData = reinterpret_cast<char*>(SecureArena::allocate(size_t(mSize)));
+  }
+}
+
+
+SecureBuffer::SecureBuffer(const char *data, int size)
+  : SecureBuffer(size)
+{
+  if (mSize > 0) {
+    memcpy(mData, data, size_t(mSize));
+  }
+}
+
+
+SecureBuffer::SecureBuffer(SecureBuffer &&other)
+  : mData(other.mData)
+  , mSize(other.mSize)
+{
+  other.mData = Q_NULLPTR;
+  other.mSize = 0;
+}
+
+
+SecureBuffer::~SecureBuffer()
+{
+  release();
+}
+
+
+SecureBuffer &SecureBuffer::operator=(SecureBuffer &&other)
+{
+  if (&other != this) {
+    release();
+    mData = other.mData;
+    mSize = other.mSize;
+    other.mData = Q_NULLPTR;
+    other.mSize = 0;
+  }
+  return *this;
+}
+
+
+char *SecureBuffer::data(void)
+{
+  return mData;
+}
+
+
+const char *SecureBuffer::constData(void) const
+{
+  return mData;
+}
+
+
+int SecureBuffer::size(void) const
+{
+  return mSize;
+}
+
+
+bool SecureBuffer::isEmpty(void) const
+{
+  return mSize == 0;
+}
+
+
+/*!
+ * \brief SecureBuffer::wipe
+ *
+ * Overwrites the contents with 0. The size is kept.
+ */
+void SecureBuffer::wipe(void)
+{
+  if (mData != Q_NULLPTR) {
+    SecureZero(mData, size_t(mSize));
+  }
+}
+
+
+/*!
+ * \brief SecureBuffer::release
+ *
+ * Wipes the contents and returns the memory to the arena, leaving an empty buffer.
+ */
+void SecureBuffer::release(void)
+{
+  SecureArena::release(mData, size_t(mSize));
+  mData = Q_NULLPTR;
+  mSize = 0;
+}
+
+
+/*!
+ * \brief SecureBuffer::toByteArray
+ *
+ * \return a copy of the contents on the general heap
+ */
+SecureByteArray SecureBuffer::toByteArray(void) const
+{
+  return SecureByteArray(mData, mSize);
+}
@@ -0,0 +1,64 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SECUREBUFFER_H_
+#define __SECUREBUFFER_H_
+
+#include <QtGlobal>
+
+#include "securebytearray.h"
+
+
+/*!
+ * \brief The SecureBuffer class
+ *
+ * Fixed-size buffer for a secret, allocated from the `SecureArena`.
+ *
+ * Unlike `SecureByteArray` a `SecureBuffer` is not implicitly shared and cannot be
+ * copied, only moved, so every copy of a secret is made explicitly. The memory is
+ * initialized with 0 and wiped when the buffer is destroyed or reassigned.
+ *
+ */
+class SecureBuffer
+{
+public:
+  SecureBuffer(void);
+  explicit SecureBuffer(int size);
+  SecureBuffer(const char *data, int size);
+  SecureBuffer(SecureBuffer &&other);
+  ~SecureBuffer();
+  SecureBuffer &operator=(SecureBuffer &&other);
+
+  char *data(void);
+  const char *constData(void) const;
+  int size(void) const;
+  bool isEmpty(void) const;
+  void wipe(void);
+  void release(void);
+  SecureByteArray toByteArray(void) const;
+
+private:
+  char *mData;
+  int mSize;
+
+  Q_DISABLE_COPY(SecureBuffer)
+};
+
+
+#endif // __SECUREBUFFER_H_
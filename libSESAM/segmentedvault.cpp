@@ -0,0 +1,504 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "segmentedvault.h"
+#include "crypter.h"
+#include "aesbackend.h"
+#include "keymanager.h"
+#include "compressionpolicy.h"
+
+#include <QCryptographicHash>
+#include <QJsonDocument>
+#include <QMessageAuthenticationCode>
+#include <QVariantList>
+#include <QVariantMap>
+#include <QtConcurrent>
+
+#include "filters.h"
+#include "gcm.h"
+
+
+const int SegmentedVault::DefaultBucketCount = 32;
+const int SegmentedVault::ManifestVersion = 1;
+
+
+namespace {
+
+// compression method and IV preceding the encrypted bucket
+const int BucketHeaderSize = 1 + Crypter::AESBlockSize;
+
+
+/*!
+ * \brief The ByteArraySink class
+ *
+ * Crypto++ sink appending everything it receives to a `QByteArray`.
+ */
+class ByteArraySink : public CryptoPP::Bufferless<CryptoPP::Sink>
+{
+public:
+  ByteArraySink(QByteArray *ba)
+    : mBA(ba)
+  { /* ... */ }
+  size_t Put2(const byte *inString, size_t length, int messageEnd, bool blocking)
+  {
+    Q_UNUSED(messageEnd);
+    Q_UNUSED(blocking);
+    mBA->append(reinterpret_cast<const char*>(inString), int(length));
+    return 0;
+  }
+
+private:
+  QByteArray *mBA;
+};
+
+
+QByteArray sha256(const QByteArray &data)
+{
+  return QCryptographicHash::hash(data, QCryptographicHash::Sha256);
+}
+
+
+// binds an encrypted bucket to its slot, so that buckets cannot be swapped
+QByteArray slotOf(int idx, int bucketCount)
+{
+  const char slot[8] = {
+    char(idx >> 24), char(idx >> 16), char(idx >> 8), char(idx),
+    char(bucketCount >> 24), char(bucketCount >> 16), char(bucketCount >> 8), char(bucketCount)
+  };
+  return QByteArray(slot, sizeof(slot));
+}
+
+
+struct Bucket {
+  Bucket(void)
+    : sealed(false)
+  { /* ... */ }
+  // SHA-256 of the bucket's plain text, to tell if it needs to be encrypted again
+  QByteArray plainDigest;
+  // SHA-256 of `cipher` as listed in the manifest
+  QByteArray cipherDigest;
+  QByteArray cipher;
+  bool sealed;
+};
+
+
+struct BucketJob {
+  int idx;
+  SecureByteArray key;
+  SecureByteArray IV;
+  QByteArray plain;
+  QByteArray cipher;
+  DomainSettingsList domains;
+  bool ok;
+};
+
+
+class BucketSealer
+{
+public:
+  typedef void result_type;
+  BucketSealer(int bucketCount, const CompressionPolicy &policy)
+    : bucketCount(bucketCount)
+    , policy(policy)
+  { /* ... */ }
+  void operator()(BucketJob &job) const
+  {
+    job.IV = Crypter::generateIV();
+    const QByteArray &header = QByteArray(1, static_cast<char>(policy.method())) + job.IV;
+    job.cipher = header;
+    CryptoPP::GCM<AESBackend>::Encryption enc;
+    enc.SetKeyWithIV(reinterpret_cast<const byte*>(job.key.constData()), job.key.size(), reinterpret_cast<const byte*>(job.IV.constData()), job.IV.size());
+    CryptoPP::AuthenticatedEncryptionFilter *aes = new CryptoPP::AuthenticatedEncryptionFilter(enc, new ByteArraySink(&job.cipher), false, Crypter::GCMTagSize);
+    const QByteArray &aad = header + slotOf(job.idx, bucketCount);
+    aes->ChannelPut(CryptoPP::AAD_CHANNEL, reinterpret_cast<const byte*>(aad.constData()), aad.size());
+    QScopedPointer<CryptoPP::BufferedTransformation> pipeline(policy.createCompressor(aes, job.plain.size()));
+    pipeline->Put(reinterpret_cast<const byte*>(job.plain.constData()), job.plain.size());
+    pipeline->MessageEnd();
+    job.ok = true;
+  }
+
+private:
+  const int bucketCount;
+  const CompressionPolicy policy;
+};
+
+
+class BucketOpener
+{
+public:
+  typedef void result_type;
+  BucketOpener(int bucketCount, bool binary)
+    : bucketCount(bucketCount)
+    , binary(binary)
+  { /* ... */ }
+  void operator()(BucketJob &job) const
+  {
+    job.ok = false;
+    if (job.cipher.size() < BucketHeaderSize + Crypter::GCMTagSize)
+      return;
+    const int method = static_cast<uchar>(job.cipher.at(0));
+    if (!CompressionPolicy::isSupported(method))
+      return;
+    const QByteArray &header = job.cipher.left(BucketHeaderSize);
+    const QByteArray &aad = header + slotOf(job.idx, bucketCount);
+    SecureByteArray compressed(job.cipher.size() - BucketHeaderSize - Crypter::GCMTagSize, static_cast<char>(0));
+    try {
+      // decrypt and verify completely before anything gets inflated
+      CryptoPP::GCM<AESBackend>::Decryption dec;
+      dec.SetKeyWithIV(reinterpret_cast<const byte*>(job.key.constData()), job.key.size(), reinterpret_cast<const byte*>(header.constData() + 1), Crypter::AESBlockSize);
+      CryptoPP::AuthenticatedDecryptionFilter aes(dec, new CryptoPP::ArraySink(reinterpret_cast<byte*>(compressed.data()), compressed.size()), CryptoPP::AuthenticatedDecryptionFilter::THROW_EXCEPTION, Crypter::GCMTagSize);
+      aes.ChannelPut(CryptoPP::AAD_CHANNEL, reinterpret_cast<const byte*>(aad.constData()), aad.size());
+      aes.ChannelPut(CryptoPP::DEFAULT_CHANNEL, reinterpret_cast<const byte*>(job.cipher.constData()) + BucketHeaderSize, job.cipher.size() - BucketHeaderSize);
+      aes.ChannelMessageEnd(CryptoPP::DEFAULT_CHANNEL);
+      QScopedPointer<CryptoPP::BufferedTransformation> pipeline(CompressionPolicy::createDecompressor(static_cast<CompressionPolicy::Method>(method), new ByteArraySink(&job.plain)));
+      pipeline->Put(reinterpret_cast<const byte*>(compressed.constData()), compressed.size());
+      pipeline->MessageEnd();
+    }
+    catch (CryptoPP::Exception &) {
+      return;
+    }
+    if (binary) {
+      bool ok = false;
+      job.domains = DomainSettingsList::fromBinary(job.plain, &ok);
+      if (!ok)
+        return;
+    }
+    else {
+      QJsonParseError parseError;
+      job.domains = DomainSettingsList::fromJson(job.plain, &parseError);
+      if (parseError.error != QJsonParseError::NoError)
+        return;
+    }
+    job.ok = true;
+  }
+
+private:
+  const int bucketCount;
+  const bool binary;
+};
+
+}
+
+
+class SegmentedVaultPrivate {
+public:
+  SegmentedVaultPrivate(int bucketCount)
+    : bucketCount(qMax(1, bucketCount))
+    , format(Crypter::AES256GCMSegmentedFormat)
+    , buckets(this->bucketCount)
+  { /* ... */ }
+  bool setKey(const SecureByteArray &KGK, const QByteArray &salt, KeyManager *keyManager);
+  SecureByteArray bucketKey(int idx) const;
+
+  int bucketCount;
+  Crypter::FormatFlags format;
+  CompressionPolicy policy;
+  SecureByteArray KGK;
+  QByteArray salt;
+  SecureByteArray vaultKey;
+  QVector<Bucket> buckets;
+};
+
+
+bool SegmentedVaultPrivate::setKey(const SecureByteArray &KGK, const QByteArray &salt, KeyManager *keyManager)
+{
+  this->KGK = KGK;
+  this->salt = salt;
+  vaultKey = (keyManager != Q_NULLPTR)
+      ? keyManager->makeKeyFromPassword(KGK, salt)
+      : Crypter::makeKeyFromPassword(KGK, salt);
+  return !vaultKey.isEmpty();
+}
+
+
+SecureByteArray SegmentedVaultPrivate::bucketKey(int idx) const
+{
+  QMessageAuthenticationCode hmac(QCryptographicHash::Sha256, vaultKey);
+  hmac.addData(QByteArray("bucket") + slotOf(idx, bucketCount));
+  return hmac.result();
+}
+
+
+SegmentedVault::SegmentedVault(int bucketCount)
+  : d_ptr(new SegmentedVaultPrivate(bucketCount))
+{ /* ... */ }
+
+
+SegmentedVault::~SegmentedVault()
+{ /* ... */ }
+
+
+int SegmentedVault::bucketCount(void) const
+{
+  return d_ptr->bucketCount;
+}
+
+
+/*!
+ * \brief SegmentedVault::bucketOf
+ *
+ * \return The index of the bucket `domainName` belongs to (FNV-1a hash of its UTF-8 representation modulo `bucketCount()`).
+ */
+int SegmentedVault::bucketOf(const QString &domainName) const
+{
+  const QByteArray &name = domainName.toUtf8();
+  quint32 h = 2166136261U;
+  for (int i = 0; i < name.size(); ++i) {
+    h ^= static_cast<uchar>(name.at(i));
+    h *= 16777619U;
+  }
+  return int(h % quint32(d_ptr->bucketCount));
+}
+
+
+void SegmentedVault::setCompressionPolicy(const CompressionPolicy &policy)
+{
+  Q_D(SegmentedVault);
+  d->policy = policy;
+}
+
+
+/*!
+ * \brief SegmentedVault::setFormat
+ *
+ * Selects how the buckets encode their domains: as JSON with
+ * `Crypter::AES256GCMSegmentedFormat` (the default), or in the binary encoding of
+ * `DomainSettingsList` with `Crypter::AES256GCMSegmentedBinaryFormat`. The manifest
+ * must be stored in that format, so that `open()` can be told how to read the buckets.
+ *
+ * After switching the format the next `seal()` encrypts all buckets again,
+ * because their plain text has changed.
+ */
+void SegmentedVault::setFormat(Crypter::FormatFlags format)
+{
+  Q_D(SegmentedVault);
+  Q_ASSERT_X(format == Crypter::AES256GCMSegmentedFormat || format == Crypter::AES256GCMSegmentedBinaryFormat, "SegmentedVault::setFormat()", "format must be one of the segmented formats");
+  d->format = format;
+}
+
+
+Crypter::FormatFlags SegmentedVault::format(void) const
+{
+  return d_ptr->format;
+}
+
+
+/*!
+ * \brief SegmentedVault::seal
+ *
+ * Distributes `domains` over the buckets and encrypts those buckets whose content
+ * differs from the last call to `seal()` or `open()`. All buckets get encrypted if
+ * `KGK` differs from the one used then.
+ *
+ * \param domains The domains to be stored.
+ * \param KGK Key generation key the bucket keys are derived from.
+ * \param keyManager Optional key cache.
+ * \return The indexes of the buckets that have been encrypted again and must be stored anew.
+ */
+QList<int> SegmentedVault::seal(const DomainSettingsList &domains, const SecureByteArray &KGK, KeyManager *keyManager)
+{
+  Q_D(SegmentedVault);
+  if (KGK != d->KGK || d->vaultKey.isEmpty()) {
+    if (!d->setKey(KGK, Crypter::generateSalt(), keyManager))
+      return QList<int>();
+    d->buckets.fill(Bucket());
+  }
+  QVector<DomainSettingsList> lists(d->bucketCount);
+  foreach (const DomainSettings &ds, domains) {
+    lists[bucketOf(ds.domainName)].append(ds);
+  }
+  const bool binary = d->format == Crypter::AES256GCMSegmentedBinaryFormat;
+  QVector<BucketJob> jobs;
+  QList<int> dirty;
+  for (int i = 0; i < d->bucketCount; ++i) {
+    Bucket &bucket = d->buckets[i];
+    const QByteArray &plain = lists.at(i).isEmpty()
+        ? QByteArray()
+        : binary ? lists.at(i).toBinary() : lists.at(i).toJson();
+    const QByteArray &digest = plain.isEmpty() ? QByteArray() : sha256(plain);
+    if (bucket.sealed && bucket.plainDigest == digest)
+      continue;
+    dirty << i;
+    bucket.plainDigest = digest;
+    bucket.cipherDigest.clear();
+    bucket.cipher.clear();
+    bucket.sealed = true;
+    if (!plain.isEmpty()) {
+      BucketJob job;
+      job.idx = i;
+      job.key = d->bucketKey(i);
+      job.plain = plain;
+      job.ok = false;
+      jobs << job;
+    }
+  }
+  QtConcurrent::blockingMap(jobs, BucketSealer(d->bucketCount, d->policy));
+  foreach (const BucketJob &job, jobs) {
+    Bucket &bucket = d->buckets[job.idx];
+    bucket.cipher = job.cipher;
+    bucket.cipherDigest = sha256(job.cipher);
+  }
+  return dirty;
+}
+
+
+/*!
+ * \brief SegmentedVault::manifest
+ *
+ * \return The JSON manifest listing the salt of the bucket keys and the digests of the buckets as of the last call to `seal()` or `open()`.
+ */
+QByteArray SegmentedVault::manifest(void) const
+{
+  QVariantList digests;
+  foreach (const Bucket &bucket, d_ptr->buckets) {
+    digests << QString::fromLatin1(bucket.cipherDigest.toBase64());
+  }
+  QVariantMap manifest;
+  manifest["version"] = ManifestVersion;
+  manifest["salt"] = QString::fromLatin1(d_ptr->salt.toBase64());
+  manifest["buckets"] = digests;
+  return QJsonDocument::fromVariant(manifest).toJson(QJsonDocument::Compact);
+}
+
+
+/*!
+ * \brief SegmentedVault::bucket
+ *
+ * \return The encrypted bucket `idx`; empty if the bucket holds no domains.
+ */
+QByteArray SegmentedVault::bucket(int idx) const
+{
+  return d_ptr->buckets.value(idx).cipher;
+}
+
+
+/*!
+ * \brief SegmentedVault::bucketDigest
+ *
+ * \return The SHA-256 digest of the encrypted bucket `idx` as listed in the manifest; empty if the bucket holds no domains.
+ */
+QByteArray SegmentedVault::bucketDigest(int idx) const
+{
+  return d_ptr->buckets.value(idx).cipherDigest;
+}
+
+
+/*!
+ * \brief SegmentedVault::bucketDigests
+ *
+ * Lets callers that store the buckets under their digests find them before calling `open()`.
+ *
+ * \return The digests of the encrypted buckets listed in `manifest`, empty ones for empty buckets; an empty vector if `manifest` is invalid.
+ */
+QVector<QByteArray> SegmentedVault::bucketDigests(const QByteArray &manifest)
+{
+  QVector<QByteArray> result;
+  QJsonParseError parseError;
+  const QVariantMap &m = QJsonDocument::fromJson(manifest, &parseError).toVariant().toMap();
+  if (parseError.error != QJsonParseError::NoError || m["version"].toInt() != ManifestVersion)
+    return result;
+  foreach (const QVariant &digest, m["buckets"].toList()) {
+    result << QByteArray::fromBase64(digest.toByteArray());
+  }
+  return result;
+}
+
+
+/*!
+ * \brief SegmentedVault::open
+ *
+ * Checks `buckets` against the digests listed in `manifest` and decrypts them in parallel.
+ * The buckets are read in the encoding selected with `setFormat()`.
+ * On success the vault remembers the buckets, so that the next `seal()` only encrypts
+ * the buckets that changed in between.
+ *
+ * \param manifest The manifest as returned by `manifest()`.
+ * \param buckets The encrypted buckets; missing buckets are treated as empty.
+ * \param KGK Key generation key the bucket keys are derived from.
+ * \param domains Receives the decrypted domains.
+ * \param keyManager Optional key cache.
+ * \return `false` if the manifest is invalid or a bucket does not match the manifest or cannot be decrypted.
+ */
+bool SegmentedVault::open(const QByteArray &manifest, const QVector<QByteArray> &buckets, const SecureByteArray &KGK, DomainSettingsList &domains, KeyManager *keyManager)
+{
+  Q_D(SegmentedVault);
+  QJsonParseError parseError;
+  const QVariantMap &m = QJsonDocument::fromJson(manifest, &parseError).toVariant().toMap();
+  if (parseError.error != QJsonParseError::NoError || m["version"].toInt() != ManifestVersion)
+    return false;
+  const QVariantList &digests = m["buckets"].toList();
+  const int n = digests.count();
+  const QByteArray &salt = QByteArray::fromBase64(m["salt"].toByteArray());
+  if (n == 0 || salt.size() != Crypter::SaltSize)
+    return false;
+  SegmentedVaultPrivate vault(n);
+  if (!vault.setKey(KGK, salt, keyManager))
+    return false;
+  QVector<BucketJob> jobs;
+  for (int i = 0; i < n; ++i) {
+    Bucket &bucket = vault.buckets[i];
+    bucket.cipher = buckets.value(i);
+    bucket.cipherDigest = bucket.cipher.isEmpty() ? QByteArray() : sha256(bucket.cipher);
+    bucket.sealed = true;
+    if (bucket.cipherDigest != QByteArray::fromBase64(digests.at(i).toByteArray()))
+      return false;
+    if (!bucket.cipher.isEmpty()) {
+      BucketJob job;
+      job.idx = i;
+      job.key = vault.bucketKey(i);
+      job.cipher = bucket.cipher;
+      job.ok = false;
+      jobs << job;
+    }
+  }
+  QtConcurrent::blockingMap(jobs, BucketOpener(n, d->format == Crypter::AES256GCMSegmentedBinaryFormat));
+  DomainSettingsList result;
+  foreach (const BucketJob &job, jobs) {
+    if (!job.ok)
+      return false;
+    vault.buckets[job.idx].plainDigest = sha256(job.plain);
+    result.append(job.domains);
+  }
+  domains = result;
+  if (n == d->bucketCount) {
+    d->KGK = vault.KGK;
+    d->salt = vault.salt;
+    d->vaultKey = vault.vaultKey;
+    d->buckets = vault.buckets;
+  }
+  else {
+    clear();
+  }
+  return true;
+}
+
+
+/*!
+ * \brief SegmentedVault::clear
+ *
+ * Forgets keys and buckets, so that the next `seal()` encrypts all buckets.
+ */
+void SegmentedVault::clear(void)
+{
+  Q_D(SegmentedVault);
+  d->KGK.invalidate();
+  d->vaultKey.invalidate();
+  d->salt.clear();
+  d->buckets.fill(Bucket());
+}
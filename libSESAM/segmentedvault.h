@@ -0,0 +1,94 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SEGMENTEDVAULT_H_
+#define __SEGMENTEDVAULT_H_
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QList>
+#include <QVector>
+#include <QString>
+#include <QScopedPointer>
+
+#include "securebytearray.h"
+#include "crypter.h"
+#include "domainsettingslist.h"
+
+class KeyManager;
+class CompressionPolicy;
+class SegmentedVaultPrivate;
+
+/*!
+ * \brief The SegmentedVault class
+ *
+ * Splits a `DomainSettingsList` into `bucketCount()` buckets by a hash of the
+ * domain name and encrypts every bucket on its own, so that saving after a
+ * change only has to compress and encrypt the buckets that actually changed.
+ *
+ * The bucket keys are derived from the KGK, not from the master password, so
+ * unchanged buckets stay valid across saves. The manifest lists the salt of the
+ * bucket keys and the SHA-256 digest of every encrypted bucket; it is meant to be
+ * stored in `Crypter::AES256GCMSegmentedFormat` or `Crypter::AES256GCMSegmentedBinaryFormat`
+ * (see `setFormat()`), which protects it with the master password and thereby
+ * authenticates the whole set of buckets.
+ *
+ * An encrypted bucket has the following structure (empty buckets are empty):
+ *
+ * Bytes   | Description
+ * ------- | ---------------------------------------------------------------------------
+ *       1 | Compression method, see `CompressionPolicy::Method`
+ *      16 | IV (randomly generated)
+ *       n | Compressed JSON or binary encoding of the bucket's domains, AES-GCM encrypted, authenticating the preceding bytes, the bucket index and the bucket count
+ *      16 | GCM tag
+ *
+ * Buckets are sealed and opened in parallel.
+ *
+ */
+class SegmentedVault
+{
+public:
+  static const int DefaultBucketCount;
+  static const int ManifestVersion;
+
+  explicit SegmentedVault(int bucketCount = DefaultBucketCount);
+  ~SegmentedVault();
+
+  int bucketCount(void) const;
+  int bucketOf(const QString &domainName) const;
+  void setCompressionPolicy(const CompressionPolicy &policy);
+  void setFormat(Crypter::FormatFlags format);
+  Crypter::FormatFlags format(void) const;
+
+  QList<int> seal(const DomainSettingsList &domains, const SecureByteArray &KGK, KeyManager *keyManager = Q_NULLPTR);
+  QByteArray manifest(void) const;
+  QByteArray bucket(int idx) const;
+  QByteArray bucketDigest(int idx) const;
+  static QVector<QByteArray> bucketDigests(const QByteArray &manifest);
+  bool open(const QByteArray &manifest, const QVector<QByteArray> &buckets, const SecureByteArray &KGK, DomainSettingsList &domains, KeyManager *keyManager = Q_NULLPTR);
+  void clear(void);
+
+private:
+  QScopedPointer<SegmentedVaultPrivate> d_ptr;
+  Q_DECLARE_PRIVATE(SegmentedVault)
+  Q_DISABLE_COPY(SegmentedVault)
+};
+
+
+#endif // __SEGMENTEDVAULT_H_
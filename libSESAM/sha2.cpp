@@ -0,0 +1,215 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "sha2.h"
+#include "hashbackend.h"
+
+
+const Sha256::Word Sha256::K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+const Sha512::Word Sha512::K[80] = {
+  Q_UINT64_C(0x428a2f98d728ae22), Q_UINT64_C(0x7137449123ef65cd), Q_UINT64_C(0xb5c0fbcfec4d3b2f), Q_UINT64_C(0xe9b5dba58189dbbc),
+  Q_UINT64_C(0x3956c25bf348b538), Q_UINT64_C(0x59f111f1b605d019), Q_UINT64_C(0x923f82a4af194f9b), Q_UINT64_C(0xab1c5ed5da6d8118),
+  Q_UINT64_C(0xd807aa98a3030242), Q_UINT64_C(0x12835b0145706fbe), Q_UINT64_C(0x243185be4ee4b28c), Q_UINT64_C(0x550c7dc3d5ffb4e2),
+  Q_UINT64_C(0x72be5d74f27b896f), Q_UINT64_C(0x80deb1fe3b1696b1), Q_UINT64_C(0x9bdc06a725c71235), Q_UINT64_C(0xc19bf174cf692694),
+  Q_UINT64_C(0xe49b69c19ef14ad2), Q_UINT64_C(0xefbe4786384f25e3), Q_UINT64_C(0x0fc19dc68b8cd5b5), Q_UINT64_C(0x240ca1cc77ac9c65),
+  Q_UINT64_C(0x2de92c6f592b0275), Q_UINT64_C(0x4a7484aa6ea6e483), Q_UINT64_C(0x5cb0a9dcbd41fbd4), Q_UINT64_C(0x76f988da831153b5),
+  Q_UINT64_C(0x983e5152ee66dfab), Q_UINT64_C(0xa831c66d2db43210), Q_UINT64_C(0xb00327c898fb213f), Q_UINT64_C(0xbf597fc7beef0ee4),
+  Q_UINT64_C(0xc6e00bf33da88fc2), Q_UINT64_C(0xd5a79147930aa725), Q_UINT64_C(0x06ca6351e003826f), Q_UINT64_C(0x142929670a0e6e70),
+  Q_UINT64_C(0x27b70a8546d22ffc), Q_UINT64_C(0x2e1b21385c26c926), Q_UINT64_C(0x4d2c6dfc5ac42aed), Q_UINT64_C(0x53380d139d95b3df),
+  Q_UINT64_C(0x650a73548baf63de), Q_UINT64_C(0x766a0abb3c77b2a8), Q_UINT64_C(0x81c2c92e47edaee6), Q_UINT64_C(0x92722c851482353b),
+  Q_UINT64_C(0xa2bfe8a14cf10364), Q_UINT64_C(0xa81a664bbc423001), Q_UINT64_C(0xc24b8b70d0f89791), Q_UINT64_C(0xc76c51a30654be30),
+  Q_UINT64_C(0xd192e819d6ef5218), Q_UINT64_C(0xd69906245565a910), Q_UINT64_C(0xf40e35855771202a), Q_UINT64_C(0x106aa07032bbd1b8),
+  Q_UINT64_C(0x19a4c116b8d2d0c8), Q_UINT64_C(0x1e376c085141ab53), Q_UINT64_C(0x2748774cdf8eeb99), Q_UINT64_C(0x34b0bcb5e19b48a8),
+  Q_UINT64_C(0x391c0cb3c5c95a63), Q_UINT64_C(0x4ed8aa4ae3418acb), Q_UINT64_C(0x5b9cca4f7763e373), Q_UINT64_C(0x682e6ff3d6b2b8a3),
+  Q_UINT64_C(0x748f82ee5defb2fc), Q_UINT64_C(0x78a5636f43172f60), Q_UINT64_C(0x84c87814a1f0ab72), Q_UINT64_C(0x8cc702081a6439ec),
+  Q_UINT64_C(0x90befffa23631e28), Q_UINT64_C(0xa4506cebde82bde9), Q_UINT64_C(0xbef9a3f7b2c67915), Q_UINT64_C(0xc67178f2e372532b),
+  Q_UINT64_C(0xca273eceea26619c), Q_UINT64_C(0xd186b8c721c0c207), Q_UINT64_C(0xeada7dd6cde0eb1e), Q_UINT64_C(0xf57d4f7fee6ed178),
+  Q_UINT64_C(0x06f067aa72176fba), Q_UINT64_C(0x0a637dc5a2c898a6), Q_UINT64_C(0x113f9804bef90dae), Q_UINT64_C(0x1b710b35131c471b),
+  Q_UINT64_C(0x28db77f523047d84), Q_UINT64_C(0x32caab7b40c72493), Q_UINT64_C(0x3c9ebe0a15c9bebc), Q_UINT64_C(0x431d67c49c100d4c),
+  Q_UINT64_C(0x4cc5d4becb3e42b6), Q_UINT64_C(0x597f299cfc657e2a), Q_UINT64_C(0x5fcb6fab3ad6faec), Q_UINT64_C(0x6c44198c4a475817)
+};
+
+
+static inline quint32 rotr32(quint32 x, int n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+
+static inline quint64 rotr64(quint64 x, int n)
+{
+  return (x >> n) | (x << (64 - n));
+}
+
+
+void Sha256::init(Word *state)
+{
+  state[0] = 0x6a09e667;
+  state[1] = 0xbb67ae85;
+  state[2] = 0x3c6ef372;
+  state[3] = 0xa54ff53a;
+  state[4] = 0x510e527f;
+  state[5] = 0x9b05688c;
+  state[6] = 0x1f83d9ab;
+  state[7] = 0x5be0cd19;
+}
+
+
+void Sha224::init(Word *state)
+{
+  state[0] = 0xc1059ed8;
+  state[1] = 0x367cd507;
+  state[2] = 0x3070dd17;
+  state[3] = 0xf70e5939;
+  state[4] = 0xffc00b31;
+  state[5] = 0x68581511;
+  state[6] = 0x64f98fa7;
+  state[7] = 0xbefa4fa4;
+}
+
+
+void Sha256::transformPortable(Word *state, const Word *block)
+{
+  Word W[64];
+  for (int t = 0; t < 16; ++t) {
+    W[t] = block[t];
+  }
+  for (int t = 16; t < 64; ++t) {
+    const Word s0 = rotr32(W[t - 15], 7) ^ rotr32(W[t - 15], 18) ^ (W[t - 15] >> 3);
+    const Word s1 = rotr32(W[t - 2], 17) ^ rotr32(W[t - 2], 19) ^ (W[t - 2] >> 10);
+    W[t] = W[t - 16] + s0 + W[t - 7] + s1;
+  }
+  Word a = state[0], b = state[1], c = state[2], d = state[3];
+  Word e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int t = 0; t < 64; ++t) {
+    const Word S1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+    const Word ch = (e & f) ^ (~e & g);
+    const Word T1 = h + S1 + ch + K[t] + W[t];
+    const Word S0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+    const Word maj = (a & b) ^ (a & c) ^ (b & c);
+    const Word T2 = S0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + T1;
+    d = c;
+    c = b;
+    b = a;
+    a = T1 + T2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+
+void Sha512::init(Word *state)
+{
+  state[0] = Q_UINT64_C(0x6a09e667f3bcc908);
+  state[1] = Q_UINT64_C(0xbb67ae8584caa73b);
+  state[2] = Q_UINT64_C(0x3c6ef372fe94f82b);
+  state[3] = Q_UINT64_C(0xa54ff53a5f1d36f1);
+  state[4] = Q_UINT64_C(0x510e527fade682d1);
+  state[5] = Q_UINT64_C(0x9b05688c2b3e6c1f);
+  state[6] = Q_UINT64_C(0x1f83d9abfb41bd6b);
+  state[7] = Q_UINT64_C(0x5be0cd19137e2179);
+}
+
+
+void Sha384::init(Word *state)
+{
+  state[0] = Q_UINT64_C(0xcbbb9d5dc1059ed8);
+  state[1] = Q_UINT64_C(0x629a292a367cd507);
+  state[2] = Q_UINT64_C(0x9159015a3070dd17);
+  state[3] = Q_UINT64_C(0x152fecd8f70e5939);
+  state[4] = Q_UINT64_C(0x67332667ffc00b31);
+  state[5] = Q_UINT64_C(0x8eb44a8768581511);
+  state[6] = Q_UINT64_C(0xdb0c2e0d64f98fa7);
+  state[7] = Q_UINT64_C(0x47b5481dbefa4fa4);
+}
+
+
+void Sha512::transformPortable(Word *state, const Word *block)
+{
+  Word W[80];
+  for (int t = 0; t < 16; ++t) {
+    W[t] = block[t];
+  }
+  for (int t = 16; t < 80; ++t) {
+    const Word s0 = rotr64(W[t - 15], 1) ^ rotr64(W[t - 15], 8) ^ (W[t - 15] >> 7);
+    const Word s1 = rotr64(W[t - 2], 19) ^ rotr64(W[t - 2], 61) ^ (W[t - 2] >> 6);
+    W[t] = W[t - 16] + s0 + W[t - 7] + s1;
+  }
+  Word a = state[0], b = state[1], c = state[2], d = state[3];
+  Word e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int t = 0; t < 80; ++t) {
+    const Word S1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);
+    const Word ch = (e & f) ^ (~e & g);
+    const Word T1 = h + S1 + ch + K[t] + W[t];
+    const Word S0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);
+    const Word maj = (a & b) ^ (a & c) ^ (b & c);
+    const Word T2 = S0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + T1;
+    d = c;
+    c = b;
+    b = a;
+    a = T1 + T2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+
+void Sha256::transform(Word *state, const Word *block)
+{
+  static const HashBackend::Sha256Transform f = HashBackend::sha256Transform();
+  f(state, block);
+}
+
+
+void Sha512::transform(Word *state, const Word *block)
+{
+  static const HashBackend::Sha512Transform f = HashBackend::sha512Transform();
+  f(state, block);
+}
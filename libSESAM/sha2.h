@@ -0,0 +1,108 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SHA2_H_
+#define __SHA2_H_
+
+#include <QtGlobal>
+
+/*!
+ * \brief The Sha256 struct
+ *
+ * Block transform of SHA-256 (FIPS 180-4).
+ *
+ * `transform()` processes a single 64 byte block given as 16 words in host byte order.
+ * Message padding and byte order conversion are left to the caller (see `PBKDF2Engine`).
+ * `transform()` dispatches to the fastest implementation available on the CPU
+ * (see `HashBackend`), `transformPortable()` is the plain C++ reference.
+ *
+ */
+struct Sha256 {
+  typedef quint32 Word;
+  enum {
+    BlockSize = 64,
+    DigestSize = 32,
+    StateWords = 8,
+    BlockWords = BlockSize / sizeof(Word),
+    DigestWords = DigestSize / sizeof(Word),
+    LengthSize = 8
+  };
+  static const Word K[64];
+  static void init(Word *state);
+  static void transform(Word *state, const Word *block);
+  static void transformPortable(Word *state, const Word *block);
+};
+
+
+/*!
+ * \brief The Sha224 struct
+ *
+ * SHA-224 is SHA-256 with a different initial state and a truncated digest.
+ *
+ */
+struct Sha224 : public Sha256 {
+  enum {
+    DigestSize = 28,
+    DigestWords = DigestSize / sizeof(Word)
+  };
+  static void init(Word *state);
+};
+
+
+/*!
+ * \brief The Sha512 struct
+ *
+ * Block transform of SHA-512 (FIPS 180-4).
+ *
+ * `transform()` processes a single 128 byte block given as 16 words in host byte order.
+ *
+ */
+struct Sha512 {
+  typedef quint64 Word;
+  enum {
+    BlockSize = 128,
+    DigestSize = 64,
+    StateWords = 8,
+    BlockWords = BlockSize / sizeof(Word),
+    DigestWords = DigestSize / sizeof(Word),
+    LengthSize = 16
+  };
+  static const Word K[80];
+  static void init(Word *state);
+  static void transform(Word *state, const Word *block);
+  static void transformPortable(Word *state, const Word *block);
+};
+
+
+/*!
+ * \brief The Sha384 struct
+ *
+ * SHA-384 is SHA-512 with a different initial state and a truncated digest.
+ *
+ */
+struct Sha384 : public Sha512 {
+  enum {
+    DigestSize = 48,
+    DigestWords = DigestSize / sizeof(Word)
+  };
+  static void init(Word *state);
+};
+
+
+#endif // __SHA2_H_
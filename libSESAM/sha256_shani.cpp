@@ -0,0 +1,71 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "sha2.h"
+#include "cpufeatures.h"
+
+#if defined(SESAM_X86)
+
+#include <immintrin.h>
+
+
+// SHA-256 block transform using the SHA extensions (SHA-NI).
+// The block is expected as 16 words in host byte order, so unlike the usual
+// byte oriented implementations no shuffle of the message is needed.
+SESAM_TARGET("sha,ssse3,sse4.1")
+void sha256TransformSHANI(quint32 *state, const quint32 *block)
+{
+  __m128i tmp = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+  __m128i state1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+  tmp = _mm_shuffle_epi32(tmp, 0xb1);              // CDAB
+  state1 = _mm_shuffle_epi32(state1, 0x1b);        // EFGH
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);     // CDGH
+  const __m128i abefSave = state0;
+  const __m128i cdghSave = state1;
+
+  __m128i M[4];
+  for (int i = 0; i < 16; ++i) {
+    if (i < 4) {
+      M[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 4 * i));
+    }
+    __m128i msg = _mm_add_epi32(M[i & 3], _mm_loadu_si128(reinterpret_cast<const __m128i*>(Sha256::K + 4 * i)));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+    if (i >= 3 && i < 15) {
+      const __m128i t = _mm_alignr_epi8(M[i & 3], M[(i + 3) & 3], 4);
+      M[(i + 1) & 3] = _mm_sha256msg2_epu32(_mm_add_epi32(M[(i + 1) & 3], t), M[i & 3]);
+    }
+    msg = _mm_shuffle_epi32(msg, 0x0e);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+    if (i >= 1 && i < 13) {
+      M[(i - 1) & 3] = _mm_sha256msg1_epu32(M[(i - 1) & 3], M[i & 3]);
+    }
+  }
+
+  state0 = _mm_add_epi32(state0, abefSave);
+  state1 = _mm_add_epi32(state1, cdghSave);
+  tmp = _mm_shuffle_epi32(state0, 0x1b);           // FEBA
+  state1 = _mm_shuffle_epi32(state1, 0xb1);        // DCHG
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);     // DCBA
+  state1 = _mm_alignr_epi8(state1, tmp, 8);        // ABEF
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "sha2.h"
+#include "cpufeatures.h"
+
+#if defined(SESAM_X86)
+
+#include <immintrin.h>
+
+
+namespace {
+
+SESAM_TARGET("avx2")
+inline __m256i rotr(__m256i x, int n)
+{
+  return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n));
+}
+
+
+SESAM_TARGET("avx2")
+inline __m256i sigma0(__m256i x)
+{
+  return _mm256_xor_si256(_mm256_xor_si256(rotr(x, 1), rotr(x, 8)), _mm256_srli_epi64(x, 7));
+}
+
+
+SESAM_TARGET("avx2")
+inline __m256i sigma1(__m256i x)
+{
+  return _mm256_xor_si256(_mm256_xor_si256(rotr(x, 19), rotr(x, 61)), _mm256_srli_epi64(x, 6));
+}
+
+
+inline quint64 rotr64(quint64 x, int n)
+{
+  return (x >> n) | (x << (64 - n));
+}
+
+
+// words 1..4 of the eight words in `lo` and `hi`
+SESAM_TARGET("avx2")
+inline __m256i shift1(__m256i lo, __m256i hi)
+{
+  return _mm256_permute4x64_epi64(_mm256_blend_epi32(lo, hi, 0x03), 0x39);
+}
+
+}
+
+
+// SHA-512 block transform with the message schedule computed four words at a
+// time in AVX2 registers, which hold the last 16 words of W. W[t-2] and W[t-1]
+// feed the upper two words of each step, so sigma1 is applied in two halves.
+// The rounds themselves stay scalar and consume the precomputed sums W[t] + K[t].
+SESAM_TARGET("avx2")
+void sha512TransformAVX2(quint64 *state, const quint64 *block)
+{
+  quint64 WK[80];
+  __m256i X[4];
+  for (int i = 0; i < 4; ++i) {
+    X[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 4 * i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(WK + 4 * i),
+                        _mm256_add_epi64(X[i], _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Sha512::K + 4 * i))));
+  }
+  for (int t = 16; t < 80; t += 4) {
+    const __m256i w16 = X[0];
+    const __m256i w15 = shift1(X[0], X[1]);
+    const __m256i w7 = shift1(X[2], X[3]);
+    const __m256i w2 = _mm256_permute2x128_si256(X[3], X[3], 0x81);
+    __m256i w = _mm256_add_epi64(_mm256_add_epi64(w16, sigma0(w15)), w7);
+    // sigma1(0) == 0, so the zeroed halves leave the other words untouched
+    w = _mm256_add_epi64(w, sigma1(w2));
+    w = _mm256_add_epi64(w, sigma1(_mm256_permute2x128_si256(w, w, 0x08)));
+    X[0] = X[1];
+    X[1] = X[2];
+    X[2] = X[3];
+    X[3] = w;
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(WK + t),
+                        _mm256_add_epi64(w, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(Sha512::K + t))));
+  }
+  quint64 a = state[0], b = state[1], c = state[2], d = state[3];
+  quint64 e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int t = 0; t < 80; ++t) {
+    const quint64 S1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);
+    const quint64 ch = (e & f) ^ (~e & g);
+    const quint64 T1 = h + S1 + ch + WK[t];
+    const quint64 S0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);
+    const quint64 maj = (a & b) ^ (a & c) ^ (b & c);
+    const quint64 T2 = S0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + T1;
+    d = c;
+    c = b;
+    b = a;
+    a = T1 + T2;
+  }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+#endif
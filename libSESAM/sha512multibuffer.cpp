@@ -0,0 +1,104 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <cstring>
+
+#include "sha512multibuffer.h"
+#include "sha512multibuffer_p.h"
+#include "util.h"
+
+
+namespace {
+
+void iterateScalar(const quint64 *inner, const quint64 *outer, quint64 *u, quint64 *t, int rounds)
+{
+  quint64 block[Sha512::BlockWords];
+  quint64 state[Sha512::StateWords];
+  memset(block, 0, sizeof(block));
+  memcpy(block, u, Sha512::DigestSize);
+  block[Sha512::DigestWords] = Q_UINT64_C(0x8000000000000000);
+  block[Sha512::BlockWords - 1] = 8 * (Sha512::BlockSize + Sha512::DigestSize);
+  for (int r = 0; r < rounds; ++r) {
+    memcpy(state, inner, sizeof(state));
+    Sha512::transform(state, block);
+    memcpy(block, state, Sha512::DigestSize);
+    memcpy(state, outer, sizeof(state));
+    Sha512::transform(state, block);
+    for (int w = 0; w < Sha512::DigestWords; ++w) {
+      block[w] = state[w];
+      t[w] ^= state[w];
+    }
+  }
+  memcpy(u, block, Sha512::DigestSize);
+  SecureErase(block, sizeof(block));
+  SecureErase(state, sizeof(state));
+}
+
+
+typedef void (*IterateFunction)(const quint64 *, const quint64 *, quint64 *, quint64 *, int);
+
+struct Backend {
+  IterateFunction iterate;
+  int lanes;
+  const char *name;
+};
+
+
+Backend selectBackend(void)
+{
+#if defined(SESAM_X86)
+  if (CPUFeatures::hasAVX2()) {
+    Backend backend = { sha512IterateAVX2, 4, "AVX2 (4 lanes)" };
+    return backend;
+  }
+  if (CPUFeatures::hasSSE2()) {
+    Backend backend = { sha512IterateSSE2, 2, "SSE2 (2 lanes)" };
+    return backend;
+  }
+#endif
+  Backend backend = { iterateScalar, 1, "portable (1 lane)" };
+  return backend;
+}
+
+
+const Backend &backend(void)
+{
+  static const Backend b = selectBackend();
+  return b;
+}
+
+}
+
+
+int Sha512MultiBuffer::lanes(void)
+{
+  return backend().lanes;
+}
+
+
+const char *Sha512MultiBuffer::backendName(void)
+{
+  return backend().name;
+}
+
+
+void Sha512MultiBuffer::iterate(const quint64 *inner, const quint64 *outer, quint64 *u, quint64 *t, int rounds)
+{
+  backend().iterate(inner, outer, u, t, rounds);
+}
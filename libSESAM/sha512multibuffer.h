@@ -0,0 +1,49 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SHA512MULTIBUFFER_H_
+#define __SHA512MULTIBUFFER_H_
+
+#include <QtGlobal>
+
+
+/*!
+ * \brief The Sha512MultiBuffer class
+ *
+ * Runs the PBKDF2-HMAC-SHA512 iteration for several independent derivations at once,
+ * one derivation per SIMD lane (4 lanes with AVX2, 2 lanes with SSE2). On CPUs without
+ * either extension `lanes()` returns 1 and `iterate()` uses the portable transform.
+ *
+ * All arrays are laid out word-major: word `w` of lane `l` is found at index
+ * `w * lanes() + l`. `inner` and `outer` hold the HMAC pad states (see `PBKDF2Engine::State`),
+ * `u` the last U_i and `t` the accumulated T of each lane.
+ *
+ */
+class Sha512MultiBuffer
+{
+public:
+  enum { MaxLanes = 4 };
+
+  static int lanes(void);
+  static const char *backendName(void);
+  static void iterate(const quint64 *inner, const quint64 *outer, quint64 *u, quint64 *t, int rounds);
+};
+
+
+#endif // __SHA512MULTIBUFFER_H_
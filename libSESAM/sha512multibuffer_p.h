@@ -0,0 +1,147 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SHA512MULTIBUFFER_P_H_
+#define __SHA512MULTIBUFFER_P_H_
+
+#include "sha2.h"
+#include "cpufeatures.h"
+
+// The lane kernel below is instantiated once per instruction set in its own
+// translation unit. Each unit defines SHA512MB_TARGET and a vector type `V`
+// offering load(), store(), set1(), add(), xor_(), and_(), andnot(), or_(),
+// shr() and shl() before including this file.
+
+#if defined(SHA512MB_TARGET)
+
+namespace {
+
+template <class V>
+SHA512MB_TARGET inline typename V::Type rotr(typename V::Type x, int n)
+{
+  return V::or_(V::shr(x, n), V::shl(x, 64 - n));
+}
+
+
+template <class V>
+SHA512MB_TARGET inline void compress(typename V::Type *s, typename V::Type *W)
+{
+  typedef typename V::Type T;
+  T a = s[0], b = s[1], c = s[2], d = s[3];
+  T e = s[4], f = s[5], g = s[6], h = s[7];
+  for (int t = 0; t < 80; ++t) {
+    T w;
+    if (t < 16) {
+      w = W[t];
+    }
+    else {
+      const T w15 = W[(t + 1) & 15];
+      const T w2 = W[(t + 14) & 15];
+      const T s0 = V::xor_(V::xor_(rotr<V>(w15, 1), rotr<V>(w15, 8)), V::shr(w15, 7));
+      const T s1 = V::xor_(V::xor_(rotr<V>(w2, 19), rotr<V>(w2, 61)), V::shr(w2, 6));
+      w = V::add(V::add(W[t & 15], s0), V::add(W[(t + 9) & 15], s1));
+      W[t & 15] = w;
+    }
+    const T S1 = V::xor_(V::xor_(rotr<V>(e, 14), rotr<V>(e, 18)), rotr<V>(e, 41));
+    const T ch = V::xor_(V::and_(e, f), V::andnot(e, g));
+    const T T1 = V::add(V::add(V::add(h, S1), V::add(ch, V::set1(Sha512::K[t]))), w);
+    const T S0 = V::xor_(V::xor_(rotr<V>(a, 28), rotr<V>(a, 34)), rotr<V>(a, 39));
+    const T maj = V::or_(V::and_(a, b), V::and_(c, V::or_(a, b)));
+    const T T2 = V::add(S0, maj);
+    h = g;
+    g = f;
+    f = e;
+    e = V::add(d, T1);
+    d = c;
+    c = b;
+    b = a;
+    a = V::add(T1, T2);
+  }
+  s[0] = a;
+  s[1] = b;
+  s[2] = c;
+  s[3] = d;
+  s[4] = e;
+  s[5] = f;
+  s[6] = g;
+  s[7] = h;
+}
+
+
+template <class V>
+SHA512MB_TARGET void iterateLanes(const quint64 *inner, const quint64 *outer, quint64 *u, quint64 *t, int rounds)
+{
+  typedef typename V::Type T;
+  const int N = V::Lanes;
+  T I[8], O[8], U[8], Tacc[8];
+  for (int w = 0; w < 8; ++w) {
+    I[w] = V::load(inner + w * N);
+    O[w] = V::load(outer + w * N);
+    U[w] = V::load(u + w * N);
+    Tacc[w] = V::load(t + w * N);
+  }
+  const T zero = V::set1(0);
+  const T pad = V::set1(Q_UINT64_C(0x8000000000000000));
+  const T length = V::set1(8 * (Sha512::BlockSize + Sha512::DigestSize));
+  for (int r = 0; r < rounds; ++r) {
+    T W[16];
+    T s[8];
+    for (int w = 0; w < 8; ++w) {
+      W[w] = U[w];
+      s[w] = I[w];
+    }
+    W[8] = pad;
+    for (int w = 9; w < 15; ++w) {
+      W[w] = zero;
+    }
+    W[15] = length;
+    compress<V>(s, W);
+    for (int w = 0; w < 8; ++w) {
+      W[w] = V::add(s[w], I[w]);
+      s[w] = O[w];
+    }
+    W[8] = pad;
+    for (int w = 9; w < 15; ++w) {
+      W[w] = zero;
+    }
+    W[15] = length;
+    compress<V>(s, W);
+    for (int w = 0; w < 8; ++w) {
+      U[w] = V::add(s[w], O[w]);
+      Tacc[w] = V::xor_(Tacc[w], U[w]);
+    }
+  }
+  for (int w = 0; w < 8; ++w) {
+    V::store(u + w * N, U[w]);
+    V::store(t + w * N, Tacc[w]);
+  }
+}
+
+}
+
+#endif
+
+
+#if defined(SESAM_X86)
+extern void sha512IterateSSE2(const quint64 *inner, const quint64 *outer, quint64 *u, quint64 *t, int rounds);
+extern void sha512IterateAVX2(const quint64 *inner, const quint64 *outer, quint64 *u, quint64 *t, int rounds);
+#endif
+
+
+#endif // __SHA512MULTIBUFFER_P_H_
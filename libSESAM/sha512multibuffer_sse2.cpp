@@ -0,0 +1,55 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "cpufeatures.h"
+
+#if defined(SESAM_X86)
+
+#include <emmintrin.h>
+
+#define SHA512MB_TARGET SESAM_TARGET("sse2")
+
+namespace {
+
+struct VecSSE2 {
+  typedef __m128i Type;
+  enum { Lanes = 2 };
+  SHA512MB_TARGET static inline Type load(const quint64 *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+  SHA512MB_TARGET static inline void store(quint64 *p, Type x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x); }
+  SHA512MB_TARGET static inline Type set1(quint64 x) { return _mm_set1_epi64x(qint64(x)); }
+  SHA512MB_TARGET static inline Type add(Type a, Type b) { return _mm_add_epi64(a, b); }
+  SHA512MB_TARGET static inline Type xor_(Type a, Type b) { return _mm_xor_si128(a, b); }
+  SHA512MB_TARGET static inline Type and_(Type a, Type b) { return _mm_and_si128(a, b); }
+  SHA512MB_TARGET static inline Type andnot(Type a, Type b) { return _mm_andnot_si128(a, b); }
+  SHA512MB_TARGET static inline Type or_(Type a, Type b) { return _mm_or_si128(a, b); }
+  SHA512MB_TARGET static inline Type shr(Type x, int n) { return _mm_srli_epi64(x, n); }
+  SHA512MB_TARGET static inline Type shl(Type x, int n) { return _mm_slli_epi64(x, n); }
+};
+
+}
+
+#include "sha512multibuffer_p.h"
+
+
+void sha512IterateSSE2(const quint64 *inner, const quint64 *outer, quint64 *u, quint64 *t, int rounds)
+{
+  iterateLanes<VecSSE2>(inner, outer, u, t, rounds);
+}
+
+#endif
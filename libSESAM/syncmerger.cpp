@@ -0,0 +1,261 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include "syncmerger.h"
+
+#include <QSet>
+#include <QVector>
+#include <QtConcurrent>
+
+
+const int SyncMerger::ChunkSize = 4096;
+
+
+namespace {
+
+bool sameRevision(const DomainSettings &a, const DomainSettings &b)
+{
+  // the copy that went through a peer may have lost the milliseconds
+  return a.isEmpty() == b.isEmpty()
+      && DomainSettings::storedDateTime(a.modifiedDate) == DomainSettings::storedDateTime(b.modifiedDate)
+      && a.deleted == b.deleted;
+}
+
+
+struct MergeJob {
+  int first;
+  int last;
+  SyncMerger::ChangeSet changes;
+};
+
+
+class RangeMerger
+{
+public:
+  typedef void result_type;
+  RangeMerger(const QStringList &names, const DomainSettingsList &local, const DomainSettingsList &remote, const DomainSettingsList &base, bool keepBoth)
+    : names(names)
+    , local(local)
+    , remote(remote)
+    , base(base)
+    , keepBoth(keepBoth)
+  { /* ... */ }
+  void operator()(MergeJob &job) const
+  {
+    for (int i = job.first; i < job.last; ++i) {
+      merge(names.at(i), job.changes);
+    }
+  }
+
+private:
+  void merge(const QString &domainName, SyncMerger::ChangeSet &changes) const
+  {
+    const DomainSettings &l = local.at(domainName);
+    const DomainSettings &r = remote.at(domainName);
+    if (r.isEmpty()) {
+      if (l.deleted) {
+        changes.removeFromLocal << domainName;
+      }
+      else {
+        changes.toRemote << l;
+      }
+      return;
+    }
+    if (l.isEmpty()) {
+      changes.toLocal << r;
+      return;
+    }
+    if (sameRevision(l, r))
+      return;
+    const DomainSettings &b = base.at(domainName);
+    const bool localChanged = !sameRevision(l, b);
+    // a stale peer handing back a revision older than the base hasn't changed anything
+    const bool remoteChanged = !sameRevision(r, b)
+        && (b.isEmpty() || DomainSettings::storedDateTime(r.modifiedDate) >= DomainSettings::storedDateTime(b.modifiedDate));
+    bool localWins = !remoteChanged;
+    if (localChanged && remoteChanged) {
+      localWins = l.modifiedDate > r.modifiedDate;
+      SyncMerger::Conflict conflict;
+      conflict.local = l;
+      conflict.remote = r;
+      conflict.localWins = localWins;
+      changes.conflicts << conflict;
+    }
+    if (!localWins) {
+      changes.toLocal << r;
+    }
+    else if (keepBoth && !l.deleted) {
+      SyncMerger::Rename rename;
+      rename.from = domainName;
+      rename.settings = l;
+      changes.renames << rename;
+      changes.toLocal << r;
+    }
+    else {
+      changes.toRemote << l;
+    }
+  }
+
+  const QStringList &names;
+  const DomainSettingsList &local;
+  const DomainSettingsList &remote;
+  const DomainSettingsList &base;
+  const bool keepBoth;
+};
+
+}
+
+
+bool SyncMerger::ChangeSet::isEmpty(void) const
+{
+  return !localChanged() && !remoteChanged() && conflicts.isEmpty();
+}
+
+
+bool SyncMerger::ChangeSet::localChanged(void) const
+{
+  return !toLocal.isEmpty() || !removeFromLocal.isEmpty() || !renames.isEmpty();
+}
+
+
+bool SyncMerger::ChangeSet::remoteChanged(void) const
+{
+  return !toRemote.isEmpty() || !renames.isEmpty();
+}
+
+
+SyncMerger::SyncMerger(void)
+  : mKeepBoth(false)
+{ /* ... */ }
+
+
+void SyncMerger::setKeepBoth(bool keepBoth)
+{
+  mKeepBoth = keepBoth;
+}
+
+
+bool SyncMerger::keepBoth(void) const
+{
+  return mKeepBoth;
+}
+
+
+/*!
+ * \brief SyncMerger::merge
+ *
+ * Computes the changes needed to bring `local` and `remote` in line with each other.
+ * The lists themselves are left untouched.
+ *
+ * \param local the local domain settings
+ * \param remote the domain settings received from the sync peer
+ * \param base the remote domain settings as received during the previous sync; empty if unknown
+ * \return the change set; its entries appear in the order of `local`, followed by the domains only `remote` has
+ */
+SyncMerger::ChangeSet SyncMerger::merge(const DomainSettingsList &local, const DomainSettingsList &remote, const DomainSettingsList &base) const
+{
+  QStringList names = local.keys();
+  names.reserve(local.count() + remote.count());
+  for (DomainSettingsList::const_iterator ds = remote.constBegin(); ds != remote.constEnd(); ++ds) {
+    if (!local.contains(ds->domainName)) {
+      names << ds->domainName;
+    }
+  }
+
+  QVector<MergeJob> jobs;
+  for (int first = 0; first < names.count(); first += ChunkSize) {
+    MergeJob job;
+    job.first = first;
+    job.last = qMin(first + ChunkSize, names.count());
+    jobs << job;
+  }
+  const RangeMerger merger(names, local, remote, base, mKeepBoth);
+  if (jobs.count() > 1) {
+    QtConcurrent::blockingMap(jobs, merger);
+  }
+  else if (jobs.count() == 1) {
+    merger(jobs.first());
+  }
+
+  ChangeSet changes;
+  foreach (const MergeJob &job, jobs) {
+    changes.toLocal << job.changes.toLocal;
+    changes.removeFromLocal << job.changes.removeFromLocal;
+    changes.toRemote << job.changes.toRemote;
+    changes.conflicts << job.changes.conflicts;
+    changes.renames << job.changes.renames;
+  }
+
+  if (!changes.renames.isEmpty()) {
+    // new names must not collide with any existing name or with each other
+    QSet<QString> taken = QSet<QString>::fromList(names);
+    for (int i = 0; i < changes.renames.count(); ++i) {
+      Rename &rename = changes.renames[i];
+      int n = 0;
+      do {
+        rename.to = alternativeNameFor(rename.from, ++n);
+      }
+      while (taken.contains(rename.to));
+      taken.insert(rename.to);
+    }
+  }
+  return changes;
+}
+
+
+/*!
+ * \brief SyncMerger::apply
+ *
+ * Carries out `changes`, which `merge()` has computed for `local` and `remote`.
+ *
+ * \param changes the change set
+ * \param local the local domain settings
+ * \param remote the domain settings of the sync peer
+ */
+void SyncMerger::apply(const ChangeSet &changes, DomainSettingsList &local, DomainSettingsList &remote)
+{
+  foreach (const DomainSettings &ds, changes.toLocal) {
+    local.updateWith(ds);
+  }
+  foreach (const QString &domainName, changes.removeFromLocal) {
+    local.remove(domainName);
+  }
+  foreach (const DomainSettings &ds, changes.toRemote) {
+    remote.updateWith(ds);
+  }
+  foreach (const Rename &rename, changes.renames) {
+    DomainSettings ds = rename.settings;
+    ds.domainName = rename.to;
+    local.updateWith(ds);
+    remote.updateWith(ds);
+  }
+}
+
+
+/*!
+ * \brief SyncMerger::alternativeNameFor
+ *
+ * \param domainName the original domain name
+ * \param n number of the alternative, starting at 1
+ * \return the `n`-th alternative name for `domainName`
+ */
+QString SyncMerger::alternativeNameFor(const QString &domainName, int n)
+{
+  return QString("%1 (%2)").arg(domainName).arg(n);
+}
@@ -0,0 +1,107 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __SYNCMERGER_H_
+#define __SYNCMERGER_H_
+
+#include <QtGlobal>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "domainsettings.h"
+#include "domainsettingslist.h"
+
+/*!
+ * \brief The SyncMerger class
+ *
+ * Three-way merge of the local domain settings with those of a sync peer.
+ *
+ * `merge()` compares every domain of the local and the remote list with the
+ * base, i.e. the remote list as it was received during the previous sync.
+ * Records are told apart by `modifiedDate` and `deleted`:
+ *
+ * - A domain only one side has changed since the base is taken over by the other side.
+ *   A remote record older than the base doesn't count as changed: it comes from a peer
+ *   that has missed the latest syncs, and is overwritten.
+ * - A domain both sides have changed is a conflict. The later `modifiedDate` wins,
+ *   the remote record if both are equal. Without a base every differing domain is a conflict.
+ * - A domain missing on the remote side is sent there, unless it is deleted locally;
+ *   then it is removed from the local list.
+ * - A domain missing on the local side is taken over from the remote side.
+ *
+ * With `setKeepBoth(true)` a local record that wins against a remote record of the
+ * same name doesn't replace it but is added to both sides under a new name.
+ * This is needed if the records were generated with different KGKs.
+ *
+ * The result is a `ChangeSet`, which `apply()` carries out. Nothing is changed
+ * on a side for which the change set is empty, so it needn't be written either.
+ *
+ * The cost is linear in the number of domains. Large lists are merged in chunks
+ * of `ChunkSize` domains in the global thread pool.
+ *
+ */
+class SyncMerger
+{
+public:
+  static const int ChunkSize;
+
+  struct Conflict {
+    DomainSettings local;
+    DomainSettings remote;
+    bool localWins;
+  };
+
+  struct Rename {
+    QString from;
+    QString to;
+    // the local record, still named `from`
+    DomainSettings settings;
+  };
+
+  struct ChangeSet {
+    // records to be added to or replaced in the local list
+    QList<DomainSettings> toLocal;
+    QStringList removeFromLocal;
+    // records to be added to or replaced in the remote list
+    QList<DomainSettings> toRemote;
+    QList<Conflict> conflicts;
+    // local records to be added to both lists under a new name
+    QList<Rename> renames;
+
+    bool isEmpty(void) const;
+    bool localChanged(void) const;
+    bool remoteChanged(void) const;
+  };
+
+  SyncMerger(void);
+
+  void setKeepBoth(bool keepBoth);
+  bool keepBoth(void) const;
+
+  ChangeSet merge(const DomainSettingsList &local, const DomainSettingsList &remote, const DomainSettingsList &base = DomainSettingsList()) const;
+  static void apply(const ChangeSet &changes, DomainSettingsList &local, DomainSettingsList &remote);
+  static QString alternativeNameFor(const QString &domainName, int n);
+
+private:
+  bool mKeepBoth;
+};
+
+
+#endif // __SYNCMERGER_H_
@@ -0,0 +1,131 @@
+/*
+
+    Copyright (c) 2015 Oliver Lau <ola@ct.de>, Heise Medien GmbH & Co. KG
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef __UINT512_H_
+#define __UINT512_H_
+
+#include <cstring>
+
+#include <QtGlobal>
+#include <QtEndian>
+
+#include "util.h"
+
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <intrin.h>
+#endif
+
+
+/*!
+ * \brief The UInt512 class
+ *
+ * Fixed-width unsigned 512 bit integer made of eight 64 bit limbs, least significant limb first.
+ *
+ * It offers just what `Password::remix()` needs to convert a derived key into
+ * a string of template characters: construction from big-endian bytes and
+ * in-place division by a small divisor yielding the remainder.
+ *
+ */
+class UInt512
+{
+public:
+  enum {
+    Limbs = 8,
+    Size = Limbs * sizeof(quint64)
+  };
+
+  UInt512(void)
+  {
+    memset(mLimbs, 0, sizeof(mLimbs));
+  }
+
+  ~UInt512()
+  {
+    SecureErase(mLimbs, sizeof(mLimbs));
+  }
+
+  /*!
+   * \brief UInt512::fromBigEndian
+   *
+   * \param data most significant byte first
+   * \param size number of bytes in `data`; at most `Size`
+   * \return the number represented by `data`
+   */
+  static UInt512 fromBigEndian(const char *data, int size)
+  {
+    Q_ASSERT_X(size <= Size, "UInt512::fromBigEndian()", "size must not exceed 64 bytes");
+    uchar buf[Size];
+    memset(buf, 0, Size);
+    if (size > 0) {
+      size = qMin(size, int(Size));
+      memcpy(buf + Size - size, data, size);
+    }
+    UInt512 v;
+    for (int i = 0; i < Limbs; ++i) {
+      v.mLimbs[i] = qFromBigEndian<quint64>(buf + (Limbs - 1 - i) * sizeof(quint64));
+    }
+    SecureErase(buf, sizeof(buf));
+    return v;
+  }
+
+  /*!
+   * \brief UInt512::divMod
+   *
+   * Divides the number by `divisor` in place.
+   *
+   * \param divisor must not be 0
+   * \return remainder
+   */
+  quint32 divMod(quint32 divisor)
+  {
+    Q_ASSERT_X(divisor != 0, "UInt512::divMod()", "division by zero");
+    quint64 r = 0;
+    for (int i = Limbs - 1; i >= 0; --i) {
+#if defined(__SIZEOF_INT128__)
+      const unsigned __int128 n = (static_cast<unsigned __int128>(r) << 64) | mLimbs[i];
+      mLimbs[i] = quint64(n / divisor);
+      r = quint64(n % divisor);
+#elif defined(_MSC_VER) && defined(_M_X64) && _MSC_VER >= 1920
+      mLimbs[i] = _udiv128(r, mLimbs[i], divisor, &r);
+#else
+      // remainder < divisor < 2^32, so each half limb division fits into 64 bits
+      const quint64 hi = (r << 32) | (mLimbs[i] >> 32);
+      const quint64 lo = ((hi % divisor) << 32) | (mLimbs[i] & 0xffffffffU);
+      mLimbs[i] = ((hi / divisor) << 32) | (lo / divisor);
+      r = lo % divisor;
+#endif
+    }
+    return quint32(r);
+  }
+
+  bool isZero(void) const
+  {
+    for (int i = 0; i < Limbs; ++i) {
+      if (mLimbs[i] != 0)
+        return false;
+    }
+    return true;
+  }
+
+private:
+  quint64 mLimbs[Limbs];
+};
+
+
+#endif // __UINT512_H_
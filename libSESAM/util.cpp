@@ -30,6 +30,32 @@ QString fingerprintify(const QByteArray &ba) {
 }
 
 
+/*!
+ * \brief SecureZero
+ *
+ * Overwrites `size` bytes at `p` with 0. Other than a plain `memset()`
+ * the call isn't dropped by the compiler if the memory isn't read afterwards.
+ *
+ * \param p memory to be wiped
+ * \param size number of bytes to wipe
+ */
+void SecureZero(void *p, size_t size)
+{
+  if (p == Q_NULLPTR || size == 0)
+    return;
+#if defined(Q_CC_GNU) || defined(Q_CC_CLANG)
+  memset(p, 0, size);
+  // tells the compiler that the memory may be read afterwards
+  __asm__ __volatile__("" : : "r"(p) : "memory");
+#else
+  volatile uchar *v = reinterpret_cast<volatile uchar*>(p);
+  while (size-- > 0) {
+    *v++ = 0;
+  }
+#endif
+}
+
+
 #if defined(Q_CC_GNU)
 void SecureErase(QString str)
 {
@@ -44,18 +44,23 @@ void SafeDelete(T& a)
   SafeRenew<T>(a, Q_NULLPTR);
 }
 
+extern void SecureZero(void *p, size_t size);
+
+
 template <class T>
 void SecureErase(T *p, size_t size)
 {
-  memset(p, 0, size);
+  SecureZero(p, size);
 }
 
 
 template <class T>
 void SecureErase(T &obj)
 {
-  for (typename T::iterator i = obj.begin(); i != obj.end(); ++i)
-    *i = 0;
+  if (!obj.isEmpty()) {
+    typename T::iterator i = obj.begin();
+    SecureZero(&*i, size_t(obj.size()) * sizeof(*i));
+  }
   obj.clear();
 }
 